@@ -18,6 +18,10 @@
 //
 //  The parent's OnInvoke method (you can name it anything you like) must
 //  have a signature that matches the InvokeFn typedef below.
+//
+//  By default the callback runs on the standard work queue. Call
+//  SetQueue to have Media Foundation invoke it on another work queue
+//  (for example, a private queue allocated with MFAllocateWorkQueueEx).
 //////////////////////////////////////////////////////////////////////////
 
 // T: Type of the parent object
@@ -27,8 +31,14 @@ class AsyncCallback : public IMFAsyncCallback
 public: 
     typedef HRESULT (T::*InvokeFn)(IMFAsyncResult *pAsyncResult);
 
-    AsyncCallback(T *pParent, InvokeFn fn) : m_pParent(pParent), m_pInvokeFn(fn)
+    AsyncCallback(T *pParent, InvokeFn fn) : m_pParent(pParent), m_pInvokeFn(fn), m_dwQueue(MFASYNC_CALLBACK_QUEUE_STANDARD)
+    {
+    }
+
+    // SetQueue: Selects the work queue that the callback is invoked on.
+    void SetQueue(DWORD dwQueue)
     {
+        m_dwQueue = dwQueue;
     }
 
     // IUnknown
@@ -65,10 +75,18 @@ public:
 
 
     // IMFAsyncCallback methods
-    STDMETHODIMP GetParameters(DWORD*, DWORD*)
+    STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue)
     {
-        // Implementation of this method is optional.
-        return E_NOTIMPL;
+        // Implementation of this method is optional, unless the caller
+        // asked for a work queue other than the standard one.
+        if (m_dwQueue == MFASYNC_CALLBACK_QUEUE_STANDARD)
+        {
+            return E_NOTIMPL;
+        }
+
+        *pdwFlags = 0;
+        *pdwQueue = m_dwQueue;
+        return S_OK;
     }
 
     STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult)
@@ -78,4 +96,5 @@ public:
 
     T *m_pParent;
     InvokeFn m_pInvokeFn;
+    DWORD m_dwQueue;
 };
@@ -17,6 +17,12 @@
 // The List class template implements a simple double-linked list. 
 // It uses STL's copy semantics. 
 
+// Nodes of removed items are kept on a per-list free list (up to
+// MAX_FREE_NODES of them) and reused by later insertions. A queue that
+// stays around the same length, such as a sample or token queue, stops
+// calling the allocator once it has warmed up. List<T, 0> keeps no spare
+// nodes and allocates one per insertion.
+
 // There are two versions of the Clear() method:
 //  Clear(void) clears the list w/out cleaning up the object.
 //  Clear(FN fn) takes a functor object that releases the objects, if they need cleanup.
@@ -36,12 +42,12 @@
 template <class T>
 struct NoOp
 {
-    void operator()(T& t)
+    void operator()(T&)
     {
     }
 };
 
-template <class T>
+template <class T, DWORD MAX_FREE_NODES = 32>
 class List
 {
 protected:
@@ -70,7 +76,7 @@ public:
     // Object for enumerating the list.
     class POSITION
     {
-        friend class List<T>;
+        friend class List<T, MAX_FREE_NODES>;
 
     public:
         POSITION() : pNode(nullptr)
@@ -98,6 +104,39 @@ public:
 protected:
     Node    m_anchor;  // Anchor node for the linked list.
     DWORD   m_count;   // Number of items in the list.
+    Node   *m_pFree;   // Spare nodes, linked through next.
+    DWORD   m_cFree;   // Number of spare nodes.
+
+    // NewNode: Returns a spare node, or allocates one.
+    Node* NewNode(T item)
+    {
+        Node *pNode = m_pFree;
+        if (pNode != nullptr)
+        {
+            m_pFree = pNode->next;
+            m_cFree--;
+
+            pNode->item = item;
+            return pNode;
+        }
+        return new Node(item);
+    }
+
+    // FreeNode: Keeps the node for reuse, or deletes it if the free list is full.
+    void FreeNode(Node *pNode)
+    {
+        if (m_cFree < MAX_FREE_NODES)
+        {
+            pNode->prev = nullptr;
+            pNode->next = m_pFree;
+            m_pFree = pNode;
+            m_cFree++;
+        }
+        else
+        {
+            delete pNode;
+        }
+    }
 
     Node* Front() const
     {
@@ -116,7 +155,7 @@ protected:
             return E_POINTER;
         }
 
-        Node *pNode = new Node(item);
+        Node *pNode = NewNode(item);
         if (pNode == nullptr)
         {
             return E_OUTOFMEMORY;
@@ -172,7 +211,7 @@ protected:
         pNode->prev->next = pNode->next;
 
         item = pNode->item;
-        delete pNode;
+        FreeNode(pNode);
 
         m_count--;
 
@@ -192,11 +231,22 @@ public:
         m_anchor.prev = &m_anchor;
 
         m_count = 0;
+
+        m_pFree = nullptr;
+        m_cFree = 0;
     }
 
     virtual ~List()
     {
         Clear();
+
+        // Delete the spare nodes.
+        while (m_pFree != nullptr)
+        {
+            Node *tmp = m_pFree->next;
+            delete m_pFree;
+            m_pFree = tmp;
+        }
     }
 
     // Insertion functions
@@ -297,7 +347,7 @@ public:
             clear_fn(n->item);
 
             Node *tmp = n->next;
-            delete n;
+            FreeNode(n);
             n = tmp;
         }
 
@@ -403,7 +453,8 @@ public:
 class MemDelete
 {
 public: 
-    void operator()(void *p)
+    template <class T>
+    void operator()(T *p)
     {
         if (p)
         {
@@ -444,6 +495,8 @@ public:
     }
 
 protected:
+    typedef typename List<Ptr>::Node Node;
+
     HRESULT InsertAfter(Ptr item, Node *pBefore)
     {
         // Do not allow nullptr item pointers unless NULLABLE is true.
@@ -91,17 +91,27 @@
 //      another operation is still in progress) the method should
 //      return MF_E_NOTACCEPTING.
 //
+// The derived class can also override CoalesceOperation:
+//
+//      Returns true if pOp does nothing that the operation already at
+//      the back of the queue (pPending) will not do. In that case
+//      QueueOperation drops pOp. The default never coalesces.
+//
+// Pending operations are kept in a fixed ring of OP_QUEUE_SIZE entries,
+// so queueing does not allocate. QueueOperation returns
+// E_NOT_SUFFICIENT_BUFFER if the ring is full.
+//
+// At most one ProcessQueueAsync work item is outstanding at a time, no
+// matter how many operations are queued.
+//
 //-------------------------------------------------------------------
-#include "linklist.h"
 #include "AsyncCB.h"
 
-template <class T, class TOperation>
+template <class T, class TOperation, UINT32 OP_QUEUE_SIZE = 64>
 class OpQueue //: public IUnknown
 {
 public:
 
-    typedef ComPtrList<TOperation>   OpList;
-
     HRESULT QueueOperation(TOperation *pOp);
 
 protected:
@@ -112,18 +122,56 @@ protected:
     virtual HRESULT DispatchOperation(TOperation *pOp) = 0;
     virtual HRESULT ValidateOperation(TOperation *pOp) = 0;
 
+    virtual bool CoalesceOperation(TOperation *pPending, TOperation *pOp)
+    {
+        return false;
+    }
+
     OpQueue(CRITICAL_SECTION& critsec)
         : m_OnProcessQueue(static_cast<T *>(this), &OpQueue::ProcessQueueAsync),
-          m_critsec(critsec)
+          m_critsec(critsec),
+          m_iFront(0),
+          m_cOps(0),
+          m_fWorkItemPending(false)
     {
+        ZeroMemory(m_OpQueue, sizeof(m_OpQueue));
     }
 
     virtual ~OpQueue()
     {
+        while (m_cOps > 0)
+        {
+            PopFront()->Release();
+        }
+    }
+
+private:
+
+    // The ring holds a reference on each operation.
+    TOperation *Front() const
+    {
+        return m_OpQueue[m_iFront];
+    }
+
+    TOperation *Back() const
+    {
+        return m_OpQueue[(m_iFront + m_cOps - 1) % OP_QUEUE_SIZE];
+    }
+
+    TOperation *PopFront()
+    {
+        TOperation *pOp = m_OpQueue[m_iFront];
+        m_OpQueue[m_iFront] = nullptr;
+        m_iFront = (m_iFront + 1) % OP_QUEUE_SIZE;
+        m_cOps--;
+        return pOp;     // Caller releases.
     }
 
 protected:
-    OpList                  m_OpQueue;         // Queue of operations.
+    TOperation             *m_OpQueue[OP_QUEUE_SIZE];  // Ring of pending operations.
+    UINT32                  m_iFront;          // Index of the oldest operation.
+    UINT32                  m_cOps;            // Number of pending operations.
+    bool                    m_fWorkItemPending;// Is ProcessQueueAsync scheduled?
     CRITICAL_SECTION&       m_critsec;         // Protects the queue state.
     AsyncCallback<T>  m_OnProcessQueue;  // ProcessQueueAsync callback.
 };
@@ -135,16 +183,32 @@ protected:
 // Public method.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::QueueOperation(TOperation *pOp)
+template <class T, class TOperation, UINT32 OP_QUEUE_SIZE>
+HRESULT OpQueue<T, TOperation, OP_QUEUE_SIZE>::QueueOperation(TOperation *pOp)
 {
     HRESULT hr = S_OK;
 
+    if (pOp == nullptr)
+    {
+        return E_POINTER;
+    }
+
     EnterCriticalSection(&m_critsec);
 
-    hr = m_OpQueue.InsertBack(pOp);
-    if (SUCCEEDED(hr))
+    if (m_cOps > 0 && CoalesceOperation(Back(), pOp))
+    {
+        // The pending operation covers this one.
+    }
+    else if (m_cOps == OP_QUEUE_SIZE)
+    {
+        hr = E_NOT_SUFFICIENT_BUFFER;
+    }
+    else
     {
+        pOp->AddRef();
+        m_OpQueue[(m_iFront + m_cOps) % OP_QUEUE_SIZE] = pOp;
+        m_cOps++;
+
         hr = ProcessQueue();
     }
 
@@ -157,14 +221,16 @@ HRESULT OpQueue<T, TOperation>::QueueOperation(TOperation *pOp)
 // Process the next operation on the queue.
 // Protected method.
 //
-// Note: This method dispatches the operation to a work queue.
+// Note: This method dispatches the operation to a work queue. If a
+// work item is already scheduled, that work item picks up the
+// operation, so no new one is queued.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::ProcessQueue()
+template <class T, class TOperation, UINT32 OP_QUEUE_SIZE>
+HRESULT OpQueue<T, TOperation, OP_QUEUE_SIZE>::ProcessQueue()
 {
     HRESULT hr = S_OK;
-    if (m_OpQueue.GetCount() > 0)
+    if (m_cOps > 0 && !m_fWorkItemPending)
     {
         hr = MFPutWorkItem2(
             MFASYNC_CALLBACK_QUEUE_STANDARD,    // Use the standard work queue.
@@ -172,6 +238,7 @@ HRESULT OpQueue<T, TOperation>::ProcessQueue()
             &m_OnProcessQueue,                  // Callback method.
             nullptr                             // State object.
             );
+        m_fWorkItemPending = SUCCEEDED(hr);
     }
     return hr;
 }
@@ -184,28 +251,25 @@ HRESULT OpQueue<T, TOperation>::ProcessQueue()
 // Note: This method is called from a work-queue thread.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::ProcessQueueAsync(IMFAsyncResult *pResult)
+template <class T, class TOperation, UINT32 OP_QUEUE_SIZE>
+HRESULT OpQueue<T, TOperation, OP_QUEUE_SIZE>::ProcessQueueAsync(IMFAsyncResult *pResult)
 {
     HRESULT hr = S_OK;
     TOperation *pOp = nullptr;
 
     EnterCriticalSection(&m_critsec);
 
-    if (m_OpQueue.GetCount() > 0)
+    // This work item is running, so the next ProcessQueue call must
+    // schedule a new one.
+    m_fWorkItemPending = false;
+
+    if (m_cOps > 0)
     {
-        hr = m_OpQueue.GetFront(&pOp);
+        hr = ValidateOperation(Front());
 
         if (SUCCEEDED(hr))
         {
-            hr = ValidateOperation(pOp);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = m_OpQueue.RemoveFront(nullptr);
-        }
-        if (SUCCEEDED(hr))
-        {
+            pOp = PopFront();
             (void)DispatchOperation(pOp);
         }
     }
@@ -0,0 +1,134 @@
+//-----------------------------------------------------------------------------
+// File: RingQueue.h
+// Desc: Bounded single-producer, single-consumer queue of COM pointers.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+
+// Notes:
+//
+// The ComPtrRing class template holds up to CAPACITY COM pointers in a
+// fixed array. It does not allocate and it does not lock.
+//
+// One thread may insert (InsertBack) while another thread removes
+// (RemoveFront, Clear). If more than one thread removes items, the
+// caller must serialize them, for example with a CritSec. The same goes
+// for more than one inserting thread.
+//
+// GetCount, IsEmpty and IsFull are exact only on the side that owns
+// the index being changed: IsFull on the producer side, IsEmpty on the
+// consumer side. From any other thread they are a snapshot.
+//
+// The queue holds a reference on each item, like ComPtrList.
+
+template <class T, UINT32 CAPACITY>
+class ComPtrRing
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+public:
+    typedef T* Ptr;
+
+    ComPtrRing() : m_head(0), m_tail(0)
+    {
+        ZeroMemory(m_items, sizeof(m_items));
+    }
+
+    ~ComPtrRing()
+    {
+        Clear();
+    }
+
+    // InsertBack: Adds an item to the back of the queue. Producer only.
+    // Returns E_NOT_SUFFICIENT_BUFFER if the queue is full.
+    HRESULT InsertBack(Ptr item)
+    {
+        if (item == nullptr)
+        {
+            return E_POINTER;
+        }
+
+        UINT32 tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == CAPACITY)
+        {
+            return E_NOT_SUFFICIENT_BUFFER;
+        }
+
+        item->AddRef();
+        m_items[tail & (CAPACITY - 1)] = item;
+
+        // Publish the item. This is a full barrier, so a load that follows
+        // cannot be reordered before it.
+        m_tail.store(tail + 1, std::memory_order_seq_cst);
+        return S_OK;
+    }
+
+    // RemoveFront: Removes the head of the queue and returns it AddRef'd.
+    // ppItem can be nullptr, in which case the item is released.
+    // Consumer only.
+    HRESULT RemoveFront(Ptr *ppItem)
+    {
+        UINT32 head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return E_FAIL;
+        }
+
+        Ptr pItem = m_items[head & (CAPACITY - 1)];
+        m_items[head & (CAPACITY - 1)] = nullptr;
+
+        // Hand the slot back to the producer.
+        m_head.store(head + 1, std::memory_order_release);
+
+        if (ppItem)
+        {
+            *ppItem = pItem;    // The queue's reference passes to the caller.
+        }
+        else
+        {
+            pItem->Release();
+        }
+        return S_OK;
+    }
+
+    // Clear: Removes and releases every item. Consumer only.
+    void Clear()
+    {
+        while (SUCCEEDED(RemoveFront(nullptr)))
+        {
+        }
+    }
+
+    UINT32 GetCount() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool IsEmpty() const
+    {
+        return GetCount() == 0;
+    }
+
+    bool IsFull() const
+    {
+        return GetCount() >= CAPACITY;
+    }
+
+private:
+    ComPtrRing(const ComPtrRing&);
+    ComPtrRing& operator=(const ComPtrRing&);
+
+    // The producer owns m_tail and the consumer owns m_head. Keep them on
+    // separate cache lines so that the two threads do not share one.
+    __declspec(align(64)) std::atomic<UINT32> m_head;
+    __declspec(align(64)) std::atomic<UINT32> m_tail;
+
+    Ptr m_items[CAPACITY];
+};
@@ -0,0 +1,532 @@
+//-----------------------------------------------------------------------------
+// File: Win32Compat.h
+// Desc: The few Windows types and functions the platform-neutral code uses,
+//       for building it with g++ on Linux.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#ifdef _WIN32
+#error Win32Compat.h is for the non-Windows builds; include windows.h instead.
+#endif
+
+// Notes:
+//
+// pch.h includes this header instead of the Windows SDK when _WIN32 is not
+// defined. It is enough for the Common/ containers, the demuxer (Demux.h)
+// and the benchmarks and tests under MKVSource.Shared/test; it is not a
+// Windows emulation.
+//
+// CRITICAL_SECTION is a recursive mutex, as a critical section can be
+// entered again by the thread that owns it.
+//
+// Every Media Foundation work queue is the same pool of threads, one per
+// processor (at least two). MFPutWorkItem2 queues the callback on it.
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Types
+
+typedef uint8_t             BYTE;
+typedef uint8_t             byte;
+typedef uint8_t             UINT8;
+typedef uint16_t            WORD;
+typedef int16_t             INT16;
+typedef uint32_t            DWORD;
+typedef uint32_t            UINT32;
+typedef uint32_t            UINT;
+typedef uint32_t            ULONG;
+typedef int32_t             LONG;
+typedef int32_t             INT32;
+typedef int32_t             BOOL;
+typedef uint64_t            QWORD;
+typedef uint64_t            DWORD64;
+typedef uint64_t            UINT64;
+typedef int64_t             INT64;
+typedef int64_t             LONG64;
+typedef int64_t             LONGLONG;
+typedef int64_t             __int64;
+typedef int32_t             HRESULT;
+typedef void*               PVOID;
+typedef uint8_t             uint8;          // Platform::uint8
+typedef int64_t             int64;          // Platform::int64
+
+union LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+};
+
+#define TRUE                1
+#define FALSE               0
+
+#define MAXDWORD            0xFFFFFFFF
+#define MAXUINT32           UINT32_MAX
+#define MAXLONGLONG         INT64_MAX
+#define MINLONGLONG         INT64_MIN
+
+#define MAKEWORD(a, b)      ((WORD)(((BYTE)(a)) | ((WORD)((BYTE)(b))) << 8))
+#define MAKELONG(a, b)      ((LONG)(((WORD)(a)) | ((DWORD)((WORD)(b))) << 16))
+
+// windows.h defines min and max as macros.
+// They yield a value, not a reference to an argument.
+template <class A, class B> inline typename std::common_type<A, B>::type max(A a, B b)
+{
+    return (a > b) ? a : b;
+}
+
+template <class A, class B> inline typename std::common_type<A, B>::type min(A a, B b)
+{
+    return (a < b) ? a : b;
+}
+
+// HRESULTs
+
+#define S_OK                        ((HRESULT)0)
+#define S_FALSE                     ((HRESULT)1)
+#define E_FAIL                      ((HRESULT)0x80004005L)
+#define E_POINTER                   ((HRESULT)0x80004003L)
+#define E_NOINTERFACE               ((HRESULT)0x80004002L)
+#define E_UNEXPECTED                ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY               ((HRESULT)0x8007000EL)
+#define E_INVALIDARG                ((HRESULT)0x80070057L)
+#define E_NOT_SUFFICIENT_BUFFER     ((HRESULT)0x8007007AL)
+#define E_NOTIMPL                   ((HRESULT)0x80004001L)
+#define E_ABORT                     ((HRESULT)0x80004004L)
+
+#define MF_E_INVALIDREQUEST         ((HRESULT)0xC00D36B2L)
+#define MF_E_INVALIDTYPE            ((HRESULT)0xC00D36B4L)
+#define MF_E_SHUTDOWN               ((HRESULT)0xC00D3E85L)
+#define MF_E_INVALID_FORMAT         ((HRESULT)0xC00D3E8CL)
+#define MF_INVALID_STATE_ERR        ((HRESULT)0x8070000BL)
+
+#define SUCCEEDED(hr)               (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)                  (((HRESULT)(hr)) < 0)
+
+// Compiler extensions. __declspec(align(n)) becomes alignas(n); the others
+// are dropped.
+
+#define __declspec(x)               __declspec_##x
+#define __declspec_align(n)         alignas(n)
+#define __declspec_novtable
+#define __declspec_selectany        __attribute__((weak))
+
+// SAL annotations
+
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _Out_opt_
+#define _In_reads_bytes_(n)
+#define _Acquires_lock_(x)
+#define _Releases_lock_(x)
+
+// Memory
+
+#define ZeroMemory(p, cb)           memset((p), 0, (cb))
+#define CopyMemory(d, s, cb)        memcpy((d), (s), (cb))
+#define MoveMemory(d, s, cb)        memmove((d), (s), (cb))
+#define ARRAYSIZE(a)                (sizeof(a) / sizeof((a)[0]))
+
+// C runtime
+
+#define _strtoui64                  strtoull
+#define _stricmp                    strcasecmp
+
+// Errors. The C++/CX code throws Platform::COMException (ExtensionsDefs.h).
+
+struct HResultException
+{
+    HRESULT HResult;
+};
+
+inline void ThrowIfError(HRESULT hr)
+{
+    if (FAILED(hr))
+    {
+        throw HResultException{ hr };
+    }
+}
+
+inline void ThrowException(HRESULT hr)
+{
+    assert(FAILED(hr));
+    throw HResultException{ hr };
+}
+
+inline void OutputDebugString(const wchar_t *)
+{
+}
+
+// Interlocked functions, on any integer type. The value arguments take
+// the type of the target.
+
+template <class T> struct Win32CompatSameType
+{
+    typedef T Type;
+};
+
+template <class T> inline T InterlockedIncrement(T volatile *p)
+{
+    return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+template <class T> inline T InterlockedDecrement(T volatile *p)
+{
+    return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+template <class T> inline T InterlockedExchange(T volatile *p, typename Win32CompatSameType<T>::Type value)
+{
+    return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+template <class T> inline T InterlockedExchangeAdd(T volatile *p, typename Win32CompatSameType<T>::Type value)
+{
+    return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+template <class T> inline T InterlockedCompareExchange(T volatile *p, typename Win32CompatSameType<T>::Type exchange,
+    typename Win32CompatSameType<T>::Type comparand)
+{
+    __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID exchange, PVOID comparand)
+{
+    __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+#define InterlockedIncrement64          InterlockedIncrement
+#define InterlockedDecrement64          InterlockedDecrement
+#define InterlockedExchange64           InterlockedExchange
+#define InterlockedExchangeAdd64        InterlockedExchangeAdd
+#define InterlockedCompareExchange64    InterlockedCompareExchange
+
+// System
+
+struct SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+};
+
+inline void GetNativeSystemInfo(SYSTEM_INFO *psi)
+{
+    psi->dwNumberOfProcessors = std::thread::hardware_concurrency();
+}
+
+// COM
+
+struct GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+
+    bool operator==(const GUID &other) const { return memcmp(this, &other, sizeof(GUID)) == 0; }
+    bool operator!=(const GUID &other) const { return !(*this == other); }
+};
+
+typedef const GUID& REFIID;
+typedef const GUID& REFGUID;
+
+#define __uuidof(x)                 IID_##x
+
+#define STDMETHODIMP                HRESULT
+#define STDMETHODIMP_(type)         type
+
+const GUID IID_IUnknown = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+
+struct IUnknown
+{
+    virtual HRESULT QueryInterface(REFIID iid, void **ppv) = 0;
+    virtual ULONG AddRef() = 0;
+    virtual ULONG Release() = 0;
+
+protected:
+    virtual ~IUnknown() {}
+};
+
+// Critical sections
+
+typedef std::recursive_mutex CRITICAL_SECTION;
+
+inline BOOL InitializeCriticalSectionEx(CRITICAL_SECTION *, DWORD, DWORD)
+{
+    return TRUE;
+}
+
+inline void DeleteCriticalSection(CRITICAL_SECTION *)
+{
+}
+
+inline void EnterCriticalSection(CRITICAL_SECTION *pcs)
+{
+    pcs->lock();
+}
+
+inline void LeaveCriticalSection(CRITICAL_SECTION *pcs)
+{
+    pcs->unlock();
+}
+
+// Media Foundation
+
+struct MFRatio
+{
+    DWORD Numerator;
+    DWORD Denominator;
+};
+
+struct PROPVARIANT
+{
+    WORD vt;
+    LARGE_INTEGER hVal;
+};
+
+const DWORD MFASYNC_CALLBACK_QUEUE_STANDARD = 0x00000001;
+const DWORD MFASYNC_CALLBACK_QUEUE_MULTITHREADED = 0x00000005;
+
+const GUID IID_IMFAsyncResult = { 0xac6b7889, 0x0740, 0x4d51, { 0x86, 0x19, 0x90, 0x59, 0x94, 0xa5, 0x5c, 0xc6 } };
+const GUID IID_IMFAsyncCallback = { 0xa27003cf, 0x2354, 0x4f2a, { 0x8d, 0x6a, 0xab, 0x7c, 0xff, 0x15, 0x43, 0x7e } };
+
+struct IMFAsyncResult : public IUnknown
+{
+    virtual HRESULT GetState(IUnknown **ppunkState) = 0;
+    virtual HRESULT GetStatus() = 0;
+    virtual HRESULT SetStatus(HRESULT hrStatus) = 0;
+    virtual HRESULT GetObject(IUnknown **ppObject) = 0;
+    virtual IUnknown *GetStateNoAddRef() = 0;
+};
+
+struct IMFAsyncCallback : public IUnknown
+{
+    virtual HRESULT GetParameters(DWORD *pdwFlags, DWORD *pdwQueue) = 0;
+    virtual HRESULT Invoke(IMFAsyncResult *pAsyncResult) = 0;
+};
+
+// The IMFAsyncResult that MFCreateAsyncResult returns.
+class Win32CompatAsyncResult : public IMFAsyncResult
+{
+public:
+    Win32CompatAsyncResult(IUnknown *pObject, IMFAsyncCallback *pCallback, IUnknown *pState)
+        : m_cRef(1), m_hrStatus(S_OK), m_pObject(pObject), m_pCallback(pCallback), m_pState(pState)
+    {
+        if (m_pObject) m_pObject->AddRef();
+        if (m_pCallback) m_pCallback->AddRef();
+        if (m_pState) m_pState->AddRef();
+    }
+
+    HRESULT QueryInterface(REFIID iid, void **ppv)
+    {
+        if (ppv == nullptr)
+        {
+            return E_POINTER;
+        }
+        if (iid == IID_IUnknown || iid == IID_IMFAsyncResult)
+        {
+            *ppv = static_cast<IMFAsyncResult*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG AddRef() { return InterlockedIncrement(&m_cRef); }
+
+    ULONG Release()
+    {
+        ULONG cRef = InterlockedDecrement(&m_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    HRESULT GetState(IUnknown **ppunkState)
+    {
+        if (m_pState == nullptr)
+        {
+            return E_POINTER;
+        }
+        *ppunkState = m_pState;
+        m_pState->AddRef();
+        return S_OK;
+    }
+
+    HRESULT GetStatus() { return m_hrStatus; }
+    HRESULT SetStatus(HRESULT hrStatus) { m_hrStatus = hrStatus; return S_OK; }
+
+    HRESULT GetObject(IUnknown **ppObject)
+    {
+        if (m_pObject == nullptr)
+        {
+            return E_POINTER;
+        }
+        *ppObject = m_pObject;
+        m_pObject->AddRef();
+        return S_OK;
+    }
+
+    IUnknown *GetStateNoAddRef() { return m_pState; }
+
+    IMFAsyncCallback *Callback() const { return m_pCallback; }
+
+private:
+    ~Win32CompatAsyncResult()
+    {
+        if (m_pObject) m_pObject->Release();
+        if (m_pCallback) m_pCallback->Release();
+        if (m_pState) m_pState->Release();
+    }
+
+    ULONG               m_cRef;
+    HRESULT             m_hrStatus;
+    IUnknown           *m_pObject;
+    IMFAsyncCallback   *m_pCallback;
+    IUnknown           *m_pState;
+};
+
+inline HRESULT MFCreateAsyncResult(IUnknown *pObject, IMFAsyncCallback *pCallback, IUnknown *pState, IMFAsyncResult **ppAsyncResult)
+{
+    if (ppAsyncResult == nullptr)
+    {
+        return E_POINTER;
+    }
+    *ppAsyncResult = new (std::nothrow) Win32CompatAsyncResult(pObject, pCallback, pState);
+    return (*ppAsyncResult != nullptr) ? S_OK : E_OUTOFMEMORY;
+}
+
+// The threads behind every work queue. It lives until the process exits;
+// work items still queued then are released without running.
+class Win32CompatWorkPool
+{
+public:
+    static Win32CompatWorkPool& Get()
+    {
+        static Win32CompatWorkPool pool;
+        return pool;
+    }
+
+    HRESULT Put(IMFAsyncResult *pResult)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+        pResult->AddRef();
+        m_items.push_back(pResult);
+        m_wake.notify_one();
+        return S_OK;
+    }
+
+private:
+    Win32CompatWorkPool() : m_fShutdown(false)
+    {
+        unsigned cThreads = std::thread::hardware_concurrency();
+        if (cThreads < 2)
+        {
+            cThreads = 2;
+        }
+        for (unsigned i = 0; i < cThreads; i++)
+        {
+            m_threads.emplace_back(&Win32CompatWorkPool::Run, this);
+        }
+    }
+
+    ~Win32CompatWorkPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_fShutdown = true;
+            m_wake.notify_all();
+        }
+        for (std::thread &thread : m_threads)
+        {
+            thread.join();
+        }
+        for (IMFAsyncResult *pResult : m_items)
+        {
+            pResult->Release();
+        }
+    }
+
+    void Run()
+    {
+        for (;;)
+        {
+            IMFAsyncResult *pResult = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]() { return m_fShutdown || !m_items.empty(); });
+                if (m_fShutdown)
+                {
+                    return;
+                }
+                pResult = m_items.front();
+                m_items.pop_front();
+            }
+            (void)static_cast<Win32CompatAsyncResult*>(pResult)->Callback()->Invoke(pResult);
+            pResult->Release();
+        }
+    }
+
+    std::mutex                      m_mutex;
+    std::condition_variable         m_wake;
+    std::deque<IMFAsyncResult*>     m_items;
+    std::vector<std::thread>        m_threads;
+    bool                            m_fShutdown;
+};
+
+inline HRESULT MFPutWorkItem2(DWORD, LONG, IMFAsyncCallback *pCallback, IUnknown *pState)
+{
+    IMFAsyncResult *pResult = nullptr;
+    HRESULT hr = MFCreateAsyncResult(nullptr, pCallback, pState, &pResult);
+    if (SUCCEEDED(hr))
+    {
+        hr = Win32CompatWorkPool::Get().Put(pResult);
+        pResult->Release();
+    }
+    return hr;
+}
+
+inline HRESULT MFPutWorkItem(DWORD dwQueue, IMFAsyncCallback *pCallback, IUnknown *pState)
+{
+    return MFPutWorkItem2(dwQueue, 0, pCallback, pState);
+}
+
+// Like MFInvokeCallback: runs the callback of a result from
+// MFCreateAsyncResult on the work queue.
+inline HRESULT MFInvokeCallback(IMFAsyncResult *pResult)
+{
+    return Win32CompatWorkPool::Get().Put(pResult);
+}
@@ -0,0 +1,669 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// WorkScheduler.h
+// Shared work-stealing scheduler for media sources.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#pragma warning( push )
+#pragma warning( disable : 4355 )  // 'this' used in base member initializer list
+
+/*
+    This header file defines a scheduler that many media sources in one
+    process can share.
+
+    Background:
+
+    Each source normally puts its parse and I/O work on a Media Foundation
+    work queue of its own. With hundreds of sources open at once, the
+    process ends up with hundreds of queues competing for the CPUs, and
+    nothing keeps one busy source from starving the others.
+
+    With the shared scheduler, each source owns a TaskQueue. A TaskQueue
+    runs its work items one at a time, in order, like a private serial
+    work queue. The scheduler runs the task queues that have work on a
+    fixed pool of workers, one per processor.
+
+    Each worker keeps a list of ready task queues. A worker runs one work
+    item from the queue at the front of its own list and then moves that
+    queue to the back, so the sources it owns take turns. A worker whose
+    list is empty steals a queue from the back of another worker's list.
+    When a queue becomes ready on a busy worker, or a busy worker has
+    more than one queue waiting, an idle worker is started so that it
+    can steal one.
+
+    The workers are work items on the Media Foundation multithreaded work
+    queue. A worker is only scheduled while it has work, so an idle pool
+    costs nothing.
+
+    Usage:
+
+        WorkScheduler *pScheduler = nullptr;
+        hr = WorkScheduler::GetShared(&pScheduler);
+
+        TaskQueue *pQueue = nullptr;
+        hr = pScheduler->CreateTaskQueue(&pQueue);
+        pScheduler->Release();
+
+        // Instead of MFPutWorkItem2(dwQueue, 0, pCallback, pState):
+        hr = pQueue->PutWorkItem(pCallback, pState);
+
+        // When the source shuts down:
+        pQueue->Shutdown();
+        pQueue->Release();
+*/
+
+#include "LinkList.h"
+#include "AsyncCB.h"
+#include "CritSec.h"
+
+class WorkScheduler;
+
+//-------------------------------------------------------------------
+// TaskQueue class
+//
+// Serial queue of work items that runs on the shared scheduler.
+//-------------------------------------------------------------------
+
+class TaskQueue
+{
+    friend class WorkScheduler;
+
+public:
+
+    ULONG AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    ULONG Release()
+    {
+        LONG cRef = InterlockedDecrement(&m_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    // PutWorkItem: Queues a work item. Same arguments as MFPutWorkItem2.
+    HRESULT PutWorkItem(IMFAsyncCallback *pCallback, IUnknown *pState);
+
+    // PutResult: Queues a call to pCallback->Invoke(pResult). Use this to
+    // move an async completion (for example, IMFByteStream::BeginRead)
+    // onto the task queue.
+    HRESULT PutResult(IMFAsyncCallback *pCallback, IMFAsyncResult *pResult);
+
+    // Shutdown: Releases the pending work items. Later calls to
+    // PutWorkItem and PutResult fail with MF_E_SHUTDOWN.
+    void Shutdown();
+
+private:
+
+    struct Task
+    {
+        IMFAsyncCallback   *pCallback;
+        IMFAsyncResult     *pResult;
+    };
+
+    struct ReleaseTask
+    {
+        void operator()(Task& task)
+        {
+            task.pCallback->Release();
+            task.pResult->Release();
+        }
+    };
+
+    TaskQueue(WorkScheduler *pScheduler);
+    ~TaskQueue();
+
+    bool RunOne();
+    void ClearReady();
+
+    long                m_cRef;
+    WorkScheduler      *m_pScheduler;
+    CritSec             m_critSec;
+    List<Task>          m_tasks;
+    bool                m_fReady;       // Is the queue on a worker's list (or running)?
+    bool                m_fShutdown;
+};
+
+
+//-------------------------------------------------------------------
+// WorkScheduler class
+//
+// Runs task queues on a fixed pool of work-stealing workers.
+//-------------------------------------------------------------------
+
+class WorkScheduler
+{
+    friend class TaskQueue;
+
+public:
+
+    // GetShared: Returns the scheduler for this process, AddRef'd. It is
+    // created on first use and lives until the process exits.
+    static HRESULT GetShared(WorkScheduler **ppScheduler);
+
+    ULONG AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    ULONG Release()
+    {
+        LONG cRef = InterlockedDecrement(&m_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    HRESULT CreateTaskQueue(TaskQueue **ppQueue);
+
+private:
+
+    static const UINT32 MAX_WORKERS = 64;
+    static const UINT32 WORKER_BATCH = 32;     // Work items a worker runs before it yields its thread.
+
+    // One worker of the pool.
+    class Worker
+    {
+    public:
+        Worker(WorkScheduler *pScheduler, UINT32 index)
+            : m_pScheduler(pScheduler),
+              m_index(index),
+              m_fScheduled(false),
+              m_OnRun(this, &Worker::OnRun)
+        {
+            m_OnRun.SetQueue(MFASYNC_CALLBACK_QUEUE_MULTITHREADED);
+        }
+
+        // The work item holds a reference on the scheduler.
+        ULONG AddRef() { return m_pScheduler->AddRef(); }
+        ULONG Release() { return m_pScheduler->Release(); }
+
+        HRESULT OnRun(IMFAsyncResult *pResult);
+
+        WorkScheduler              *m_pScheduler;
+        UINT32                      m_index;
+        CritSec                     m_critSec;      // Protects m_ready and m_fScheduled.
+        List<TaskQueue*>            m_ready;        // Task queues with work, oldest first.
+        bool                        m_fScheduled;   // Is OnRun queued or running?
+        AsyncCallback<Worker>       m_OnRun;
+    };
+
+    WorkScheduler();
+    ~WorkScheduler();
+
+    HRESULT Initialize();
+
+    HRESULT Schedule(TaskQueue *pQueue, UINT32 iWorker);
+    HRESULT Schedule(TaskQueue *pQueue);
+    HRESULT Start(Worker *pWorker);
+    void WakeIdle(UINT32 iWaker);
+    TaskQueue *Steal(UINT32 iThief);
+
+    long                m_cRef;
+    Worker             *m_workers[MAX_WORKERS];
+    UINT32              m_cWorkers;
+    LONG                m_iNextWorker;      // Round-robin start for new work.
+    LONG                m_cIdle;            // Workers that are not scheduled.
+};
+
+
+/* TaskQueue methods */
+
+inline TaskQueue::TaskQueue(WorkScheduler *pScheduler)
+    : m_cRef(1),
+      m_pScheduler(pScheduler),
+      m_fReady(false),
+      m_fShutdown(false)
+{
+    m_pScheduler->AddRef();
+}
+
+inline TaskQueue::~TaskQueue()
+{
+    ReleaseTask rt;
+    m_tasks.Clear(rt);
+    m_pScheduler->Release();
+}
+
+inline HRESULT TaskQueue::PutWorkItem(IMFAsyncCallback *pCallback, IUnknown *pState)
+{
+    IMFAsyncResult *pResult = nullptr;
+
+    HRESULT hr = MFCreateAsyncResult(nullptr, pCallback, pState, &pResult);
+    if (SUCCEEDED(hr))
+    {
+        hr = PutResult(pCallback, pResult);
+        pResult->Release();
+    }
+    return hr;
+}
+
+inline HRESULT TaskQueue::PutResult(IMFAsyncCallback *pCallback, IMFAsyncResult *pResult)
+{
+    if (pCallback == nullptr || pResult == nullptr)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    bool fSchedule = false;
+
+    {
+        AutoLock lock(m_critSec);
+
+        if (m_fShutdown)
+        {
+            return MF_E_SHUTDOWN;
+        }
+
+        Task task = { pCallback, pResult };
+        hr = m_tasks.InsertBack(task);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        pCallback->AddRef();
+        pResult->AddRef();
+
+        // The first work item makes the queue ready. While it is ready, the
+        // worker that runs it picks up later work items.
+        if (!m_fReady)
+        {
+            m_fReady = true;
+            fSchedule = true;
+        }
+    }
+
+    if (fSchedule)
+    {
+        hr = m_pScheduler->Schedule(this);
+        if (FAILED(hr))
+        {
+            ClearReady();
+        }
+    }
+    return hr;
+}
+
+inline void TaskQueue::Shutdown()
+{
+    AutoLock lock(m_critSec);
+
+    m_fShutdown = true;
+
+    // Pending work items hold references on their owner, which usually
+    // holds this queue. Drop them to break the cycle.
+    ReleaseTask rt;
+    m_tasks.Clear(rt);
+}
+
+//-------------------------------------------------------------------
+// RunOne
+// Runs the oldest work item. Called by a worker.
+//
+// Returns true if the queue has more work and must stay ready.
+//-------------------------------------------------------------------
+
+inline bool TaskQueue::RunOne()
+{
+    Task task = { nullptr, nullptr };
+
+    {
+        AutoLock lock(m_critSec);
+
+        if (FAILED(m_tasks.RemoveFront(&task)))
+        {
+            m_fReady = false;
+            return false;
+        }
+    }
+
+    // Run the work item without the queue lock, so that it can queue more.
+    (void)task.pCallback->Invoke(task.pResult);
+
+    task.pCallback->Release();
+    task.pResult->Release();
+
+    AutoLock lock(m_critSec);
+
+    if (m_tasks.IsEmpty())
+    {
+        m_fReady = false;
+        return false;
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------
+// ClearReady
+// Called when a ready queue could not be put on a worker's list. The
+// pending work items run once the next PutWorkItem or PutResult
+// schedules the queue again.
+//-------------------------------------------------------------------
+
+inline void TaskQueue::ClearReady()
+{
+    AutoLock lock(m_critSec);
+    m_fReady = false;
+}
+
+
+/* WorkScheduler methods */
+
+inline HRESULT WorkScheduler::GetShared(WorkScheduler **ppScheduler)
+{
+    // A plain pointer needs no dynamic initialization, so this is safe
+    // to read before any constructor has run.
+    static WorkScheduler *s_pShared = nullptr;
+
+    if (ppScheduler == nullptr)
+    {
+        return E_POINTER;
+    }
+
+    WorkScheduler *pScheduler = static_cast<WorkScheduler*>(
+        InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&s_pShared), nullptr, nullptr));
+
+    if (pScheduler == nullptr)
+    {
+        pScheduler = new (std::nothrow) WorkScheduler();
+        if (pScheduler == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = pScheduler->Initialize();
+        if (FAILED(hr))
+        {
+            pScheduler->Release();
+            return hr;
+        }
+
+        // If another thread got there first, use its scheduler. The
+        // reference we hold here stays with s_pShared otherwise.
+        WorkScheduler *pExisting = static_cast<WorkScheduler*>(
+            InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&s_pShared), pScheduler, nullptr));
+        if (pExisting != nullptr)
+        {
+            pScheduler->Release();
+            pScheduler = pExisting;
+        }
+    }
+
+    *ppScheduler = pScheduler;
+    (*ppScheduler)->AddRef();
+    return S_OK;
+}
+
+inline WorkScheduler::WorkScheduler()
+    : m_cRef(1),
+      m_cWorkers(0),
+      m_iNextWorker(0),
+      m_cIdle(0)
+{
+    ZeroMemory(m_workers, sizeof(m_workers));
+}
+
+inline WorkScheduler::~WorkScheduler()
+{
+    for (UINT32 i = 0; i < m_cWorkers; i++)
+    {
+        delete m_workers[i];
+    }
+}
+
+inline HRESULT WorkScheduler::Initialize()
+{
+    SYSTEM_INFO si;
+    GetNativeSystemInfo(&si);
+
+    UINT32 cWorkers = si.dwNumberOfProcessors;
+    if (cWorkers == 0)
+    {
+        cWorkers = 1;
+    }
+    else if (cWorkers > MAX_WORKERS)
+    {
+        cWorkers = MAX_WORKERS;
+    }
+
+    for (UINT32 i = 0; i < cWorkers; i++)
+    {
+        m_workers[i] = new (std::nothrow) Worker(this, i);
+        if (m_workers[i] == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+        m_cWorkers++;
+        m_cIdle++;
+    }
+    return S_OK;
+}
+
+inline HRESULT WorkScheduler::CreateTaskQueue(TaskQueue **ppQueue)
+{
+    if (ppQueue == nullptr)
+    {
+        return E_POINTER;
+    }
+
+    *ppQueue = new (std::nothrow) TaskQueue(this);
+    return (*ppQueue != nullptr) ? S_OK : E_OUTOFMEMORY;
+}
+
+//-------------------------------------------------------------------
+// Schedule
+// Puts a task queue that just became ready on a worker's list.
+//-------------------------------------------------------------------
+
+inline HRESULT WorkScheduler::Schedule(TaskQueue *pQueue)
+{
+    UINT32 iWorker = static_cast<UINT32>(InterlockedIncrement(&m_iNextWorker)) % m_cWorkers;
+    return Schedule(pQueue, iWorker);
+}
+
+inline HRESULT WorkScheduler::Schedule(TaskQueue *pQueue, UINT32 iWorker)
+{
+    Worker *pWorker = m_workers[iWorker];
+    HRESULT hr = S_OK;
+    bool fStart = false;
+
+    {
+        AutoLock lock(pWorker->m_critSec);
+
+        hr = pWorker->m_ready.InsertBack(pQueue);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        // The list holds a reference on the task queue.
+        pQueue->AddRef();
+
+        if (!pWorker->m_fScheduled)
+        {
+            pWorker->m_fScheduled = true;
+            InterlockedDecrement(&m_cIdle);
+            fStart = true;
+        }
+    }
+
+    if (fStart)
+    {
+        // The queue stays on the list if this fails; the next Schedule
+        // call on this worker, or a thief, picks it up.
+        hr = Start(pWorker);
+    }
+    else
+    {
+        // The worker is busy with other queues. Let an idle one steal this.
+        WakeIdle(iWorker);
+    }
+    return hr;
+}
+
+//-------------------------------------------------------------------
+// Start
+// Queues OnRun for a worker that was just marked as scheduled.
+//-------------------------------------------------------------------
+
+inline HRESULT WorkScheduler::Start(Worker *pWorker)
+{
+    HRESULT hr = MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &pWorker->m_OnRun, nullptr);
+    if (FAILED(hr))
+    {
+        AutoLock lock(pWorker->m_critSec);
+        pWorker->m_fScheduled = false;
+        InterlockedIncrement(&m_cIdle);
+    }
+    return hr;
+}
+
+//-------------------------------------------------------------------
+// WakeIdle
+// Starts one idle worker, which steals a queue from a busy one.
+//-------------------------------------------------------------------
+
+inline void WorkScheduler::WakeIdle(UINT32 iWaker)
+{
+    // Cheap check first: most of the time the whole pool is busy, or
+    // the whole pool is idle and the caller just started a worker.
+    if (InterlockedCompareExchange(&m_cIdle, 0, 0) == 0)
+    {
+        return;
+    }
+
+    for (UINT32 i = 1; i < m_cWorkers; i++)
+    {
+        Worker *pWorker = m_workers[(iWaker + i) % m_cWorkers];
+        bool fStart = false;
+
+        {
+            AutoLock lock(pWorker->m_critSec);
+            if (!pWorker->m_fScheduled)
+            {
+                pWorker->m_fScheduled = true;
+                InterlockedDecrement(&m_cIdle);
+                fStart = true;
+            }
+        }
+
+        if (fStart)
+        {
+            (void)Start(pWorker);
+            return;
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// Steal
+// Takes the newest ready task queue from another worker.
+//-------------------------------------------------------------------
+
+inline TaskQueue *WorkScheduler::Steal(UINT32 iThief)
+{
+    for (UINT32 i = 1; i < m_cWorkers; i++)
+    {
+        Worker *pVictim = m_workers[(iThief + i) % m_cWorkers];
+        TaskQueue *pQueue = nullptr;
+
+        AutoLock lock(pVictim->m_critSec);
+
+        if (SUCCEEDED(pVictim->m_ready.RemoveBack(&pQueue)))
+        {
+            return pQueue;      // The list's reference passes to the caller.
+        }
+    }
+    return nullptr;
+}
+
+//-------------------------------------------------------------------
+// Worker::OnRun
+// Runs ready task queues until there is no work left. Called on the
+// Media Foundation multithreaded work queue.
+//-------------------------------------------------------------------
+
+inline HRESULT WorkScheduler::Worker::OnRun(IMFAsyncResult * /*pResult*/)
+{
+    for (UINT32 cRun = 0; cRun < WORKER_BATCH; cRun++)
+    {
+        TaskQueue *pQueue = nullptr;
+
+        {
+            AutoLock lock(m_critSec);
+            (void)m_ready.RemoveFront(&pQueue);
+        }
+
+        if (pQueue == nullptr)
+        {
+            pQueue = m_pScheduler->Steal(m_index);
+        }
+
+        if (pQueue == nullptr)
+        {
+            // Nothing to do anywhere. Check our own list once more under the
+            // lock, so that a queue added after the check above is not lost.
+            AutoLock lock(m_critSec);
+            if (m_ready.IsEmpty())
+            {
+                m_fScheduled = false;
+                InterlockedIncrement(&m_pScheduler->m_cIdle);
+                return S_OK;
+            }
+            continue;
+        }
+
+        if (pQueue->RunOne())
+        {
+            // More work: the queue goes to the back of our own list, so the
+            // other queues get a turn first.
+            HRESULT hr = S_OK;
+            bool fWake = false;
+            {
+                AutoLock lock(m_critSec);
+                hr = m_ready.InsertBack(pQueue);
+                if (SUCCEEDED(hr))
+                {
+                    pQueue->AddRef();
+                    fWake = (m_ready.GetCount() > 1);
+                }
+            }
+
+            if (FAILED(hr))
+            {
+                // The queue is on no list now. Clear m_fReady, or it would
+                // never be scheduled again.
+                pQueue->ClearReady();
+            }
+            else if (fWake)
+            {
+                // Queues are waiting behind this one. Let an idle worker
+                // take some of them.
+                m_pScheduler->WakeIdle(m_index);
+            }
+        }
+        pQueue->Release();
+    }
+
+    // Give the thread back to the platform and continue in a new work item.
+    (void)m_pScheduler->Start(this);
+    return S_OK;
+}
+
+#pragma warning( pop )
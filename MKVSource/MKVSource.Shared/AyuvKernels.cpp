@@ -0,0 +1,552 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AyuvKernels.cpp
+// Fill and blend routines for AYUV caption frames.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "AyuvKernels.h"
+
+#include <atomic>
+#include <mutex>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define AYUV_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AYUV_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define AYUV_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	typedef void (*FillFn)(DWORD*, LONG, UINT32, UINT32, DWORD);
+	typedef void (*BlendCoverageFn)(DWORD*, LONG, const BYTE*, LONG, UINT32, UINT32, DWORD);
+	typedef void (*BlendFn)(DWORD*, LONG, const DWORD*, LONG, UINT32, UINT32);
+
+	// x / 255, rounded, for x in [0, 255 * 255].
+	inline DWORD Div255(DWORD x)
+	{
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	//---------------------------------------------------------------
+	// Scalar versions. The vector versions use these for the pixels
+	// left over at the end of a row.
+	//---------------------------------------------------------------
+
+	void FillRowScalar(DWORD *pDest, UINT32 cx, DWORD dwColor)
+	{
+		for (UINT32 x = 0; x < cx; x++)
+		{
+			pDest[x] = dwColor;
+		}
+	}
+
+	void BlendCoverageRowScalar(DWORD *pDest, const BYTE *pAlpha, UINT32 cx, DWORD dwColor)
+	{
+		const DWORD srcV = dwColor & 0xff;
+		const DWORD srcU = (dwColor >> 8) & 0xff;
+		const DWORD srcY = (dwColor >> 16) & 0xff;
+
+		for (UINT32 x = 0; x < cx; x++)
+		{
+			DWORD a = pAlpha[x];
+			if (a == 0)
+			{
+				continue;
+			}
+
+			DWORD dest = pDest[x];
+			DWORD inv = 255 - a;
+
+			DWORD outA = Div255(255 * a + (dest >> 24) * inv);
+			DWORD outY = Div255(srcY * a + ((dest >> 16) & 0xff) * inv);
+			DWORD outU = Div255(srcU * a + ((dest >> 8) & 0xff) * inv);
+			DWORD outV = Div255(srcV * a + (dest & 0xff) * inv);
+
+			pDest[x] = (outA << 24) | (outY << 16) | (outU << 8) | outV;
+		}
+	}
+
+	void BlendRowScalar(DWORD *pDest, const DWORD *pSrc, UINT32 cx)
+	{
+		for (UINT32 x = 0; x < cx; x++)
+		{
+			DWORD src = pSrc[x];
+			DWORD a = src >> 24;
+			if (a == 0)
+			{
+				continue;
+			}
+
+			DWORD dest = pDest[x];
+			DWORD inv = 255 - a;
+
+			DWORD outA = Div255(255 * a + (dest >> 24) * inv);
+			DWORD outY = Div255(((src >> 16) & 0xff) * a + ((dest >> 16) & 0xff) * inv);
+			DWORD outU = Div255(((src >> 8) & 0xff) * a + ((dest >> 8) & 0xff) * inv);
+			DWORD outV = Div255((src & 0xff) * a + (dest & 0xff) * inv);
+
+			pDest[x] = (outA << 24) | (outY << 16) | (outU << 8) | outV;
+		}
+	}
+
+	void FillScalar(DWORD *pDest, LONG destPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch)
+		{
+			FillRowScalar(pDest, cx, dwColor);
+		}
+	}
+
+	void BlendCoverageScalar(DWORD *pDest, LONG destPitch, const BYTE *pAlpha, LONG alphaPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pAlpha += alphaPitch)
+		{
+			BlendCoverageRowScalar(pDest, pAlpha, cx, dwColor);
+		}
+	}
+
+	void BlendScalar(DWORD *pDest, LONG destPitch, const DWORD *pSrc, LONG srcPitch, UINT32 cx, UINT32 cy)
+	{
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pSrc += srcPitch)
+		{
+			BlendRowScalar(pDest, pSrc, cx);
+		}
+	}
+
+#if defined(AYUV_KERNELS_X86)
+
+	//---------------------------------------------------------------
+	// SSE2 versions: 4 pixels at a time.
+	//
+	// The blend widens each channel to 16 bits; color * a + dest * inv
+	// is at most 255 * 255, so it fits, and so does the division.
+	//---------------------------------------------------------------
+
+	inline __m128i Div255Epu16(__m128i x)
+	{
+		x = _mm_add_epi16(x, _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+	}
+
+	void FillSse2(DWORD *pDest, LONG destPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		const __m128i color = _mm_set1_epi32((int)dwColor);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 4 <= cx; x += 4)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + x), color);
+			}
+			FillRowScalar(pDest + x, cx - x, dwColor);
+		}
+	}
+
+	void BlendCoverageSse2(DWORD *pDest, LONG destPitch, const BYTE *pAlpha, LONG alphaPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi16(255);
+
+		// The color, with alpha 255, in 16 bits per channel, for 2 pixels.
+		const __m128i color = _mm_unpacklo_epi8(_mm_set1_epi32((int)(dwColor | 0xff000000)), zero);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pAlpha += alphaPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 4 <= cx; x += 4)
+			{
+				int alpha4;
+				CopyMemory(&alpha4, pAlpha + x, sizeof(alpha4));
+				if (alpha4 == 0)
+				{
+					continue;
+				}
+
+				// a0 a1 a2 a3 -> a0 a0 a0 a0 a1 a1 a1 a1 ... (one per channel)
+				__m128i a = _mm_cvtsi32_si128(alpha4);
+				a = _mm_unpacklo_epi8(a, a);
+				a = _mm_unpacklo_epi16(a, a);
+
+				__m128i aLo = _mm_unpacklo_epi8(a, zero);
+				__m128i aHi = _mm_unpackhi_epi8(a, zero);
+
+				__m128i dest = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDest + x));
+				__m128i destLo = _mm_unpacklo_epi8(dest, zero);
+				__m128i destHi = _mm_unpackhi_epi8(dest, zero);
+
+				__m128i outLo = _mm_add_epi16(_mm_mullo_epi16(color, aLo), _mm_mullo_epi16(destLo, _mm_sub_epi16(full, aLo)));
+				__m128i outHi = _mm_add_epi16(_mm_mullo_epi16(color, aHi), _mm_mullo_epi16(destHi, _mm_sub_epi16(full, aHi)));
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + x),
+					_mm_packus_epi16(Div255Epu16(outLo), Div255Epu16(outHi)));
+			}
+			BlendCoverageRowScalar(pDest + x, pAlpha + x, cx - x, dwColor);
+		}
+	}
+
+	void BlendSse2(DWORD *pDest, LONG destPitch, const DWORD *pSrc, LONG srcPitch, UINT32 cx, UINT32 cy)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi16(255);
+		const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pSrc += srcPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 4 <= cx; x += 4)
+			{
+				__m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + x));
+
+				// The alpha of each pixel, copied to its 4 bytes.
+				__m128i a = _mm_srli_epi32(src, 24);
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xffff)
+				{
+					continue;
+				}
+				a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+				a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+
+				__m128i aLo = _mm_unpacklo_epi8(a, zero);
+				__m128i aHi = _mm_unpackhi_epi8(a, zero);
+
+				// The source, with alpha 255 (see AyuvKernels.h).
+				src = _mm_or_si128(src, alphaMask);
+				__m128i srcLo = _mm_unpacklo_epi8(src, zero);
+				__m128i srcHi = _mm_unpackhi_epi8(src, zero);
+
+				__m128i dest = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDest + x));
+				__m128i destLo = _mm_unpacklo_epi8(dest, zero);
+				__m128i destHi = _mm_unpackhi_epi8(dest, zero);
+
+				__m128i outLo = _mm_add_epi16(_mm_mullo_epi16(srcLo, aLo), _mm_mullo_epi16(destLo, _mm_sub_epi16(full, aLo)));
+				__m128i outHi = _mm_add_epi16(_mm_mullo_epi16(srcHi, aHi), _mm_mullo_epi16(destHi, _mm_sub_epi16(full, aHi)));
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + x),
+					_mm_packus_epi16(Div255Epu16(outLo), Div255Epu16(outHi)));
+			}
+			BlendRowScalar(pDest + x, pSrc + x, cx - x);
+		}
+	}
+
+	//---------------------------------------------------------------
+	// AVX2 versions: 8 pixels at a time.
+	//
+	// The unpack and pack instructions work within each 128-bit lane,
+	// so pixels 0-3 stay in the low lane and 4-7 in the high lane.
+	//---------------------------------------------------------------
+
+	AYUV_TARGET_AVX2 void FillAvx2(DWORD *pDest, LONG destPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		const __m256i color = _mm256_set1_epi32((int)dwColor);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 8 <= cx; x += 8)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + x), color);
+			}
+			FillRowScalar(pDest + x, cx - x, dwColor);
+		}
+	}
+
+	AYUV_TARGET_AVX2 void BlendCoverageAvx2(DWORD *pDest, LONG destPitch, const BYTE *pAlpha, LONG alphaPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i full = _mm256_set1_epi16(255);
+		const __m256i add = _mm256_set1_epi16(128);
+		const __m256i color = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)(dwColor | 0xff000000)), zero);
+
+		// Copies the low byte of each DWORD to its other 3 bytes.
+		const __m256i spread = _mm256_setr_epi8(
+			0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+			0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pAlpha += alphaPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 8 <= cx; x += 8)
+			{
+				__m128i alpha8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pAlpha + x));
+				if (_mm_cvtsi128_si32(alpha8) == 0 && _mm_cvtsi128_si32(_mm_srli_si128(alpha8, 4)) == 0)
+				{
+					continue;
+				}
+
+				__m256i a = _mm256_shuffle_epi8(_mm256_cvtepu8_epi32(alpha8), spread);
+
+				__m256i aLo = _mm256_unpacklo_epi8(a, zero);
+				__m256i aHi = _mm256_unpackhi_epi8(a, zero);
+
+				__m256i dest = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDest + x));
+				__m256i destLo = _mm256_unpacklo_epi8(dest, zero);
+				__m256i destHi = _mm256_unpackhi_epi8(dest, zero);
+
+				__m256i outLo = _mm256_add_epi16(_mm256_mullo_epi16(color, aLo), _mm256_mullo_epi16(destLo, _mm256_sub_epi16(full, aLo)));
+				__m256i outHi = _mm256_add_epi16(_mm256_mullo_epi16(color, aHi), _mm256_mullo_epi16(destHi, _mm256_sub_epi16(full, aHi)));
+
+				outLo = _mm256_add_epi16(outLo, add);
+				outLo = _mm256_srli_epi16(_mm256_add_epi16(outLo, _mm256_srli_epi16(outLo, 8)), 8);
+				outHi = _mm256_add_epi16(outHi, add);
+				outHi = _mm256_srli_epi16(_mm256_add_epi16(outHi, _mm256_srli_epi16(outHi, 8)), 8);
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + x), _mm256_packus_epi16(outLo, outHi));
+			}
+			BlendCoverageRowScalar(pDest + x, pAlpha + x, cx - x, dwColor);
+		}
+	}
+
+	AYUV_TARGET_AVX2 void BlendAvx2(DWORD *pDest, LONG destPitch, const DWORD *pSrc, LONG srcPitch, UINT32 cx, UINT32 cy)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i full = _mm256_set1_epi16(255);
+		const __m256i add = _mm256_set1_epi16(128);
+		const __m256i alphaMask = _mm256_set1_epi32((int)0xff000000);
+
+		const __m256i spread = _mm256_setr_epi8(
+			0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+			0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+
+		for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pSrc += srcPitch)
+		{
+			UINT32 x = 0;
+			for (; x + 8 <= cx; x += 8)
+			{
+				__m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + x));
+
+				__m256i a = _mm256_srli_epi32(src, 24);
+				if (_mm256_testz_si256(a, a))
+				{
+					continue;
+				}
+				a = _mm256_shuffle_epi8(a, spread);
+
+				__m256i aLo = _mm256_unpacklo_epi8(a, zero);
+				__m256i aHi = _mm256_unpackhi_epi8(a, zero);
+
+				src = _mm256_or_si256(src, alphaMask);
+				__m256i srcLo = _mm256_unpacklo_epi8(src, zero);
+				__m256i srcHi = _mm256_unpackhi_epi8(src, zero);
+
+				__m256i dest = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDest + x));
+				__m256i destLo = _mm256_unpacklo_epi8(dest, zero);
+				__m256i destHi = _mm256_unpackhi_epi8(dest, zero);
+
+				__m256i outLo = _mm256_add_epi16(_mm256_mullo_epi16(srcLo, aLo), _mm256_mullo_epi16(destLo, _mm256_sub_epi16(full, aLo)));
+				__m256i outHi = _mm256_add_epi16(_mm256_mullo_epi16(srcHi, aHi), _mm256_mullo_epi16(destHi, _mm256_sub_epi16(full, aHi)));
+
+				outLo = _mm256_add_epi16(outLo, add);
+				outLo = _mm256_srli_epi16(_mm256_add_epi16(outLo, _mm256_srli_epi16(outLo, 8)), 8);
+				outHi = _mm256_add_epi16(outHi, add);
+				outHi = _mm256_srli_epi16(_mm256_add_epi16(outHi, _mm256_srli_epi16(outHi, 8)), 8);
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + x), _mm256_packus_epi16(outLo, outHi));
+			}
+			BlendRowScalar(pDest + x, pSrc + x, cx - x);
+		}
+	}
+
+	//---------------------------------------------------------------
+	// CPU detection
+	//---------------------------------------------------------------
+
+	void CpuId(int info[4], int leaf)
+	{
+#if defined(_MSC_VER)
+		__cpuidex(info, leaf, 0);
+#else
+		__cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+	}
+
+	AyuvKernelLevel DetectLevel()
+	{
+		int info[4];
+
+		CpuId(info, 0);
+		int maxLeaf = info[0];
+
+		CpuId(info, 1);
+		bool fSse2 = (info[3] & (1 << 26)) != 0;
+		bool fOsxsave = (info[2] & (1 << 27)) != 0;
+		bool fAvx = (info[2] & (1 << 28)) != 0;
+
+		// AVX2 also needs the OS to save the YMM registers.
+		bool fAvx2 = false;
+		if (maxLeaf >= 7 && fOsxsave && fAvx)
+		{
+#if defined(_MSC_VER)
+			unsigned long long xcr0 = _xgetbv(0);
+#else
+			unsigned int eax, edx;
+			__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+			if ((xcr0 & 0x6) == 0x6)
+			{
+				CpuId(info, 7);
+				fAvx2 = (info[1] & (1 << 5)) != 0;
+			}
+		}
+
+		if (fAvx2)
+		{
+			return AYUV_KERNEL_AVX2;
+		}
+		return (fSse2 ? AYUV_KERNEL_SSE2 : AYUV_KERNEL_SCALAR);
+	}
+
+#else
+
+	AyuvKernelLevel DetectLevel()
+	{
+		return AYUV_KERNEL_SCALAR;
+	}
+
+#endif
+
+	//---------------------------------------------------------------
+	// Dispatch. The routines of each level are in a constant table,
+	// and g_pKernels points to the one in use. The CPU is checked once,
+	// under g_detectOnce, whichever thread gets there first.
+	//---------------------------------------------------------------
+
+	struct KernelSet
+	{
+		AyuvKernelLevel     level;
+		FillFn              pfnFill;
+		BlendCoverageFn     pfnBlendCoverage;
+		BlendFn             pfnBlend;
+	};
+
+	const KernelSet g_scalarKernels = { AYUV_KERNEL_SCALAR, FillScalar, BlendCoverageScalar, BlendScalar };
+#if defined(AYUV_KERNELS_X86)
+	const KernelSet g_sse2Kernels = { AYUV_KERNEL_SSE2, FillSse2, BlendCoverageSse2, BlendSse2 };
+	const KernelSet g_avx2Kernels = { AYUV_KERNEL_AVX2, FillAvx2, BlendCoverageAvx2, BlendAvx2 };
+#endif
+
+	std::once_flag g_detectOnce;
+	AyuvKernelLevel g_maxLevel = AYUV_KERNEL_SCALAR;    // Set under g_detectOnce.
+	std::atomic<const KernelSet*> g_pKernels;           // Null until then.
+
+	const KernelSet *GetKernelSet(AyuvKernelLevel level)
+	{
+		switch (level)
+		{
+#if defined(AYUV_KERNELS_X86)
+		case AYUV_KERNEL_AVX2:
+			return &g_avx2Kernels;
+
+		case AYUV_KERNEL_SSE2:
+			return &g_sse2Kernels;
+#endif
+		default:
+			return &g_scalarKernels;
+		}
+	}
+
+	const KernelSet *Kernels()
+	{
+		const KernelSet *pKernels = g_pKernels.load(std::memory_order_acquire);
+		if (pKernels == nullptr)
+		{
+			std::call_once(g_detectOnce, []()
+			{
+				g_maxLevel = DetectLevel();
+				g_pKernels.store(GetKernelSet(g_maxLevel), std::memory_order_release);
+			});
+			pKernels = g_pKernels.load(std::memory_order_acquire);
+		}
+		return pKernels;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// AyuvFill
+// Sets a rectangle of pixels to one color.
+//-------------------------------------------------------------------
+
+void AyuvFill(DWORD *pDest, LONG destPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+{
+	Kernels()->pfnFill(pDest, destPitch, cx, cy, dwColor);
+}
+
+
+//-------------------------------------------------------------------
+// AyuvBlendCoverage
+// Blends a color into a rectangle of pixels, through a coverage mask.
+//-------------------------------------------------------------------
+
+void AyuvBlendCoverage(DWORD *pDest, LONG destPitch, const BYTE *pAlpha, LONG alphaPitch, UINT32 cx, UINT32 cy, DWORD dwColor)
+{
+	Kernels()->pfnBlendCoverage(pDest, destPitch, pAlpha, alphaPitch, cx, cy, dwColor);
+}
+
+
+//-------------------------------------------------------------------
+// AyuvBlend
+// Blends a rectangle of pixels over another, by the source alpha.
+//-------------------------------------------------------------------
+
+void AyuvBlend(DWORD *pDest, LONG destPitch, const DWORD *pSrc, LONG srcPitch, UINT32 cx, UINT32 cy)
+{
+	Kernels()->pfnBlend(pDest, destPitch, pSrc, srcPitch, cx, cy);
+}
+
+
+//-------------------------------------------------------------------
+// AyuvExpandPalette
+// Converts palette indices to pixels.
+//-------------------------------------------------------------------
+
+void AyuvExpandPalette(DWORD *pDest, LONG destPitch, const BYTE *pIndices, LONG indexPitch, UINT32 cx, UINT32 cy, const DWORD *pPalette)
+{
+	for (UINT32 y = 0; y < cy; y++, pDest += destPitch, pIndices += indexPitch)
+	{
+		UINT32 x = 0;
+		for (; x + 4 <= cx; x += 4)
+		{
+			pDest[x] = pPalette[pIndices[x]];
+			pDest[x + 1] = pPalette[pIndices[x + 1]];
+			pDest[x + 2] = pPalette[pIndices[x + 2]];
+			pDest[x + 3] = pPalette[pIndices[x + 3]];
+		}
+		for (; x < cx; x++)
+		{
+			pDest[x] = pPalette[pIndices[x]];
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GetAyuvKernelLevel / SetAyuvKernelLevel
+//-------------------------------------------------------------------
+
+AyuvKernelLevel GetAyuvKernelLevel()
+{
+	return Kernels()->level;
+}
+
+void SetAyuvKernelLevel(AyuvKernelLevel level)
+{
+	// Kernels() sets g_maxLevel first.
+	(void)Kernels();
+	g_pKernels.store(GetKernelSet(level < g_maxLevel ? level : g_maxLevel), std::memory_order_release);
+}
@@ -0,0 +1,58 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// AyuvKernels.h
+// Fill and blend routines for AYUV caption frames.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// AYUV pixels are DWORDs: A in the high byte, then Y, U and V. Pitches
+// are in pixels.
+//
+// Each routine has a scalar version, and SSE2 and AVX2 versions on x86
+// and x64. The first call, from any thread, picks the widest one the CPU
+// supports. All versions give the same results, bit for bit.
+//
+// Blending is straight "over" compositing, with a color of full alpha:
+//
+//     out = (color * a + dest * (255 - a)) / 255, rounded,
+//
+// for V, U and Y; the alpha channel uses 255 for the color, which
+// gives outA = a + destA * (255 - a) / 255. For AyuvBlendCoverage, a
+// is the coverage; for AyuvBlend, it is the alpha of the source pixel.
+
+// Sets a cx by cy rectangle to dwColor.
+void AyuvFill(DWORD *pDest, LONG destPitch, UINT32 cx, UINT32 cy, DWORD dwColor);
+
+// Blends dwColor (alpha ignored) into a cx by cy rectangle, with the
+// per-pixel coverage in pAlpha (8 bits per pixel, alphaPitch bytes per row).
+void AyuvBlendCoverage(DWORD *pDest, LONG destPitch, const BYTE *pAlpha, LONG alphaPitch, UINT32 cx, UINT32 cy, DWORD dwColor);
+
+// Blends a cx by cy rectangle of AYUV pixels (srcPitch pixels per row)
+// over another.
+void AyuvBlend(DWORD *pDest, LONG destPitch, const DWORD *pSrc, LONG srcPitch, UINT32 cx, UINT32 cy);
+
+// Writes palette[index] for each index of a cx by cy plane of palette
+// indices (8 bits per pixel, indexPitch bytes per row). This is a table
+// lookup per pixel, which SSE2 cannot do faster, so it is scalar only.
+void AyuvExpandPalette(DWORD *pDest, LONG destPitch, const BYTE *pIndices, LONG indexPitch, UINT32 cx, UINT32 cy, const DWORD *pPalette);
+
+// Instruction sets the kernels can use.
+enum AyuvKernelLevel
+{
+	AYUV_KERNEL_SCALAR,
+	AYUV_KERNEL_SSE2,
+	AYUV_KERNEL_AVX2
+};
+
+// Returns the level in use. SetAyuvKernelLevel forces a lower level
+// (for comparing the versions); it cannot go above what the CPU has.
+// A call in progress on another thread finishes with the old level.
+AyuvKernelLevel GetAyuvKernelLevel();
+void SetAyuvKernelLevel(AyuvKernelLevel level);
@@ -0,0 +1,814 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BitmapSubtitles.cpp
+// Decoders for bitmap subtitles: PGS (S_HDMV/PGS) and VobSub (S_VOBSUB).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "Demux.h"
+#include "BitmapSubtitles.h"
+
+#include <string.h>
+#include <string>
+
+namespace
+{
+	const DWORD c_dwTransparent = 0x00108080;      // AYUV: A=0, Y=16, U=V=128.
+	const UINT32 c_maxPgsSize = 4096;               // Largest PGS object side, before the composition size is known.
+
+	inline UINT32 Read16(const BYTE *p)
+	{
+		return (p[0] << 8) | p[1];
+	}
+
+	inline UINT32 Read24(const BYTE *p)
+	{
+		return (p[0] << 16) | (p[1] << 8) | p[2];
+	}
+
+	inline DWORD MakeAyuv(BYTE a, BYTE y, BYTE u, BYTE v)
+	{
+		return ((DWORD)a << 24) | ((DWORD)y << 16) | ((DWORD)u << 8) | v;
+	}
+
+	// BT.601, studio range.
+	DWORD RgbToAyuv(BYTE a, int r, int g, int b)
+	{
+		int y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		int u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		int v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		return MakeAyuv(a, (BYTE)y, (BYTE)u, (BYTE)v);
+	}
+
+	void InitBitmap(SubtitleBitmap *pBitmap, LONG x, LONG y, UINT32 cx, UINT32 cy)
+	{
+		pBitmap->x = x;
+		pBitmap->y = y;
+		pBitmap->cx = cx;
+		pBitmap->cy = cy;
+		pBitmap->indices.assign(cx * cy, 0);
+		for (int i = 0; i < 256; i++)
+		{
+			pBitmap->palette[i] = c_dwTransparent;
+		}
+	}
+
+
+	//---------------------------------------------------------------
+	// PGS
+	//
+	// A display set is a list of segments: a presentation composition
+	// (PCS) saying which objects show where, window definitions (WDS),
+	// palettes (PDS), objects (ODS, possibly in several fragments), and
+	// an end segment. Objects and palettes last for an epoch, so a later
+	// display set can show an object again without sending it.
+	//---------------------------------------------------------------
+
+	enum PgsSegment
+	{
+		PGS_PALETTE = 0x14,
+		PGS_OBJECT = 0x15,
+		PGS_COMPOSITION = 0x16,
+		PGS_WINDOW = 0x17,
+		PGS_END = 0x80
+	};
+
+	class PgsDecoder : public BitmapSubtitleDecoder
+	{
+	public:
+		PgsDecoder() : m_paletteId(0), m_cxVideo(c_maxPgsSize), m_cyVideo(c_maxPgsSize), m_fComplete(false) { }
+
+		bool Decode(const BYTE *pData, DWORD cbData, std::vector<SubtitleBitmap> *pBitmaps) override;
+		void Reset() override;
+
+	private:
+		struct Object
+		{
+			Object() : cx(0), cy(0), cbExpected(0) { }
+
+			UINT32              cx, cy;
+			UINT32              cbExpected;     // RLE bytes announced by the first fragment.
+			std::vector<BYTE>   rle;
+		};
+
+		struct Placement
+		{
+			UINT32  objectId;
+			LONG    x, y;
+			bool    fCropped;
+			UINT32  cropX, cropY, cropCx, cropCy;
+		};
+
+		void ParseComposition(const BYTE *p, DWORD cb);
+		void ParsePalette(const BYTE *p, DWORD cb);
+		void ParseObject(const BYTE *p, DWORD cb);
+		void Compose(std::vector<SubtitleBitmap> *pBitmaps);
+		static void DecodeRle(const Object &object, BYTE *pPlane);
+
+		std::map<UINT32, Object>                    m_objects;
+		std::map<UINT32, std::vector<DWORD> >       m_palettes;
+		std::vector<Placement>                      m_placements;
+		UINT32                                      m_paletteId;
+		UINT32                                      m_cxVideo;      // Composition size: no object is larger.
+		UINT32                                      m_cyVideo;
+		bool                                        m_fComplete;    // The set is an epoch start or an acquisition point.
+	};
+
+	bool PgsDecoder::Decode(const BYTE *pData, DWORD cbData, std::vector<SubtitleBitmap> *pBitmaps)
+	{
+		pBitmaps->clear();
+		m_fComplete = false;
+
+		// Segment: type (1), size (2), then the data.
+		while (cbData >= 3)
+		{
+			BYTE type = pData[0];
+			DWORD cbSegment = Read16(pData + 1);
+			pData += 3;
+			cbData -= 3;
+
+			if (cbSegment > cbData)
+			{
+				break;
+			}
+
+			switch (type)
+			{
+			case PGS_COMPOSITION:
+				ParseComposition(pData, cbSegment);
+				break;
+			case PGS_PALETTE:
+				ParsePalette(pData, cbSegment);
+				break;
+			case PGS_OBJECT:
+				ParseObject(pData, cbSegment);
+				break;
+			case PGS_END:
+				Compose(pBitmaps);
+				break;
+			default:
+				break;
+			}
+
+			pData += cbSegment;
+			cbData -= cbSegment;
+		}
+
+		return m_fComplete;
+	}
+
+	void PgsDecoder::Reset()
+	{
+		m_objects.clear();
+		m_palettes.clear();
+		m_placements.clear();
+		m_paletteId = 0;
+	}
+
+	void PgsDecoder::ParseComposition(const BYTE *p, DWORD cb)
+	{
+		// Width (2), height (2), frame rate (1), number (2), state (1),
+		// palette update (1), palette ID (1), object count (1).
+		if (cb < 11)
+		{
+			return;
+		}
+
+		UINT32 cxVideo = Read16(p);
+		UINT32 cyVideo = Read16(p + 2);
+		if (cxVideo != 0 && cyVideo != 0)
+		{
+			m_cxVideo = min(cxVideo, c_maxPgsSize);
+			m_cyVideo = min(cyVideo, c_maxPgsSize);
+		}
+
+		// Epoch start (0x80): forget the objects and palettes of the last
+		// epoch. An acquisition point (0x40) sends them all again.
+		BYTE state = p[7];
+		if (state & 0x80)
+		{
+			Reset();
+		}
+		m_fComplete = (state & 0xc0) != 0;
+
+		m_paletteId = p[9];
+		UINT32 cObjects = p[10];
+		p += 11;
+		cb -= 11;
+
+		m_placements.clear();
+		for (UINT32 i = 0; i < cObjects && cb >= 8; i++)
+		{
+			// Object ID (2), window ID (1), flags (1), x (2), y (2),
+			// and the cropping rectangle (8) if flags has 0x80.
+			Placement placement;
+			placement.objectId = Read16(p);
+			placement.fCropped = (p[3] & 0x80) != 0;
+			placement.x = Read16(p + 4);
+			placement.y = Read16(p + 6);
+			p += 8;
+			cb -= 8;
+
+			placement.cropX = placement.cropY = placement.cropCx = placement.cropCy = 0;
+			if (placement.fCropped)
+			{
+				if (cb < 8)
+				{
+					break;
+				}
+				placement.cropX = Read16(p);
+				placement.cropY = Read16(p + 2);
+				placement.cropCx = Read16(p + 4);
+				placement.cropCy = Read16(p + 6);
+				p += 8;
+				cb -= 8;
+			}
+
+			m_placements.push_back(placement);
+		}
+	}
+
+	void PgsDecoder::ParsePalette(const BYTE *p, DWORD cb)
+	{
+		// Palette ID (1), version (1), then entries of index, Y, Cr, Cb, A.
+		if (cb < 2)
+		{
+			return;
+		}
+
+		std::vector<DWORD> &palette = m_palettes[p[0]];
+		if (palette.empty())
+		{
+			palette.assign(256, c_dwTransparent);
+		}
+
+		for (DWORD i = 2; i + 5 <= cb; i += 5)
+		{
+			palette[p[i]] = MakeAyuv(p[i + 4], p[i + 1], p[i + 3], p[i + 2]);
+		}
+	}
+
+	void PgsDecoder::ParseObject(const BYTE *p, DWORD cb)
+	{
+		// Object ID (2), version (1), sequence flags (1): 0x80 first
+		// fragment, 0x40 last fragment. The first fragment then has the
+		// data length (3, counting the size fields), width (2), height (2).
+		if (cb < 4)
+		{
+			return;
+		}
+
+		Object &object = m_objects[Read16(p)];
+		BYTE flags = p[3];
+		p += 4;
+		cb -= 4;
+
+		if (flags & 0x80)
+		{
+			if (cb < 7)
+			{
+				return;
+			}
+			UINT32 cbData = Read24(p);
+			object.cbExpected = (cbData >= 4 ? cbData - 4 : 0);
+
+			// Compose allocates cx * cy bytes: no more than the video.
+			// DecodeRle drops what falls outside.
+			object.cx = min(Read16(p + 3), m_cxVideo);
+			object.cy = min(Read16(p + 5), m_cyVideo);
+			object.rle.clear();
+			object.rle.reserve(object.cbExpected);
+			p += 7;
+			cb -= 7;
+		}
+
+		object.rle.insert(object.rle.end(), p, p + cb);
+	}
+
+	void PgsDecoder::Compose(std::vector<SubtitleBitmap> *pBitmaps)
+	{
+		auto itPalette = m_palettes.find(m_paletteId);
+
+		for (size_t i = 0; i < m_placements.size(); i++)
+		{
+			const Placement &placement = m_placements[i];
+
+			auto itObject = m_objects.find(placement.objectId);
+			if (itObject == m_objects.end() || itObject->second.cx == 0 || itObject->second.cy == 0)
+			{
+				continue;
+			}
+			const Object &object = itObject->second;
+
+			pBitmaps->push_back(SubtitleBitmap());
+			SubtitleBitmap &bitmap = pBitmaps->back();
+			InitBitmap(&bitmap, placement.x, placement.y, object.cx, object.cy);
+
+			DecodeRle(object, bitmap.indices.data());
+
+			if (itPalette != m_palettes.end())
+			{
+				CopyMemory(bitmap.palette, itPalette->second.data(), sizeof(bitmap.palette));
+			}
+
+			if (placement.fCropped)
+			{
+				UINT32 cropX = min(placement.cropX, object.cx);
+				UINT32 cropY = min(placement.cropY, object.cy);
+				UINT32 cx = min(placement.cropCx, object.cx - cropX);
+				UINT32 cy = min(placement.cropCy, object.cy - cropY);
+
+				for (UINT32 y = 0; y < cy; y++)
+				{
+					MoveMemory(&bitmap.indices[y * cx], &bitmap.indices[(cropY + y) * object.cx + cropX], cx);
+				}
+				bitmap.cx = cx;
+				bitmap.cy = cy;
+				bitmap.indices.resize(cx * cy);
+			}
+		}
+	}
+
+	//---------------------------------------------------------------
+	// PGS run-length code, per row:
+	//
+	//   CCCCCCCC                       one pixel of color C (C != 0)
+	//   00000000 00LLLLLL              L pixels of color 0
+	//   00000000 01LLLLLL LLLLLLLL     L pixels of color 0
+	//   00000000 10LLLLLL CCCCCCCC     L pixels of color C
+	//   00000000 11LLLLLL LLLLLLLL CCCCCCCC
+	//   00000000 00000000              end of row
+	//---------------------------------------------------------------
+
+	void PgsDecoder::DecodeRle(const Object &object, BYTE *pPlane)
+	{
+		const BYTE *p = object.rle.data();
+		const BYTE *pEnd = p + object.rle.size();
+
+		UINT32 x = 0;
+		UINT32 y = 0;
+		BYTE *pRow = pPlane;
+
+		while (p < pEnd && y < object.cy)
+		{
+			BYTE b = *p++;
+			if (b != 0)
+			{
+				if (x < object.cx)
+				{
+					pRow[x++] = b;
+				}
+				continue;
+			}
+
+			if (p >= pEnd)
+			{
+				break;
+			}
+
+			BYTE flags = *p++;
+			if (flags == 0)
+			{
+				// End of row.
+				x = 0;
+				y++;
+				pRow += object.cx;
+				continue;
+			}
+
+			UINT32 run = flags & 0x3f;
+			if (flags & 0x40)
+			{
+				if (p >= pEnd)
+				{
+					break;
+				}
+				run = (run << 8) | *p++;
+			}
+
+			BYTE color = 0;
+			if (flags & 0x80)
+			{
+				if (p >= pEnd)
+				{
+					break;
+				}
+				color = *p++;
+			}
+
+			run = min(run, object.cx - x);
+			memset(pRow + x, color, run);
+			x += run;
+		}
+	}
+
+
+	//---------------------------------------------------------------
+	// VobSub
+	//
+	// A subpicture unit: its size (2), the offset of the control
+	// sequences (2), the run-length coded picture, then the control
+	// sequences. The picture is interlaced: even rows are coded from
+	// one offset, odd rows from another. Each pixel is one of 4 colors,
+	// each a palette index plus a contrast (alpha) of 0-15.
+	//---------------------------------------------------------------
+
+	enum VobSubCommand
+	{
+		SPU_FORCE_DISPLAY = 0x00,
+		SPU_START_DISPLAY = 0x01,
+		SPU_STOP_DISPLAY = 0x02,
+		SPU_SET_COLOR = 0x03,
+		SPU_SET_CONTRAST = 0x04,
+		SPU_SET_AREA = 0x05,
+		SPU_SET_OFFSETS = 0x06,
+		SPU_END = 0xff
+	};
+
+	// Control sequence dates are in units of 1024 / 90000 seconds.
+	inline LONGLONG SpuDateToHns(UINT32 date)
+	{
+		return (LONGLONG)date * 1024 * 10000000 / 90000;
+	}
+
+	// Reads the nibbles of the run-length code.
+	class NibbleReader
+	{
+	public:
+		NibbleReader(const BYTE *p, const BYTE *pEnd) : m_p(p), m_pEnd(pEnd), m_fHigh(true) { }
+
+		UINT32 Next()
+		{
+			if (m_p >= m_pEnd)
+			{
+				return 0;
+			}
+			UINT32 n = (m_fHigh ? (*m_p >> 4) : (*m_p++ & 0x0f));
+			m_fHigh = !m_fHigh;
+			return n;
+		}
+
+		void AlignToByte()
+		{
+			if (!m_fHigh)
+			{
+				m_p++;
+				m_fHigh = true;
+			}
+		}
+
+		bool AtEnd() const { return m_p >= m_pEnd; }
+
+	private:
+		const BYTE  *m_p;
+		const BYTE  *m_pEnd;
+		bool        m_fHigh;
+	};
+
+	class VobSubDecoder : public BitmapSubtitleDecoder
+	{
+	public:
+		VobSubDecoder(const BYTE *pCodecPrivate, DWORD cbCodecPrivate);
+
+		// Each subpicture unit stands alone.
+		bool Decode(const BYTE *pData, DWORD cbData, std::vector<SubtitleBitmap> *pBitmaps) override;
+		void Reset() override { }
+
+	private:
+		static void DecodeField(NibbleReader *pReader, BYTE *pRow, UINT32 cx, UINT32 cRows, UINT32 rowPitch);
+
+		DWORD   m_palette[16];      // From the .idx header, as AYUV with full alpha.
+	};
+
+	VobSubDecoder::VobSubDecoder(const BYTE *pCodecPrivate, DWORD cbCodecPrivate)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			m_palette[i] = RgbToAyuv(255, i * 17, i * 17, i * 17);
+		}
+
+		// The header is text; the palette is a line
+		// "palette: rrggbb, rrggbb, ..." with 16 colors.
+		if (pCodecPrivate == nullptr)
+		{
+			return;
+		}
+
+		std::string header(reinterpret_cast<const char*>(pCodecPrivate), cbCodecPrivate);
+		size_t pos = header.find("palette:");
+		if (pos == std::string::npos)
+		{
+			return;
+		}
+
+		const char *psz = header.c_str() + pos + 8;
+		for (int i = 0; i < 16; i++)
+		{
+			char *pszEnd = nullptr;
+			unsigned long rgb = strtoul(psz, &pszEnd, 16);
+			if (pszEnd == psz)
+			{
+				break;
+			}
+			m_palette[i] = RgbToAyuv(255, (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+
+			psz = pszEnd;
+			while (*psz == ',' || *psz == ' ')
+			{
+				psz++;
+			}
+		}
+	}
+
+	bool VobSubDecoder::Decode(const BYTE *pData, DWORD cbData, std::vector<SubtitleBitmap> *pBitmaps)
+	{
+		pBitmaps->clear();
+
+		if (cbData < 4)
+		{
+			return true;
+		}
+
+		DWORD cbUnit = min((DWORD)Read16(pData), cbData);
+		DWORD offControl = Read16(pData + 2);
+
+		BYTE colors[4] = { 0, 1, 2, 3 };
+		BYTE contrast[4] = { 0, 15, 15, 15 };
+		UINT32 x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+		DWORD offFields[2] = { 0, 0 };
+		bool fArea = false;
+		bool fShow = false;
+
+		// Walk the control sequences. Each one has a date (2), the offset of
+		// the next one (2), and commands; the last one points to itself.
+		for (int cSequences = 0; offControl + 4 <= cbUnit && cSequences < 16; cSequences++)
+		{
+			DWORD offNext = Read16(pData + offControl + 2);
+			DWORD i = offControl + 4;
+			bool fEnd = false;
+
+			while (i < cbUnit && !fEnd)
+			{
+				switch (pData[i++])
+				{
+				case SPU_FORCE_DISPLAY:
+				case SPU_START_DISPLAY:
+					fShow = true;
+					break;
+				case SPU_STOP_DISPLAY:
+					break;
+				case SPU_SET_COLOR:
+					if (i + 2 > cbUnit) { fEnd = true; break; }
+					colors[3] = pData[i] >> 4;
+					colors[2] = pData[i] & 0x0f;
+					colors[1] = pData[i + 1] >> 4;
+					colors[0] = pData[i + 1] & 0x0f;
+					i += 2;
+					break;
+				case SPU_SET_CONTRAST:
+					if (i + 2 > cbUnit) { fEnd = true; break; }
+					contrast[3] = pData[i] >> 4;
+					contrast[2] = pData[i] & 0x0f;
+					contrast[1] = pData[i + 1] >> 4;
+					contrast[0] = pData[i + 1] & 0x0f;
+					i += 2;
+					break;
+				case SPU_SET_AREA:
+					if (i + 6 > cbUnit) { fEnd = true; break; }
+					x1 = (pData[i] << 4) | (pData[i + 1] >> 4);
+					x2 = ((pData[i + 1] & 0x0f) << 8) | pData[i + 2];
+					y1 = (pData[i + 3] << 4) | (pData[i + 4] >> 4);
+					y2 = ((pData[i + 4] & 0x0f) << 8) | pData[i + 5];
+					fArea = true;
+					i += 6;
+					break;
+				case SPU_SET_OFFSETS:
+					if (i + 4 > cbUnit) { fEnd = true; break; }
+					offFields[0] = Read16(pData + i);
+					offFields[1] = Read16(pData + i + 2);
+					i += 4;
+					break;
+				default:    // SPU_END, or a command we do not know (so we cannot skip it).
+					fEnd = true;
+					break;
+				}
+			}
+
+			if (offNext == offControl)
+			{
+				break;
+			}
+			offControl = offNext;
+		}
+
+		if (!fShow || !fArea || x2 < x1 || y2 < y1)
+		{
+			return true;
+		}
+
+		pBitmaps->push_back(SubtitleBitmap());
+		SubtitleBitmap &bitmap = pBitmaps->back();
+		InitBitmap(&bitmap, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+
+		for (int i = 0; i < 4; i++)
+		{
+			BYTE alpha = (BYTE)(contrast[i] * 17);
+			bitmap.palette[i] = (m_palette[colors[i]] & 0x00ffffff) | ((DWORD)alpha << 24);
+		}
+
+		// Even rows, then odd rows.
+		for (int field = 0; field < 2; field++)
+		{
+			if (offFields[field] >= cbUnit || bitmap.cy <= (UINT32)field)
+			{
+				continue;
+			}
+
+			NibbleReader reader(pData + offFields[field], pData + cbUnit);
+			DecodeField(&reader, &bitmap.indices[field * bitmap.cx], bitmap.cx, (bitmap.cy - field + 1) / 2, bitmap.cx * 2);
+		}
+
+		return true;
+	}
+
+	//---------------------------------------------------------------
+	// VobSub run-length code: a run and a color index (2 bits) packed
+	// into 1 to 4 nibbles, with fewer leading zero nibbles for short
+	// runs. A run of 0 fills the rest of the row. Rows start on a
+	// byte boundary.
+	//---------------------------------------------------------------
+
+	void VobSubDecoder::DecodeField(NibbleReader *pReader, BYTE *pRow, UINT32 cx, UINT32 cRows, UINT32 rowPitch)
+	{
+		for (UINT32 y = 0; y < cRows && !pReader->AtEnd(); y++, pRow += rowPitch)
+		{
+			UINT32 x = 0;
+			while (x < cx && !pReader->AtEnd())
+			{
+				UINT32 v = pReader->Next();
+				if (v < 0x4)
+				{
+					v = (v << 4) | pReader->Next();
+					if (v < 0x10)
+					{
+						v = (v << 4) | pReader->Next();
+						if (v < 0x40)
+						{
+							v = (v << 4) | pReader->Next();
+						}
+					}
+				}
+
+				UINT32 run = v >> 2;
+				if (run == 0 || run > cx - x)
+				{
+					run = cx - x;
+				}
+
+				memset(pRow + x, v & 0x3, run);
+				x += run;
+			}
+			pReader->AlignToByte();
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// BitmapSubtitleDecoder::Create
+//-------------------------------------------------------------------
+
+BitmapSubtitleDecoder *BitmapSubtitleDecoder::Create(SubtitleFormat format, const BYTE *pCodecPrivate, DWORD cbCodecPrivate)
+{
+	switch (format)
+	{
+	case SUBTITLE_PGS:
+		return new PgsDecoder();
+	case SUBTITLE_VOBSUB:
+		return new VobSubDecoder(pCodecPrivate, cbCodecPrivate);
+	default:
+		return nullptr;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GetVobSubDisplayDuration
+// Returns the date of the first stop-display command.
+//-------------------------------------------------------------------
+
+LONGLONG GetVobSubDisplayDuration(const BYTE *pData, DWORD cbData)
+{
+	if (cbData < 4)
+	{
+		return -1;
+	}
+
+	DWORD cbUnit = min((DWORD)Read16(pData), cbData);
+	DWORD offControl = Read16(pData + 2);
+
+	for (int cSequences = 0; offControl + 4 <= cbUnit && cSequences < 16; cSequences++)
+	{
+		UINT32 date = Read16(pData + offControl);
+		DWORD offNext = Read16(pData + offControl + 2);
+
+		// Walk the commands; stop at one whose size we do not know.
+		for (DWORD i = offControl + 4; i < cbUnit; )
+		{
+			BYTE command = pData[i++];
+			if (command == SPU_STOP_DISPLAY)
+			{
+				return SpuDateToHns(date);
+			}
+
+			static const BYTE c_cbArgs[] = { 0, 0, 0, 2, 2, 6, 4 };
+			if (command >= ARRAYSIZE(c_cbArgs))
+			{
+				break;
+			}
+			i += c_cbArgs[command];
+		}
+
+		if (offNext == offControl)
+		{
+			break;
+		}
+		offControl = offNext;
+	}
+
+	return -1;
+}
+
+
+//-------------------------------------------------------------------
+// BitmapSubtitleCache class
+//-------------------------------------------------------------------
+
+BitmapSubtitleCache::BitmapSubtitleCache(BitmapSubtitleDecoder *pDecoder)
+	: m_pDecoder(pDecoder)
+	, m_useCount(0)
+{
+	assert(pDecoder != nullptr);
+}
+
+BitmapSubtitleCache::~BitmapSubtitleCache()
+{
+	delete m_pDecoder;
+}
+
+
+//-------------------------------------------------------------------
+// GetBitmaps
+// Returns the decoded pictures of a cue. When the cache is full, the
+// least recently used display set makes room.
+//-------------------------------------------------------------------
+
+const std::vector<SubtitleBitmap> &BitmapSubtitleCache::GetBitmaps(const SubtitleCue &cue)
+{
+	auto it = m_entries.find(cue.pData);
+	if (it == m_entries.end())
+	{
+		std::vector<SubtitleBitmap> bitmaps;
+		if (!m_pDecoder->Decode(reinterpret_cast<const BYTE*>(cue.pData), cue.cbData, &bitmaps))
+		{
+			m_uncached.swap(bitmaps);
+			return m_uncached;
+		}
+
+		if (m_entries.size() >= MAX_CACHED_DISPLAY_SETS)
+		{
+			auto itOldest = m_entries.begin();
+			for (auto itEntry = m_entries.begin(); itEntry != m_entries.end(); ++itEntry)
+			{
+				if (itEntry->second.lastUse < itOldest->second.lastUse)
+				{
+					itOldest = itEntry;
+				}
+			}
+			m_entries.erase(itOldest);
+		}
+
+		it = m_entries.insert(std::make_pair(cue.pData, Entry())).first;
+		it->second.bitmaps.swap(bitmaps);
+	}
+
+	it->second.lastUse = ++m_useCount;
+	return it->second.bitmaps;
+}
+
+
+//-------------------------------------------------------------------
+// Reset
+// Resets the decoder after a seek.
+//-------------------------------------------------------------------
+
+void BitmapSubtitleCache::Reset()
+{
+	m_pDecoder->Reset();
+}
@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BitmapSubtitles.h
+// Decoders for bitmap subtitles: PGS (S_HDMV/PGS) and VobSub (S_VOBSUB).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "SubtitleCues.h"
+
+// One decoded subtitle picture: a plane of palette indices, and the
+// palette as AYUV pixels.
+struct SubtitleBitmap
+{
+	LONG                x, y;           // Position in the video frame.
+	UINT32              cx, cy;
+	std::vector<BYTE>   indices;        // cy rows of cx indices.
+	DWORD               palette[256];   // AYUV. Unused entries are transparent.
+};
+
+// Both formats code each row as runs of one palette index, and pictures
+// are large (a full-width line of text is easily 1900 x 100 pixels).
+// The decoders write runs with memset, and only check the bounds once
+// per run.
+//
+// A decoder is fed the blocks of one track, in order. Bitmap subtitle
+// blocks are stored in the SubtitleCueStore like text cues; a block is
+// one display set (PGS) or one subpicture unit (VobSub).
+//
+// A PGS display set can show objects and palettes sent by earlier sets
+// of its epoch. Only an epoch start or an acquisition point carries
+// everything it shows.
+class BitmapSubtitleDecoder
+{
+public:
+	virtual ~BitmapSubtitleDecoder() { }
+
+	// Decodes a block into the pictures it shows. An empty list is
+	// valid: it clears the screen. Returns true if the pictures depend
+	// on this block only, false if they depend on the blocks decoded
+	// before it.
+	virtual bool Decode(const BYTE *pData, DWORD cbData, std::vector<SubtitleBitmap> *pBitmaps) = 0;
+
+	// Forgets what the blocks decoded so far left behind. Call it when
+	// the next block does not follow the last one (after a seek).
+	virtual void Reset() = 0;
+
+	// Creates the decoder for a track. pCodecPrivate is the track's
+	// CodecPrivate (the .idx header for VobSub). Returns nullptr if the
+	// format is not a bitmap format.
+	static BitmapSubtitleDecoder *Create(SubtitleFormat format, const BYTE *pCodecPrivate, DWORD cbCodecPrivate);
+};
+
+// Returns how long a VobSub subpicture shows, from its stop-display
+// command, or -1 if it has none.
+LONGLONG GetVobSubDisplayDuration(const BYTE *pData, DWORD cbData);
+
+// Decoded display sets, by cue. The store never moves cue data, so the
+// data pointer of a cue identifies it. The cache holds the most recent
+// MAX_CACHED_DISPLAY_SETS sets, so that a set is decoded once however
+// long it shows, and again only if it is dropped.
+//
+// Only the sets that decode on their own are cached. The others depend
+// on the decoder's state, which a seek resets, so they are decoded
+// each time they are asked for.
+class BitmapSubtitleCache
+{
+public:
+	BitmapSubtitleCache(BitmapSubtitleDecoder *pDecoder);
+	~BitmapSubtitleCache();
+
+	// Returns the pictures of a cue, decoding it if needed. The list
+	// is valid until the next call.
+	const std::vector<SubtitleBitmap> &GetBitmaps(const SubtitleCue &cue);
+
+	// Resets the decoder, after a seek. The cached sets stay.
+	void Reset();
+
+	static const size_t MAX_CACHED_DISPLAY_SETS = 8;
+
+private:
+	BitmapSubtitleCache(const BitmapSubtitleCache&);
+	BitmapSubtitleCache& operator=(const BitmapSubtitleCache&);
+
+	struct Entry
+	{
+		std::vector<SubtitleBitmap>     bitmaps;
+		UINT64                          lastUse;
+	};
+
+	BitmapSubtitleDecoder                   *m_pDecoder;
+	std::map<const char*, Entry>            m_entries;
+	std::vector<SubtitleBitmap>             m_uncached;     // The last set that did not decode on its own.
+	UINT64                                  m_useCount;
+};
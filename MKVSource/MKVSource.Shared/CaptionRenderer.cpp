@@ -0,0 +1,623 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CaptionRenderer.cpp
+// Draws text subtitle cues into AYUV caption frames.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "MKVSource.h"
+#include "CaptionRenderer.h"
+#include "AyuvKernels.h"
+
+namespace
+{
+	const WCHAR c_wszFontFamily[] = L"Segoe UI";
+	const FLOAT c_flLinesPerFrame = 15.0f;      // Font size, as a fraction of the frame height.
+	const LONG  c_lShadowOffset = 2;            // Drop shadow offset, in pixels.
+	const LONG  c_lMargin = 8;                  // Space left around the text, in pixels.
+
+	// Returns the intersection of two rectangles (empty if they do not meet).
+	RECT Intersect(const RECT &a, const RECT &b)
+	{
+		RECT rc;
+		rc.left = max(a.left, b.left);
+		rc.top = max(a.top, b.top);
+		rc.right = max(rc.left, min(a.right, b.right));
+		rc.bottom = max(rc.top, min(a.bottom, b.bottom));
+		return rc;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GlyphAtlas class
+//-------------------------------------------------------------------
+
+GlyphAtlas::GlyphAtlas(IDWriteFactory *pFactory, IDWriteFontFace *pFontFace, FLOAT emSize)
+	: m_spFactory(pFactory)
+	, m_spFontFace(pFontFace)
+	, m_emSize(emSize)
+	, m_plane(ATLAS_WIDTH * ATLAS_HEIGHT)
+	, m_shelfTop(0)
+	, m_shelfHeight(0)
+	, m_shelfX(0)
+{
+	DWRITE_FONT_METRICS metrics;
+	m_spFontFace->GetMetrics(&metrics);
+	m_designUnitsToPixels = m_emSize / metrics.designUnitsPerEm;
+}
+
+
+//-------------------------------------------------------------------
+// GetGlyph
+// Returns the atlas slot of a glyph.
+//-------------------------------------------------------------------
+
+const GlyphSlot *GlyphAtlas::GetGlyph(UINT16 glyphIndex)
+{
+	auto it = m_glyphs.find(glyphIndex);
+	if (it != m_glyphs.end())
+	{
+		return &it->second;
+	}
+
+	GlyphSlot slot;
+	if (!Rasterize(glyphIndex, &slot))
+	{
+		return nullptr;
+	}
+
+	return &(m_glyphs[glyphIndex] = slot);
+}
+
+
+//-------------------------------------------------------------------
+// Reset
+// Empties the atlas.
+//-------------------------------------------------------------------
+
+void GlyphAtlas::Reset()
+{
+	m_glyphs.clear();
+	m_shelfTop = 0;
+	m_shelfHeight = 0;
+	m_shelfX = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Rasterize
+// Draws a glyph into the atlas.
+//
+// DirectWrite gives ClearType coverage (3 bytes per pixel, one per
+// subpixel). The atlas keeps their average, which is the grayscale
+// anti-aliased coverage.
+//-------------------------------------------------------------------
+
+bool GlyphAtlas::Rasterize(UINT16 glyphIndex, GlyphSlot *pSlot)
+{
+	DWRITE_GLYPH_METRICS glyphMetrics;
+	ThrowIfError(m_spFontFace->GetDesignGlyphMetrics(&glyphIndex, 1, &glyphMetrics, FALSE));
+
+	ZeroMemory(pSlot, sizeof(*pSlot));
+	pSlot->advance = glyphMetrics.advanceWidth * m_designUnitsToPixels;
+
+	FLOAT advance = 0.0f;
+	DWRITE_GLYPH_OFFSET offset = { 0.0f, 0.0f };
+
+	DWRITE_GLYPH_RUN run = { 0 };
+	run.fontFace = m_spFontFace.Get();
+	run.fontEmSize = m_emSize;
+	run.glyphCount = 1;
+	run.glyphIndices = &glyphIndex;
+	run.glyphAdvances = &advance;
+	run.glyphOffsets = &offset;
+
+	ComPtr<IDWriteGlyphRunAnalysis> spAnalysis;
+	ThrowIfError(m_spFactory->CreateGlyphRunAnalysis(
+		&run,
+		1.0f,
+		nullptr,
+		DWRITE_RENDERING_MODE_CLEARTYPE_NATURAL_SYMMETRIC,
+		DWRITE_MEASURING_MODE_NATURAL,
+		0.0f,
+		0.0f,
+		&spAnalysis
+		));
+
+	RECT bounds;
+	ThrowIfError(spAnalysis->GetAlphaTextureBounds(DWRITE_TEXTURE_CLEARTYPE_3x1, &bounds));
+
+	UINT32 cx = bounds.right - bounds.left;
+	UINT32 cy = bounds.bottom - bounds.top;
+	if (cx == 0 || cy == 0)
+	{
+		// Blank glyph (a space): nothing to store.
+		return true;
+	}
+
+	UINT32 x = 0;
+	UINT32 y = 0;
+	if (!Allocate(cx, cy, &x, &y))
+	{
+		return false;
+	}
+
+	m_texture.resize(cx * cy * 3);
+	ThrowIfError(spAnalysis->CreateAlphaTexture(DWRITE_TEXTURE_CLEARTYPE_3x1, &bounds, m_texture.data(), (UINT32)m_texture.size()));
+
+	const BYTE *pSrc = m_texture.data();
+	for (UINT32 row = 0; row < cy; row++)
+	{
+		BYTE *pDest = &m_plane[(y + row) * ATLAS_WIDTH + x];
+		for (UINT32 col = 0; col < cx; col++, pSrc += 3)
+		{
+			pDest[col] = (BYTE)((pSrc[0] + pSrc[1] + pSrc[2]) / 3);
+		}
+	}
+
+	pSlot->x = (UINT16)x;
+	pSlot->y = (UINT16)y;
+	pSlot->cx = (UINT16)cx;
+	pSlot->cy = (UINT16)cy;
+	pSlot->left = (INT16)bounds.left;
+	pSlot->top = (INT16)bounds.top;
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// Allocate
+// Finds room for a cx by cy bitmap in the atlas.
+//-------------------------------------------------------------------
+
+bool GlyphAtlas::Allocate(UINT32 cx, UINT32 cy, UINT32 *pX, UINT32 *pY)
+{
+	if (cx > ATLAS_WIDTH || cy > ATLAS_HEIGHT)
+	{
+		return false;
+	}
+
+	// Start a new shelf if the glyph does not fit at the end of this one.
+	if (m_shelfX + cx > ATLAS_WIDTH)
+	{
+		m_shelfTop += m_shelfHeight;
+		m_shelfHeight = 0;
+		m_shelfX = 0;
+	}
+
+	if (m_shelfTop + cy > ATLAS_HEIGHT)
+	{
+		return false;
+	}
+
+	*pX = m_shelfX;
+	*pY = m_shelfTop;
+
+	m_shelfX += cx;
+	m_shelfHeight = max(m_shelfHeight, cy);
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// CaptionRenderer class
+//-------------------------------------------------------------------
+
+CaptionRenderer::CaptionRenderer(UINT32 width, UINT32 height)
+	: m_width(width)
+	, m_height(height)
+	, m_frame(width * height, DWORD(TRANSPARENT_PIXEL))
+	, m_pAtlas(nullptr)
+	, m_pBitmaps(nullptr)
+	, m_emSize(height / c_flLinesPerFrame)
+{
+	ComPtr<IDWriteFontCollection> spFonts;
+	ComPtr<IDWriteFontFamily> spFamily;
+	ComPtr<IDWriteFont> spFont;
+	UINT32 iFamily = 0;
+	BOOL fExists = FALSE;
+
+	ThrowIfError(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(m_spFactory.GetAddressOf())));
+	ThrowIfError(m_spFactory->GetSystemFontCollection(&spFonts));
+	ThrowIfError(spFonts->FindFamilyName(c_wszFontFamily, &iFamily, &fExists));
+	if (!fExists)
+	{
+		iFamily = 0;
+	}
+	ThrowIfError(spFonts->GetFontFamily(iFamily, &spFamily));
+	ThrowIfError(spFamily->GetFirstMatchingFont(DWRITE_FONT_WEIGHT_SEMI_BOLD, DWRITE_FONT_STRETCH_NORMAL, DWRITE_FONT_STYLE_NORMAL, &spFont));
+	ThrowIfError(spFont->CreateFontFace(&m_spFontFace));
+
+	DWRITE_FONT_METRICS metrics;
+	m_spFontFace->GetMetrics(&metrics);
+	m_ascent = metrics.ascent * m_emSize / metrics.designUnitsPerEm;
+	m_lineHeight = (metrics.ascent + metrics.descent + metrics.lineGap) * m_emSize / metrics.designUnitsPerEm;
+
+	m_pAtlas = new GlyphAtlas(m_spFactory.Get(), m_spFontFace.Get(), m_emSize);
+}
+
+CaptionRenderer::~CaptionRenderer()
+{
+	delete m_pBitmaps;
+	delete m_pAtlas;
+}
+
+
+//-------------------------------------------------------------------
+// SetBitmapDecoder
+// Switches the renderer to bitmap subtitles.
+//-------------------------------------------------------------------
+
+void CaptionRenderer::SetBitmapDecoder(BitmapSubtitleDecoder *pDecoder)
+{
+	assert(pDecoder != nullptr);
+
+	delete m_pBitmaps;
+	m_pBitmaps = new BitmapSubtitleCache(pDecoder);
+
+	// Force a redraw.
+	m_shownCues.clear();
+	m_shownCues.push_back(nullptr);
+}
+
+
+//-------------------------------------------------------------------
+// ResetBitmaps
+// Resets the bitmap decoder after a seek.
+//-------------------------------------------------------------------
+
+void CaptionRenderer::ResetBitmaps()
+{
+	if (m_pBitmaps != nullptr)
+	{
+		m_pBitmaps->Reset();
+
+		// Force a redraw.
+		m_shownCues.clear();
+		m_shownCues.push_back(nullptr);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Update
+// Composes the frame for the cues that show now.
+//
+// Only the lines of the old and the new text are touched: the old
+// lines are cleared, then the new lines are drawn from the atlas.
+// Bitmap pictures cover their whole rectangle, so only the old ones
+// are cleared.
+//-------------------------------------------------------------------
+
+bool CaptionRenderer::Update(const std::vector<SubtitleCue> &cues, std::vector<RECT> *pDirty)
+{
+	if (pDirty != nullptr)
+	{
+		pDirty->clear();
+	}
+
+	// Same cues, same frame. (The store never moves cue data, so the data
+	// pointer identifies a cue.)
+	if (cues.size() == m_shownCues.size())
+	{
+		size_t i = 0;
+		while (i < cues.size() && cues[i].pData == m_shownCues[i])
+		{
+			i++;
+		}
+		if (i == cues.size())
+		{
+			return false;
+		}
+	}
+
+	if (m_pBitmaps != nullptr)
+	{
+		for (size_t i = 0; i < m_shownLines.size(); i++)
+		{
+			ClearRect(m_shownLines[i]);
+		}
+
+		DrawBitmaps(cues);
+	}
+	else
+	{
+		// If the atlas fills up halfway, start over with an empty one; the
+		// glyphs placed so far might be overwritten.
+		if (!LayOut(cues))
+		{
+			m_pAtlas->Reset();
+			(void)LayOut(cues);
+		}
+
+		for (size_t i = 0; i < m_shownLines.size(); i++)
+		{
+			ClearRect(m_shownLines[i]);
+		}
+		for (size_t i = 0; i < m_lines.size(); i++)
+		{
+			ClearRect(m_lines[i]);
+		}
+
+		for (size_t i = 0; i < m_glyphs.size(); i++)
+		{
+			DrawGlyph(m_glyphs[i], c_lShadowOffset, c_lShadowOffset, SHADOW_PIXEL);
+		}
+		for (size_t i = 0; i < m_glyphs.size(); i++)
+		{
+			DrawGlyph(m_glyphs[i], 0, 0, TEXT_PIXEL);
+		}
+	}
+
+	m_shownCues.clear();
+	for (size_t i = 0; i < cues.size(); i++)
+	{
+		m_shownCues.push_back(cues[i].pData);
+	}
+
+	if (pDirty != nullptr)
+	{
+		pDirty->insert(pDirty->end(), m_shownLines.begin(), m_shownLines.end());
+		pDirty->insert(pDirty->end(), m_lines.begin(), m_lines.end());
+	}
+	m_shownLines.swap(m_lines);
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// LayOut
+// Places the glyphs of the cues: one row per line, each row centered,
+// and the block of rows at the bottom of the frame.
+//
+// Returns false if a glyph did not fit in the atlas.
+//-------------------------------------------------------------------
+
+bool CaptionRenderer::LayOut(const std::vector<SubtitleCue> &cues)
+{
+	std::vector<std::wstring> lines;
+	std::vector<UINT16> glyphIndices;
+	std::vector<UINT32> codePoints;
+	bool fComplete = true;
+
+	m_glyphs.clear();
+	m_lines.clear();
+
+	for (size_t i = 0; i < cues.size(); i++)
+	{
+		GetCueLines(cues[i], &lines);
+	}
+
+	const RECT rcFrame = { 0, 0, (LONG)m_width, (LONG)m_height };
+	FLOAT baseline = m_height - c_lMargin - (lines.size() * m_lineHeight) + m_ascent;
+
+	for (size_t iLine = 0; iLine < lines.size(); iLine++, baseline += m_lineHeight)
+	{
+		const std::wstring &line = lines[iLine];
+
+		// DirectWrite maps code points, not UTF-16 units. (Surrogate pairs
+		// are rare in subtitles; each half maps to the missing glyph.)
+		codePoints.assign(line.begin(), line.end());
+		glyphIndices.resize(line.size());
+		if (line.empty())
+		{
+			continue;
+		}
+		ThrowIfError(m_spFontFace->GetGlyphIndices(codePoints.data(), (UINT32)codePoints.size(), glyphIndices.data()));
+
+		size_t iFirstGlyph = m_glyphs.size();
+		FLOAT penX = 0.0f;
+
+		for (size_t j = 0; j < glyphIndices.size(); j++)
+		{
+			const GlyphSlot *pSlot = m_pAtlas->GetGlyph(glyphIndices[j]);
+			if (pSlot == nullptr)
+			{
+				fComplete = false;
+				continue;
+			}
+
+			if (pSlot->cx > 0)
+			{
+				PlacedGlyph glyph;
+				glyph.x = (LONG)(penX + 0.5f) + pSlot->left;
+				glyph.y = (LONG)(baseline + 0.5f) + pSlot->top;
+				glyph.slot = *pSlot;
+				m_glyphs.push_back(glyph);
+			}
+			penX += pSlot->advance;
+		}
+
+		// Center the line.
+		LONG dx = ((LONG)m_width - (LONG)(penX + 0.5f)) / 2;
+		RECT rcLine = { MAXLONG, MAXLONG, MINLONG, MINLONG };
+
+		for (size_t j = iFirstGlyph; j < m_glyphs.size(); j++)
+		{
+			PlacedGlyph &glyph = m_glyphs[j];
+			glyph.x += dx;
+
+			rcLine.left = min(rcLine.left, glyph.x);
+			rcLine.top = min(rcLine.top, glyph.y);
+			rcLine.right = max(rcLine.right, glyph.x + glyph.slot.cx + c_lShadowOffset);
+			rcLine.bottom = max(rcLine.bottom, glyph.y + glyph.slot.cy + c_lShadowOffset);
+		}
+
+		if (iFirstGlyph < m_glyphs.size())
+		{
+			rcLine = Intersect(rcLine, rcFrame);
+			if (rcLine.right > rcLine.left && rcLine.bottom > rcLine.top)
+			{
+				m_lines.push_back(rcLine);
+			}
+		}
+	}
+
+	return fComplete;
+}
+
+
+//-------------------------------------------------------------------
+// DrawBitmaps
+// Copies the pictures of the cues into the frame, and lists their
+// rectangles in m_lines. A picture that overlaps one drawn before it
+// is blended over it instead.
+//
+// The pictures come from the cache: a display set is decoded the first
+// time it shows, not for every frame.
+//-------------------------------------------------------------------
+
+void CaptionRenderer::DrawBitmaps(const std::vector<SubtitleCue> &cues)
+{
+	const RECT rcFrame = { 0, 0, (LONG)m_width, (LONG)m_height };
+
+	m_glyphs.clear();
+	m_lines.clear();
+
+	for (size_t i = 0; i < cues.size(); i++)
+	{
+		const std::vector<SubtitleBitmap> &bitmaps = m_pBitmaps->GetBitmaps(cues[i]);
+
+		for (size_t j = 0; j < bitmaps.size(); j++)
+		{
+			const SubtitleBitmap &bitmap = bitmaps[j];
+			const RECT rcBitmap = { bitmap.x, bitmap.y, bitmap.x + (LONG)bitmap.cx, bitmap.y + (LONG)bitmap.cy };
+			const RECT rc = Intersect(rcBitmap, rcFrame);
+
+			if (rc.right <= rc.left || rc.bottom <= rc.top)
+			{
+				continue;
+			}
+
+			const UINT32 cx = rc.right - rc.left;
+			const UINT32 cy = rc.bottom - rc.top;
+			const BYTE *pIndices = &bitmap.indices[(rc.top - rcBitmap.top) * bitmap.cx + (rc.left - rcBitmap.left)];
+
+			bool fOverlaps = false;
+			for (size_t k = 0; k < m_lines.size() && !fOverlaps; k++)
+			{
+				const RECT rcCommon = Intersect(rc, m_lines[k]);
+				fOverlaps = (rcCommon.right > rcCommon.left && rcCommon.bottom > rcCommon.top);
+			}
+
+			if (fOverlaps)
+			{
+				m_pixels.resize(cx * cy);
+				AyuvExpandPalette(m_pixels.data(), cx, pIndices, bitmap.cx, cx, cy, bitmap.palette);
+				AyuvBlend(&m_frame[rc.top * m_width + rc.left], m_width, m_pixels.data(), cx, cx, cy);
+			}
+			else
+			{
+				AyuvExpandPalette(&m_frame[rc.top * m_width + rc.left], m_width, pIndices, bitmap.cx, cx, cy, bitmap.palette);
+			}
+
+			m_lines.push_back(rc);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GetCueLines
+// Appends the lines of text of a cue to *pLines.
+//
+// Line breaks are newlines and the SSA "\N" and "\n" escapes. SSA
+// override blocks ("{\b1}" and the like) are dropped.
+//-------------------------------------------------------------------
+
+void CaptionRenderer::GetCueLines(const SubtitleCue &cue, std::vector<std::wstring> *pLines)
+{
+	if (cue.TextLength() == 0)
+	{
+		return;
+	}
+
+	int cch = MultiByteToWideChar(CP_UTF8, 0, cue.Text(), cue.TextLength(), nullptr, 0);
+	if (cch <= 0)
+	{
+		return;
+	}
+
+	std::wstring text(cch, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, cue.Text(), cue.TextLength(), &text[0], cch);
+
+	std::wstring line;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		WCHAR ch = text[i];
+
+		if (ch == L'{' && i + 1 < text.size() && text[i + 1] == L'\\')
+		{
+			size_t iEnd = text.find(L'}', i);
+			if (iEnd != std::wstring::npos)
+			{
+				i = iEnd;
+				continue;
+			}
+		}
+
+		if (ch == L'\\' && i + 1 < text.size() && (text[i + 1] == L'N' || text[i + 1] == L'n'))
+		{
+			pLines->push_back(line);
+			line.clear();
+			i++;
+		}
+		else if (ch == L'\n')
+		{
+			pLines->push_back(line);
+			line.clear();
+		}
+		else if (ch != L'\r')
+		{
+			line.push_back(ch);
+		}
+	}
+	pLines->push_back(line);
+}
+
+
+//-------------------------------------------------------------------
+// ClearRect
+// Makes a rectangle of the frame transparent.
+//-------------------------------------------------------------------
+
+void CaptionRenderer::ClearRect(const RECT &rc)
+{
+	AyuvFill(&m_frame[rc.top * m_width + rc.left], m_width, rc.right - rc.left, rc.bottom - rc.top, TRANSPARENT_PIXEL);
+}
+
+
+//-------------------------------------------------------------------
+// DrawGlyph
+// Blends a glyph from the atlas into the frame, offset by (dx, dy),
+// in the color dwColor (AYUV, alpha ignored).
+//-------------------------------------------------------------------
+
+void CaptionRenderer::DrawGlyph(const PlacedGlyph &glyph, LONG dx, LONG dy, DWORD dwColor)
+{
+	const RECT rcFrame = { 0, 0, (LONG)m_width, (LONG)m_height };
+	const RECT rcGlyph = { glyph.x + dx, glyph.y + dy, glyph.x + dx + glyph.slot.cx, glyph.y + dy + glyph.slot.cy };
+	const RECT rc = Intersect(rcGlyph, rcFrame);
+
+	if (rc.right <= rc.left || rc.bottom <= rc.top)
+	{
+		return;
+	}
+
+	const BYTE *pAlpha = m_pAtlas->Plane() +
+		(glyph.slot.y + rc.top - rcGlyph.top) * m_pAtlas->Pitch() +
+		(glyph.slot.x + rc.left - rcGlyph.left);
+
+	AyuvBlendCoverage(&m_frame[rc.top * m_width + rc.left], m_width, pAlpha, m_pAtlas->Pitch(),
+		rc.right - rc.left, rc.bottom - rc.top, dwColor);
+}
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CaptionRenderer.h
+// Draws text subtitle cues into AYUV caption frames.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <dwrite.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SubtitleCues.h"
+#include "BitmapSubtitles.h"
+
+// A glyph in the atlas.
+struct GlyphSlot
+{
+	UINT16  x, y;           // Position in the atlas.
+	UINT16  cx, cy;         // Size of the coverage bitmap. (0 for blank glyphs.)
+	INT16   left, top;      // Offset of the bitmap from the pen position on the baseline.
+	FLOAT   advance;        // Pen advance, in pixels.
+};
+
+// The glyph atlas holds the coverage (alpha) of each glyph that has
+// been drawn, in one 8-bit plane. A glyph is rasterized by DirectWrite
+// the first time it is used, and copied from the atlas after that.
+//
+// Glyphs are packed in shelves: rows as tall as their tallest glyph,
+// filled left to right. When the atlas is full, Reset empties it.
+class GlyphAtlas
+{
+public:
+	GlyphAtlas(IDWriteFactory *pFactory, IDWriteFontFace *pFontFace, FLOAT emSize);
+
+	// Returns the slot of a glyph, rasterizing it if needed. Returns
+	// nullptr if it does not fit in the atlas.
+	const GlyphSlot *GetGlyph(UINT16 glyphIndex);
+
+	// Forgets every glyph.
+	void Reset();
+
+	const BYTE *Plane() const { return m_plane.data(); }
+	UINT32 Pitch() const { return ATLAS_WIDTH; }
+
+	static const UINT32 ATLAS_WIDTH = 1024;
+	static const UINT32 ATLAS_HEIGHT = 1024;
+
+private:
+	GlyphAtlas(const GlyphAtlas&);
+	GlyphAtlas& operator=(const GlyphAtlas&);
+
+	bool Rasterize(UINT16 glyphIndex, GlyphSlot *pSlot);
+	bool Allocate(UINT32 cx, UINT32 cy, UINT32 *pX, UINT32 *pY);
+
+	ComPtr<IDWriteFactory>                      m_spFactory;
+	ComPtr<IDWriteFontFace>                     m_spFontFace;
+	FLOAT                                       m_emSize;
+	FLOAT                                       m_designUnitsToPixels;
+
+	std::vector<BYTE>                           m_plane;
+	std::unordered_map<UINT16, GlyphSlot>       m_glyphs;
+	std::vector<BYTE>                           m_texture;      // Scratch buffer for DirectWrite.
+
+	UINT32                                      m_shelfTop;     // Top of the current shelf.
+	UINT32                                      m_shelfHeight;  // Height of the current shelf.
+	UINT32                                      m_shelfX;       // Next free column in the current shelf.
+};
+
+// The caption renderer keeps the last caption frame it composed. When
+// the active cues change, it lays out the new text, clears the lines of
+// the old text and draws the new lines; the rest of the frame is left
+// alone. Update reports the rectangles that changed, and whether the
+// frame changed at all, so that the caller can reuse its last frame.
+//
+// For bitmap subtitles (see SetBitmapDecoder), the pictures of each
+// display set are decoded once into a cache, and copied into the frame
+// when the display set changes.
+//
+// Frames are AYUV, with the pixels outside the text fully transparent.
+class CaptionRenderer
+{
+public:
+	CaptionRenderer(UINT32 width, UINT32 height);
+	~CaptionRenderer();
+
+	// Switches to bitmap subtitles. The renderer takes ownership of
+	// pDecoder. Picture positions are in video pixels, so the frame
+	// should be the size of the video.
+	void SetBitmapDecoder(BitmapSubtitleDecoder *pDecoder);
+
+	// Tells the bitmap decoder that the next display set does not follow
+	// the last one, after a seek. The next Update redraws the frame.
+	void ResetBitmaps();
+
+	// Composes the frame for a set of cues (as returned by
+	// SubtitleCueStore::FindActive). Returns false if the cues are the
+	// ones shown already. Otherwise, *pDirty (if not null) gets the
+	// rectangles that were redrawn.
+	bool Update(const std::vector<SubtitleCue> &cues, std::vector<RECT> *pDirty);
+
+	// Composed frame: Height() rows of Width() AYUV pixels.
+	const DWORD *Frame() const { return m_frame.data(); }
+	UINT32 Width() const { return m_width; }
+	UINT32 Height() const { return m_height; }
+
+	static const DWORD TRANSPARENT_PIXEL = 0x00108080;      // A=0, Y=16, U=V=128.
+	static const DWORD TEXT_PIXEL = 0x00eb8080;             // Y=235 (white); alpha from the glyph.
+	static const DWORD SHADOW_PIXEL = 0x00108080;           // Y=16 (black); alpha from the glyph.
+
+private:
+	CaptionRenderer(const CaptionRenderer&);
+	CaptionRenderer& operator=(const CaptionRenderer&);
+
+	struct PlacedGlyph
+	{
+		LONG        x, y;       // Top-left corner in the frame.
+		GlyphSlot   slot;
+	};
+
+	bool LayOut(const std::vector<SubtitleCue> &cues);
+	void DrawBitmaps(const std::vector<SubtitleCue> &cues);
+	static void GetCueLines(const SubtitleCue &cue, std::vector<std::wstring> *pLines);
+	void ClearRect(const RECT &rc);
+	void DrawGlyph(const PlacedGlyph &glyph, LONG dx, LONG dy, DWORD dwColor);
+
+	UINT32                          m_width;
+	UINT32                          m_height;
+	std::vector<DWORD>              m_frame;
+
+	ComPtr<IDWriteFactory>          m_spFactory;
+	ComPtr<IDWriteFontFace>         m_spFontFace;
+	GlyphAtlas                      *m_pAtlas;
+	BitmapSubtitleCache             *m_pBitmaps;    // Set for bitmap subtitles.
+	FLOAT                           m_emSize;
+	FLOAT                           m_lineHeight;
+	FLOAT                           m_ascent;
+
+	std::vector<const char*>        m_shownCues;    // Cue data pointers (stable in the store) of the shown cues.
+	std::vector<RECT>               m_shownLines;   // Rectangles of the lines (or pictures) shown.
+	std::vector<PlacedGlyph>        m_glyphs;       // Layout of the new cues.
+	std::vector<RECT>               m_lines;        // Line (or picture) rectangles of the new cues.
+	std::vector<DWORD>              m_pixels;       // Scratch buffer for a picture that overlaps another.
+};
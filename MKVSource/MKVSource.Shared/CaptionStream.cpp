@@ -7,11 +7,7 @@
 
 namespace
 {
-	const DWORD c_dwOutputImageHeight = 256;
-	const DWORD c_dwOutputImageWidth = 320;
-	const DWORD c_cbOutputSamplenNumPixels = c_dwOutputImageWidth * c_dwOutputImageHeight;
-	const DWORD c_cbOutputSampleSize = c_cbOutputSamplenNumPixels * 4;
-	const DWORD c_dwOutputFrameRateNumerator = 1;
+	const DWORD c_dwOutputFrameRateNumerator = 10;
 	const DWORD c_dwOutputFrameRateDenominator = 1;
 	const LONGLONG c_llOutputFrameDuration = 1000000ll;
 }
@@ -42,172 +38,38 @@ private:
 	ComPtr<MKVSource> m_spSource;
 };
 
-BYTE Clip(int i)
+ComPtr<CaptionStream> CaptionStream::CreateInstance(MKVSource *pSource, DWORD dwStreamId, DWORD dwTrack, UINT32 width, UINT32 height)
 {
-	return (i > 255 ? 255 : (i < 0 ? 0 : i));
-}
-
-DWORD YUVToRGB(BYTE Y, BYTE U, BYTE V)
-{
-	int C = INT(Y) - 16;
-	int D = INT(U) - 128;
-	int E = INT(V) - 128;
-
-	INT R = (298 * C + 409 * E + 128) >> 8;
-	INT G = (298 * C - 100 * D - 208 * E + 128) >> 8;
-	INT B = (298 * C + 516 * D + 128) >> 8;
-
-	DWORD ret = 0xff000000;
-	BYTE *bCols = reinterpret_cast<BYTE*>(&ret);
-
-	bCols[2] = Clip(R);
-	bCols[1] = Clip(G);
-	bCols[0] = Clip(B);
-
-	return ret;
-}
-
-ref class CFrameGenerator abstract
-{
-internal:
-	CFrameGenerator() { }
-
-	void PrepareFrame(BYTE *pBuf, LONGLONG llTimestamp, LONG lPitch)
+	if (pSource == nullptr || width == 0 || height == 0)
 	{
-		ZeroMemory(pBuf, lPitch * c_dwOutputImageHeight);
-
-		sin((llTimestamp / 100000.0)*3.1415);
-		DrawFrame(pBuf, YUVToRGB(128, 128 + BYTE(127 * sin(llTimestamp / 10000000.0)), 128 + BYTE(127 * cos(llTimestamp / 3300000.0))), lPitch);
+		throw ref new InvalidArgumentException();
 	}
 
-protected private:
-	virtual void DrawFrame(BYTE *pBuf, DWORD dwColor, LONG lPitch) = 0;
-
-	void SetColor(_In_reads_bytes_(cElements) DWORD *pBuf, DWORD dwColor, DWORD cElements)
+	ComPtr<CaptionStream> spStream;
+	spStream.Attach(new(std::nothrow) CaptionStream(pSource, dwStreamId, dwTrack, width, height));
+	if (spStream == nullptr)
 	{
-		for (DWORD nIndex = 0; nIndex < cElements; ++nIndex)
-		{
-			pBuf[nIndex] = dwColor;
-		}
+		throw ref new OutOfMemoryException();
 	}
-};
-
-ref class CSquareDrawer sealed : public CFrameGenerator
-{
-protected private:
-	void DrawFrame(BYTE *pBuf, DWORD dwColor, LONG lPitch) override
-	{
-		const DWORD dwDimension = min(c_dwOutputImageWidth, c_dwOutputImageHeight);
-		const int nFirstLine = (c_dwOutputImageHeight - dwDimension) / 2;
-		const int nStartPos = (c_dwOutputImageWidth - dwDimension) / 2;
-
-		for (int nLine = 0; nLine < dwDimension; ++nLine, pBuf += lPitch)
-		{
-			DWORD *pLine = reinterpret_cast<DWORD *>(pBuf)+nStartPos;
-			SetColor(pLine, dwColor, dwDimension);
-		}
-	}
-};
 
-ref class CCircleDrawer sealed : public CFrameGenerator
-{
-protected private:
-	void DrawFrame(BYTE *pBuf, DWORD dwColor, LONG lPitch) override
-	{
-		const int dwDimension = min(c_dwOutputImageWidth, c_dwOutputImageHeight);
-		const int dwRadius = dwDimension / 2;
-		const int nFirstLine = (c_dwOutputImageHeight - dwDimension) / 2;
-		const int nStartPos = (c_dwOutputImageWidth - dwDimension) / 2;
+	spStream->Initialize();
 
-		for (int nLine = -dwRadius; nLine < dwRadius; ++nLine, pBuf += lPitch)
-		{
-			const int nXPos = (int)sqrt(dwRadius*(double)dwRadius - nLine*(double)nLine);
-			const int nStartPos = (c_dwOutputImageWidth / 2) - nXPos;
-			const int cPixels = nXPos * 2;
-			DWORD *pLine = reinterpret_cast<DWORD *>(pBuf)+nStartPos;
-
-			SetColor(pLine, dwColor, cPixels);
-		}
-	}
-};
-
-ref class CTriangleDrawer sealed : public CFrameGenerator
-{
-protected private:
-	void DrawFrame(BYTE *pBuf, DWORD dwColor, LONG lPitch) override
-	{
-		const DWORD dwDimension = min(c_dwOutputImageWidth, c_dwOutputImageHeight);
-
-		const int nFirstLine = (c_dwOutputImageHeight - dwDimension) / 2;
-		const int nStartPos = (c_dwOutputImageWidth - dwDimension) / 2;
-
-		int nLeft = c_dwOutputImageWidth / 2;
-		int nRight = nLeft + 1;
-		const int cLinesPerPixel = 2;
-
-		for (int nLine = 0, nLinesToGrow = 1; nLine < dwDimension; ++nLine, pBuf += lPitch, --nLinesToGrow)
-		{
-			if (nLinesToGrow == 0)
-			{
-				nLinesToGrow = cLinesPerPixel;
-				--nLeft;
-				++nRight;
-			}
-
-			DWORD *pLine = reinterpret_cast<DWORD *>(pBuf)+nLeft;
-			SetColor(pLine, dwColor, nRight - nLeft);
-		}
-	}
-};
-
-//CFrameGenerator ^CreateFrameGenerator()
-//{
-//	switch (eShape)
-//	{
-//	case GeometricShape_Square:
-//	{
-//		return ref new CSquareDrawer();
-//	}
-//	case GeometricShape_Circle:
-//	{
-//		return ref new CCircleDrawer();
-//	}
-//	case GeometricShape_Triangle:
-//	{
-//		return ref new CTriangleDrawer();
-//	}
-//	default:
-//	{
-//		throw ref new InvalidArgumentException();
-//	}
-//	}
-//}
-
-//ComPtr<CaptionStream> CaptionStream::CreateInstance(CGeometricMediaSource *pSource, GeometricShape eShape)
-//{
-//	if (pSource == nullptr)
-//	{
-//		throw ref new InvalidArgumentException();
-//	}
-//
-//	ComPtr<CaptionStream> spStream;
-//	spStream.Attach(new(std::nothrow) CaptionStream(pSource, eShape));
-//	if (spStream == nullptr)
-//	{
-//		throw ref new OutOfMemoryException();
-//	}
-//
-//	spStream->Initialize();
-//
-//	return spStream;
-//}
+	return spStream;
+}
 
-CaptionStream::CaptionStream(MKVSource *pSource, IMFStreamDescriptor *pSD)
+CaptionStream::CaptionStream(MKVSource *pSource, DWORD dwStreamId, DWORD dwTrack, UINT32 width, UINT32 height)
 	: m_cRef(1)
 	, m_spSource(pSource)
 	, m_state(STATE_STOPPED)
+	, m_llCurrentTimestamp(0)
+	, m_pRenderer(nullptr)
+	, m_dwStreamId(dwStreamId)
+	, m_dwTrack(dwTrack)
+	, m_fActive(false)
+	, m_fEOS(false)
+	, m_width(width)
+	, m_height(height)
 	, m_flRate(1.0f)
-	, m_spStreamDescriptor(pSD)
 {
 	auto module = ::Microsoft::WRL::GetModuleBase();
 	if (module != nullptr)
@@ -216,7 +78,6 @@ CaptionStream::CaptionStream(MKVSource *pSource, IMFStreamDescriptor *pSD)
 	}
 
 	assert(pSource != nullptr);
-	assert(pSD != nullptr);
 }
 
 
@@ -224,6 +85,8 @@ CaptionStream::~CaptionStream(void)
 {
 	assert(m_state == STATE_SHUTDOWN);
 
+	delete m_pRenderer;
+
 	auto module = ::Microsoft::WRL::GetModuleBase();
 	if (module != nullptr)
 	{
@@ -413,6 +276,11 @@ IFACEMETHODIMP CaptionStream::RequestSample(IUnknown *pToken)
 			ThrowException(MF_E_INVALIDREQUEST);
 		}
 
+		if (m_fEOS)
+		{
+			ThrowException(MF_E_END_OF_STREAM);
+		}
+
 		// Trigger sample delivery
 		DeliverSample(pToken);
 	}
@@ -424,7 +292,13 @@ IFACEMETHODIMP CaptionStream::RequestSample(IUnknown *pToken)
 	return hr;
 }
 
-HRESULT CaptionStream::Start()
+//-------------------------------------------------------------------
+// Start
+// Starts the stream at varStart, or where it is (VT_EMPTY). Called by
+// the media source.
+//-------------------------------------------------------------------
+
+HRESULT CaptionStream::Start(const PROPVARIANT &varStart)
 {
 	HRESULT hr = S_OK;
 
@@ -432,22 +306,57 @@ HRESULT CaptionStream::Start()
 	{
 		ThrowIfError(CheckShutdown());
 
-		if (m_state == STATE_STOPPED ||
-			m_state == STATE_STARTED)
+		if (m_state == STATE_STOPPED)
 		{
-			if (m_state == STATE_STOPPED)
+			m_llCurrentTimestamp = 0;
+		}
+		if (varStart.vt == VT_I8)
+		{
+			m_llCurrentTimestamp = varStart.hVal.QuadPart;
+
+			// A PGS display set can use the objects of the sets before it;
+			// after a seek, those are not the ones the decoder has.
+			if (m_pRenderer != nullptr)
 			{
-				m_llCurrentTimestamp = 0;
+				m_pRenderer->ResetBitmaps();
 			}
-			m_state = STATE_STARTED;
+		}
+		m_state = STATE_STARTED;
+		m_fEOS = false;
 
-			// Inform the client that we've started
-			ThrowIfError(QueueEvent(MEStreamStarted, GUID_NULL, S_OK, nullptr));
+		// Inform the client that we've started, as MKVStream does.
+		if (varStart.vt == VT_I8 && varStart.hVal.QuadPart != 0)
+		{
+			ThrowIfError(QueueEvent(MEStreamSeeked, GUID_NULL, S_OK, &varStart));
 		}
 		else
+		{
+			ThrowIfError(QueueEvent(MEStreamStarted, GUID_NULL, S_OK, &varStart));
+		}
+	}
+	catch (Exception ^exc)
+	{
+		hr = HandleError(exc->HResult);
+	}
+
+	return hr;
+}
+
+HRESULT CaptionStream::Pause()
+{
+	HRESULT hr = S_OK;
+
+	try
+	{
+		ThrowIfError(CheckShutdown());
+
+		if (m_state != STATE_STARTED)
 		{
 			ThrowException(MF_E_INVALID_STATE_TRANSITION);
 		}
+
+		m_state = STATE_PAUSED;
+		ThrowIfError(QueueEvent(MEStreamPaused, GUID_NULL, S_OK, nullptr));
 	}
 	catch (Exception ^exc)
 	{
@@ -465,7 +374,7 @@ HRESULT CaptionStream::Stop()
 	{
 		ThrowIfError(CheckShutdown());
 
-		if (m_state == STATE_STARTED)
+		if (m_state == STATE_STARTED || m_state == STATE_PAUSED)
 		{
 			m_state = STATE_STOPPED;
 			// Inform the client that we've stopped.
@@ -502,6 +411,35 @@ HRESULT CaptionStream::SetRate(float flRate)
 	return hr;
 }
 
+//-------------------------------------------------------------------
+// EndOfStream
+// Called by the source when it reaches the end of the file. The frames
+// are generated, so there is nothing left to deliver: the stream ends
+// at once.
+//-------------------------------------------------------------------
+
+HRESULT CaptionStream::EndOfStream()
+{
+	HRESULT hr = S_OK;
+
+	try
+	{
+		ThrowIfError(CheckShutdown());
+
+		if (!m_fEOS)
+		{
+			m_fEOS = true;
+			ThrowIfError(QueueEvent(MEEndOfStream, GUID_NULL, S_OK, nullptr));
+		}
+	}
+	catch (Exception ^exc)
+	{
+		hr = HandleError(exc->HResult);
+	}
+
+	return hr;
+}
+
 void CaptionStream::Shutdown()
 {
 	try
@@ -521,9 +459,9 @@ void CaptionStream::Shutdown()
 
 		m_spStreamDescriptor.Reset();
 		m_spDeviceManager.Reset();
+		m_spPicture.Reset();
+		m_spPictureSample.Reset();
 		m_state = STATE_SHUTDOWN;
-
-		m_frameGenerator = nullptr;
 	}
 	catch (Exception ^exc)
 	{
@@ -553,7 +491,7 @@ void CaptionStream::Initialize()
 	m_spMediaType = CreateMediaType();
 
 	// Now we can create MF stream descriptor.
-	ThrowIfError(MFCreateStreamDescriptor(c_dwGeometricStreamId, 1, m_spMediaType.GetAddressOf(), &spSD));
+	ThrowIfError(MFCreateStreamDescriptor(m_dwStreamId, 1, m_spMediaType.GetAddressOf(), &spSD));
 	ThrowIfError(spSD->GetMediaTypeHandler(&spMediaTypeHandler));
 	// Set current media type
 	ThrowIfError(spMediaTypeHandler->SetCurrentMediaType(m_spMediaType.Get()));
@@ -561,7 +499,15 @@ void CaptionStream::Initialize()
 	// State of the stream is started.
 	m_state = STATE_STOPPED;
 
-	//m_frameGenerator = CreateFrameGenerator(_eShape);
+	m_pRenderer = new CaptionRenderer(m_width, m_height);
+
+	const BYTE *pCodecPrivate = nullptr;
+	DWORD cbCodecPrivate = 0;
+	SubtitleFormat format = m_spSource->GetSubtitleTrackFormat(m_dwTrack, &pCodecPrivate, &cbCodecPrivate);
+	if (IsBitmapSubtitleFormat(format))
+	{
+		m_pRenderer->SetBitmapDecoder(BitmapSubtitleDecoder::Create(format, pCodecPrivate, cbCodecPrivate));
+	}
 }
 
 ComPtr<IMFMediaType> CaptionStream::CreateMediaType()
@@ -570,11 +516,11 @@ ComPtr<IMFMediaType> CaptionStream::CreateMediaType()
 	ThrowIfError(MFCreateMediaType(&spOutputType));
 
 	ThrowIfError(spOutputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-	ThrowIfError(spOutputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_ARGB32));
+	ThrowIfError(spOutputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_AYUV));
 	ThrowIfError(spOutputType->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
 	ThrowIfError(spOutputType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
-	ThrowIfError(spOutputType->SetUINT32(MF_MT_SAMPLE_SIZE, c_cbOutputSampleSize));
-	ThrowIfError(MFSetAttributeSize(spOutputType.Get(), MF_MT_FRAME_SIZE, c_dwOutputImageWidth, c_dwOutputImageHeight));
+	ThrowIfError(spOutputType->SetUINT32(MF_MT_SAMPLE_SIZE, m_width * m_height * 4));
+	ThrowIfError(MFSetAttributeSize(spOutputType.Get(), MF_MT_FRAME_SIZE, m_width, m_height));
 	ThrowIfError(MFSetAttributeRatio(spOutputType.Get(), MF_MT_FRAME_RATE, c_dwOutputFrameRateNumerator, c_dwOutputFrameRateDenominator));
 	ThrowIfError(spOutputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
 	ThrowIfError(MFSetAttributeRatio(spOutputType.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
@@ -595,17 +541,39 @@ void CaptionStream::DeliverSample(IUnknown *pToken)
 	ThrowIfError(m_spEventQueue->QueueEventParamUnk(MEMediaSample, GUID_NULL, S_OK, spSample.Get()));
 }
 
+//-------------------------------------------------------------------
+// CreateImage
+// Returns the caption frame for the current time.
+//
+// The renderer only redraws when the cues that show change. Until
+// then, each sample wraps the buffer of the last frame, so a steady
+// caption costs no drawing and no copying.
+//-------------------------------------------------------------------
+
 ComPtr<IMFSample> CaptionStream::CreateImage()
 {
 	ComPtr<IMFMediaBuffer> spOutputBuffer;
 	ComPtr<IMFSample> spSample;
-	const LONG pitch = c_dwOutputImageWidth * sizeof(DWORD);
+	std::vector<SubtitleCue> cues;
+	const LONG pitch = m_width * sizeof(DWORD);
+	const DWORD cbFrame = pitch * m_height;
 
-	if (m_frameGenerator == nullptr)
+	if (m_pRenderer == nullptr)
 	{
 		ThrowException(E_UNEXPECTED);
 	}
 
+	m_spSource->GetSubtitleCues(m_dwTrack, m_llCurrentTimestamp, &cues);
+
+	if (!m_pRenderer->Update(cues, nullptr) && m_spPicture != nullptr)
+	{
+		ThrowIfError(MFCreateSample(&spSample));
+		ThrowIfError(spSample->AddBuffer(m_spPicture.Get()));
+		return spSample;
+	}
+
+	// Downstream might still hold the last buffer, so a new frame goes
+	// into a new buffer.
 	if (m_spDeviceManager != nullptr)
 	{
 		ThrowIfError(m_spAllocEx->AllocateSample(&spSample));
@@ -613,16 +581,26 @@ ComPtr<IMFSample> CaptionStream::CreateImage()
 	}
 	else
 	{
-		ThrowIfError(MFCreateMemoryBuffer(c_cbOutputSampleSize, &spOutputBuffer));
+		ThrowIfError(MFCreateMemoryBuffer(cbFrame, &spOutputBuffer));
 		ThrowIfError(MFCreateSample(&spSample));
 		ThrowIfError(spSample->AddBuffer(spOutputBuffer.Get()));
 	}
 
-	VideoBufferLock lock(spOutputBuffer.Get(), MF2DBuffer_LockFlags_Write, c_dwOutputImageHeight, pitch);
+	{
+		VideoBufferLock lock(spOutputBuffer.Get(), MF2DBuffer_LockFlags_Write, m_height, pitch);
+
+		const BYTE *pSrc = reinterpret_cast<const BYTE*>(m_pRenderer->Frame());
+		BYTE *pDest = lock.GetTopRow();
+		for (UINT32 y = 0; y < m_height; y++, pSrc += pitch, pDest += lock.GetStride())
+		{
+			CopyMemory(pDest, pSrc, pitch);
+		}
+	}
 
-	m_frameGenerator->PrepareFrame(lock.GetData(), m_llCurrentTimestamp, lock.GetStride());
+	ThrowIfError(spOutputBuffer->SetCurrentLength(cbFrame));
 
-	ThrowIfError(spOutputBuffer->SetCurrentLength(c_cbOutputSampleSize));
+	m_spPicture = spOutputBuffer;
+	m_spPictureSample = spSample;
 
 	return spSample;
 }
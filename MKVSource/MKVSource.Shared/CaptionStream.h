@@ -7,16 +7,18 @@
 
 #pragma once
 #include "MKVSource.h"
+#include "CaptionRenderer.h"
 
-const DWORD c_dwGeometricStreamId = 1;
-
-ref class CFrameGenerator;
+const DWORD CAPTION_STREAM_ID_BASE = 0x100;    // Stream ID of a caption stream: this plus the track number.
 
+// Caption stream: draws the subtitle cues of a track (text or bitmap)
+// into AYUV video frames, for renderers that cannot show subtitle samples.
+// The source offers one, deselected, for each subtitle track.
 class CaptionStream WrlSealed
 	: public IMFMediaStream
 {
 public:
-	//static ComPtr<CaptionStream> CreateInstance(MKVSource *pSource, GeometricShape eShape);
+	static ComPtr<CaptionStream> CreateInstance(MKVSource *pSource, DWORD dwStreamId, DWORD dwTrack, UINT32 width, UINT32 height);
 
 	// IUnknown
 	IFACEMETHOD(QueryInterface) (REFIID iid, void **ppv);
@@ -35,15 +37,19 @@ public:
 	IFACEMETHOD(RequestSample) (IUnknown *pToken);
 
 	// Other public methods
-	HRESULT Start();
+	void Activate(bool fActive) { m_fActive = fActive; }
+	bool IsActive() const { return m_fActive; }
+	HRESULT Start(const PROPVARIANT &varStart);
+	HRESULT Pause();
 	HRESULT Stop();
 	HRESULT SetRate(float flRate);
+	HRESULT EndOfStream();
 	void Shutdown();
 	void SetDXGIDeviceManager(IMFDXGIDeviceManager *pManager);
 
 protected:
 	CaptionStream();
-	CaptionStream(MKVSource *pSource, IMFStreamDescriptor *pSD);
+	CaptionStream(MKVSource *pSource, DWORD dwStreamId, DWORD dwTrack, UINT32 width, UINT32 height);
 	~CaptionStream(void);
 
 private:
@@ -68,13 +74,20 @@ private:
 	ComPtr<MKVSource>			m_spSource;
 	ComPtr<IMFMediaEventQueue>  m_spEventQueue;              // Event queue
 	ComPtr<IMFStreamDescriptor> m_spStreamDescriptor;        // Stream descriptor
-	ComPtr<IMFMediaBuffer>      m_spPicture;
+	ComPtr<IMFMediaBuffer>      m_spPicture;                 // Last frame sent.
+	ComPtr<IMFSample>           m_spPictureSample;           // Its sample, which keeps it out of the allocator's pool.
 	LONGLONG                    m_llCurrentTimestamp;
 	ComPtr<IMFDXGIDeviceManager> m_spDeviceManager;
 	//GeometricShape              _eShape;
 	ComPtr<IMFMediaType>        m_spMediaType;
 	ComPtr<IMFVideoSampleAllocatorEx> m_spAllocEx;
-	CFrameGenerator^            m_frameGenerator;
+	CaptionRenderer             *m_pRenderer;
+	DWORD                       m_dwStreamId;
+	DWORD                       m_dwTrack;                   // Subtitle track to draw.
+	bool                        m_fActive;                   // Selected in the presentation descriptor.
+	bool                        m_fEOS;                      // The source reached the end of the file.
+	UINT32                      m_width;
+	UINT32                      m_height;
 	float                       m_flRate;
 };
 
@@ -0,0 +1,311 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Chapters.cpp
+// Time-indexed chapter list, per edition.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "Demux.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Orders chapters by start time, for std::upper_bound.
+	bool StartsAfter(LONGLONG hnsTime, const Chapter &chapter)
+	{
+		return hnsTime < chapter.hnsStart;
+	}
+
+	// Sorts by start time; a chapter comes before the chapters in it.
+	bool IsBefore(const Chapter &a, const Chapter &b)
+	{
+		return (a.hnsStart != b.hnsStart) ? (a.hnsStart < b.hnsStart) : (a.depth < b.depth);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ChapterIndex class
+//-------------------------------------------------------------------
+
+ChapterIndex::ChapterIndex() :
+	m_iDefault(0)
+{
+}
+
+
+//-------------------------------------------------------------------
+// AddEdition
+// Adds an edition, and sorts its chapters.
+//-------------------------------------------------------------------
+
+void ChapterIndex::AddEdition(const ChapterEdition &edition)
+{
+	AutoLock lock(m_critSec);
+
+	// A file read again after a seek back has the same editions.
+	for (size_t i = 0; i < m_editions.size(); i++)
+	{
+		if (m_editions[i].uid == edition.uid)
+		{
+			return;
+		}
+	}
+
+	m_editions.push_back(edition);
+
+	std::vector<Chapter> &chapters = m_editions.back().chapters;
+	std::stable_sort(chapters.begin(), chapters.end(), IsBefore);
+
+	// The first edition flagged as default is the default, else the first.
+	if (edition.fDefault && !m_editions[m_iDefault].fDefault)
+	{
+		m_iDefault = (DWORD)(m_editions.size() - 1);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GetEditionCount
+// Returns the number of editions.
+//-------------------------------------------------------------------
+
+DWORD ChapterIndex::GetEditionCount()
+{
+	AutoLock lock(m_critSec);
+
+	return (DWORD)m_editions.size();
+}
+
+
+//-------------------------------------------------------------------
+// GetDefaultEdition
+// Returns the index of the edition to play by default.
+//-------------------------------------------------------------------
+
+DWORD ChapterIndex::GetDefaultEdition()
+{
+	AutoLock lock(m_critSec);
+
+	return m_iDefault;
+}
+
+
+//-------------------------------------------------------------------
+// FindAt
+// Returns the chapter that plays at hnsTime: of the chapters that
+// started by then and have not ended, the one that started last.
+//-------------------------------------------------------------------
+
+bool ChapterIndex::FindAt(DWORD edition, LONGLONG hnsTime, Chapter *pChapter)
+{
+	assert(pChapter != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	const std::vector<Chapter> *pChapters = GetEdition(edition);
+	if (pChapters == nullptr)
+	{
+		return false;
+	}
+
+	size_t i = FindCurrent(*pChapters, hnsTime);
+	if (i == 0)
+	{
+		return false;
+	}
+
+	*pChapter = (*pChapters)[i - 1];
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// FindNext
+// Returns the first chapter that starts after hnsTime.
+//-------------------------------------------------------------------
+
+bool ChapterIndex::FindNext(DWORD edition, LONGLONG hnsTime, Chapter *pChapter)
+{
+	assert(pChapter != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	const std::vector<Chapter> *pChapters = GetEdition(edition);
+	if (pChapters == nullptr)
+	{
+		return false;
+	}
+
+	size_t i = CountStartedBy(*pChapters, hnsTime);
+	if (i == pChapters->size())
+	{
+		return false;
+	}
+
+	*pChapter = (*pChapters)[i];
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// FindPrevious
+// Returns the chapter before the one that plays at hnsTime.
+//-------------------------------------------------------------------
+
+bool ChapterIndex::FindPrevious(DWORD edition, LONGLONG hnsTime, Chapter *pChapter)
+{
+	assert(pChapter != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	const std::vector<Chapter> *pChapters = GetEdition(edition);
+	if (pChapters == nullptr)
+	{
+		return false;
+	}
+
+	// Skip the current chapter (or, in a gap, the last one before it),
+	// and any others that start at the same time.
+	size_t i = FindCurrent(*pChapters, hnsTime);
+	if (i == 0)
+	{
+		i = CountStartedBy(*pChapters, hnsTime);
+		if (i == 0)
+		{
+			return false;
+		}
+	}
+
+	LONGLONG hnsCurrent = (*pChapters)[i - 1].hnsStart;
+	while (i > 0 && (*pChapters)[i - 1].hnsStart == hnsCurrent)
+	{
+		--i;
+	}
+	if (i == 0)
+	{
+		return false;
+	}
+
+	*pChapter = (*pChapters)[i - 1];
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// FindByUid
+// Returns the chapter with a ChapterUID. The editions are searched in
+// order, so a chapter that is in several is taken from the first.
+//-------------------------------------------------------------------
+
+bool ChapterIndex::FindByUid(UINT64 uid, Chapter *pChapter)
+{
+	assert(pChapter != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	for (size_t i = 0; i < m_editions.size(); i++)
+	{
+		const std::vector<Chapter> &chapters = m_editions[i].chapters;
+		for (size_t j = 0; j < chapters.size(); j++)
+		{
+			if (chapters[j].uid == uid)
+			{
+				*pChapter = chapters[j];
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+// GetChapters
+// Returns the chapters of an edition, sorted by start time.
+//-------------------------------------------------------------------
+
+void ChapterIndex::GetChapters(DWORD edition, std::vector<Chapter> *pChapters)
+{
+	assert(pChapters != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	pChapters->clear();
+
+	const std::vector<Chapter> *pEdition = GetEdition(edition);
+	if (pEdition != nullptr)
+	{
+		*pChapters = *pEdition;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Clear
+// Removes every edition.
+//-------------------------------------------------------------------
+
+void ChapterIndex::Clear()
+{
+	AutoLock lock(m_critSec);
+
+	m_editions.clear();
+	m_iDefault = 0;
+}
+
+
+//-------------------------------------------------------------------
+// GetEdition
+// Returns the chapters of an edition, or nullptr. Call with the lock.
+//-------------------------------------------------------------------
+
+const std::vector<Chapter> *ChapterIndex::GetEdition(DWORD edition) const
+{
+	return (edition < m_editions.size()) ? &m_editions[edition].chapters : nullptr;
+}
+
+
+//-------------------------------------------------------------------
+// FindCurrent
+// Returns 1 + the index of the chapter that plays at hnsTime, or 0.
+//-------------------------------------------------------------------
+
+size_t ChapterIndex::FindCurrent(const std::vector<Chapter> &chapters, LONGLONG hnsTime)
+{
+	// Usually the last chapter to start is still playing. If it has an
+	// end time and ended (a gap, or a nested chapter that ended before
+	// its parent), look further back: chapters nest, so this is short.
+	for (size_t i = CountStartedBy(chapters, hnsTime); i > 0; i--)
+	{
+		const Chapter &chapter = chapters[i - 1];
+		if (chapter.hnsEnd == CHAPTER_OPEN_END || chapter.hnsEnd > hnsTime)
+		{
+			return i;
+		}
+		if (chapter.depth == 0)
+		{
+			break;
+		}
+	}
+	return 0;
+}
+
+
+//-------------------------------------------------------------------
+// CountStartedBy
+// Returns the number of chapters that start at or before hnsTime.
+//-------------------------------------------------------------------
+
+size_t ChapterIndex::CountStartedBy(const std::vector<Chapter> &chapters, LONGLONG hnsTime)
+{
+	return std::upper_bound(chapters.begin(), chapters.end(), hnsTime, StartsAfter) - chapters.begin();
+}
@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Chapters.h
+// Time-indexed chapter list, per edition.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+const LONGLONG CHAPTER_OPEN_END = MAXLONGLONG;  // End time of a chapter that runs to the end.
+
+// One chapter (ChapterAtom).
+struct Chapter
+{
+	UINT64      uid;
+	LONGLONG    hnsStart;       // In 100-ns units.
+	LONGLONG    hnsEnd;         // ChapterTimeEnd, or CHAPTER_OPEN_END.
+	DWORD       depth;          // 0 for a top-level chapter, 1 for a chapter in it, and so on.
+	std::string title;          // The first ChapString (UTF-8), or empty.
+};
+
+// One edition (EditionEntry).
+struct ChapterEdition
+{
+	UINT64                  uid;
+	bool                    fDefault;
+	bool                    fOrdered;
+	std::vector<Chapter>    chapters;
+};
+
+// Matroska chapters are a tree: editions, holding chapters, which can
+// hold more chapters. The index flattens each edition into one list
+// sorted by start time, so that the queries are binary searches. Nested
+// chapters keep their depth; at a given time the innermost chapter
+// (the one that started last) is the current one. Hidden and disabled
+// chapters, and hidden editions, are not indexed.
+//
+// The index has its own lock: the demux thread adds editions, and the
+// application queries them.
+class ChapterIndex
+{
+public:
+	ChapterIndex();
+
+	// Adds an edition. The chapters do not have to be sorted.
+	void AddEdition(const ChapterEdition &edition);
+
+	// Returns the number of editions, and the one to play by default.
+	DWORD GetEditionCount();
+	DWORD GetDefaultEdition();
+
+	// Returns the chapter that plays at hnsTime.
+	bool FindAt(DWORD edition, LONGLONG hnsTime, Chapter *pChapter);
+
+	// Returns the first chapter that starts after hnsTime.
+	bool FindNext(DWORD edition, LONGLONG hnsTime, Chapter *pChapter);
+
+	// Returns the chapter before the one that plays at hnsTime.
+	bool FindPrevious(DWORD edition, LONGLONG hnsTime, Chapter *pChapter);
+
+	// Returns the chapter with a ChapterUID, in any edition.
+	bool FindByUid(UINT64 uid, Chapter *pChapter);
+
+	// Returns all the chapters of an edition, by start time.
+	void GetChapters(DWORD edition, std::vector<Chapter> *pChapters);
+
+	void Clear();
+
+private:
+	ChapterIndex(const ChapterIndex&);
+	ChapterIndex& operator=(const ChapterIndex&);
+
+	const std::vector<Chapter> *GetEdition(DWORD edition) const;
+	static size_t FindCurrent(const std::vector<Chapter> &chapters, LONGLONG hnsTime);
+	static size_t CountStartedBy(const std::vector<Chapter> &chapters, LONGLONG hnsTime);
+
+	CritSec                         m_critSec;
+	std::vector<ChapterEdition>     m_editions;
+	DWORD                           m_iDefault;
+};
@@ -0,0 +1,310 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CrcVerifier.cpp
+// Checks the CRC-32 elements of Matroska masters.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "Demux.h"
+
+namespace
+{
+	const DWORD CRC32_ELEMENT_SIZE = 6;     // ID, size (0x84) and 4 bytes.
+
+	// Slicing-by-8 tables: s_tables.t[k][b] is the CRC of byte b followed
+	// by k zero bytes, so that eight bytes take one step. This is the
+	// same method libebml's EbmlCrc32 uses on CPUs without PCLMULQDQ.
+	struct Crc32Tables
+	{
+		UINT32 t[8][256];
+
+		Crc32Tables()
+		{
+			for (UINT32 b = 0; b < 256; b++)
+			{
+				UINT32 crc = b;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+				}
+				t[0][b] = crc;
+			}
+			for (UINT32 b = 0; b < 256; b++)
+			{
+				for (int k = 1; k < 8; k++)
+				{
+					t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+				}
+			}
+		}
+	};
+
+	const Crc32Tables s_tables;
+}
+
+
+//-------------------------------------------------------------------
+// ComputeCrc32
+// Returns the CRC-32 of a buffer.
+//-------------------------------------------------------------------
+
+UINT32 ComputeCrc32(const BYTE *pData, DWORD cbData)
+{
+	const UINT32 (*t)[256] = s_tables.t;
+	UINT32 crc = 0xFFFFFFFF;
+
+	while (cbData >= 8)
+	{
+		// Little-endian loads: x86, x64 and ARM all are.
+		UINT32 one, two;
+		memcpy(&one, pData, 4);
+		memcpy(&two, pData + 4, 4);
+		one ^= crc;
+		crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+			t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+		pData += 8;
+		cbData -= 8;
+	}
+
+	while (cbData-- > 0)
+	{
+		crc = t[0][(crc ^ *pData++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+
+//-------------------------------------------------------------------
+// CrcVerifier class
+//-------------------------------------------------------------------
+
+CrcVerifier::CrcVerifier() :
+	m_cRef(1),
+	m_mode(CRC_VERIFY_OFF),
+	m_cbPending(0),
+	m_fShutdown(false),
+	m_OnVerify(this, &CrcVerifier::OnVerify)
+{
+	m_OnVerify.SetQueue(MFASYNC_CALLBACK_QUEUE_MULTITHREADED);
+}
+
+CrcVerifier::~CrcVerifier()
+{
+	Shutdown();
+}
+
+
+//-------------------------------------------------------------------
+// SetMode
+// Turns checking on or off.
+//-------------------------------------------------------------------
+
+void CrcVerifier::SetMode(CrcVerifyMode mode)
+{
+	m_mode = mode;
+}
+
+
+//-------------------------------------------------------------------
+// Verify
+// Checks a master that starts with a CRC-32 element, or queues it.
+//
+// In the background mode the data is copied, since the read buffer
+// moves on. Past MAX_CRC_PENDING_BYTES the check is done inline, so
+// that a slow thread pool cannot make the copies pile up.
+//-------------------------------------------------------------------
+
+void CrcVerifier::Verify(DWORD id, QWORD qwPosition, const BYTE *pData, DWORD cbData)
+{
+	if (m_mode == CRC_VERIFY_OFF || cbData < CRC32_ELEMENT_SIZE || pData[0] != MKV_ID_CRC32 || pData[1] != 0x84)
+	{
+		return;
+	}
+
+	// The CRC is stored little-endian.
+	UINT32 crc = pData[2] | (pData[3] << 8) | (pData[4] << 16) | ((UINT32)pData[5] << 24);
+	pData += CRC32_ELEMENT_SIZE;
+	cbData -= CRC32_ELEMENT_SIZE;
+
+	if (m_mode == CRC_VERIFY_BACKGROUND)
+	{
+		AutoLock lock(m_critSec);
+
+		if (!m_fShutdown && m_cbPending + cbData <= MAX_CRC_PENDING_BYTES)
+		{
+			Job *pJob = new (std::nothrow) Job();
+			if (pJob != nullptr)
+			{
+				pJob->id = id;
+				pJob->qwPosition = qwPosition;
+				pJob->crc = crc;
+				pJob->data.assign(pData, pData + cbData);
+
+				if (SUCCEEDED(m_jobs.InsertBack(pJob)))
+				{
+					if (SUCCEEDED(MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, 0, &m_OnVerify, nullptr)))
+					{
+						m_cbPending += cbData;
+						FindCounters(id)->pending++;
+						return;
+					}
+					m_jobs.RemoveBack(&pJob);
+				}
+				delete pJob;
+			}
+		}
+	}
+
+	Report(id, qwPosition, ComputeCrc32(pData, cbData) == crc);
+}
+
+
+//-------------------------------------------------------------------
+// Skip
+// Counts a master whose CRC-32 was not checked.
+//-------------------------------------------------------------------
+
+void CrcVerifier::Skip(DWORD id)
+{
+	if (m_mode == CRC_VERIFY_OFF)
+	{
+		return;
+	}
+
+	AutoLock lock(m_critSec);
+
+	FindCounters(id)->skipped++;
+}
+
+
+//-------------------------------------------------------------------
+// GetCounters
+// Returns the counters for each element ID.
+//-------------------------------------------------------------------
+
+void CrcVerifier::GetCounters(std::vector<CrcCounters> *pCounters)
+{
+	assert(pCounters != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	*pCounters = m_counters;
+}
+
+
+//-------------------------------------------------------------------
+// GetFailures
+// Returns the elements that failed the check.
+//-------------------------------------------------------------------
+
+void CrcVerifier::GetFailures(std::vector<CrcFailure> *pFailures)
+{
+	assert(pFailures != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	*pFailures = m_failures;
+}
+
+
+//-------------------------------------------------------------------
+// Shutdown
+// Drops the queued checks. Their work items find nothing to do.
+//-------------------------------------------------------------------
+
+void CrcVerifier::Shutdown()
+{
+	AutoLock lock(m_critSec);
+
+	m_fShutdown = true;
+
+	Job *pJob = nullptr;
+	while (SUCCEEDED(m_jobs.RemoveFront(&pJob)))
+	{
+		FindCounters(pJob->id)->pending--;
+		delete pJob;
+	}
+	m_cbPending = 0;
+}
+
+
+//-------------------------------------------------------------------
+// OnVerify
+// Work item: checks the oldest queued master.
+//-------------------------------------------------------------------
+
+HRESULT CrcVerifier::OnVerify(IMFAsyncResult *pResult)
+{
+	Job *pJob = nullptr;
+	{
+		AutoLock lock(m_critSec);
+
+		if (FAILED(m_jobs.RemoveFront(&pJob)))
+		{
+			return S_OK;
+		}
+		m_cbPending -= (DWORD)pJob->data.size();
+		FindCounters(pJob->id)->pending--;
+	}
+
+	// Outside the lock: this is the slow part.
+	bool fPassed = ComputeCrc32(pJob->data.data(), (DWORD)pJob->data.size()) == pJob->crc;
+	Report(pJob->id, pJob->qwPosition, fPassed);
+
+	delete pJob;
+	return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Report
+// Counts the result of a check.
+//-------------------------------------------------------------------
+
+void CrcVerifier::Report(DWORD id, QWORD qwPosition, bool fPassed)
+{
+	AutoLock lock(m_critSec);
+
+	CrcCounters *pCounters = FindCounters(id);
+	if (fPassed)
+	{
+		pCounters->passed++;
+		return;
+	}
+
+	pCounters->failed++;
+	if (m_failures.size() < MAX_CRC_FAILURES)
+	{
+		CrcFailure failure = { id, qwPosition };
+		m_failures.push_back(failure);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// FindCounters
+// Returns the counters for an element ID, adding them if needed. Call
+// with the lock held.
+//-------------------------------------------------------------------
+
+CrcCounters *CrcVerifier::FindCounters(DWORD id)
+{
+	for (size_t i = 0; i < m_counters.size(); i++)
+	{
+		if (m_counters[i].id == id)
+		{
+			return &m_counters[i];
+		}
+	}
+
+	CrcCounters counters = { id, 0, 0, 0, 0 };
+	m_counters.push_back(counters);
+	return &m_counters.back();
+}
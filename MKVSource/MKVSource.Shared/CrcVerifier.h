@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// CrcVerifier.h
+// Checks the CRC-32 elements of Matroska masters.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+const DWORD MKV_ID_CRC32 = 0xBF;
+const DWORD MAX_CRC_FAILURES = 64;                      // Failures kept for GetFailures.
+const DWORD MAX_CRC_PENDING_BYTES = 32 * 1024 * 1024;   // Data queued for the background check.
+
+enum CrcVerifyMode
+{
+	CRC_VERIFY_OFF,         // CRC-32 elements are skipped (the default).
+	CRC_VERIFY_INLINE,      // Checked by the parser, as it reads the element.
+	CRC_VERIFY_BACKGROUND   // Copied and checked on a work queue thread.
+};
+
+// Results for one element ID (Cluster, Cues, Tracks...).
+struct CrcCounters
+{
+	DWORD       id;             // EBML ID of the master, with its length marker.
+	DWORD       passed;
+	DWORD       failed;
+	DWORD       skipped;        // Had a CRC-32, but was not all in the read buffer.
+	DWORD       pending;        // Queued for the background check.
+};
+
+struct CrcFailure
+{
+	DWORD       id;
+	QWORD       qwPosition;     // File offset of the element.
+};
+
+// Returns the CRC-32 (IEEE 802.3, as EBML uses it) of a buffer.
+UINT32 ComputeCrc32(const BYTE *pData, DWORD cbData);
+
+// Matroska writers can put a CRC-32 element first in a master; it covers
+// the rest of the master's data. The parser hands those masters to the
+// verifier, which checks them inline or on a background thread, and
+// keeps counters per element ID that the application can query.
+class CrcVerifier
+{
+public:
+	CrcVerifier();
+
+	ULONG AddRef()
+	{
+		return InterlockedIncrement(&m_cRef);
+	}
+
+	ULONG Release()
+	{
+		LONG cRef = InterlockedDecrement(&m_cRef);
+		if (cRef == 0)
+		{
+			delete this;
+		}
+		return cRef;
+	}
+
+	void SetMode(CrcVerifyMode mode);
+	CrcVerifyMode GetMode() const { return m_mode; }
+
+	// Checks the data of a master (pData, cbData: everything after its
+	// header). Does nothing if the master does not start with a CRC-32.
+	void Verify(DWORD id, QWORD qwPosition, const BYTE *pData, DWORD cbData);
+
+	// Counts a master with a CRC-32 that could not be checked.
+	void Skip(DWORD id);
+
+	// Returns the counters, one entry per element ID seen.
+	void GetCounters(std::vector<CrcCounters> *pCounters);
+
+	// Returns the first MAX_CRC_FAILURES failures.
+	void GetFailures(std::vector<CrcFailure> *pFailures);
+
+	// Drops the checks still queued.
+	void Shutdown();
+
+private:
+	struct Job
+	{
+		DWORD               id;
+		QWORD               qwPosition;
+		UINT32              crc;
+		std::vector<BYTE>   data;
+	};
+
+	~CrcVerifier();
+
+	CrcVerifier(const CrcVerifier&);
+	CrcVerifier& operator=(const CrcVerifier&);
+
+	HRESULT OnVerify(IMFAsyncResult *pResult);
+	void Report(DWORD id, QWORD qwPosition, bool fPassed);
+	CrcCounters *FindCounters(DWORD id);
+
+	long                        m_cRef;
+	volatile CrcVerifyMode      m_mode;
+	CritSec                     m_critSec;      // Protects the members below.
+	std::vector<CrcCounters>    m_counters;
+	std::vector<CrcFailure>     m_failures;
+	List<Job*>                  m_jobs;         // Waiting for OnVerify, oldest first.
+	DWORD                       m_cbPending;
+	bool                        m_fShutdown;
+
+	AsyncCallback<CrcVerifier>  m_OnVerify;
+};
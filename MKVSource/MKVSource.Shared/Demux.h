@@ -0,0 +1,27 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Demux.h
+// The demuxer: the parser and the stores it fills (subtitle cues,
+// chapters, tags, CRC-32 checks). It does not depend on the rest of the
+// media source, and make/linux builds it with g++ for the tests and
+// benchmarks.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Common sample files.
+#include "LinkList.h"
+#include "AsyncCB.h"
+#include "CritSec.h"
+
+#include "SubtitleCues.h"   // Text subtitle cue store
+#include "Chapters.h"       // Chapter index
+#include "Tags.h"           // Tags reader
+#include "CrcVerifier.h"    // CRC-32 checks
+#include "Parse.h"          // MPEG-1 parser
@@ -0,0 +1,566 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// DemuxPipeline.cpp
+// The demuxer as a coroutine over asynchronous reads.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include "DemuxPipeline.h"
+
+//-------------------------------------------------------------------
+// Chunk
+//-------------------------------------------------------------------
+
+DemuxPipeline::Chunk::Chunk(DemuxPipeline *pPipeline, QWORD qwPosition, DWORD cb, DWORD cGeneration)
+	: m_pPipeline(pPipeline), m_data(cb), m_qwPosition(qwPosition), m_cGeneration(cGeneration),
+	  m_fDone(false), m_fPending(true), m_hr(S_OK), m_cbRead(0), m_cRef(1)
+{
+	m_pPipeline->AddRef();
+}
+
+ULONG DemuxPipeline::Chunk::AddRef()
+{
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG DemuxPipeline::Chunk::Release()
+{
+	LONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0)
+	{
+		DemuxPipeline *pPipeline = m_pPipeline;
+		delete this;
+		pPipeline->Release();
+	}
+	return cRef;
+}
+
+void DemuxPipeline::Chunk::OnReadComplete(HRESULT hr, DWORD cbRead)
+{
+	m_pPipeline->OnReadComplete(this, hr, cbRead);
+
+	// The reference of the pending read.
+	Release();
+}
+
+
+//-------------------------------------------------------------------
+// DemuxPipeline
+//-------------------------------------------------------------------
+
+DemuxPipeline::DemuxPipeline(AsyncByteSource *pSource, DemuxSink *pSink, DWORD cbRead, DWORD cReadsAhead)
+	: m_cRef(1), m_pSource(pSource), m_pSink(pSink), m_cbRead(cbRead), m_cReadsAhead(max(cReadsAhead, 1u)),
+	  m_qwReadPosition(0), m_cReadGeneration(0), m_cReadsInFlight(0), m_fSeekPending(false), m_hnsSeekTime(0),
+	  m_fShutdown(false), m_stats(), m_buffer(cbRead), m_qwPosition(0), m_fSeekAfterHeaders(false), m_hnsSeekTarget(0)
+{
+}
+
+DemuxPipeline::~DemuxPipeline()
+{
+	assert(m_chunks.empty());
+}
+
+ULONG DemuxPipeline::AddRef()
+{
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG DemuxPipeline::Release()
+{
+	LONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0)
+	{
+		delete this;
+	}
+	return cRef;
+}
+
+//-------------------------------------------------------------------
+// Start
+// Runs the pipeline until it waits for its first read. Run() holds a
+// reference until it returns.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::Start()
+{
+	AddRef();
+	(void)Run();
+}
+
+//-------------------------------------------------------------------
+// Seek
+// The reads in flight are cancelled now. Run() drops them and moves
+// the parser when it next looks, which is before the next frame.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::Seek(LONGLONG hnsTime)
+{
+	std::vector<Chunk*> pending;
+	{
+		AutoLock lock(m_critSec);
+
+		if (m_fShutdown)
+		{
+			return;
+		}
+		m_fSeekPending = true;
+		m_hnsSeekTime = hnsTime;
+		CollectPendingReads(&pending);
+	}
+	CancelPendingReads(pending);
+}
+
+//-------------------------------------------------------------------
+// Shutdown
+//-------------------------------------------------------------------
+
+void DemuxPipeline::Shutdown()
+{
+	std::vector<Chunk*> pending;
+	{
+		AutoLock lock(m_critSec);
+
+		if (m_fShutdown)
+		{
+			return;
+		}
+		m_fShutdown = true;
+		CollectPendingReads(&pending);
+	}
+	CancelPendingReads(pending);
+}
+
+DemuxPipelineStats DemuxPipeline::GetStats()
+{
+	AutoLock lock(m_critSec);
+	return m_stats;
+}
+
+//-------------------------------------------------------------------
+// Run
+// Reads, parses and delivers until the end of the file, an error or
+// Shutdown. Each pass parses what is buffered, keeps the read-ahead
+// full, and waits for the oldest read.
+//-------------------------------------------------------------------
+
+DemuxPipeline::Job DemuxPipeline::Run()
+{
+	HRESULT hr = S_OK;
+	bool fEndOfFile = false;
+
+	while (SUCCEEDED(hr) && !fEndOfFile)
+	{
+		try
+		{
+			// The headers can come in while a seek waits for them.
+			do
+			{
+				ApplySeek();
+				ParseBuffer();
+			} while (HasDeferredSeek());
+		}
+		catch (const HResultException &exc)
+		{
+			hr = exc.HResult;
+			break;
+		}
+
+		StartReads();
+
+		co_await NextChunk{ this };
+
+		hr = TakeChunk(&fEndOfFile);
+	}
+
+	DropChunks();
+
+	m_pSink->OnEnd(hr);
+	Release();
+}
+
+//-------------------------------------------------------------------
+// ParseBuffer
+// Parses the buffered data and delivers its frames, until the parser
+// needs more data or a seek or Shutdown interrupts. Follows
+// MKVSource::ParseData.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::ParseBuffer()
+{
+	while (!IsInterrupted())
+	{
+		DWORD cbAte = 0;
+		bool fNeedMoreData = false;
+
+		if (m_parser.HasFrames())
+		{
+			const DWORD cbFrame = *m_parser.pCircRead;
+			if (cbFrame > m_buffer.DataSize())
+			{
+				fNeedMoreData = true;
+			}
+			else
+			{
+				DeliverFrame(cbFrame);
+				cbAte = cbFrame;
+			}
+		}
+		else
+		{
+			m_parser.m_bufferPosition = m_qwPosition - m_buffer.DataSize();
+			fNeedMoreData = !m_parser.ParseBytes(m_buffer.DataPtr(), m_buffer.DataSize(), &cbAte);
+		}
+
+		if (m_parser.m_jumpFlag)
+		{
+			m_parser.m_jumpFlag = false;
+			m_buffer.MoveStart(m_buffer.DataSize());
+			SeekReads(m_parser.m_jumpTo);
+		}
+		else
+		{
+			m_buffer.MoveStart(cbAte);
+		}
+
+		// The headers are read: restart at the first cluster. (See
+		// MKVSource::ParseData.)
+		MKVMasterData *pMasterData = m_parser.GetMasterData();
+		if (m_buffer.DataSize() == 0 && !m_parser.HasFinishedParsedData() && !fNeedMoreData
+			&& !pMasterData->Cues.empty())
+		{
+			m_parser.m_isFinishedParsingMaster = true;
+			SeekReads(pMasterData->Cues[0]->CueTrackPositions[0]->CueClusterPosition + pMasterData->SegmentPosition);
+		}
+
+		if (fNeedMoreData)
+		{
+			return;
+		}
+	}
+}
+
+//-------------------------------------------------------------------
+// DeliverFrame
+// Hands the next frame of the current block to the sink, and tells
+// the parser that it is done with it.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::DeliverFrame(DWORD cbFrame)
+{
+	m_pSink->OnFrame(m_parser, m_buffer.DataPtr(), cbFrame);
+
+	// Laced frames after the first follow at the default duration.
+	for (TrackData *pTrack : m_parser.GetMasterData()->Tracks)
+	{
+		if (pTrack->TrackNumber == (DWORD)m_parser.m_currentStream)
+		{
+			m_parser.m_currentTimeStamp += pTrack->DefaultDuration / 1000000;
+			break;
+		}
+	}
+
+	m_parser.pCircRead++;
+	if ((m_parser.pCircRead - &m_parser.m_circularBuffer[0]) == m_parser.m_cirBufferLength)
+	{
+		m_parser.pCircRead = &m_parser.m_circularBuffer[0];
+	}
+	m_parser.m_frameCount--;
+	if (m_parser.m_frameCount == 0)
+	{
+		m_parser.ClearFrames();
+	}
+}
+
+bool DemuxPipeline::IsInterrupted()
+{
+	if (HasDeferredSeek())
+	{
+		return true;
+	}
+	AutoLock lock(m_critSec);
+	return m_fSeekPending || m_fShutdown;
+}
+
+bool DemuxPipeline::HasDeferredSeek() const
+{
+	return m_fSeekAfterHeaders && m_parser.HasFinishedParsedData();
+}
+
+//-------------------------------------------------------------------
+// ApplySeek
+// Moves the parser to the position of the last Seek call. The reads
+// of the old position were made stale by Seek; they are dropped here.
+//
+// The cue points are needed to find the position. A seek before the
+// headers are parsed goes on reading from where the parser is, and
+// takes effect once they are.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::ApplySeek()
+{
+	bool fSeek = false;
+	{
+		AutoLock lock(m_critSec);
+		if (m_fSeekPending)
+		{
+			fSeek = true;
+			m_fSeekPending = false;
+			m_hnsSeekTarget = m_hnsSeekTime;
+			++m_stats.cSeeks;
+		}
+	}
+
+	if (fSeek)
+	{
+		m_fSeekAfterHeaders = true;
+	}
+	if (!m_fSeekAfterHeaders)
+	{
+		return;
+	}
+
+	if (!m_parser.HasFinishedParsedData())
+	{
+		if (fSeek)
+		{
+			SeekReads(m_qwPosition);
+		}
+		return;
+	}
+
+	m_fSeekAfterHeaders = false;
+
+	// Without cues, there is nowhere to go: read on.
+	const QWORD qwCluster = m_parser.FindCuePosition(m_hnsSeekTarget);
+	if (qwCluster == 0)
+	{
+		SeekReads(m_qwPosition);
+		return;
+	}
+
+	m_parser.DiscardFrames();
+	m_buffer.MoveStart(m_buffer.DataSize());
+	SeekReads(qwCluster);
+}
+
+//-------------------------------------------------------------------
+// StartReads
+// Issues reads until m_cReadsAhead of them are pending or buffered.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::StartReads()
+{
+	std::vector<Chunk*> chunks;
+	{
+		AutoLock lock(m_critSec);
+
+		if (m_fShutdown || m_fSeekPending)
+		{
+			return;
+		}
+		while (m_chunks.size() < m_cReadsAhead)
+		{
+			Chunk *pChunk = new Chunk(this, m_qwReadPosition, m_cbRead, m_cReadGeneration);
+			m_qwReadPosition += m_cbRead;
+
+			m_chunks.push_back(pChunk);
+			pChunk->AddRef(); // For the pending read.
+			chunks.push_back(pChunk);
+
+			++m_stats.cReads;
+			++m_cReadsInFlight;
+			m_stats.cMaxReadsInFlight = max(m_stats.cMaxReadsInFlight, m_cReadsInFlight);
+		}
+	}
+
+	// The source may complete a read before BeginRead returns, so the
+	// lock is not held here.
+	for (Chunk *pChunk : chunks)
+	{
+		HRESULT hr = m_pSource->BeginRead(pChunk->m_qwPosition, pChunk->m_data.data(), m_cbRead, pChunk);
+		if (FAILED(hr))
+		{
+			pChunk->OnReadComplete(hr, 0);
+		}
+	}
+}
+
+//-------------------------------------------------------------------
+// NextChunk
+// Run() waits only for a pending read, so OnReadComplete resumes it.
+//-------------------------------------------------------------------
+
+bool DemuxPipeline::NextChunk::await_suspend(std::coroutine_handle<> hRun)
+{
+	AutoLock lock(m_pPipeline->m_critSec);
+
+	if (m_pPipeline->m_fShutdown || m_pPipeline->m_fSeekPending ||
+		m_pPipeline->m_chunks.empty() || m_pPipeline->m_chunks.front()->m_fDone)
+	{
+		return false;
+	}
+	m_pPipeline->m_hWaiting = hRun;
+	return true;
+}
+
+//-------------------------------------------------------------------
+// OnReadComplete
+// Records the result of a read, and resumes Run() if it waits for it.
+// A read of an old generation was dropped by a seek or a jump, but it
+// resumes Run() too if a seek is pending, as Run() may wait on it.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::OnReadComplete(Chunk *pChunk, HRESULT hr, DWORD cbRead)
+{
+	std::coroutine_handle<> hRun;
+	{
+		AutoLock lock(m_critSec);
+
+		pChunk->m_fPending = false;
+		pChunk->m_fDone = true;
+		pChunk->m_hr = hr;
+		pChunk->m_cbRead = min(cbRead, (DWORD)pChunk->m_data.size());
+		--m_cReadsInFlight;
+
+		if (pChunk->m_cGeneration != m_cReadGeneration)
+		{
+			++m_stats.cCancelledReads;
+		}
+
+		if (m_hWaiting && (m_fShutdown || m_fSeekPending || (!m_chunks.empty() && m_chunks.front() == pChunk)))
+		{
+			hRun = m_hWaiting;
+			m_hWaiting = nullptr;
+		}
+	}
+
+	if (hRun)
+	{
+		hRun.resume();
+	}
+}
+
+//-------------------------------------------------------------------
+// TakeChunk
+// Moves the oldest read into the parser's buffer. Takes nothing if a
+// seek is pending. A short read ends the file, or (if the source
+// returns less than asked in the middle) moves the reads after it.
+//-------------------------------------------------------------------
+
+HRESULT DemuxPipeline::TakeChunk(bool *pfEndOfFile)
+{
+	Chunk *pChunk = nullptr;
+	bool fMoreChunks = false;
+	{
+		AutoLock lock(m_critSec);
+
+		if (m_fShutdown)
+		{
+			return MF_E_SHUTDOWN;
+		}
+		if (m_fSeekPending || m_chunks.empty())
+		{
+			return S_OK;
+		}
+
+		pChunk = m_chunks.front();
+		assert(pChunk->m_fDone);
+		m_chunks.pop_front();
+		fMoreChunks = !m_chunks.empty();
+	}
+
+	HRESULT hr = pChunk->m_hr;
+	const DWORD cbRead = pChunk->m_cbRead;
+
+	if (SUCCEEDED(hr) && cbRead == 0)
+	{
+		*pfEndOfFile = true;
+	}
+	else if (SUCCEEDED(hr))
+	{
+		m_buffer.Reserve(cbRead);
+		CopyMemory(m_buffer.DataPtr() + m_buffer.DataSize(), pChunk->m_data.data(), cbRead);
+		m_buffer.MoveEnd(cbRead);
+		m_qwPosition += cbRead;
+
+		if (cbRead < m_cbRead && fMoreChunks)
+		{
+			SeekReads(m_qwPosition);
+		}
+	}
+
+	pChunk->Release();
+	return hr;
+}
+
+//-------------------------------------------------------------------
+// SeekReads
+// Moves the reads to qwPosition: the chunks read ahead are dropped and
+// their pending reads cancelled. The caller has dropped the buffer (or
+// qwPosition is its end).
+//-------------------------------------------------------------------
+
+void DemuxPipeline::SeekReads(QWORD qwPosition)
+{
+	DropChunks();
+	{
+		AutoLock lock(m_critSec);
+		m_qwReadPosition = qwPosition;
+	}
+	m_qwPosition = qwPosition;
+}
+
+// Drops the chunks read ahead, and cancels their pending reads.
+void DemuxPipeline::DropChunks()
+{
+	std::vector<Chunk*> pending;
+	{
+		AutoLock lock(m_critSec);
+
+		CollectPendingReads(&pending);
+		for (Chunk *pChunk : m_chunks)
+		{
+			pChunk->Release();
+		}
+		m_chunks.clear();
+	}
+	CancelPendingReads(pending);
+}
+
+//-------------------------------------------------------------------
+// CollectPendingReads
+// Makes the chunks read so far stale, and lists those with a pending
+// read, so that the caller can cancel the reads once it has released
+// the lock. The lock is held from the change of generation to the
+// listing, so that no read issued after it is cancelled.
+//-------------------------------------------------------------------
+
+void DemuxPipeline::CollectPendingReads(std::vector<Chunk*> *pPending)
+{
+	++m_cReadGeneration; // This counter is allowed to overflow.
+
+	for (Chunk *pChunk : m_chunks)
+	{
+		if (pChunk->m_fPending)
+		{
+			pChunk->AddRef();
+			pPending->push_back(pChunk);
+		}
+	}
+}
+
+void DemuxPipeline::CancelPendingReads(const std::vector<Chunk*> &pending)
+{
+	for (Chunk *pChunk : pending)
+	{
+		m_pSource->CancelRead(pChunk);
+		pChunk->Release();
+	}
+}
@@ -0,0 +1,215 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// DemuxPipeline.h
+// The demuxer as a C++20 coroutine over asynchronous reads. Run() reads,
+// parses and delivers in one loop, and co_awaits the next read instead
+// of returning to a callback. Reads are issued ahead of the parser, a
+// few at a time, so that several clusters are in flight; a seek (or a
+// jump of the parser) cancels them and starts over at the new position.
+//
+// The pipeline depends on the demuxer (Demux.h) and on the standard
+// library only. It needs a compiler with coroutines; make/linux builds
+// it and its tests. MKVSource keeps its own read loop (ParseData), which
+// the v120 toolset can build.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <coroutine>
+#include <deque>
+#include <vector>
+
+#include "Demux.h"
+
+//-------------------------------------------------------------------
+// AsyncByteSource
+// Where the pipeline reads from.
+//
+// BeginRead starts a read of up to cb bytes at qwPosition. The source
+// calls pCallback->OnReadComplete exactly once per read, on any thread,
+// possibly before BeginRead returns. A read of 0 bytes is the end of
+// the file. CancelRead asks the source to complete a pending read
+// early; the pipeline ignores the result. The source must accept
+// CancelRead for a read that has already completed.
+//-------------------------------------------------------------------
+
+class AsyncReadCallback
+{
+public:
+	virtual void OnReadComplete(HRESULT hr, DWORD cbRead) = 0;
+
+protected:
+	virtual ~AsyncReadCallback() {}
+};
+
+class AsyncByteSource
+{
+public:
+	virtual HRESULT BeginRead(QWORD qwPosition, BYTE *pData, DWORD cb, AsyncReadCallback *pCallback) = 0;
+	virtual void CancelRead(AsyncReadCallback *pCallback) = 0;
+
+protected:
+	virtual ~AsyncByteSource() {}
+};
+
+//-------------------------------------------------------------------
+// DemuxSink
+// Receives what the pipeline demuxes, on the thread that completed
+// the last read. The sink may call Seek and Shutdown.
+//-------------------------------------------------------------------
+
+class DemuxSink
+{
+public:
+	// One frame. The data is valid until OnFrame returns.
+	virtual void OnFrame(const Parser &parser, const BYTE *pData, DWORD cbData) = 0;
+
+	// The end: S_OK at the end of the file, MF_E_SHUTDOWN after
+	// Shutdown, or the error that stopped the pipeline.
+	virtual void OnEnd(HRESULT hr) = 0;
+
+protected:
+	virtual ~DemuxSink() {}
+};
+
+struct DemuxPipelineStats
+{
+	DWORD	cReads;				// Reads issued.
+	DWORD	cCancelledReads;	// Reads dropped by a seek or a jump while pending.
+	DWORD	cMaxReadsInFlight;	// Most reads pending at once.
+	DWORD	cSeeks;
+};
+
+//-------------------------------------------------------------------
+// DemuxPipeline
+//
+// Reads are cbRead bytes, and up to cReadsAhead of them are pending or
+// buffered ahead of the parser. Start() runs the pipeline until the
+// first read is pending; the rest runs on the threads that complete
+// the reads. The source and the sink must outlive OnEnd.
+//-------------------------------------------------------------------
+
+class DemuxPipeline
+{
+public:
+	DemuxPipeline(AsyncByteSource *pSource, DemuxSink *pSink, DWORD cbRead, DWORD cReadsAhead);
+
+	ULONG AddRef();
+	ULONG Release();
+
+	void Start();
+
+	// Drops everything read so far, and restarts at the cluster of the
+	// last cue point at or before hnsTime. Without cues, the pipeline
+	// reads on.
+	void Seek(LONGLONG hnsTime);
+
+	// Stops the pipeline. OnEnd follows, with MF_E_SHUTDOWN, unless the
+	// pipeline has already ended.
+	void Shutdown();
+
+	DemuxPipelineStats GetStats();
+
+private:
+	// A read, pending or done. It is referenced by m_chunks and by the
+	// source while the read is pending.
+	class Chunk : public AsyncReadCallback
+	{
+	public:
+		Chunk(DemuxPipeline *pPipeline, QWORD qwPosition, DWORD cb, DWORD cGeneration);
+
+		ULONG AddRef();
+		ULONG Release();
+
+		void OnReadComplete(HRESULT hr, DWORD cbRead) override;
+
+		DemuxPipeline		*m_pPipeline;
+		std::vector<BYTE>	m_data;
+		QWORD				m_qwPosition;
+		DWORD				m_cGeneration;		// m_cReadGeneration when issued.
+		bool				m_fDone;
+		bool				m_fPending;			// Not yet completed by the source.
+		HRESULT				m_hr;
+		DWORD				m_cbRead;
+
+	private:
+		~Chunk() {}
+
+		long				m_cRef;
+	};
+
+	// The coroutine type of Run(). It starts at once and frees itself
+	// when it returns.
+	struct Job
+	{
+		struct promise_type
+		{
+			Job get_return_object() { return Job(); }
+			std::suspend_never initial_suspend() { return std::suspend_never(); }
+			std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	// co_await NextChunk() suspends Run() until the oldest read is done,
+	// or a seek or Shutdown needs it.
+	struct NextChunk
+	{
+		DemuxPipeline *m_pPipeline;
+
+		bool await_ready() { return false; }
+		bool await_suspend(std::coroutine_handle<> hRun);
+		void await_resume() {}
+	};
+
+	~DemuxPipeline();
+
+	Job Run();
+
+	void ParseBuffer();
+	void DeliverFrame(DWORD cbFrame);
+	bool IsInterrupted();
+	bool HasDeferredSeek() const;
+	void ApplySeek();
+	HRESULT TakeChunk(bool *pfEndOfFile);
+
+	void StartReads();
+	void SeekReads(QWORD qwPosition);
+	void DropChunks();
+	void CollectPendingReads(std::vector<Chunk*> *pPending);
+	void CancelPendingReads(const std::vector<Chunk*> &pending);
+	void OnReadComplete(Chunk *pChunk, HRESULT hr, DWORD cbRead);
+
+	long					m_cRef;
+	CritSec					m_critSec;		// Protects the read state below.
+
+	AsyncByteSource			*m_pSource;
+	DemuxSink				*m_pSink;
+	const DWORD				m_cbRead;
+	const DWORD				m_cReadsAhead;
+
+	// Read state.
+	std::deque<Chunk*>		m_chunks;		// In file order.
+	QWORD					m_qwReadPosition;	// Where the next read starts.
+	DWORD					m_cReadGeneration;	// Bumped when the reads move.
+	DWORD					m_cReadsInFlight;
+	std::coroutine_handle<>	m_hWaiting;		// Run(), while it waits for m_chunks.front().
+	bool					m_fSeekPending;
+	LONGLONG				m_hnsSeekTime;
+	bool					m_fShutdown;
+	DemuxPipelineStats		m_stats;
+
+	// Parse state, used by Run() only.
+	Parser					m_parser;
+	Buffer					m_buffer;
+	QWORD					m_qwPosition;	// File offset of the end of m_buffer.
+	bool					m_fSeekAfterHeaders;	// A seek waits for the cue points.
+	LONGLONG				m_hnsSeekTarget;
+};
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "MKVSource.h"
+#include "SourcePrefetcher.h"
 #include "MKVByteStreamHandler.h"
 #include <wrl\module.h>
 
@@ -15,6 +16,9 @@ ActivatableClass(MKVByteStreamHandler);
 //-------------------------------------------------------------------
 
 MKVByteStreamHandler::MKVByteStreamHandler()
+	: m_fUseSharedScheduler(false)
+	, m_cPrefetch(1)
+	, m_crcMode(CRC_VERIFY_OFF)
 {
 }
 
@@ -33,10 +37,62 @@ MKVByteStreamHandler::~MKVByteStreamHandler()
 //-------------------------------------------------------------------
 // SetProperties
 // Sets the configuration of the media byte stream handler
+//
+// "UseSharedScheduler" (bool): Parse on the process-wide scheduler
+// shared by all sources, instead of one work queue per source. Meant
+// for processes that open many files at once.
+//
+// "Playlist" (IIterable<String>): URLs in the order they will play.
+// When the handler opens one of them, it opens the next ones ahead of
+// time (see SourcePrefetcher), so that switching files is quick.
+//
+// "PrefetchCount" (UInt32): How many files to open ahead. Default 1.
+//
+// "VerifyCrc" (UInt32): Check the CRC-32 elements of the file: 0 (the
+// default) does not, 1 checks them as they are parsed, 2 checks them on
+// a background thread. IMKVCrcResults on the source has the results.
 //-------------------------------------------------------------------
 IFACEMETHODIMP MKVByteStreamHandler::SetProperties(ABI::Windows::Foundation::Collections::IPropertySet *pConfiguration)
 {
-	return S_OK;
+	if (pConfiguration == nullptr)
+	{
+		return S_OK;
+	}
+
+	HRESULT hr = S_OK;
+	try
+	{
+		auto config = reinterpret_cast<Windows::Foundation::Collections::IPropertySet^>(pConfiguration);
+		if (config->HasKey(L"UseSharedScheduler"))
+		{
+			m_fUseSharedScheduler = safe_cast<bool>(config->Lookup(L"UseSharedScheduler"));
+		}
+		if (config->HasKey(L"Playlist"))
+		{
+			auto playlist = safe_cast<Windows::Foundation::Collections::IIterable<String^>^>(config->Lookup(L"Playlist"));
+
+			m_playlist.clear();
+			for (auto it = playlist->First(); it->HasCurrent; it->MoveNext())
+			{
+				m_playlist.push_back(it->Current->Data());
+			}
+		}
+		if (config->HasKey(L"PrefetchCount"))
+		{
+			m_cPrefetch = min(safe_cast<UINT32>(config->Lookup(L"PrefetchCount")), MAX_PREFETCHED_SOURCES);
+		}
+		if (config->HasKey(L"VerifyCrc"))
+		{
+			UINT32 mode = safe_cast<UINT32>(config->Lookup(L"VerifyCrc"));
+			m_crcMode = (mode <= CRC_VERIFY_BACKGROUND) ? (CrcVerifyMode)mode : CRC_VERIFY_OFF;
+		}
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
+
+	return hr;
 }
 
 //-------------------------------------------------------------------
@@ -76,38 +132,70 @@ HRESULT MKVByteStreamHandler::BeginCreateObject(
 			ThrowException(E_INVALIDARG);
 		}
 
-		ComPtr<IMFAsyncResult> spResult;
-		ComPtr<MKVSource> spSource = MKVSource::CreateInstance();
+		ComPtr<MKVSource> spPrefetched;
+		concurrency::task<void> prefetchTask;
+		bool fPrefetched = false;
 
-		ComPtr<IUnknown> spSourceUnk;
-		ThrowIfError(spSource.As(&spSourceUnk));
-		ThrowIfError(MFCreateAsyncResult(spSourceUnk.Get(), pCallback, punkState, &spResult));
+		// If this file was opened ahead of time, take that source. It has
+		// its own byte stream, so pByteStream is only used if the
+		// prefetched open failed.
+		if (pwszURL != nullptr)
+		{
+			ComPtr<SourcePrefetcher> spPrefetcher;
+			ThrowIfError(SourcePrefetcher::GetShared(&spPrefetcher));
+			fPrefetched = spPrefetcher->Take(pwszURL, m_crcMode, &spPrefetched, &prefetchTask);
+		}
 
 		// Start opening the source. This is an async operation.
-		// When it completes, the source will invoke our callback
-		// and then we will invoke the caller's callback.
-		ComPtr<MKVByteStreamHandler> spThis = this;
-		spSource->OpenAsync(pByteStream).then([this, spThis, spResult, spSource](concurrency::task<void>& openTask)
+		// When it completes, we invoke the caller's callback.
+		concurrency::task<ComPtr<MKVSource>> openTask;
+		if (fPrefetched)
 		{
-			try
+			ComPtr<IMFByteStream> spByteStream = pByteStream;
+			const bool fUseSharedScheduler = m_fUseSharedScheduler;
+			const CrcVerifyMode crcMode = m_crcMode;
+
+			openTask = prefetchTask.then([spPrefetched, spByteStream, fUseSharedScheduler, crcMode](concurrency::task<void> &prefetch)
 			{
-				if (spResult == nullptr)
+				try
 				{
-					ThrowIfError(MF_E_UNEXPECTED);
+					prefetch.get();
+					return concurrency::task_from_result(spPrefetched);
 				}
+				catch (Exception ^)
+				{
+					// Open the file as if it had not been prefetched.
+					(void)spPrefetched->Shutdown();
+				}
+				return OpenSource(spByteStream.Get(), fUseSharedScheduler, crcMode);
+			});
+		}
+		else
+		{
+			openTask = OpenSource(pByteStream, m_fUseSharedScheduler, m_crcMode);
+		}
 
-				openTask.get();
+		ComPtr<MKVByteStreamHandler> spThis = this;
+		ComPtr<IMFAsyncCallback> spCallback = pCallback;
+		ComPtr<IUnknown> spState = punkState;
+		openTask.then([spThis, spCallback, spState](concurrency::task<ComPtr<MKVSource>> &openTask)
+		{
+			HRESULT hrStatus = S_OK;
+			ComPtr<IUnknown> spSourceUnk;
+			try
+			{
+				ComPtr<MKVSource> spSource = openTask.get();
+				ThrowIfError(spSource.As(&spSourceUnk));
 			}
 			catch (Exception ^exc)
 			{
-				if (spResult != nullptr)
-				{
-					spResult->SetStatus(exc->HResult);
-				}
+				hrStatus = exc->HResult;
 			}
 
-			if (spResult != nullptr)
+			ComPtr<IMFAsyncResult> spResult;
+			if (SUCCEEDED(MFCreateAsyncResult(spSourceUnk.Get(), spCallback.Get(), spState.Get(), &spResult)))
 			{
+				spResult->SetStatus(hrStatus);
 				MFInvokeCallback(spResult.Get());
 			}
 		});
@@ -116,6 +204,9 @@ HRESULT MKVByteStreamHandler::BeginCreateObject(
 		{
 			*ppIUnknownCancelCookie = nullptr;
 		}
+
+		// Open the files that play after this one.
+		PrefetchNext(pwszURL);
 	}
 	catch (Exception ^exc)
 	{
@@ -162,6 +253,78 @@ HRESULT MKVByteStreamHandler::EndCreateObject(
 }
 
 
+//-------------------------------------------------------------------
+// OpenSource
+// Creates a source for pByteStream and starts opening it. The task
+// returns the source once it is open.
+//-------------------------------------------------------------------
+
+concurrency::task<ComPtr<MKVSource>> MKVByteStreamHandler::OpenSource(
+	IMFByteStream *pByteStream, bool fUseSharedScheduler, CrcVerifyMode crcMode)
+{
+	ComPtr<MKVSource> spSource = MKVSource::CreateInstance();
+	if (fUseSharedScheduler)
+	{
+		spSource->UseSharedScheduler();
+	}
+	spSource->SetCrcVerification(crcMode);
+
+	return spSource->OpenAsync(pByteStream).then([spSource]()
+	{
+		return spSource;
+	});
+}
+
+
+//-------------------------------------------------------------------
+// PrefetchNext
+// Opens the playlist entries that follow pwszURL ahead of time, and
+// lets go of sources prefetched for any other entry.
+//
+// Prefetching is an optimization, so errors are ignored.
+//-------------------------------------------------------------------
+
+void MKVByteStreamHandler::PrefetchNext(LPCWSTR pwszURL)
+{
+	if (m_playlist.empty())
+	{
+		return;
+	}
+
+	try
+	{
+		// If pwszURL is not in the playlist, the playlist has not started yet.
+		size_t iNext = 0;
+		if (pwszURL != nullptr)
+		{
+			auto it = std::find(m_playlist.begin(), m_playlist.end(), pwszURL);
+			if (it != m_playlist.end())
+			{
+				iNext = (it - m_playlist.begin()) + 1;
+			}
+		}
+
+		std::vector<std::wstring> next;
+		for (size_t i = iNext; i < m_playlist.size() && next.size() < m_cPrefetch; i++)
+		{
+			next.push_back(m_playlist[i]);
+		}
+
+		ComPtr<SourcePrefetcher> spPrefetcher;
+		ThrowIfError(SourcePrefetcher::GetShared(&spPrefetcher));
+
+		spPrefetcher->Retain(next);
+		for (size_t i = 0; i < next.size(); i++)
+		{
+			spPrefetcher->Prefetch(next[i].c_str(), m_fUseSharedScheduler, m_crcMode);
+		}
+	}
+	catch (Exception ^)
+	{
+	}
+}
+
+
 HRESULT MKVByteStreamHandler::CancelObjectCreation(IUnknown *pIUnknownCancelCookie)
 {
 	return E_NOTIMPL;
@@ -42,4 +42,13 @@ public:
 	STDMETHODIMP CancelObjectCreation(IUnknown *pIUnknownCancelCookie);
 	STDMETHODIMP GetMaxNumberOfBytesRequiredForResolution(QWORD *pqwBytes);
 
+private:
+	static concurrency::task<ComPtr<MKVSource>> OpenSource(IMFByteStream *pByteStream, bool fUseSharedScheduler, CrcVerifyMode crcMode);
+	void PrefetchNext(LPCWSTR pwszURL);
+
+	bool m_fUseSharedScheduler;     // Set by the "UseSharedScheduler" configuration property.
+	std::vector<std::wstring> m_playlist;   // Set by the "Playlist" configuration property.
+	UINT32 m_cPrefetch;             // Set by the "PrefetchCount" configuration property.
+	CrcVerifyMode m_crcMode;        // Set by the "VerifyCrc" configuration property.
+
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "MKVSource.h"
+#include "CaptionStream.h"
 
 
 #pragma warning( push )
@@ -10,6 +11,33 @@ ComPtr<IMFMediaType> CreateVideoMediaType(MKVMasterData* mkvMasterData, int curr
 ComPtr<IMFMediaType> CreateAudioMediaType(MKVMasterData* mkvMasterData, int currentTrack);
 ComPtr<IMFMediaType> CreateSubtitleMediaType(MKVMasterData* mkvMasterData, int currentTrack);
 void GetStreamMajorType(IMFStreamDescriptor *pSD, GUID *pguidMajorType);
+const TrackStatistics *FindTrackStatistics(MKVMasterData* mkvMasterData, UINT64 trackUID);
+DWORD ReadByteStreamAt(IMFByteStream *pStream, QWORD qwPosition, BYTE *pData, DWORD cb);
+
+// Copy a list into an array the caller frees with CoTaskMemFree (null if
+// the list is empty).
+template <class T>
+HRESULT CopyToTaskMem(const std::vector<T> &items, T **ppItems, DWORD *pcItems)
+{
+	*ppItems = nullptr;
+	*pcItems = 0;
+
+	if (items.empty())
+	{
+		return S_OK;
+	}
+
+	T *pItems = (T*)CoTaskMemAlloc(items.size() * sizeof(T));
+	if (pItems == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+	memcpy(pItems, items.data(), items.size() * sizeof(T));
+
+	*ppItems = pItems;
+	*pcItems = (DWORD)items.size();
+	return S_OK;
+}
 
 
 /* Public class methods */
@@ -66,6 +94,24 @@ HRESULT MKVSource::QueryInterface(REFIID riid, void **ppv)
 		AddRef();
 		hr = S_OK;
 	}
+	else if (riid == __uuidof(IMKVSubtitleCues))
+	{
+		(*ppv) = static_cast<IMKVSubtitleCues*>(this);
+		AddRef();
+		hr = S_OK;
+	}
+	else if (riid == __uuidof(IMKVChapters))
+	{
+		(*ppv) = static_cast<IMKVChapters*>(this);
+		AddRef();
+		hr = S_OK;
+	}
+	else if (riid == __uuidof(IMKVCrcResults))
+	{
+		(*ppv) = static_cast<IMKVCrcResults*>(this);
+		AddRef();
+		hr = S_OK;
+	}
 
 	return hr;
 }
@@ -284,6 +330,7 @@ HRESULT MKVSource::Pause()
 HRESULT MKVSource::Shutdown()
 {
 	AutoLock lock(m_critSec);
+	AutoLock demuxLock(m_demuxCritSec);
 
 	HRESULT hr = S_OK;
 
@@ -298,8 +345,13 @@ HRESULT MKVSource::Shutdown()
 		{
 			(void)m_streams[i]->Shutdown();
 		}
+		for (size_t i = 0; i < m_captionStreams.size(); i++)
+		{
+			m_captionStreams[i]->Shutdown();
+		}
 		// Break circular references with streams here.
 		m_streams.Clear();
+		m_captionStreams.clear();
 
 		// Shut down the event queue.
 		if (m_spEventQueue)
@@ -312,14 +364,44 @@ HRESULT MKVSource::Shutdown()
 		m_spEventQueue.Reset();
 		m_spPresentationDescriptor.Reset();
 		m_spByteStream.Reset();
+		m_spAttachmentStream.Reset();
 		m_spCurrentOp.Reset();
+		m_spSampleRequest.Reset();
+
+		// Release the demux work queue.
+		if (m_dwDemuxQueue != 0)
+		{
+			(void)MFUnlockWorkQueue(m_dwDemuxQueue);
+			m_dwDemuxQueue = 0;
+		}
+
+		// Drop pending demux work. Keep the task queue itself, because a
+		// read can still complete and call OnReadCompleted.
+		if (m_spTaskQueue != nullptr)
+		{
+			m_spTaskQueue->Shutdown();
+		}
 
-		delete m_masterData;
+		// The parser does not free its master data. m_masterData points
+		// to it once the headers are parsed, and is null before.
+		if (m_parser != nullptr)
+		{
+			delete m_parser->GetMasterData();
+		}
+		m_masterData = nullptr;
 
+		delete m_parser;
 		m_parser = nullptr;
+		m_subtitles.Clear();
+		m_chapters.Clear();
+		m_spCrcVerifier->Shutdown();
 
 		// Set the state.
 		m_state = STATE_SHUTDOWN;
+
+		// Wake an attachment read that waits for the read in flight,
+		// which may never complete now.
+		m_readDone.set();
 	}
 
 	return hr;
@@ -349,8 +431,27 @@ HRESULT MKVSource::Start(
 		return E_INVALIDARG;
 	}
 
-	// Check the time format.
-	if ((pguidTimeFormat != nullptr) && (*pguidTimeFormat != GUID_NULL))
+	// Check the time format. A chapter UID becomes the chapter's start
+	// time, and the start goes on as a seek to that time.
+	PROPVARIANT varChapterStart;
+	if ((pguidTimeFormat != nullptr) && (*pguidTimeFormat == MKV_TIME_FORMAT_CHAPTER))
+	{
+		Chapter chapter;
+		if (pvarStartPos->vt != VT_UI8)
+		{
+			return MF_E_UNSUPPORTED_TIME_FORMAT;
+		}
+		if (!m_chapters.FindByUid(pvarStartPos->uhVal.QuadPart, &chapter))
+		{
+			return E_INVALIDARG;
+		}
+
+		PropVariantInit(&varChapterStart);
+		varChapterStart.vt = VT_I8;
+		varChapterStart.hVal.QuadPart = chapter.hnsStart;
+		pvarStartPos = &varChapterStart;
+	}
+	else if ((pguidTimeFormat != nullptr) && (*pguidTimeFormat != GUID_NULL))
 	{
 		// Unrecognized time format GUID.
 		return MF_E_UNSUPPORTED_TIME_FORMAT;
@@ -476,7 +577,7 @@ HRESULT MKVSource::GetService(_In_ REFGUID guidService, _In_ REFIID riid, _Out_o
 		return E_POINTER;
 	}
 
-	if (guidService == MF_RATE_CONTROL_SERVICE)
+	if (guidService == MF_RATE_CONTROL_SERVICE || guidService == MKV_SOURCE_SERVICE)
 	{
 		hr = QueryInterface(riid, ppvObject);
 	}
@@ -609,15 +710,44 @@ concurrency::task<void> MKVSource::OpenAsync(IMFByteStream *pStream)
 	}
 
 	// Reserve space in the read buffer.
-	m_ReadBuffer = ref new Buffer(INITIAL_BUFFER_SIZE);
+	m_ReadBuffer = new Buffer(INITIAL_BUFFER_SIZE);
+	m_PrefetchBuffer = new Buffer(INITIAL_BUFFER_SIZE);
+
+	// Prefetched data is tracked by its offset in the file.
+	ThrowIfError(pStream->GetCurrentPosition(&m_qwPrefetchPosition));
 
 	// Create the MPEG-1 parser.
-	m_parser = ref new Parser();
+	m_parser = new Parser();
+	m_parser->m_pSubtitles = &m_subtitles;
+	m_parser->m_pChapters = &m_chapters;
+	m_parser->m_pCrcVerifier = m_spCrcVerifier.Get();
 
-	RequestData(READ_SIZE);
+	// Reading and parsing run on a private work queue, so that a long
+	// parse does not hold up the standard work queue threads. With many
+	// sources open, the shared scheduler does the same job with one pool
+	// of workers for all of them.
+	if (m_fUseSharedScheduler)
+	{
+		ComPtr<WorkScheduler> spScheduler;
+		ThrowIfError(WorkScheduler::GetShared(&spScheduler));
+		ThrowIfError(spScheduler->CreateTaskQueue(&m_spTaskQueue));
+	}
+	else
+	{
+		ThrowIfError(MFAllocateWorkQueueEx(MF_STANDARD_WORKQUEUE, &m_dwDemuxQueue));
+		m_OnByteStreamRead.SetQueue(m_dwDemuxQueue);
+	}
 
+	// Set the state before the first read, because the read callback
+	// checks it to decide which locks to take.
 	m_state = STATE_OPENING;
 
+	{
+		AutoLock demuxLock(m_demuxCritSec);
+		m_fParserWaiting = true;
+		RequestData(READ_SIZE);
+	}
+
 	return concurrency::create_task(_openedEvent);
 }
 
@@ -625,71 +755,221 @@ concurrency::task<void> MKVSource::OpenAsync(IMFByteStream *pStream)
 // OnByteStreamRead
 // Called when an asynchronous read completes.
 //
-// Read requests are issued in the RequestData() method.
+// Read requests are issued in the RequestData() method. The callback
+// runs on the demux work queue.
+//
+// The data goes to the prefetch buffer. If the parser is waiting for
+// it, parse; otherwise keep reading ahead.
 //-------------------------------------------------------------------
 HRESULT MKVSource::OnByteStreamRead(IMFAsyncResult *pResult)
 {
-	AutoLock lock(m_critSec);
+	HRESULT hr = S_OK;
+	bool fEndOfStream = false;
 
 	DWORD cbRead = 0;
 
-	IUnknown *pState = nullptr;
+	// While the source is opening, parsing creates the streams and the
+	// presentation descriptor, so we need the source lock too. Only this
+	// thread moves the state out of STATE_OPENING (or Shutdown, which we
+	// check again under the lock).
+	const bool fOpening = (m_state == STATE_OPENING);
+	if (fOpening)
+	{
+		m_critSec.Lock();
+	}
 
-	if (m_state == STATE_SHUTDOWN)
 	{
+		AutoLock lock(m_demuxCritSec);
+
 		// If we are shut down, then we've already released the
 		// byte stream. Nothing to do.
-		return S_OK;
+		if (m_state != STATE_SHUTDOWN)
+		{
+			try
+			{
+				// Complete the read opertation.
+				HRESULT hrRead = m_spByteStream->EndRead(pResult, &cbRead);
+
+				m_fReadPending = false;
+
+				// ReadAttachment waits for the read in flight. No other
+				// read starts until it is done.
+				if (m_fAttachmentRead)
+				{
+					m_readDone.set();
+				}
+
+				// If the source seeked (or stopped) while the read was pending,
+				// the data is from the old position. SeekReads() bumped the
+				// generation, so we discard the data. A cancelled read can also
+				// fail; that is not an error either.
+
+				if (m_cPendingReadGeneration == m_cReadGeneration)
+				{
+					ThrowIfError(hrRead);
+
+					if (cbRead == 0)
+					{
+						// There is no more data in the stream. The parser signals
+						// end-of-stream once it has used up the prefetched data.
+						m_fEndOfFile = true;
+					}
+					else
+					{
+						// Update the end-position of the prefetch buffer.
+						m_PrefetchBuffer->MoveEnd(cbRead);
+					}
+				}
+
+				if (m_fParserWaiting)
+				{
+					// Parse the new data.
+					m_fParserWaiting = false;
+					ParseData();
+				}
+				else
+				{
+					// Keep reading ahead.
+					Prefetch();
+				}
+			}
+			catch (Exception ^exc)
+			{
+				hr = exc->HResult;
+			}
+
+			fEndOfStream = m_fDemuxEndOfStream;
+			m_fDemuxEndOfStream = false;
+		}
 	}
 
-	try
+	if (fOpening)
 	{
-		// Get the state object. This is either nullptr or the most
-		// recent OP_REQUEST_DATA operation.
-		(void)pResult->GetState(&pState);
+		m_critSec.Unlock();
+	}
 
-		// Complete the read opertation.
-		ThrowIfError(m_spByteStream->EndRead(pResult, &cbRead));
+	CompleteDemux(hr, fEndOfStream);
+
+	return S_OK;
+}
 
-		// If the source stops and restarts in rapid succession, there is
-		// a chance this is a "stale" read request, initiated before the
-		// stop/restart.
+//-------------------------------------------------------------------
+// OnDemux
+// Runs a demux pass on the demux work queue.
+//
+// Streams ask for data through OP_REQUEST_DATA operations. The
+// operation only schedules this work item, so the source lock is not
+// held while data is read and parsed, and a stream's RequestSample
+// never waits for the parser.
+//-------------------------------------------------------------------
+HRESULT MKVSource::OnDemux(IMFAsyncResult *pResult)
+{
+	HRESULT hr = S_OK;
+	bool fEndOfStream = false;
 
-		// To ensure that we don't deliver stale data, we store the
-		// OP_REQUEST_DATA operation as a state object in pResult, and compare
-		// this against the current value of m_cRestartCounter.
+	ComPtr<IUnknown> spState;
 
-		// If they don't match, we discard the data.
+	// The state object is the OP_REQUEST_DATA operation that queued us.
+	(void)pResult->GetState(&spState);
 
-		// NOTE: During BeginOpen, pState is nullptr
+	// From here on, a new request must queue another pass.
+	InterlockedExchange(&m_fDemuxPending, FALSE);
 
-		if ((pState == nullptr) || (((SourceOp*)pState)->Data().ulVal == m_cRestartCounter))
-		{
-			// This data is OK to parse.
+	{
+		AutoLock lock(m_demuxCritSec);
 
-			if (cbRead == 0)
+		if (m_state != STATE_SHUTDOWN)
+		{
+			try
 			{
-				// There is no more data in the stream. Signal end-of-stream.
-				EndOfMPEGStream();
+				// Ignore this request if we are already handling an earlier request.
+				// (In that case m_spSampleRequest will be non-nullptr, and the
+				// pending read parses more data when it completes.) Also ignore
+				// it if the source stopped since it was queued; the streams ask
+				// again when they restart.
+				SourceOp *pOp = static_cast<SourceOp*>(spState.Get());
+				if (m_spSampleRequest == nullptr && pOp->Data().ulVal == m_cRestartCounter)
+				{
+					// Store this while the request is pending.
+					m_spSampleRequest = pOp;
+
+					// Try to parse data - this will invoke a read request if needed.
+					ParseData();
+				}
 			}
-			else
+			catch (Exception ^exc)
 			{
-				// Update the end-position of the read buffer.
-				m_ReadBuffer->MoveEnd(cbRead);
-
-				// Parse the new data.
-				ParseData();
+				hr = exc->HResult;
 			}
+
+			fEndOfStream = m_fDemuxEndOfStream;
+			m_fDemuxEndOfStream = false;
 		}
 	}
-	catch (Exception ^exc)
+
+	CompleteDemux(hr, fEndOfStream);
+
+	return S_OK;
+}
+
+//-------------------------------------------------------------------
+// OnReadCompleted
+// Called when an asynchronous read completes, if the source uses the
+// shared scheduler.
+//
+// The byte stream invokes this on the standard work queue. Hand the
+// result to OnByteStreamRead on our task queue.
+//-------------------------------------------------------------------
+HRESULT MKVSource::OnReadCompleted(IMFAsyncResult *pResult)
+{
+	HRESULT hr = m_spTaskQueue->PutResult(&m_OnByteStreamRead, pResult);
+
+	if (FAILED(hr) && hr != MF_E_SHUTDOWN)
 	{
-		StreamingError(exc->HResult);
+		AutoLock lock(m_critSec);
+		StreamingError(hr);
 	}
-
 	return S_OK;
 }
 
+//-------------------------------------------------------------------
+// PutDemuxWorkItem
+// Queues a work item where the demux work runs: the task queue on the
+// shared scheduler, or the private work queue.
+//-------------------------------------------------------------------
+HRESULT MKVSource::PutDemuxWorkItem(IMFAsyncCallback *pCallback, IUnknown *pState)
+{
+	if (m_spTaskQueue != nullptr)
+	{
+		return m_spTaskQueue->PutWorkItem(pCallback, pState);
+	}
+	return MFPutWorkItem2(m_dwDemuxQueue, 0, pCallback, pState);
+}
+
+//-------------------------------------------------------------------
+// CompleteDemux
+// Finishes a demux pass, after the demux lock is released.
+//
+// Reporting an error or the end of the file needs the source lock,
+// which the demux worker may not take while it holds the demux lock.
+//-------------------------------------------------------------------
+void MKVSource::CompleteDemux(HRESULT hr, bool fEndOfStream)
+{
+	if (FAILED(hr))
+	{
+		AutoLock lock(m_critSec);
+		StreamingError(hr);
+	}
+	else if (fEndOfStream)
+	{
+		AutoLock lock(m_critSec);
+		if (m_state != STATE_SHUTDOWN)
+		{
+			EndOfMPEGStream();
+		}
+	}
+}
+
 
 
 /* Private methods */
@@ -698,10 +978,38 @@ MKVSource::MKVSource() :
 OpQueue(m_critSec.m_criticalSection),
 m_cRef(1),
 m_state(STATE_INVALID),
+m_ReadBuffer(nullptr),
+m_PrefetchBuffer(nullptr),
+m_parser(nullptr),
+m_masterData(nullptr),
 m_cRestartCounter(0),
+m_dwDemuxQueue(0),
+m_fDemuxPending(FALSE),
+m_fDemuxEndOfStream(false),
+m_fUseSharedScheduler(false),
+m_qwPrefetchPosition(0),
+m_fReadPending(false),
+m_fParserWaiting(false),
+m_fEndOfFile(false),
+m_cReadGeneration(0),
+m_cPendingReadGeneration(0),
+m_fAttachmentRead(false),
+m_fAttachmentStreamTried(false),
+m_readMode(READ_INTERLEAVED),
+m_cSkipped(0),
+m_qwClusterPosition(0),
+m_qwResumePosition(0),
+m_qwSkipEndPosition(0),
+m_hnsSubtitleStart(0),
 m_OnByteStreamRead(this, &MKVSource::OnByteStreamRead),
+m_OnDemux(this, &MKVSource::OnDemux),
+m_OnReadCompleted(this, &MKVSource::OnReadCompleted),
 m_flRate(1.0f)
 {
+	ZeroMemory(&m_stats, sizeof(m_stats));
+
+	m_spCrcVerifier.Attach(new CrcVerifier());
+
 	auto module = ::Microsoft::WRL::GetModuleBase();
 	if (module != nullptr)
 	{
@@ -716,6 +1024,11 @@ MKVSource::~MKVSource()
 		Shutdown();
 	}
 
+	// The buffers go last: a read that was pending at shutdown writes to
+	// the prefetch buffer, and it holds a reference on the source.
+	delete m_ReadBuffer;
+	delete m_PrefetchBuffer;
+
 	auto module = ::Microsoft::WRL::GetModuleBase();
 	if (module != nullptr)
 	{
@@ -762,10 +1075,10 @@ STDMETHODIMP MKVSource::SetD3DManager(_In_opt_ IUnknown *pManager)
 			ThrowIfError(pManager->QueryInterface(IID_PPV_ARGS(&m_spDeviceManager)));
 		}
 
-		//if (_spStream != nullptr)
-		//{
-		//	_spStream->SetDXGIDeviceManager(m_spDeviceManager.Get());
-		//}
+		for (size_t i = 0; i < m_captionStreams.size(); i++)
+		{
+			m_captionStreams[i]->SetDXGIDeviceManager(m_spDeviceManager.Get());
+		}
 	}
 	catch (Exception ^exc)
 	{
@@ -916,18 +1229,20 @@ void MKVSource::InitPresentationDescriptor()
 	// We should never create a stream we don't support.
 	assert(cStreams == m_streams.GetCount());
 
-	// Ready to create the presentation descriptor.
+	// Ready to create the presentation descriptor. The caption streams
+	// come after the track streams.
+	const DWORD cDescriptors = cStreams + (DWORD)m_captionStreams.size();
 
 	// Create an array of IMFStreamDescriptor pointers.
 	IMFStreamDescriptor **ppSD =
-		new (std::nothrow) IMFStreamDescriptor*[cStreams];
+		new (std::nothrow) IMFStreamDescriptor*[cDescriptors];
 
 	if (ppSD == nullptr)
 	{
 		throw ref new OutOfMemoryException();
 	}
 
-	ZeroMemory(ppSD, cStreams * sizeof(IMFStreamDescriptor*));
+	ZeroMemory(ppSD, cDescriptors * sizeof(IMFStreamDescriptor*));
 
 	Exception ^error;
 	try
@@ -936,34 +1251,36 @@ void MKVSource::InitPresentationDescriptor()
 		// Fill the array by getting the stream descriptors from the streams.
 		for (DWORD i = 0; i < cStreams; i++)
 		{
-			if (i!=2)
 			ThrowIfError(m_streams[i]->GetStreamDescriptor(&ppSD[i]));
 		}
-
-		if (cStreams == 3)
-			cStreams--;
+		for (DWORD i = cStreams; i < cDescriptors; i++)
+		{
+			ThrowIfError(m_captionStreams[i - cStreams]->GetStreamDescriptor(&ppSD[i]));
+		}
 
 		// Create the presentation descriptor.
-		ThrowIfError(MFCreatePresentationDescriptor(cStreams, ppSD,
+		ThrowIfError(MFCreatePresentationDescriptor(cDescriptors, ppSD,
 			&m_spPresentationDescriptor));
 
-		// Select the first video stream (if any).
+		// Select the first video stream and the first audio stream (if any).
+		// Subtitle and caption streams start deselected; the application
+		// selects one.
+		bool fVideoSelected = false;
+		bool fAudioSelected = false;
 		for (DWORD i = 0; i < cStreams; i++)
 		{
 			GUID majorType = GUID_NULL;
 
 			GetStreamMajorType(ppSD[i], &majorType);
-			//if (majorType == MFMediaType_Video)
-			if (i==0)
+			if (majorType == MFMediaType_Video && !fVideoSelected)
 			{
 				ThrowIfError(m_spPresentationDescriptor->SelectStream(i));
-				//break;
+				fVideoSelected = true;
 			}
-			//if (majorType == MFMediaType_Audio)
-			if (i==1)
+			else if (majorType == MFMediaType_Audio && !fAudioSelected)
 			{
 				ThrowIfError(m_spPresentationDescriptor->SelectStream(i));
-				//break;
+				fAudioSelected = true;
 			}
 		}
 
@@ -973,6 +1290,20 @@ void MKVSource::InitPresentationDescriptor()
 			auto duration = m_parser->GetMasterData()->SegInfo->Duration * 1000*1000*1000*10 / m_parser->GetMasterData()->SegInfo->TimecodeScale;
 			ThrowIfError(m_spPresentationDescriptor->SetUINT64(MF_PD_DURATION, duration));
 		}
+		else
+		{
+			// No segment duration: use the longest track, from the statistics tags.
+			LONGLONG hnsDuration = 0;
+			const std::vector<TrackStatistics> &statistics = m_parser->GetMasterData()->Statistics;
+			for (size_t i = 0; i < statistics.size(); i++)
+			{
+				hnsDuration = max(hnsDuration, statistics[i].Duration);
+			}
+			if (hnsDuration > 0)
+			{
+				ThrowIfError(m_spPresentationDescriptor->SetUINT64(MF_PD_DURATION, hnsDuration));
+			}
+		}
 
 		ThrowIfError(m_spPresentationDescriptor->SetString(MF_PD_MIME_TYPE, L"video/x-matroska"));
 
@@ -989,9 +1320,12 @@ void MKVSource::InitPresentationDescriptor()
 
 	if (ppSD != nullptr)
 	{
-		for (DWORD i = 0; i < cStreams; i++)
+		for (DWORD i = 0; i < cDescriptors; i++)
 		{
-			ppSD[i]->Release();
+			if (ppSD[i] != nullptr)
+			{
+				ppSD[i]->Release();
+			}
 		}
 		delete[] ppSD;
 	}
@@ -1178,6 +1512,28 @@ HRESULT MKVSource::ValidateOperation(SourceOp *pOp)
 }
 
 
+//-------------------------------------------------------------------
+// CoalesceOperation
+//
+// Returns true if pOp can be dropped because the operation at the
+// back of the queue (pPending) does the same work.
+//
+// Several streams often ask for data at once. One OP_REQUEST_DATA
+// runs a demux pass that fills every stream, so a second request
+// queued right behind the first adds nothing.
+//
+// NOTE:
+// Overrides OpQueue::CoalesceOperation. Called with the source lock
+// held.
+//-------------------------------------------------------------------
+
+bool MKVSource::CoalesceOperation(SourceOp *pPending, SourceOp *pOp)
+{
+	return (pPending->Op() == SourceOp::OP_REQUEST_DATA) &&
+		(pOp->Op() == SourceOp::OP_REQUEST_DATA);
+}
+
+
 
 //-------------------------------------------------------------------
 // DoStart
@@ -1220,7 +1576,11 @@ void MKVSource::DoStart(StartOp *pOp)
 		auto startPos = pOp->Data().hVal.QuadPart;
 		if (startPos != 0)
 		{
-			m_parser->m_startPosition = *(&pOp->Data());
+			{
+				// The demux worker picks up the seek on its next pass.
+				AutoLock demuxLock(m_demuxCritSec);
+				m_parser->m_startPosition = *(&pOp->Data());
+			}
 			// Queue the "seeked" event. The event data is the seeked position.
 			ThrowIfError(m_spEventQueue->QueueEventParamVar(
 				MESourceSeeked,
@@ -1271,10 +1631,11 @@ void MKVSource::DoStop(SourceOp *pOp)
 {
 	BeginAsyncOp(pOp);
 
+	// Wait for any demux pass in progress; we reset its state below.
+	AutoLock demuxLock(m_demuxCritSec);
+
 	try
 	{
-		QWORD qwCurrentPosition = 0;
-
 		// Stop the active streams.
 		for (DWORD i = 0; i < m_streams.GetCount(); i++)
 		{
@@ -1283,20 +1644,26 @@ void MKVSource::DoStop(SourceOp *pOp)
 				m_streams[i]->Stop();
 			}
 		}
+		for (size_t i = 0; i < m_captionStreams.size(); i++)
+		{
+			if (m_captionStreams[i]->IsActive())
+			{
+				(void)m_captionStreams[i]->Stop();
+			}
+		}
 
 		// Seek to the start of the file. If we restart after stopping,
-		// we will start from the beginning of the file again.
-		ThrowIfError(m_spByteStream->Seek(
-			msoBegin,
-			0,
-			MFBYTESTREAM_SEEK_FLAG_CANCEL_PENDING_IO,
-			&qwCurrentPosition
-			));
+		// we will start from the beginning of the file again. This also
+		// drops prefetched data and makes a pending read "stale".
+		SeekReads(0);
+		ResetReadMode();
+		m_hnsSubtitleStart = 0;
 
 		// Increment the counter that tracks "stale" read requests.
 		++m_cRestartCounter; // This counter is allowed to overflow.
 
 		m_spSampleRequest.Reset();
+		m_fParserWaiting = false;
 
 		m_state = STATE_STOPPED;
 
@@ -1346,6 +1713,13 @@ void MKVSource::DoPause(SourceOp *pOp)
 				m_streams[i]->Pause();
 			}
 		}
+		for (size_t i = 0; i < m_captionStreams.size(); i++)
+		{
+			if (m_captionStreams[i]->IsActive())
+			{
+				ThrowIfError(m_captionStreams[i]->Pause());
+			}
+		}
 
 		m_state = STATE_PAUSED;
 
@@ -1385,6 +1759,13 @@ void MKVSource::DoSetRate(SourceOp *pOp)
 				m_streams[i]->SetRate(pSetRateOp->GetRate());
 			}
 		}
+		for (size_t i = 0; i < m_captionStreams.size(); i++)
+		{
+			if (m_captionStreams[i]->IsActive())
+			{
+				ThrowIfError(m_captionStreams[i]->SetRate(pSetRateOp->GetRate()));
+			}
+		}
 
 		m_flRate = pSetRateOp->GetRate();
 
@@ -1408,21 +1789,20 @@ void MKVSource::DoSetRate(SourceOp *pOp)
 // Called by streams when they need more data.
 //
 // Note: This is an async operation. The stream requests more data
-// by queueing an OP_REQUEST_DATA operation.
+// by queueing an OP_REQUEST_DATA operation. The operation hands the
+// request to the demux work queue (see OnDemux) and completes at once.
 //-------------------------------------------------------------------
 
 void MKVSource::OnStreamRequestSample(SourceOp *pOp)
 {
-	HRESULT hr = S_OK;
-
 	BeginAsyncOp(pOp);
 
-	// Ignore this request if we are already handling an earlier request.
-	// (In that case m_pSampleRequest will be non-nullptr.)
+	// Ignore this request if a demux pass is already queued. That pass
+	// parses until every stream has enough samples.
 
 	try
 	{
-		if (m_spSampleRequest == nullptr)
+		if (InterlockedCompareExchange(&m_fDemuxPending, TRUE, FALSE) == FALSE)
 		{
 			// Add the request counter as data to the operation.
 			// This counter tracks whether a read request becomes "stale."
@@ -1433,11 +1813,12 @@ void MKVSource::OnStreamRequestSample(SourceOp *pOp)
 
 			ThrowIfError(pOp->SetData(var));
 
-			// Store this while the request is pending.
-			m_spSampleRequest = pOp;
-
-			// Try to parse data - this will invoke a read request if needed.
-			ParseData();
+			HRESULT hr = PutDemuxWorkItem(&m_OnDemux, pOp);
+			if (FAILED(hr))
+			{
+				InterlockedExchange(&m_fDemuxPending, FALSE);
+				ThrowException(hr);
+			}
 		}
 	}
 	catch (Exception ^exc)
@@ -1541,6 +1922,33 @@ void MKVSource::SelectStreams(
 			wpStream->Start(varStart);
 		}
 	}
+
+	// The caption streams follow. They do not count toward the pending
+	// EOS: they end as soon as the file does.
+	for (DWORD i = m_streams.GetCount(); i < m_streams.GetCount() + m_captionStreams.size(); i++)
+	{
+		ComPtr<IMFStreamDescriptor> spSD;
+
+		ThrowIfError(pPD->GetStreamDescriptorByIndex(i, &fSelected, &spSD));
+		ThrowIfError(spSD->GetStreamIdentifier(&stream_id));
+
+		CaptionStream *wpCaptionStream = FindCaptionStream(stream_id);
+		if (wpCaptionStream == nullptr)
+		{
+			ThrowException(E_INVALIDARG);
+		}
+
+		fWasSelected = wpCaptionStream->IsActive();
+		wpCaptionStream->Activate(!!fSelected);
+
+		if (fSelected)
+		{
+			MediaEventType met = fWasSelected ? MEUpdatedStream : MENewStream;
+
+			ThrowIfError(m_spEventQueue->QueueEventParamUnk(met, GUID_NULL, S_OK, wpCaptionStream));
+			ThrowIfError(wpCaptionStream->Start(varStart));
+		}
+	}
 }
 
 
@@ -1553,17 +1961,121 @@ void MKVSource::SelectStreams(
 
 void MKVSource::RequestData(DWORD cbRequest)
 {
-	// Reserve a sufficient read buffer.
-	m_ReadBuffer->Reserve(cbRequest);
+	// One read at a time. If a read is pending, its completion picks up
+	// where we are. ReadAttachment restarts the reads when it is done.
+	if (m_fReadPending || m_fEndOfFile || m_fAttachmentRead)
+	{
+		return;
+	}
+
+	// Reserve a sufficient prefetch buffer. (It is not touched while the
+	// read is pending, other than consuming data from the front.)
+	m_PrefetchBuffer->Reserve(cbRequest);
 
 	// Submit the async read request.
-	// When it completes, our OnByteStreamRead method will be invoked.
+	// When it completes, our OnByteStreamRead method will be invoked
+	// (through OnReadCompleted, if we use the shared scheduler).
 
 	ThrowIfError(m_spByteStream->BeginRead(
-		m_ReadBuffer->DataPtr + m_ReadBuffer->DataSize,
+		m_PrefetchBuffer->DataPtr() + m_PrefetchBuffer->DataSize(),
 		cbRequest,
-		&m_OnByteStreamRead,
-		m_spSampleRequest.Get()
+		(m_spTaskQueue != nullptr) ? &m_OnReadCompleted : &m_OnByteStreamRead,
+		nullptr
+		));
+
+	m_fReadPending = true;
+	m_cPendingReadGeneration = m_cReadGeneration;
+}
+
+
+//-------------------------------------------------------------------
+// Prefetch
+// Reads ahead of the parser, up to PREFETCH_SIZE bytes.
+//
+// Reading and parsing overlap: while the parser works on the read
+// buffer, the next data is already on its way.
+//-------------------------------------------------------------------
+
+void MKVSource::Prefetch()
+{
+	if (m_state != STATE_OPENING && m_PrefetchBuffer->DataSize() < PREFETCH_SIZE)
+	{
+		RequestData(PREFETCH_READ_SIZE);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// TakePrefetchedData
+// Moves the prefetched data to the end of the read buffer.
+//
+// Returns false if there is no prefetched data.
+//-------------------------------------------------------------------
+
+bool MKVSource::TakePrefetchedData()
+{
+	DWORD cb = m_PrefetchBuffer->DataSize();
+	if (cb == 0)
+	{
+		return false;
+	}
+
+	m_ReadBuffer->Reserve(cb);
+	CopyMemory(m_ReadBuffer->DataPtr() + m_ReadBuffer->DataSize(), m_PrefetchBuffer->DataPtr(), cb);
+	m_ReadBuffer->MoveEnd(cb);
+
+	m_PrefetchBuffer->MoveStart(cb);
+	m_qwPrefetchPosition += cb;
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// SkipData
+// Skips cb bytes that follow the read buffer.
+//
+// Uses the prefetched data if it covers them; otherwise seeks.
+//-------------------------------------------------------------------
+
+void MKVSource::SkipData(DWORD cb)
+{
+	if (cb <= m_PrefetchBuffer->DataSize())
+	{
+		m_PrefetchBuffer->MoveStart(cb);
+		m_qwPrefetchPosition += cb;
+	}
+	else
+	{
+		SeekReads(m_qwPrefetchPosition + cb);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// SeekReads
+// Moves the read position of the byte stream.
+//
+// Prefetched data is dropped, and a pending read becomes "stale": its
+// data is discarded when it completes. The caller is responsible for
+// the contents of the read buffer.
+//-------------------------------------------------------------------
+
+void MKVSource::SeekReads(QWORD qwPosition)
+{
+	QWORD qwCurrentPosition = 0;
+
+	++m_cReadGeneration; // This counter is allowed to overflow.
+
+	m_PrefetchBuffer->MoveStart(m_PrefetchBuffer->DataSize());
+	m_qwPrefetchPosition = qwPosition;
+	m_fEndOfFile = false;
+
+	ThrowIfError(m_spByteStream->Seek(
+		msoBegin,
+		qwPosition,
+		MFBYTESTREAM_SEEK_FLAG_CANCEL_PENDING_IO,
+		&qwCurrentPosition
 		));
 }
 
@@ -1589,20 +2101,34 @@ void MKVSource::ParseData()
 		DWORD cbAte = 0;    // How much data we consumed from the read buffer.
 
 		//if the master data parsing is done, load it up
-		if (m_masterData == nullptr && m_parser->HasFinishedParsedData)
+		if (m_masterData == nullptr && m_parser->HasFinishedParsedData())
 		{
 			m_masterData = m_parser->GetMasterData();
 		}
 
-		if (m_parser->IsEndOfStream)
+		if (m_parser->IsEndOfStream())
 		{
-			// The parser reached the end of the MPEG-1 stream. Notify the streams.
-			EndOfMPEGStream();
+			// The parser reached the end of the MPEG-1 stream. The streams are
+			// notified once the demux lock is released (see CompleteDemux).
+			m_fDemuxEndOfStream = true;
+			break;
 		}
-		else if (m_parser->HasFrames)
+		else if (m_parser->HasFrames())
 		{
 			// The parser reached the start of a new block (or block group).
-			fNeedMoreData = !ReadPayload(&cbAte, &cbNextRequest);
+			// Check whether its stream can take the frame. If not, stop here;
+			// that stream asks for data again once it has delivered some samples.
+			bool fSkip = false;
+			if (!ScheduleFrame(&fSkip))
+			{
+				break;
+			}
+
+			// (ScheduleFrame drops the frame if it seeks back.)
+			if (m_parser->HasFrames())
+			{
+				fNeedMoreData = !ReadPayload(&cbAte, &cbNextRequest, fSkip);
+			}
 		}
 		else if (m_parser->m_startPosition.hVal.QuadPart > 0)    // FOR SEEKING
 		{
@@ -1611,21 +2137,42 @@ void MKVSource::ParseData()
 			m_parser->m_jumpTo = jumpToBytePosition;
 			//fNeedMoreData = true;
 			//auto hr = m_spByteStream->SetCurrentPosition(jumpToBytePosition);
-			//m_ReadBuffer->MoveStart(m_ReadBuffer->DataSize);  //dump the rest of the read buffer
+			//m_ReadBuffer->MoveStart(m_ReadBuffer->DataSize());  //dump the rest of the read buffer
 			//clear the position
+			ResetReadMode();
+
+			// Cues that started before the seek position and still show are
+			// in the store, if that part of the file was read before.
+			m_hnsSubtitleStart = m_parser->m_startPosition.hVal.QuadPart;
+			DeliverActiveSubtitleCues(m_hnsSubtitleStart);
+
 			m_parser->m_startPosition.hVal.QuadPart = 0;
 		}
 		else
 		{
 			// Parse more data.
-			fNeedMoreData = !m_parser->ParseBytes(m_ReadBuffer->DataPtr, m_ReadBuffer->DataSize, &cbAte);
-		}
+			QWORD qwBufferPosition = FramePosition();
+
+			m_parser->m_bufferPosition = qwBufferPosition;
+			fNeedMoreData = !m_parser->ParseBytes(m_ReadBuffer->DataPtr(), m_ReadBuffer->DataSize(), &cbAte);
+
+			if (m_parser->m_isNewCluster)
+			{
+				m_parser->m_isNewCluster = false;
+				m_qwClusterPosition = qwBufferPosition + m_parser->m_clusterOffset;
+			}
+
+			if (!m_parser->m_parsedCues.empty())
+			{
+				DeliverParsedSubtitleCues();
+			}
+		}
 
 		if (m_parser->m_jumpFlag)
 		{
 			m_parser->m_jumpFlag = false;
-			auto hr = m_spByteStream->SetCurrentPosition(m_parser->m_jumpTo);
-			m_ReadBuffer->MoveStart(m_ReadBuffer->DataSize);
+			SeekReads(m_parser->m_jumpTo);
+			m_ReadBuffer->MoveStart(m_ReadBuffer->DataSize());
 		}
 		else
 		{
@@ -1634,11 +2181,14 @@ void MKVSource::ParseData()
 		}
 
 		// case where reached end of file after parsing... need to restart at Cluster data
-		if (m_ReadBuffer->DataSize == 0 && !m_parser->HasFinishedParsedData && !fNeedMoreData)
+		// (Only once the Cues are read: a read can also end right after
+		// a master element in the middle of the file.)
+		if (m_ReadBuffer->DataSize() == 0 && !m_parser->HasFinishedParsedData() && !fNeedMoreData
+			&& !m_parser->GetMasterData()->Cues.empty())
 		{
 			m_parser->m_isFinishedParsingMaster = true;
 			m_masterData = m_parser->GetMasterData();
-			auto hr = m_spByteStream->SetCurrentPosition(m_masterData->Cues[0]->CueTrackPositions[0]->CueClusterPosition + m_masterData->SegmentPosition);
+			SeekReads(m_masterData->Cues[0]->CueTrackPositions[0]->CueClusterPosition + m_masterData->SegmentPosition);
 
 			CreateStreams();
 
@@ -1647,9 +2197,34 @@ void MKVSource::ParseData()
 		}
 
 
-		// If we need more data, start an async read operation.
+		// If we need more data, take what has been prefetched. If there is
+		// none, wait for the read.
 		if (fNeedMoreData)
 		{
+			if (TakePrefetchedData())
+			{
+				fNeedMoreData = false;
+				continue;
+			}
+
+			if (m_fEndOfFile && m_readMode == READ_SKIP_TRACKS)
+			{
+				// Go back for the frames that were skipped.
+				SeekBackToSkippedFrames();
+				fNeedMoreData = false;
+				continue;
+			}
+
+			if (m_fEndOfFile)
+			{
+				// Nothing more to read. The streams are notified once the demux
+				// lock is released (see CompleteDemux).
+				m_fDemuxEndOfStream = true;
+				fNeedMoreData = false;
+				break;
+			}
+
+			m_fParserWaiting = true;
 			RequestData(max(READ_SIZE, cbNextRequest));
 
 			// Break from the loop because we need to wait for the async read to complete.
@@ -1666,6 +2241,9 @@ void MKVSource::ParseData()
 	{
 		m_spSampleRequest.Reset();
 	}
+
+	// Read ahead while the streams use up their samples.
+	Prefetch();
 }
 
 //-------------------------------------------------------------------
@@ -1677,161 +2255,1302 @@ void MKVSource::ParseData()
 // - We have the packet header, but not necessarily the entire payload.
 //-------------------------------------------------------------------
 
-bool MKVSource::ReadPayload(DWORD *pcbAte, DWORD *pcbNextRequest)
+bool MKVSource::ReadPayload(DWORD *pcbAte, DWORD *pcbNextRequest, bool fSkip)
+{
+	assert(m_parser != nullptr);
+	assert(m_parser->HasFrames());
+	bool fResult = true;
+	DWORD cbPayloadRead = 0;
+	DWORD cbPayloadUnread = 0;
+
+	m_parser->m_currentFrameSize = *m_parser->pCircRead;
+	auto skipBytes = 0;//*m_parser->pCircReadPosition;
+	//m_parser->m_currentFrameSize = m_parser->GetFrameSizeQueue().front();
+
+	// At this point, the read buffer might be larger or smaller than the payload.
+	// Calculate which portion of the payload has been read.
+	if (m_parser->m_currentFrameSize + skipBytes > m_ReadBuffer->DataSize())
+	{
+		cbPayloadUnread = m_parser->m_currentFrameSize + skipBytes - m_ReadBuffer->DataSize();
+	}
+
+	cbPayloadRead = m_parser->m_currentFrameSize + skipBytes - cbPayloadUnread;
+
+	// Do we need to deliver this payload?
+	if (fSkip || !IsStreamActive(MPEG1PacketHeader()))
+	{
+		// Skip this payload. Skip the unread portion of the payload.
+		SkipData(cbPayloadUnread);
+
+		// Advance the data buffer to the end of payload, or the portion
+		// that has been read.
+
+		*pcbAte = cbPayloadRead;
+
+		// Tell the parser that we are done with this packet.
+
+		m_parser->pCircRead++;
+		//m_parser->pCircReadPosition++;
+		if ((m_parser->pCircRead - &m_parser->m_circularBuffer[0]) == m_parser->m_cirBufferLength)
+		{
+			m_parser->pCircRead = &m_parser->m_circularBuffer[0];
+			//m_parser->pCircReadPosition = &m_parser->m_circularBufferPosition[0];
+		}
+		m_parser->m_frameCount--;
+		//m_parser->PopFrameSizeQueue();
+		//if (m_parser->GetFrameSizeQueue().size() == 0)
+		if (m_parser->m_frameCount == 0)
+			m_parser->ClearFrames();
+	}
+	else if (cbPayloadUnread > 0)
+	{
+		// Some portion of this payload has not been read. Schedule a read.
+		*pcbNextRequest = cbPayloadUnread;
+
+		*pcbAte = 0;
+
+		fResult = false; // Need more data.
+	}
+	else
+	{
+		// The entire payload is in the data buffer. Deliver the packet.
+		DeliverPayload();
+
+		*pcbAte = cbPayloadRead;
+
+		// Tell the parser that we are done with this packet.
+		int trackIndex = -1;
+		for (int i = 0; i < m_parser->GetMasterData()->Tracks.size(); ++i)
+		{
+			if (m_parser->GetMasterData()->Tracks[i]->TrackNumber == m_parser->m_currentStream)
+				trackIndex = i;
+		}
+		m_parser->m_currentTimeStamp = m_parser->m_currentTimeStamp + m_parser->GetMasterData()->Tracks[trackIndex]->DefaultDuration / 1000000;
+
+		m_parser->pCircRead++;
+		//m_parser->pCircReadPosition++;
+		if ((m_parser->pCircRead - &m_parser->m_circularBuffer[0]) == m_parser->m_cirBufferLength)
+		{
+			m_parser->pCircRead = &m_parser->m_circularBuffer[0];
+			//m_parser->pCircReadPosition = &m_parser->m_circularBufferPosition[0];
+		}
+		m_parser->m_frameCount--;
+		if (m_parser->m_frameCount == 0)
+			m_parser->ClearFrames();
+		/*m_parser->PopFrameSizeQueue();
+		if (m_parser->GetFrameSizeQueue().size() == 0)
+			m_parser->ClearFrames();*/
+	}
+
+	return fResult;
+}
+
+//-------------------------------------------------------------------
+// EndOfMPEGStream:
+// Called when the parser reaches the end of the MPEG1 stream.
+//-------------------------------------------------------------------
+
+void MKVSource::EndOfMPEGStream()
+{
+	// Notify the streams. The streams might have pending samples.
+	// When each stream delivers the last sample, it will send the
+	// end-of-stream event to the pipeline and then notify the
+	// source.
+
+	// When every stream is done, the source sends the end-of-
+	// presentation event.
+
+	for (DWORD i = 0; i < m_streams.GetCount(); i++)
+	{
+		if (m_streams[i]->IsActive())
+		{
+			m_streams[i]->EndOfStream();
+		}
+	}
+
+	for (size_t i = 0; i < m_captionStreams.size(); i++)
+	{
+		if (m_captionStreams[i]->IsActive())
+		{
+			ThrowIfError(m_captionStreams[i]->EndOfStream());
+		}
+	}
+}
+
+
+
+//-------------------------------------------------------------------
+// StreamsNeedData:
+// Returns TRUE if any streams need more data.
+//-------------------------------------------------------------------
+
+bool MKVSource::StreamsNeedData() const
+{
+	bool fNeedData = false;
+
+	switch (m_state)
+	{
+	case STATE_OPENING:
+		// While opening, we always need data (until we get enough
+		// to complete the open operation).
+		return true;
+
+	case STATE_SHUTDOWN:
+		// While shut down, we never need data.
+		return false;
+
+	default:
+		// If none of the above, ask the streams.
+		for (DWORD i = 0; i < m_streams.GetCount(); i++)
+		{
+			if (m_streams[i]->NeedsData())
+			{
+				fNeedData = true;
+				break;
+			}
+		}
+		return fNeedData;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ScheduleFrame
+// Decides what to do with the parser's current frame.
+//
+// Returns false if the demux should stop until a stream asks for more
+// data. Otherwise *pfSkip says whether to skip the frame. If this
+// method seeks back for skipped frames, the parser has no frames left.
+//-------------------------------------------------------------------
+
+bool MKVSource::ScheduleFrame(bool *pfSkip)
+{
+	*pfSkip = false;
+
+	MKVStream *wpStream = m_streams.Find(m_parser->m_currentStream);   // not AddRef'd
+	if (wpStream == nullptr || !wpStream->IsActive())
+	{
+		// ReadPayload skips the frame (or creates the stream, while opening).
+		return true;
+	}
+
+	QWORD qwFrame = FramePosition();
+	int iSkipped = FindSkippedTrack(m_parser->m_currentStream);
+
+	if (m_readMode == READ_REREAD_TRACKS)
+	{
+		if (qwFrame >= m_qwSkipEndPosition)
+		{
+			// Back where we stopped skipping. Everything from here on is new.
+			ResetReadMode();
+		}
+		else if (iSkipped < 0 || qwFrame < m_skipped[iSkipped].qwFirstFrame)
+		{
+			// This frame was delivered before we seeked back.
+			*pfSkip = true;
+			return true;
+		}
+		else if (IsOverBuffered(wpStream))
+		{
+			++m_stats.cBackPressure;
+			return false;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	if (m_readMode == READ_SKIP_TRACKS)
+	{
+		if (!UnskippedStreamsNeedData(false))
+		{
+			// The other streams hold enough now. Go back for the skipped frames.
+			SeekBackToSkippedFrames();
+			return true;
+		}
+
+		if (iSkipped >= 0)
+		{
+			++m_stats.cSkippedFrames;
+			*pfSkip = true;
+			return true;
+		}
+	}
+
+	if (!IsOverBuffered(wpStream))
+	{
+		return true;
+	}
+
+	// The stream holds enough. If no other stream starves, wait until
+	// this one delivers some samples. Otherwise, the file is interleaved
+	// badly enough that waiting would stall playback: skip this track for
+	// now, and come back for it later. That needs a cluster to come back to.
+
+	if (!UnskippedStreamsNeedData(true) || m_qwClusterPosition == 0 || m_cSkipped == MAX_STREAMS)
+	{
+		++m_stats.cBackPressure;
+		return false;
+	}
+
+	if (m_readMode == READ_INTERLEAVED)
+	{
+		m_readMode = READ_SKIP_TRACKS;
+		m_qwResumePosition = m_qwClusterPosition;
+		++m_stats.cSeekAndRead;
+	}
+
+	m_skipped[m_cSkipped].track = m_parser->m_currentStream;
+	m_skipped[m_cSkipped].qwFirstFrame = qwFrame;
+	++m_cSkipped;
+
+	++m_stats.cSkippedFrames;
+	*pfSkip = true;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// SeekBackToSkippedFrames
+// Ends READ_SKIP_TRACKS: seeks back to the cluster of the first
+// skipped frame, and starts READ_REREAD_TRACKS.
+//-------------------------------------------------------------------
+
+void MKVSource::SeekBackToSkippedFrames()
+{
+	assert(m_readMode == READ_SKIP_TRACKS);
+
+	m_qwSkipEndPosition = m_parser->HasFrames() ? FramePosition() : m_qwPrefetchPosition;
+	m_readMode = READ_REREAD_TRACKS;
+
+	m_parser->DiscardFrames();
+	SeekReads(m_qwResumePosition);
+	m_ReadBuffer->MoveStart(m_ReadBuffer->DataSize());
+}
+
+
+//-------------------------------------------------------------------
+// ResetReadMode
+// Goes back to delivering frames in file order. Called when the
+// demux catches up, and when the read position changes (seek, stop).
+//-------------------------------------------------------------------
+
+void MKVSource::ResetReadMode()
+{
+	m_readMode = READ_INTERLEAVED;
+	m_cSkipped = 0;
+}
+
+
+//-------------------------------------------------------------------
+// FindSkippedTrack
+// Returns the index of the track in m_skipped, or -1.
+//-------------------------------------------------------------------
+
+int MKVSource::FindSkippedTrack(int track) const
+{
+	for (DWORD i = 0; i < m_cSkipped; i++)
+	{
+		if (m_skipped[i].track == track)
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+
+//-------------------------------------------------------------------
+// UnskippedStreamsNeedData
+// Returns true if an active stream that is not being skipped needs
+// data (fStarving == false), or has none for a waiting request
+// (fStarving == true).
+//-------------------------------------------------------------------
+
+bool MKVSource::UnskippedStreamsNeedData(bool fStarving) const
+{
+	for (DWORD i = 0; i < m_streams.GetCount(); i++)
+	{
+		if (FindSkippedTrack(m_streams.GetId(i)) >= 0)
+		{
+			continue;
+		}
+
+		if (fStarving ? m_streams[i]->IsStarving() : m_streams[i]->NeedsData())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+// IsOverBuffered
+// Returns true if the stream should not take more samples now.
+//
+// A stream is over-buffered if its queue is full, if it holds
+// BUFFER_MAX_DURATION, or if the source is over MEMORY_BUDGET. A stream
+// below its target is never over-buffered, apart from a full queue:
+// that would stall playback to save memory.
+//-------------------------------------------------------------------
+
+bool MKVSource::IsOverBuffered(MKVStream *pStream) const
+{
+	if (pStream->IsQueueFull())
+	{
+		return true;
+	}
+
+	if (pStream->NeedsData())
+	{
+		return false;
+	}
+
+	if (pStream->BufferedDuration() >= BUFFER_MAX_DURATION)
+	{
+		return true;
+	}
+
+	LONGLONG cbTotal = m_ReadBuffer->DataSize() + m_PrefetchBuffer->DataSize();
+	for (DWORD i = 0; i < m_streams.GetCount(); i++)
+	{
+		cbTotal += m_streams[i]->BufferedBytes();
+	}
+
+	return (cbTotal >= MEMORY_BUDGET);
+}
+
+
+//-------------------------------------------------------------------
+// GetPrefetchStats
+// Returns how often the demux used each read strategy.
+//-------------------------------------------------------------------
+
+void MKVSource::GetPrefetchStats(PrefetchStats *pStats)
+{
+	assert(pStats != nullptr);
+
+	AutoLock demuxLock(m_demuxCritSec);
+
+	*pStats = m_stats;
+}
+
+
+//-------------------------------------------------------------------
+// SetCrcVerification
+// Turns CRC-32 checking on or off.
+//-------------------------------------------------------------------
+
+void MKVSource::SetCrcVerification(CrcVerifyMode mode)
+{
+	m_spCrcVerifier->SetMode(mode);
+}
+
+
+//-------------------------------------------------------------------
+// GetCrcCounters
+// Returns the CRC-32 check results, per element ID.
+//-------------------------------------------------------------------
+
+void MKVSource::GetCrcCounters(std::vector<CrcCounters> *pCounters)
+{
+	m_spCrcVerifier->GetCounters(pCounters);
+}
+
+
+//-------------------------------------------------------------------
+// GetCrcFailures
+// Returns the elements whose CRC-32 did not match.
+//-------------------------------------------------------------------
+
+void MKVSource::GetCrcFailures(std::vector<CrcFailure> *pFailures)
+{
+	m_spCrcVerifier->GetFailures(pFailures);
+}
+
+
+//-------------------------------------------------------------------
+// GetSubtitleCues
+// Returns the subtitle cues of a track that show at hnsTime.
+//-------------------------------------------------------------------
+
+void MKVSource::GetSubtitleCues(DWORD dwTrack, LONGLONG hnsTime, std::vector<SubtitleCue> *pCues)
+{
+	// The store has its own lock.
+	m_subtitles.FindActive(dwTrack, hnsTime, pCues);
+}
+
+
+//-------------------------------------------------------------------
+// GetNextSubtitleCue
+// Returns the next subtitle cue of a track after hnsTime.
+//-------------------------------------------------------------------
+
+bool MKVSource::GetNextSubtitleCue(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue)
+{
+	return m_subtitles.FindNext(dwTrack, hnsTime, pCue);
+}
+
+
+//-------------------------------------------------------------------
+// GetSubtitleTrackFormat
+// Returns the subtitle format and CodecPrivate data of a track.
+//-------------------------------------------------------------------
+
+SubtitleFormat MKVSource::GetSubtitleTrackFormat(DWORD dwTrack, const BYTE **ppCodecPrivate, DWORD *pcbCodecPrivate)
+{
+	AutoLock lock(m_critSec);
+
+	*ppCodecPrivate = nullptr;
+	*pcbCodecPrivate = 0;
+
+	if (m_masterData == nullptr)
+	{
+		return SUBTITLE_NONE;
+	}
+
+	for (size_t i = 0; i < m_masterData->Tracks.size(); i++)
+	{
+		TrackData *pTrack = m_masterData->Tracks[i];
+		if (pTrack->TrackNumber == dwTrack && pTrack->TrackType == 0x11)
+		{
+			*ppCodecPrivate = pTrack->CodecPrivate;
+			*pcbCodecPrivate = pTrack->CodecPrivateLength;
+			return GetSubtitleFormat(pTrack->CodecID);
+		}
+	}
+
+	return SUBTITLE_NONE;
+}
+
+
+//-------------------------------------------------------------------
+// IMKVSubtitleCues methods
+//-------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+// GetCuesAt
+// Returns the subtitle cues of a track that show at hnsTime, in an
+// array the caller frees with CoTaskMemFree.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetCuesAt(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue **ppCues, DWORD *pcCues)
+{
+	if (ppCues == nullptr || pcCues == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*ppCues = nullptr;
+	*pcCues = 0;
+
+	HRESULT hr = S_OK;
+	{
+		AutoLock lock(m_critSec);
+		hr = CheckShutdown();
+	}
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	try
+	{
+		std::vector<SubtitleCue> cues;
+		GetSubtitleCues(dwTrack, hnsTime, &cues);
+
+		hr = CopyToTaskMem(cues, ppCues, pcCues);
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetCueAfter
+// Returns the next known subtitle cue of a track after hnsTime, or
+// S_FALSE.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetCueAfter(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue)
+{
+	if (pCue == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	HRESULT hr = S_OK;
+	{
+		AutoLock lock(m_critSec);
+		hr = CheckShutdown();
+	}
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	return GetNextSubtitleCue(dwTrack, hnsTime, pCue) ? S_OK : S_FALSE;
+}
+
+
+//-------------------------------------------------------------------
+// GetSubtitleTrackInfo
+// Returns the subtitle format and CodecPrivate data of a track.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetSubtitleTrackInfo(DWORD dwTrack, SubtitleFormat *pFormat, const BYTE **ppCodecPrivate, DWORD *pcbCodecPrivate)
+{
+	if (pFormat == nullptr || ppCodecPrivate == nullptr || pcbCodecPrivate == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoLock lock(m_critSec);
+
+	HRESULT hr = CheckShutdown();
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	*pFormat = GetSubtitleTrackFormat(dwTrack, ppCodecPrivate, pcbCodecPrivate);
+	return (*pFormat != SUBTITLE_NONE) ? S_OK : MF_E_INVALIDSTREAMNUMBER;
+}
+
+
+//-------------------------------------------------------------------
+// IMKVChapters methods
+//-------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+// GetEditionCount
+// Returns the number of chapter editions.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetEditionCount(DWORD *pcEditions)
+{
+	if (pcEditions == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoLock lock(m_critSec);
+
+	HRESULT hr = CheckShutdown();
+	if (SUCCEEDED(hr))
+	{
+		*pcEditions = GetChapterEditionCount();
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetDefaultEdition
+// Returns the index of the edition to play by default.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetDefaultEdition(DWORD *pdwEdition)
+{
+	if (pdwEdition == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoLock lock(m_critSec);
+
+	HRESULT hr = CheckShutdown();
+	if (SUCCEEDED(hr))
+	{
+		*pdwEdition = GetDefaultChapterEdition();
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetChapter
+// Returns a chapter, the cluster to read from to play it, and its
+// title in a string the caller frees with CoTaskMemFree.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetChapter(DWORD dwEdition, LONGLONG hnsTime, ChapterQuery query, MKVChapterInfo *pInfo)
+{
+	if (pInfo == nullptr)
+	{
+		return E_POINTER;
+	}
+	if (query != CHAPTER_AT && query != CHAPTER_NEXT && query != CHAPTER_PREVIOUS)
+	{
+		return E_INVALIDARG;
+	}
+
+	ZeroMemory(pInfo, sizeof(*pInfo));
+
+	HRESULT hr = S_OK;
+
+	try
+	{
+		Chapter chapter;
+		QWORD qwPosition = 0;
+
+		if (dwEdition >= GetChapterEditionCount())
+		{
+			ThrowException(E_INVALIDARG);
+		}
+		if (!FindChapter(dwEdition, hnsTime, query, &chapter, &qwPosition))
+		{
+			return S_FALSE;
+		}
+
+		int cch = 0;
+		if (!chapter.title.empty())
+		{
+			cch = MultiByteToWideChar(CP_UTF8, 0, chapter.title.data(), (int)chapter.title.size(), nullptr, 0);
+		}
+
+		LPWSTR pszTitle = (LPWSTR)CoTaskMemAlloc((cch + 1) * sizeof(WCHAR));
+		if (pszTitle == nullptr)
+		{
+			ThrowException(E_OUTOFMEMORY);
+		}
+		if (cch > 0)
+		{
+			MultiByteToWideChar(CP_UTF8, 0, chapter.title.data(), (int)chapter.title.size(), pszTitle, cch);
+		}
+		pszTitle[cch] = L'\0';
+
+		pInfo->uid = chapter.uid;
+		pInfo->hnsStart = chapter.hnsStart;
+		pInfo->hnsEnd = chapter.hnsEnd;
+		pInfo->depth = chapter.depth;
+		pInfo->qwPosition = qwPosition;
+		pInfo->pszTitle = pszTitle;
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// IMKVCrcResults methods
+//-------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+// SetVerifyMode
+// Turns the CRC-32 checks off, or on (inline or in the background).
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::SetVerifyMode(CrcVerifyMode mode)
+{
+	if (mode != CRC_VERIFY_OFF && mode != CRC_VERIFY_INLINE && mode != CRC_VERIFY_BACKGROUND)
+	{
+		return E_INVALIDARG;
+	}
+
+	AutoLock lock(m_critSec);
+
+	HRESULT hr = CheckShutdown();
+	if (SUCCEEDED(hr))
+	{
+		SetCrcVerification(mode);
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetCounters
+// Returns the CRC-32 check results, per element ID, in an array the
+// caller frees with CoTaskMemFree.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetCounters(CrcCounters **ppCounters, DWORD *pcCounters)
+{
+	if (ppCounters == nullptr || pcCounters == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*ppCounters = nullptr;
+	*pcCounters = 0;
+
+	HRESULT hr = S_OK;
+	{
+		AutoLock lock(m_critSec);
+		hr = CheckShutdown();
+	}
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	try
+	{
+		// The verifier has its own lock.
+		std::vector<CrcCounters> counters;
+		GetCrcCounters(&counters);
+
+		hr = CopyToTaskMem(counters, ppCounters, pcCounters);
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetFailures
+// Returns the elements whose CRC-32 did not match, in an array the
+// caller frees with CoTaskMemFree.
+//-------------------------------------------------------------------
+
+HRESULT MKVSource::GetFailures(CrcFailure **ppFailures, DWORD *pcFailures)
+{
+	if (ppFailures == nullptr || pcFailures == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	*ppFailures = nullptr;
+	*pcFailures = 0;
+
+	HRESULT hr = S_OK;
+	{
+		AutoLock lock(m_critSec);
+		hr = CheckShutdown();
+	}
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	try
+	{
+		std::vector<CrcFailure> failures;
+		GetCrcFailures(&failures);
+
+		hr = CopyToTaskMem(failures, ppFailures, pcFailures);
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
+
+	return hr;
+}
+
+
+//-------------------------------------------------------------------
+// GetChapterEditionCount
+// Returns the number of chapter editions.
+//-------------------------------------------------------------------
+
+DWORD MKVSource::GetChapterEditionCount()
+{
+	// The index has its own lock.
+	return m_chapters.GetEditionCount();
+}
+
+
+//-------------------------------------------------------------------
+// GetDefaultChapterEdition
+// Returns the index of the edition to play by default.
+//-------------------------------------------------------------------
+
+DWORD MKVSource::GetDefaultChapterEdition()
+{
+	return m_chapters.GetDefaultEdition();
+}
+
+
+//-------------------------------------------------------------------
+// FindChapter
+// Finds a chapter, and the cluster to read from to play it.
+//
+// pqwPosition: Receives the file offset of the cluster, or 0 if the
+// Cues are not known. Can be nullptr.
+//-------------------------------------------------------------------
+
+bool MKVSource::FindChapter(DWORD edition, LONGLONG hnsTime, ChapterQuery query, Chapter *pChapter, QWORD *pqwPosition)
+{
+	assert(pChapter != nullptr);
+
+	bool fFound = false;
+
+	switch (query)
+	{
+	case CHAPTER_AT:
+		fFound = m_chapters.FindAt(edition, hnsTime, pChapter);
+		break;
+
+	case CHAPTER_NEXT:
+		fFound = m_chapters.FindNext(edition, hnsTime, pChapter);
+		break;
+
+	case CHAPTER_PREVIOUS:
+		fFound = m_chapters.FindPrevious(edition, hnsTime, pChapter);
+		break;
+	}
+
+	if (fFound && pqwPosition != nullptr)
+	{
+		AutoLock lock(m_critSec);
+
+		ThrowIfError(CheckShutdown());
+
+		AutoLock demuxLock(m_demuxCritSec);
+
+		*pqwPosition = m_parser->FindCuePosition(pChapter->hnsStart);
+	}
+
+	return fFound;
+}
+
+
+//-------------------------------------------------------------------
+// GetAttachmentCount
+// Returns the number of attachments found so far.
+//-------------------------------------------------------------------
+
+DWORD MKVSource::GetAttachmentCount()
+{
+	AutoLock lock(m_critSec);
+
+	ThrowIfError(CheckShutdown());
+
+	AutoLock demuxLock(m_demuxCritSec);
+
+	return (DWORD)m_parser->GetMasterData()->Attachments.size();
+}
+
+
+//-------------------------------------------------------------------
+// GetAttachment
+// Returns the name, type and location of an attachment.
+//-------------------------------------------------------------------
+
+void MKVSource::GetAttachment(DWORD index, AttachedFile *pFile)
+{
+	assert(pFile != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	ThrowIfError(CheckShutdown());
+
+	AutoLock demuxLock(m_demuxCritSec);
+
+	const std::vector<AttachedFile*> &attachments = m_parser->GetMasterData()->Attachments;
+	if (index >= attachments.size())
+	{
+		ThrowException(E_INVALIDARG);
+	}
+
+	*pFile = *attachments[index];
+}
+
+
+//-------------------------------------------------------------------
+// ReadAttachment
+// Reads the data of an attachment from the file.
+//
+// Fonts can be tens of megabytes, so the read does not hold the source
+// locks. The byte stream has one position, shared with the read-ahead:
+// if the app's stream can be cloned, the read goes through the clone;
+// otherwise it waits for the read in flight (see ReadAfterPendingRead).
+//-------------------------------------------------------------------
+
+void MKVSource::ReadAttachment(DWORD index, std::vector<BYTE> *pData)
+{
+	assert(pData != nullptr);
+
+	AutoLock attachmentLock(m_attachmentCritSec);
+
+	ComPtr<IMFByteStream> spStream;
+	QWORD qwPosition = 0;
+	QWORD cbData = 0;
+
+	{
+		AutoLock lock(m_critSec);
+
+		ThrowIfError(CheckShutdown());
+
+		AutoLock demuxLock(m_demuxCritSec);
+
+		const std::vector<AttachedFile*> &attachments = m_parser->GetMasterData()->Attachments;
+		if (index >= attachments.size())
+		{
+			ThrowException(E_INVALIDARG);
+		}
+
+		const AttachedFile *pFile = attachments[index];
+		if (pFile->DataSize > MAX_ATTACHMENT_SIZE)
+		{
+			ThrowException(E_OUTOFMEMORY);
+		}
+		qwPosition = pFile->DataPosition;
+		cbData = pFile->DataSize;
+
+		if (!m_fAttachmentStreamTried)
+		{
+			m_fAttachmentStreamTried = true;
+			m_spAttachmentStream = CloneByteStream();
+		}
+		spStream = m_spAttachmentStream;
+	}
+
+	pData->resize((size_t)cbData);
+
+	DWORD cbRead = 0;
+	if (spStream != nullptr)
+	{
+		cbRead = ReadByteStreamAt(spStream.Get(), qwPosition, pData->data(), (DWORD)cbData);
+	}
+	else
+	{
+		cbRead = ReadAfterPendingRead(qwPosition, pData->data(), (DWORD)cbData);
+	}
+
+	if (cbRead < cbData)
+	{
+		ThrowException(MF_E_INVALID_FORMAT);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// CloneByteStream
+// Returns a byte stream over the same data as m_spByteStream, with its
+// own position, or nullptr if there is none.
+//
+// An app that hands us a stream (MFCreateMFByteStreamOnStreamEx) can
+// clone it. Other byte streams cannot.
+//-------------------------------------------------------------------
+
+ComPtr<IMFByteStream> MKVSource::CloneByteStream()
+{
+	ComPtr<IMFByteStream> spClone;
+	ComPtr<IMFGetService> spGetService;
+	ComPtr<IInspectable> spWrapped;
+
+	if (FAILED(m_spByteStream.As(&spGetService)) ||
+		FAILED(spGetService->GetService(MF_WRAPPED_OBJECT, IID_PPV_ARGS(&spWrapped))))
+	{
+		return spClone;
+	}
+
+	try
+	{
+		auto stream = dynamic_cast<Windows::Storage::Streams::IRandomAccessStream^>(reinterpret_cast<Object^>(spWrapped.Get()));
+		if (stream != nullptr)
+		{
+			Windows::Storage::Streams::IRandomAccessStream ^clone = stream->CloneStream();
+			if (FAILED(MFCreateMFByteStreamOnStreamEx(reinterpret_cast<IUnknown*>(clone), &spClone)))
+			{
+				spClone.Reset();
+			}
+		}
+	}
+	catch (Exception ^)
+	{
+		// Not cloneable: read after the pending read instead.
+		spClone.Reset();
+	}
+
+	return spClone;
+}
+
+
+//-------------------------------------------------------------------
+// ReadAfterPendingRead
+// Reads from a file offset, on m_spByteStream, for ReadAttachment.
+//
+// The read-ahead stops, and the read waits for the read in flight to
+// complete, without the demux lock (the completion needs it). Then the
+// demux lock is held for the read, and the read-ahead resumes.
+//-------------------------------------------------------------------
+
+DWORD MKVSource::ReadAfterPendingRead(QWORD qwPosition, BYTE *pData, DWORD cb)
+{
+	AutoLock demuxLock(m_demuxCritSec);
+
+	m_fAttachmentRead = true;
+
+	DWORD cbRead = 0;
+	try
+	{
+		while (m_fReadPending && m_state != STATE_SHUTDOWN)
+		{
+			// The completion sets the event under the demux lock, so it
+			// cannot come before the reset.
+			m_readDone.reset();
+
+			m_demuxCritSec.Unlock();
+			m_readDone.wait();
+			m_demuxCritSec.Lock();
+		}
+
+		ThrowIfError(CheckShutdown());
+
+		cbRead = ReadAt(qwPosition, pData, cb);
+	}
+	catch (Exception ^)
+	{
+		// ReadAt may have failed before it put the read position back.
+		try
+		{
+			if (m_state != STATE_SHUTDOWN)
+			{
+				SeekReads(m_qwPrefetchPosition);
+			}
+			ResumeReads();
+		}
+		catch (Exception ^)
+		{
+			m_fAttachmentRead = false;
+		}
+		throw;
+	}
+
+	ResumeReads();
+
+	return cbRead;
+}
+
+
+//-------------------------------------------------------------------
+// ResumeReads
+// Restarts the reads that ReadAfterPendingRead held off.
+//
+// Call with the demux lock held.
+//-------------------------------------------------------------------
+
+void MKVSource::ResumeReads()
+{
+	m_fAttachmentRead = false;
+
+	if (m_state == STATE_SHUTDOWN)
+	{
+		return;
+	}
+
+	if (m_fParserWaiting)
+	{
+		RequestData(READ_SIZE);
+	}
+	else
+	{
+		Prefetch();
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ReadAt
+// Reads from a file offset, synchronously, and returns the number of
+// bytes read (less than cb at the end of the file).
+//
+// Call with the demux lock held. The byte stream has one position, so
+// the read cancels the read-ahead, and SeekReads puts the position back
+// where the demux left it.
+//-------------------------------------------------------------------
+
+DWORD MKVSource::ReadAt(QWORD qwPosition, BYTE *pData, DWORD cb)
+{
+	DWORD cbTotal = ReadByteStreamAt(m_spByteStream.Get(), qwPosition, pData, cb);
+
+	SeekReads(m_qwPrefetchPosition);
+
+	return cbTotal;
+}
+
+
+//-------------------------------------------------------------------
+// LoadTags
+// Reads the Tags element, if the parser has not come across it, so
+// that the statistics tags are known when the streams are created.
+//
+// mkvmerge writes the Tags after the clusters, because it counts the
+// statistics while muxing; the SeekHead says where.
+//
+// The statistics are an extra: if the byte stream is slow to seek or
+// a read fails, the streams are created without them, and the open
+// goes on.
+//-------------------------------------------------------------------
+
+void MKVSource::LoadTags()
 {
-	assert(m_parser != nullptr);
-	assert(m_parser->HasFrames);
-	bool fResult = true;
-	DWORD cbPayloadRead = 0;
-	DWORD cbPayloadUnread = 0;
-
-	m_parser->m_currentFrameSize = *m_parser->pCircRead;
-	auto skipBytes = 0;//*m_parser->pCircReadPosition;
-	//m_parser->m_currentFrameSize = m_parser->GetFrameSizeQueue.front();
-
-	// At this point, the read buffer might be larger or smaller than the payload.
-	// Calculate which portion of the payload has been read.
-	if (m_parser->m_currentFrameSize + skipBytes > m_ReadBuffer->DataSize)
+	MKVMasterData *pMasterData = m_parser->GetMasterData();
+	if (pMasterData->HasTags)
 	{
-		cbPayloadUnread = m_parser->m_currentFrameSize + skipBytes - m_ReadBuffer->DataSize;
+		return;
 	}
 
-	cbPayloadRead = m_parser->m_currentFrameSize + skipBytes - cbPayloadUnread;
+	// Whatever happens, do not try again.
+	pMasterData->HasTags = true;
 
-	// Do we need to deliver this payload?
-	if (!IsStreamActive(MPEG1PacketHeader()))
+	// The Tags are usually at the end of the file. Do not go there on a
+	// stream that is still downloading or that seeks slowly.
+	DWORD dwCaps = 0;
+	if (FAILED(m_spByteStream->GetCapabilities(&dwCaps)) ||
+		(dwCaps & MFBYTESTREAM_IS_SEEKABLE) == 0 ||
+		(dwCaps & (MFBYTESTREAM_HAS_SLOW_SEEK | MFBYTESTREAM_IS_PARTIALLY_DOWNLOADED)) != 0)
 	{
-		QWORD qwCurrentPosition = 0;
+		return;
+	}
 
-		// Skip this payload. Seek past the unread portion of the payload.
-		ThrowIfError(m_spByteStream->Seek(
-			msoCurrent,
-			cbPayloadUnread,
-			MFBYTESTREAM_SEEK_FLAG_CANCEL_PENDING_IO,
-			&qwCurrentPosition
-			));
+	for (size_t i = 0; i < pMasterData->SeekHead.size(); i++)
+	{
+		if (pMasterData->SeekHead[i]->elemID == nullptr || strcmp(pMasterData->SeekHead[i]->elemID, "Tags") != 0)
+		{
+			continue;
+		}
 
-		// Advance the data buffer to the end of payload, or the portion
-		// that has been read.
+		QWORD qwPosition = pMasterData->SeekHead[i]->SeekPosition + pMasterData->SegmentPosition;
 
-		*pcbAte = cbPayloadRead;
+		try
+		{
+			BYTE header[12];
+			DWORD cbHeader = 0;
+			UINT64 cbBody = 0;
 
-		// Tell the parser that we are done with this packet.
+			DWORD cbRead = ReadAt(qwPosition, header, sizeof(header));
+			if (!ReadTagsHeader(header, cbRead, &cbHeader, &cbBody) || cbBody > MAX_TAGS_SIZE)
+			{
+				break;
+			}
 
-		m_parser->pCircRead++;
-		//m_parser->pCircReadPosition++;
-		if ((m_parser->pCircRead - &m_parser->m_circularBuffer[0]) == m_parser->m_cirBufferLength)
+			std::vector<BYTE> body((size_t)cbBody);
+			if (ReadAt(qwPosition + cbHeader, body.data(), (DWORD)cbBody) == cbBody)
+			{
+				m_parser->ParseTags(body.data(), (DWORD)cbBody);
+			}
+		}
+		catch (Exception ^)
 		{
-			m_parser->pCircRead = &m_parser->m_circularBuffer[0];
-			//m_parser->pCircReadPosition = &m_parser->m_circularBufferPosition[0];
+			// Go without the statistics. ReadAt may have failed before it
+			// put the read position back; if this fails too, the next
+			// read reports the error.
+			try
+			{
+				SeekReads(m_qwPrefetchPosition);
+			}
+			catch (Exception ^)
+			{
+			}
 		}
-		m_parser->m_frameCount--;
-		//m_parser->PopFrameSizeQueue();
-		//if (m_parser->GetFrameSizeQueue.size() == 0)
-		if (m_parser->m_frameCount == 0)
-			m_parser->ClearFrames();
+		break;
 	}
-	else if (cbPayloadUnread > 0)
-	{
-		// Some portion of this payload has not been read. Schedule a read.
-		*pcbNextRequest = cbPayloadUnread;
+}
 
-		*pcbAte = 0;
 
-		fResult = false; // Need more data.
-	}
-	else
-	{
-		// The entire payload is in the data buffer. Deliver the packet.
-		DeliverPayload();
+//-------------------------------------------------------------------
+// DeliverParsedSubtitleCues
+// Sends the cues the parser found to their streams.
+//
+// After a seek, DeliverActiveSubtitleCues already sent the known cues
+// that show at the seek position. Of the cues that start before it,
+// only new ones that still show are sent here.
+//-------------------------------------------------------------------
 
-		*pcbAte = cbPayloadRead;
+void MKVSource::DeliverParsedSubtitleCues()
+{
+	for (size_t i = 0; i < m_parser->m_parsedCues.size(); i++)
+	{
+		const ParsedSubtitleCue &parsed = m_parser->m_parsedCues[i];
 
-		// Tell the parser that we are done with this packet.
-		int trackIndex = -1;
-		for (int i = 0; i < m_parser->GetMasterData()->Tracks.size(); ++i)
+		if (parsed.cue.hnsStart < m_hnsSubtitleStart &&
+			(!parsed.fNew || parsed.cue.hnsEnd <= m_hnsSubtitleStart))
 		{
-			if (m_parser->GetMasterData()->Tracks[i]->TrackNumber == m_parser->m_currentStream)
-				trackIndex = i;
+			continue;
 		}
-		m_parser->m_currentTimeStamp = m_parser->m_currentTimeStamp + m_parser->GetMasterData()->Tracks[trackIndex]->DefaultDuration / 1000000;
 
-		m_parser->pCircRead++;
-		//m_parser->pCircReadPosition++;
-		if ((m_parser->pCircRead - &m_parser->m_circularBuffer[0]) == m_parser->m_cirBufferLength)
-		{
-			m_parser->pCircRead = &m_parser->m_circularBuffer[0];
-			//m_parser->pCircReadPosition = &m_parser->m_circularBufferPosition[0];
-		}
-		m_parser->m_frameCount--;
-		if (m_parser->m_frameCount == 0)
-			m_parser->ClearFrames();
-		/*m_parser->PopFrameSizeQueue();
-		if (m_parser->GetFrameSizeQueue.size() == 0)
-			m_parser->ClearFrames();*/
+		DeliverSubtitleCue(parsed.dwTrack, parsed.cue);
 	}
 
-	return fResult;
+	m_parser->m_parsedCues.clear();
 }
 
+
 //-------------------------------------------------------------------
-// EndOfMPEGStream:
-// Called when the parser reaches the end of the MPEG1 stream.
+// DeliverActiveSubtitleCues
+// Sends the known cues that show at hnsTime to the subtitle streams.
 //-------------------------------------------------------------------
 
-void MKVSource::EndOfMPEGStream()
+void MKVSource::DeliverActiveSubtitleCues(LONGLONG hnsTime)
 {
-	// Notify the streams. The streams might have pending samples.
-	// When each stream delivers the last sample, it will send the
-	// end-of-stream event to the pipeline and then notify the
-	// source.
-
-	// When every stream is done, the source sends the end-of-
-	// presentation event.
+	std::vector<SubtitleCue> cues;
 
 	for (DWORD i = 0; i < m_streams.GetCount(); i++)
 	{
-		if (m_streams[i]->IsActive())
+		if (!m_streams[i]->IsActive())
 		{
-			m_streams[i]->EndOfStream();
+			continue;
+		}
+
+		m_subtitles.FindActive(m_streams.GetId(i), hnsTime, &cues);
+		for (size_t j = 0; j < cues.size(); j++)
+		{
+			DeliverSubtitleCue(m_streams.GetId(i), cues[j]);
 		}
 	}
 }
 
 
-
 //-------------------------------------------------------------------
-// StreamsNeedData:
-// Returns TRUE if any streams need more data.
+// DeliverSubtitleCue
+// Sends one cue to its stream, as a sample.
+//
+// A cue that started before the seek position starts at it instead.
+// The cue stays in the store even if the stream does not take it.
 //-------------------------------------------------------------------
 
-bool MKVSource::StreamsNeedData() const
+void MKVSource::DeliverSubtitleCue(DWORD dwTrack, const SubtitleCue &cue)
 {
-	bool fNeedData = false;
-
-	switch (m_state)
+	MKVStream *wpStream = m_streams.Find((BYTE)dwTrack);   // not AddRef'd
+	if (wpStream == nullptr || !wpStream->IsActive() || wpStream->IsQueueFull())
 	{
-	case STATE_OPENING:
-		// While opening, we always need data (until we get enough
-		// to complete the open operation).
-		return true;
+		return;
+	}
 
-	case STATE_SHUTDOWN:
-		// While shut down, we never need data.
-		return false;
+	ComPtr<IMFMediaBuffer> spBuffer;
+	ComPtr<IMFSample> spSample;
+	BYTE *pData = nullptr;
 
-	default:
-		// If none of the above, ask the streams.
-		for (DWORD i = 0; i < m_streams.GetCount(); i++)
-		{
-			if (m_streams[i]->NeedsData())
-			{
-				fNeedData = true;
-				break;
-			}
-		}
-		return fNeedData;
+	LONGLONG hnsTime = max(cue.hnsStart, m_hnsSubtitleStart);
+
+	ThrowIfError(MFCreateMemoryBuffer(cue.cbData, &spBuffer));
+	ThrowIfError(spBuffer->Lock(&pData, nullptr, nullptr));
+	CopyMemory(pData, cue.pData, cue.cbData);
+	ThrowIfError(spBuffer->Unlock());
+	ThrowIfError(spBuffer->SetCurrentLength(cue.cbData));
+
+	ThrowIfError(MFCreateSample(&spSample));
+	ThrowIfError(spSample->AddBuffer(spBuffer.Get()));
+	ThrowIfError(spSample->SetSampleTime(hnsTime));
+	if (cue.hnsEnd != SUBTITLE_OPEN_END)
+	{
+		ThrowIfError(spSample->SetSampleDuration(cue.hnsEnd - hnsTime));
 	}
+	ThrowIfError(spSample->SetUINT32(MFSampleExtension_CleanPoint, TRUE));
+
+	wpStream->DeliverPayload(spSample.Get());
 }
 
 
@@ -1845,7 +3564,7 @@ void MKVSource::DeliverPayload()
 	// When this method is called, the read buffer contains a complete
 	// payload, and the payload belongs to a stream whose type we support.
 
-	assert(m_parser->HasFrames);
+	assert(m_parser->HasFrames());
 
 	assert(m_parser->m_currentStream != 3);
 
@@ -1859,7 +3578,7 @@ void MKVSource::DeliverPayload()
 	//packetHdr = m_parser->PacketHeader;
 	auto skipBytes = 0;// *m_parser->pCircReadPosition;
 
-	if (m_parser->m_currentFrameSize + skipBytes > m_ReadBuffer->DataSize)
+	if (m_parser->m_currentFrameSize + skipBytes > m_ReadBuffer->DataSize())
 	{
 		assert(FALSE);
 		ThrowException(E_UNEXPECTED);
@@ -1916,9 +3635,9 @@ void MKVSource::DeliverPayload()
 		}
 
 
-		auto p = m_ReadBuffer->DataPtr;
+		auto p = m_ReadBuffer->DataPtr();
 		int nalu_len = 0;
-		while (p < (unsigned char *)m_ReadBuffer->DataPtr + frameLength + skipBytes - headerSize)
+		while (p < (unsigned char *)m_ReadBuffer->DataPtr() + frameLength + skipBytes - headerSize)
 		{
 			nalu_len = (p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
 			p[0] = 0;
@@ -1929,12 +3648,12 @@ void MKVSource::DeliverPayload()
 			p += (nalu_len + 4);
 			//CopyMemory(pData, m_startCode, 4);
 		}
-		CopyMemory(pData + skipBytes + headerSize, m_ReadBuffer->DataPtr, frameLength - headerSize);
+		CopyMemory(pData + skipBytes + headerSize, m_ReadBuffer->DataPtr(), frameLength - headerSize);
 		
 		//CopyMemory(pData, m_startCode, 4);
 		//CopyMemory(pData, sps, 7);
 		//CopyMemory(pData + 4 + 7, pps, 4);
-		//CopyMemory(pData + 4 + 7 + 4, m_ReadBuffer->DataPtr, m_parser->m_currentFrameSize);
+		//CopyMemory(pData + 4 + 7 + 4, m_ReadBuffer->DataPtr(), m_parser->m_currentFrameSize);
 		//CopyMemory(pData + 4 + 7 + 4 + m_parser->m_currentFrameSize, m_endCode, 1);
 
 	}
@@ -1946,7 +3665,7 @@ void MKVSource::DeliverPayload()
 
 		ThrowIfError(spBuffer->Lock(&pData, nullptr, nullptr));
 				
-		CopyMemory(pData + skipBytes, m_ReadBuffer->DataPtr, m_parser->m_currentFrameSize);
+		CopyMemory(pData + skipBytes, m_ReadBuffer->DataPtr(), m_parser->m_currentFrameSize);
 	}
 	ThrowIfError(spBuffer->Unlock());
 
@@ -1969,13 +3688,27 @@ void MKVSource::DeliverPayload()
 			trackIndex = i;
 	}
 
-	ThrowIfError(spSample->SetSampleTime(m_parser->m_currentTimeStamp*10000));  //if in milliseconds, times 10,000 will make it 100-nanosecond units
+	LONGLONG hnsTime = m_parser->m_currentTimeStamp * 10000;
+
+	ThrowIfError(spSample->SetSampleTime(hnsTime));  //if in milliseconds, times 10,000 will make it 100-nanosecond units
 	ThrowIfError(spSample->SetSampleDuration(m_parser->GetMasterData()->Tracks[trackIndex]->DefaultDuration / 100));  //in nanoseconds, divide by 100 will make it 100-nanosecond units
 	ThrowIfError(spSample->SetUINT32(MFSampleExtension_CleanPoint, m_parser->m_isCurrentKeyFrame));
 
 	// Deliver the payload to the stream.
 	wpStream->DeliverPayload(spSample.Get());
 
+	// The parser is past any subtitle that starts before this frame.
+	TickSparseStreams(hnsTime);
+
+	if (m_readMode == READ_REREAD_TRACKS)
+	{
+		++m_stats.cRereadFrames;
+	}
+	else
+	{
+		++m_stats.cInterleaved;
+	}
+
 	// If the open operation is still pending, check if we're done.
 	if (m_state == STATE_OPENING)
 	{
@@ -1983,8 +3716,28 @@ void MKVSource::DeliverPayload()
 	}
 }
 
+//-------------------------------------------------------------------
+// TickSparseStreams
+// Sends MEStreamTick to the sparse streams that have had no sample
+// for a while, so that the pipeline does not wait for them.
+//-------------------------------------------------------------------
+
+void MKVSource::TickSparseStreams(LONGLONG hnsTime)
+{
+	for (DWORD i = 0; i < m_streams.GetCount(); i++)
+	{
+		if (m_streams[i]->IsSparse())
+		{
+			m_streams[i]->SendTick(hnsTime);
+		}
+	}
+}
+
 void MKVSource::CreateStreams()
 {
+	// The media types use the statistics tags.
+	LoadTags();
+
 	//create all the streams at once using mkvmaster data.
 	for (int i = 0; i < m_parser->GetMasterData()->Tracks.size(); ++i)
 	{
@@ -2034,6 +3787,75 @@ void MKVSource::CreateStreams()
 		// Add the stream to the array.
 		ThrowIfError(m_streams.AddStream(m_parser->GetMasterData()->Tracks[i]->TrackNumber, spStream.Get()));
 	}
+
+	CreateCaptionStreams();
+}
+
+//-------------------------------------------------------------------
+// CreateCaptionStreams
+// Creates a caption stream for each subtitle track, at the frame size
+// of the first video track (720p if there is none).
+//-------------------------------------------------------------------
+
+void MKVSource::CreateCaptionStreams()
+{
+	MKVMasterData *pMasterData = m_parser->GetMasterData();
+
+	if (!m_captionStreams.empty())
+	{
+		return;
+	}
+
+	UINT32 width = 1280;
+	UINT32 height = 720;
+	for (size_t i = 0; i < pMasterData->Tracks.size(); i++)
+	{
+		const TrackData *pTrack = pMasterData->Tracks[i];
+		if (pTrack->TrackType == 1 && pTrack->PixelWidth != 0 && pTrack->PixelHeight != 0)
+		{
+			width = pTrack->PixelWidth;
+			height = pTrack->PixelHeight;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < pMasterData->Tracks.size(); i++)
+	{
+		const TrackData *pTrack = pMasterData->Tracks[i];
+		if (pTrack->TrackType != 0x11 || !IsStreamTypeSupported(pTrack->CodecID))
+		{
+			continue;
+		}
+
+		ComPtr<CaptionStream> spStream = CaptionStream::CreateInstance(this,
+			CAPTION_STREAM_ID_BASE + (DWORD)pTrack->TrackNumber, (DWORD)pTrack->TrackNumber, width, height);
+		if (m_spDeviceManager != nullptr)
+		{
+			spStream->SetDXGIDeviceManager(m_spDeviceManager.Get());
+		}
+		m_captionStreams.push_back(spStream);
+	}
+}
+
+//-------------------------------------------------------------------
+// FindCaptionStream
+// Returns the caption stream with this stream ID, or nullptr. The
+// stream is not AddRef'd.
+//-------------------------------------------------------------------
+
+CaptionStream *MKVSource::FindCaptionStream(DWORD dwStreamId)
+{
+	for (size_t i = 0; i < m_captionStreams.size(); i++)
+	{
+		DWORD dwId = 0;
+		ComPtr<IMFStreamDescriptor> spSD;
+		if (SUCCEEDED(m_captionStreams[i]->GetStreamDescriptor(&spSD)) &&
+			SUCCEEDED(spSD->GetStreamIdentifier(&dwId)) && dwId == dwStreamId)
+		{
+			return m_captionStreams[i].Get();
+		}
+	}
+	return nullptr;
 }
 
 //-------------------------------------------------------------------
@@ -2067,7 +3889,7 @@ void MKVSource::CreateStream(int packetSize)
 	MPEG1AudioFrameHeader audioFrameHeader;
 
 	// Get a pointer to the start of the payload.
-	pPayload = m_ReadBuffer->DataPtr;
+	pPayload = m_ReadBuffer->DataPtr();
 
 	int trackIndex = -1;
 	for (int i = 0; i < m_masterData->Tracks.size(); ++i)
@@ -2423,31 +4245,74 @@ ComPtr<IMFMediaType> CreateVideoMediaType(MKVMasterData* mkvMasterData, int curr
 		//videoSeqHdr.height
 		));
 
-	// Frame rate
-	ThrowIfError(MFSetAttributeRatio(
-		spType.Get(),
-		MF_MT_FRAME_RATE,
-		24000,1001
-		//mkvMasterData->Tracks[currentTrack]->Video->
-		//videoSeqHdr.frameRate.Numerator,
-		//videoSeqHdr.frameRate.Denominator
-		));
+	const VideoTrackFormat *pFormat = GetVideoTrackFormat(mkvMasterData->Tracks[trackIndex],
+		FindTrackStatistics(mkvMasterData, mkvMasterData->Tracks[trackIndex]->TrackUID));
+
+	// Frame rate, if the track header, the SPS or the statistics tags have it.
+	if (pFormat->frameRate.Denominator != 0)
+	{
+		ThrowIfError(MFSetAttributeRatio(
+			spType.Get(),
+			MF_MT_FRAME_RATE,
+			pFormat->frameRate.Numerator,
+			pFormat->frameRate.Denominator
+			));
+	}
 
 	// Pixel aspect ratio
 	ThrowIfError(MFSetAttributeRatio(
 		spType.Get(),
 		MF_MT_PIXEL_ASPECT_RATIO,
-		1,
-		1
-		//videoSeqHdr.pixelAspectRatio.Numerator,
-		//videoSeqHdr.pixelAspectRatio.Denominator
+		pFormat->pixelAspectRatio.Numerator,
+		pFormat->pixelAspectRatio.Denominator
 		));
 
-	// Average bit rate
-	ThrowIfError(spType->SetUINT32(MF_MT_AVG_BITRATE, 2165000));//videoSeqHdr.bitRate));
+	// Average bit rate, if the statistics tags have it.
+	if (pFormat->avgBitrate != 0)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_AVG_BITRATE, pFormat->avgBitrate));
+	}
+
+	// Interlacing
+	ThrowIfError(spType->SetUINT32(MF_MT_INTERLACE_MODE, (UINT32)pFormat->interlaceMode));
+
+	// Colour description, so that the decoder and the compositor do not
+	// have to look at the frames. HDR10 needs all of it.
+	if (pFormat->primaries != MFVideoPrimaries_Unknown)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_VIDEO_PRIMARIES, (UINT32)pFormat->primaries));
+	}
+	if (pFormat->transferFunction != MFVideoTransFunc_Unknown)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_TRANSFER_FUNCTION, (UINT32)pFormat->transferFunction));
+	}
+	if (pFormat->transferMatrix != MFVideoTransferMatrix_Unknown)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_YUV_MATRIX, (UINT32)pFormat->transferMatrix));
+	}
+	if (pFormat->nominalRange != MFNominalRange_Unknown)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, (UINT32)pFormat->nominalRange));
+	}
+	if (pFormat->chromaSiting != MFVideoChromaSubsampling_Unknown)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_VIDEO_CHROMA_SITING, pFormat->chromaSiting));
+	}
 
-	// Interlacing (progressive frames)
-	ThrowIfError(spType->SetUINT32(MF_MT_INTERLACE_MODE, (UINT32)MFVideoInterlace_MixedInterlaceOrProgressive));
+	// HDR light levels
+	if (pFormat->maxContentLightLevel != 0)
+	{
+		ThrowIfError(spType->SetUINT32(MKV_MT_MAX_LUMINANCE_LEVEL, pFormat->maxContentLightLevel));
+	}
+	if (pFormat->maxFrameAverageLightLevel != 0)
+	{
+		ThrowIfError(spType->SetUINT32(MKV_MT_MAX_FRAME_AVERAGE_LUMINANCE_LEVEL, pFormat->maxFrameAverageLightLevel));
+	}
+	if (pFormat->maxMasteringLuminance != 0)
+	{
+		ThrowIfError(spType->SetUINT32(MKV_MT_MAX_MASTERING_LUMINANCE, pFormat->maxMasteringLuminance));
+		ThrowIfError(spType->SetUINT32(MKV_MT_MIN_MASTERING_LUMINANCE, pFormat->minMasteringLuminance));
+	}
 
 
 	//// Sequence header.
@@ -2473,6 +4338,44 @@ ComPtr<IMFMediaType> CreateSubtitleMediaType(MKVMasterData* mkvMasterData, int c
 
 	ThrowIfError(MFCreateMediaType(&spType));
 
+	// Subtitles: one cue per sample. The CodecPrivate data (the SSA/ASS
+	// styles, or the VobSub .idx header) goes in MF_MT_USER_DATA.
+	GUID subtype = GUID_NULL;
+	switch (GetSubtitleFormat(mkvMasterData->Tracks[trackIndex]->CodecID))
+	{
+	case SUBTITLE_UTF8:
+		subtype = MKVSubtitleFormat_UTF8;
+		break;
+	case SUBTITLE_SSA:
+		subtype = MKVSubtitleFormat_SSA;
+		break;
+	case SUBTITLE_ASS:
+		subtype = MKVSubtitleFormat_ASS;
+		break;
+	case SUBTITLE_PGS:
+		subtype = MKVSubtitleFormat_PGS;
+		break;
+	case SUBTITLE_VOBSUB:
+		subtype = MKVSubtitleFormat_VobSub;
+		break;
+	default:
+		break;
+	}
+
+	if (subtype != GUID_NULL)
+	{
+		ThrowIfError(spType->SetGUID(MF_MT_MAJOR_TYPE, MKVMediaType_Subtitle));
+		ThrowIfError(spType->SetGUID(MF_MT_SUBTYPE, subtype));
+		ThrowIfError(spType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
+		if (mkvMasterData->Tracks[trackIndex]->CodecPrivate != nullptr)
+		{
+			ThrowIfError(spType->SetBlob(MF_MT_USER_DATA,
+				mkvMasterData->Tracks[trackIndex]->CodecPrivate,
+				mkvMasterData->Tracks[trackIndex]->CodecPrivateLength));
+		}
+		return spType;
+	}
+
 	ThrowIfError(spType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
 	ThrowIfError(spType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_AYUV));
 	ThrowIfError(spType->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
@@ -2543,11 +4446,12 @@ ComPtr<IMFMediaType> CreateAudioMediaType(MKVMasterData* mkvMasterData, int curr
 		16));
 		//mkvMasterData->Tracks[trackIndex]->Audio->BitDepth));
 
-	// Bit rate
-	ThrowIfError(spType->SetUINT32(
-		MF_MT_AVG_BITRATE,
-		384000));
-	//mkvMasterData->Tracks[trackIndex]->Audio->BitDepth));
+	// Bit rate, if the statistics tags have it.
+	const TrackStatistics *pStats = FindTrackStatistics(mkvMasterData, mkvMasterData->Tracks[trackIndex]->TrackUID);
+	if (pStats != nullptr && pStats->Bitrate != 0)
+	{
+		ThrowIfError(spType->SetUINT32(MF_MT_AVG_BITRATE, pStats->Bitrate));
+	}
 
 	if (strcmp(mkvMasterData->Tracks[trackIndex]->CodecID, "A_AAC") == 0){
 		ThrowIfError(spType->SetBlob(MF_MT_AAC_AUDIO_PROFILE_LEVEL_INDICATION, mkvMasterData->Tracks[trackIndex]->CodecPrivate, mkvMasterData->Tracks[trackIndex]->CodecPrivateLength));
@@ -2558,6 +4462,19 @@ ComPtr<IMFMediaType> CreateAudioMediaType(MKVMasterData* mkvMasterData, int curr
 	return spType;
 }
 
+// Find the statistics tags of a track. Returns nullptr if there are none.
+const TrackStatistics *FindTrackStatistics(MKVMasterData *mkvMasterData, UINT64 trackUID)
+{
+	for (size_t i = 0; i < mkvMasterData->Statistics.size(); i++)
+	{
+		if (mkvMasterData->Statistics[i].TrackUID == trackUID)
+		{
+			return &mkvMasterData->Statistics[i];
+		}
+	}
+	return nullptr;
+}
+
 // Get the major media type from a stream descriptor.
 void GetStreamMajorType(IMFStreamDescriptor *pSD, GUID *pguidMajorType)
 {
@@ -2572,4 +4489,27 @@ void GetStreamMajorType(IMFStreamDescriptor *pSD, GUID *pguidMajorType)
 	ThrowIfError(spHandler->GetMajorType(pguidMajorType));
 }
 
+// Read from a file offset, synchronously. Returns the number of bytes
+// read (less than cb at the end of the file).
+DWORD ReadByteStreamAt(IMFByteStream *pStream, QWORD qwPosition, BYTE *pData, DWORD cb)
+{
+	QWORD qwCurrentPosition = 0;
+
+	ThrowIfError(pStream->Seek(msoBegin, qwPosition, MFBYTESTREAM_SEEK_FLAG_CANCEL_PENDING_IO, &qwCurrentPosition));
+
+	DWORD cbTotal = 0;
+	while (cbTotal < cb)
+	{
+		ULONG cbRead = 0;
+		ThrowIfError(pStream->Read(pData + cbTotal, cb - cbTotal, &cbRead));
+		if (cbRead == 0)
+		{
+			break;
+		}
+		cbTotal += cbRead;
+	}
+
+	return cbTotal;
+}
+
 #pragma warning( pop )
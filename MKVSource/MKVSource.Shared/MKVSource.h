@@ -16,18 +16,23 @@
 #pragma once
 // Common sample files.
 #include "linklist.h"
+#include "RingQueue.h"
 
 #include "asynccb.h"
 #include "OpQueue.h"
+#include "WorkScheduler.h"
 #include "critsec.h"
 
 // Forward declares
+class CaptionStream;
 class MKVByteStreamHandler;
 class MKVSource;
 class MKVStream;
 class SourceOp;
 
-typedef ComPtrList<IMFSample>       SampleList;
+const UINT32 SAMPLE_RING_SIZE = 128;         // Most samples a stream can hold before the demux thread waits.
+
+typedef ComPtrRing<IMFSample, SAMPLE_RING_SIZE> SampleRing;  // Filled by the demux thread, drained by the stream.
 typedef ComPtrList<IUnknown, true>  TokenList;    // List of tokens for IMFMediaStream::RequestSample
 
 enum SourceState
@@ -40,7 +45,8 @@ enum SourceState
 	STATE_SHUTDOWN
 };
 
-#include "Parse.h"          // MPEG-1 parser
+#include "Demux.h"          // Parser, subtitle cues, chapters, tags, CRC-32 checks
+#include "VideoFormat.h"    // Video track attributes
 #include "MKVStream.h"    // MPEG-1 stream
 
 const UINT32 MAX_STREAMS = 32;
@@ -125,6 +131,12 @@ public:
 		assert(index < m_count);
 		return m_streams[index].Get();
 	}
+
+	BYTE GetId(DWORD index) const
+	{
+		assert(index < m_count);
+		return m_id[index];
+	}
 };
 
 
@@ -132,7 +144,151 @@ public:
 
 const DWORD INITIAL_BUFFER_SIZE = 4 * 1024; // Initial size of the read buffer. (The buffer expands dynamically.)
 const DWORD READ_SIZE = 4 * 1024;           // Size of each read request.
+const DWORD PREFETCH_SIZE = 1024 * 1024;    // How far ahead of the parser do we read? (A few clusters.)
+const DWORD PREFETCH_READ_SIZE = 64 * 1024; // Size of each read-ahead request.
 const DWORD SAMPLE_QUEUE = 2;               // How many samples does each stream try to hold in its queue?
+const LONGLONG BUFFER_TARGET_DURATION = 10000000;   // How much time does each stream try to hold? (1 second)
+const LONGLONG BUFFER_MAX_DURATION = 50000000;      // Past this much time, a stream does not take more. (5 seconds)
+const LONGLONG MEMORY_BUDGET = 64 * 1024 * 1024;    // Most bytes held in sample queues and read buffers.
+const QWORD MAX_TAGS_SIZE = 16 * 1024 * 1024;          // Largest Tags element read at open.
+const QWORD MAX_ATTACHMENT_SIZE = 256 * 1024 * 1024;    // Largest attachment ReadAttachment reads.
+const LONGLONG SPARSE_TICK_INTERVAL = 5000000;      // How often does an idle sparse stream get an MEStreamTick? (0.5 second)
+
+// Media type of subtitle streams. Each sample holds one cue: the
+// Matroska block payload, which is UTF-8 text, an SSA/ASS Dialogue line
+// without the time fields, a PGS display set or a VobSub subpicture unit
+// (MF_MT_SUBTYPE tells which).
+
+// {A40307F7-3058-4253-A7C4-507AD0299EE0}
+const GUID MKVMediaType_Subtitle = { 0xa40307f7, 0x3058, 0x4253, { 0xa7, 0xc4, 0x50, 0x7a, 0xd0, 0x29, 0x9e, 0xe0 } };
+// {EABD6F7D-49D8-4683-B25F-945182184C4E}
+const GUID MKVSubtitleFormat_UTF8 = { 0xeabd6f7d, 0x49d8, 0x4683, { 0xb2, 0x5f, 0x94, 0x51, 0x82, 0x18, 0x4c, 0x4e } };
+// {B63111F4-FDCE-4AB6-9BE8-25D3223074E6}
+const GUID MKVSubtitleFormat_SSA = { 0xb63111f4, 0xfdce, 0x4ab6, { 0x9b, 0xe8, 0x25, 0xd3, 0x22, 0x30, 0x74, 0xe6 } };
+// {310AA477-E92F-4111-A03D-DA7B0BAF32A4}
+const GUID MKVSubtitleFormat_ASS = { 0x310aa477, 0xe92f, 0x4111, { 0xa0, 0x3d, 0xda, 0x7b, 0x0b, 0xaf, 0x32, 0xa4 } };
+// {8EBEF929-487D-4967-AEA7-BD867DEF233D}
+const GUID MKVSubtitleFormat_PGS = { 0x8ebef929, 0x487d, 0x4967, { 0xae, 0xa7, 0xbd, 0x86, 0x7d, 0xef, 0x23, 0x3d } };
+// {D82DD676-371F-4614-A7DD-A31BAC056456}
+const GUID MKVSubtitleFormat_VobSub = { 0xd82dd676, 0x371f, 0x4614, { 0xa7, 0xdd, 0xa3, 0x1b, 0xac, 0x05, 0x64, 0x56 } };
+
+// HDR attributes and colour values that came with the Windows 10 SDK. The
+// project builds against the 8.1 SDK, so they are declared here with the
+// documented GUIDs and values, under our own names.
+
+// MF_MT_MAX_LUMINANCE_LEVEL {50253128-C110-4DE4-98AE-46A324FAE6DA}
+const GUID MKV_MT_MAX_LUMINANCE_LEVEL = { 0x50253128, 0xc110, 0x4de4, { 0x98, 0xae, 0x46, 0xa3, 0x24, 0xfa, 0xe6, 0xda } };
+// MF_MT_MAX_FRAME_AVERAGE_LUMINANCE_LEVEL {58D4BF57-6F52-4733-A195-A9E29ECF9E27}
+const GUID MKV_MT_MAX_FRAME_AVERAGE_LUMINANCE_LEVEL = { 0x58d4bf57, 0x6f52, 0x4733, { 0xa1, 0x95, 0xa9, 0xe2, 0x9e, 0xcf, 0x9e, 0x27 } };
+// MF_MT_MAX_MASTERING_LUMINANCE {D6C6B997-272F-4CA1-8D00-8042111A0FF6}
+const GUID MKV_MT_MAX_MASTERING_LUMINANCE = { 0xd6c6b997, 0x272f, 0x4ca1, { 0x8d, 0x00, 0x80, 0x42, 0x11, 0x1a, 0x0f, 0xf6 } };
+// MF_MT_MIN_MASTERING_LUMINANCE {839A4460-4E7E-4B4F-AE79-CC08905C7B27}
+const GUID MKV_MT_MIN_MASTERING_LUMINANCE = { 0x839a4460, 0x4e7e, 0x4b4f, { 0xae, 0x79, 0xcc, 0x08, 0x90, 0x5c, 0x7b, 0x27 } };
+
+const MFVideoPrimaries MKVVideoPrimaries_DCI_P3 = (MFVideoPrimaries)11;            // MFVideoPrimaries_DCI_P3
+const MFVideoTransferFunction MKVVideoTransFunc_2084 = (MFVideoTransferFunction)15; // MFVideoTransFunc_2084 (SMPTE ST 2084, PQ)
+const MFVideoTransferFunction MKVVideoTransFunc_HLG = (MFVideoTransferFunction)16;  // MFVideoTransFunc_HLG (ARIB STD-B67)
+
+// Interfaces for applications that hold the source as an IMFMediaSource.
+// Query them from the source, or get them from IMFGetService::GetService
+// with MKV_SOURCE_SERVICE.
+
+// {F9CAABEB-52A0-4547-B313-EEF97EC217CE}
+const GUID MKV_SOURCE_SERVICE = { 0xf9caabeb, 0x52a0, 0x4547, { 0xb3, 0x13, 0xee, 0xf9, 0x7e, 0xc2, 0x17, 0xce } };
+
+// IMKVSubtitleCues
+// The subtitle cues of the file, for an application that draws them
+// itself. Only cues in the part of the file read so far are known. The
+// cue data and the CodecPrivate data stay valid until the source shuts
+// down.
+MIDL_INTERFACE("04D09DD0-F05C-4150-B2C8-D6D4390736F1")
+IMKVSubtitleCues : public IUnknown
+{
+public:
+	// Returns the cues of a track that show at hnsTime. Free *ppCues
+	// with CoTaskMemFree (it is null when *pcCues is 0).
+	virtual HRESULT STDMETHODCALLTYPE GetCuesAt(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue **ppCues, DWORD *pcCues) = 0;
+
+	// Returns the first known cue of a track that starts after hnsTime,
+	// or S_FALSE if there is none yet.
+	virtual HRESULT STDMETHODCALLTYPE GetCueAfter(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue) = 0;
+
+	// Returns the subtitle format and CodecPrivate data of a track, or
+	// MF_E_INVALIDSTREAMNUMBER if it is not a subtitle track.
+	virtual HRESULT STDMETHODCALLTYPE GetSubtitleTrackInfo(DWORD dwTrack, SubtitleFormat *pFormat, const BYTE **ppCodecPrivate, DWORD *pcbCodecPrivate) = 0;
+};
+
+// Chapter queries (see IMKVChapters).
+enum ChapterQuery
+{
+	CHAPTER_AT,         // The chapter that plays at hnsTime.
+	CHAPTER_NEXT,       // The first chapter after it.
+	CHAPTER_PREVIOUS    // The chapter before it.
+};
+
+// A chapter, as IMKVChapters returns it.
+struct MKVChapterInfo
+{
+	UINT64      uid;            // ChapterUID: the start position for MKV_TIME_FORMAT_CHAPTER.
+	LONGLONG    hnsStart;       // In 100-ns units.
+	LONGLONG    hnsEnd;         // ChapterTimeEnd, or CHAPTER_OPEN_END.
+	DWORD       depth;          // 0 for a top-level chapter, 1 for a chapter in it, and so on.
+	QWORD       qwPosition;     // File offset of the cluster to read from, or 0 if the Cues are not known yet.
+	LPWSTR      pszTitle;       // The title, or an empty string. Free with CoTaskMemFree.
+};
+
+// Time format for IMFMediaSource::Start: the start position is the
+// ChapterUID (VT_UI8) of a chapter, and the source starts at the
+// chapter's start time. The seek goes through the Cues, like any
+// other: one lookup, then one jump to the cluster.
+
+// {2F3B8A51-6C0E-4D7B-9A1F-5E24C7B3D980}
+const GUID MKV_TIME_FORMAT_CHAPTER = { 0x2f3b8a51, 0x6c0e, 0x4d7b, { 0x9a, 0x1f, 0x5e, 0x24, 0xc7, 0xb3, 0xd9, 0x80 } };
+
+// IMKVChapters
+// The chapters of the file, by edition. Only the chapters in the part of
+// the file read so far are known (they are usually at the start).
+MIDL_INTERFACE("6B1E94C2-0D4A-4F3E-8C57-A93D2E61B70F")
+IMKVChapters : public IUnknown
+{
+public:
+	// Returns the number of editions, and the one to play by default.
+	virtual HRESULT STDMETHODCALLTYPE GetEditionCount(DWORD *pcEditions) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDefaultEdition(DWORD *pdwEdition) = 0;
+
+	// Returns a chapter of an edition, relative to hnsTime, or S_FALSE
+	// if there is none.
+	virtual HRESULT STDMETHODCALLTYPE GetChapter(DWORD dwEdition, LONGLONG hnsTime, ChapterQuery query, MKVChapterInfo *pInfo) = 0;
+};
+
+// IMKVCrcResults
+// The CRC-32 checks of the masters that have one (see CrcVerifier). They
+// are off by default. The mode can change at any time; it applies to the
+// elements parsed after that.
+MIDL_INTERFACE("C41F7A36-8E2B-4D05-B6E9-1F70D35A82C4")
+IMKVCrcResults : public IUnknown
+{
+public:
+	virtual HRESULT STDMETHODCALLTYPE SetVerifyMode(CrcVerifyMode mode) = 0;
+
+	// Returns the results per element ID. Free *ppCounters with
+	// CoTaskMemFree (it is null when *pcCounters is 0).
+	virtual HRESULT STDMETHODCALLTYPE GetCounters(CrcCounters **ppCounters, DWORD *pcCounters) = 0;
+
+	// Returns the elements whose CRC-32 did not match. Free *ppFailures
+	// with CoTaskMemFree (it is null when *pcFailures is 0).
+	virtual HRESULT STDMETHODCALLTYPE GetFailures(CrcFailure **ppFailures, DWORD *pcFailures) = 0;
+};
+
+// How often the demux used each read strategy (see MKVSource::GetPrefetchStats).
+struct PrefetchStats
+{
+	ULONG cInterleaved;     // Frames delivered in file order.
+	ULONG cBackPressure;    // Times the demux stopped because a stream held enough.
+	ULONG cSeekAndRead;     // Times the demux skipped over-buffered tracks to feed a starving one.
+	ULONG cSkippedFrames;   // Frames skipped while doing so...
+	ULONG cRereadFrames;    // ...and delivered later, after seeking back.
+};
 
 // Represents a request for an asynchronous operation.
 
@@ -205,7 +361,10 @@ class MKVSource WrlSealed :
 	public OpQueue<MKVSource, SourceOp>,
 	public IMFMediaSourceEx,
 	public IMFGetService,
-	public IMFRateControl
+	public IMFRateControl,
+	public IMKVSubtitleCues,
+	public IMKVChapters,
+	public IMKVCrcResults
 {
 public:
 	static ComPtr<MKVSource> CreateInstance();
@@ -245,15 +404,72 @@ public:
 	IFACEMETHOD(SetRate) (BOOL fThin, float flRate);
 	IFACEMETHOD(GetRate) (_Inout_opt_ BOOL *pfThin, _Inout_opt_ float *pflRate);
 
+	// IMKVSubtitleCues
+	IFACEMETHOD(GetCuesAt) (DWORD dwTrack, LONGLONG hnsTime, SubtitleCue **ppCues, DWORD *pcCues);
+	IFACEMETHOD(GetCueAfter) (DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue);
+	IFACEMETHOD(GetSubtitleTrackInfo) (DWORD dwTrack, SubtitleFormat *pFormat, const BYTE **ppCodecPrivate, DWORD *pcbCodecPrivate);
+
+	// IMKVChapters
+	IFACEMETHOD(GetEditionCount) (DWORD *pcEditions);
+	IFACEMETHOD(GetDefaultEdition) (DWORD *pdwEdition);
+	IFACEMETHOD(GetChapter) (DWORD dwEdition, LONGLONG hnsTime, ChapterQuery query, MKVChapterInfo *pInfo);
+
+	// IMKVCrcResults
+	IFACEMETHOD(SetVerifyMode) (CrcVerifyMode mode);
+	IFACEMETHOD(GetCounters) (CrcCounters **ppCounters, DWORD *pcCounters);
+	IFACEMETHOD(GetFailures) (CrcFailure **ppFailures, DWORD *pcFailures);
+
 	// Called by the byte stream handler.
 	concurrency::task<void> OpenAsync(IMFByteStream *pStream);
 
+	// Runs reading and parsing on the process-wide WorkScheduler instead
+	// of a private work queue. Call before OpenAsync.
+	void UseSharedScheduler() { m_fUseSharedScheduler = true; }
+
+	// Returns the read strategy counters since the source was created.
+	void GetPrefetchStats(PrefetchStats *pStats);
+
+	// Returns the subtitle cues of a track that show at hnsTime.
+	// Only cues in the part of the file read so far are known. The data
+	// pointers stay valid until the source shuts down.
+	void GetSubtitleCues(DWORD dwTrack, LONGLONG hnsTime, std::vector<SubtitleCue> *pCues);
+
+	// Returns the next known cue of a track that starts after hnsTime.
+	bool GetNextSubtitleCue(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue);
+
+	// Returns the subtitle format of a track, and its CodecPrivate data
+	// (valid until the source shuts down).
+	SubtitleFormat GetSubtitleTrackFormat(DWORD dwTrack, const BYTE **ppCodecPrivate, DWORD *pcbCodecPrivate);
+
+	// Chapters, by edition (see ChapterIndex). FindChapter also returns
+	// the file offset of the cluster to read from, found in the Cues;
+	// Start() at the chapter's time (or at its UID, with
+	// MKV_TIME_FORMAT_CHAPTER) seeks straight there, with one read.
+	DWORD GetChapterEditionCount();
+	DWORD GetDefaultChapterEdition();
+	bool FindChapter(DWORD edition, LONGLONG hnsTime, ChapterQuery query, Chapter *pChapter, QWORD *pqwPosition);
+
+	// Attachments (fonts for SSA/ASS subtitles, cover art). Only those in
+	// the part of the file read so far are known. GetAttachment returns
+	// the name, MIME type and file offset (the strings stay valid until
+	// the source shuts down); ReadAttachment reads the data, and blocks
+	// until it has. It reads without the source locks, on a clone of the
+	// app's stream if it has one, so the demux goes on meanwhile.
+	DWORD GetAttachmentCount();
+	void GetAttachment(DWORD index, AttachedFile *pFile);
+	void ReadAttachment(DWORD index, std::vector<BYTE> *pData);
+
+	// CRC-32 checks (see IMKVCrcResults).
+	void SetCrcVerification(CrcVerifyMode mode);
+	void GetCrcCounters(std::vector<CrcCounters> *pCounters);
+	void GetCrcFailures(std::vector<CrcFailure> *pFailures);
+
 	// Queues an asynchronous operation, specify by op-type.
 	// (This method is public because the streams call it.)
 	HRESULT QueueAsyncOperation(SourceOp::Operation OpType);
 
 	// Lock/Unlock:
-	// Holds and releases the source's critical section. Called by the streams.
+	// Holds and releases the source's critical section.
 	_Acquires_lock_(m_critSec)
 		void    Lock() { m_critSec.Lock(); }
 
@@ -262,6 +478,8 @@ public:
 
 	// Callbacks
 	HRESULT OnByteStreamRead(IMFAsyncResult *pResult);  // Async callback for RequestData
+	HRESULT OnDemux(IMFAsyncResult *pResult);           // Demux work item, queued by OnStreamRequestSample
+	HRESULT OnReadCompleted(IMFAsyncResult *pResult);   // Moves a read completion to the task queue
 
 private:
 
@@ -292,13 +510,37 @@ private:
 	void        SelectStreams(IMFPresentationDescriptor *pPD, const PROPVARIANT varStart);
 
 	void        RequestData(DWORD cbRequest);
+	void        Prefetch();
+	bool        TakePrefetchedData();
+	void        SkipData(DWORD cb);
+	void        SeekReads(QWORD qwPosition);
 	void        ParseData();
-	bool        ReadPayload(DWORD *pcbAte, DWORD *pcbNextRequest);
+	void        CompleteDemux(HRESULT hr, bool fEndOfStream);
+	HRESULT     PutDemuxWorkItem(IMFAsyncCallback *pCallback, IUnknown *pState);
+	bool        ReadPayload(DWORD *pcbAte, DWORD *pcbNextRequest, bool fSkip);
+	bool        ScheduleFrame(bool *pfSkip);
+	void        SeekBackToSkippedFrames();
+	void        ResetReadMode();
+	int         FindSkippedTrack(int track) const;
+	bool        UnskippedStreamsNeedData(bool fStarving) const;
+	bool        IsOverBuffered(MKVStream *pStream) const;
+	void        DeliverParsedSubtitleCues();
+	void        DeliverActiveSubtitleCues(LONGLONG hnsTime);
+	void        DeliverSubtitleCue(DWORD dwTrack, const SubtitleCue &cue);
+	QWORD       FramePosition() const { return m_qwPrefetchPosition - m_ReadBuffer->DataSize(); }
 	void        DeliverPayload();
+	void        TickSparseStreams(LONGLONG hnsTime);
 	void        EndOfMPEGStream();
 
 	void        CreateStream(int packetSize);
 	void		CreateStreams();  //create streams from mkv data, not frame/packet headers
+	void		CreateCaptionStreams();
+	CaptionStream *FindCaptionStream(DWORD dwStreamId);
+	void        LoadTags();
+	DWORD       ReadAt(QWORD qwPosition, BYTE *pData, DWORD cb);
+	DWORD       ReadAfterPendingRead(QWORD qwPosition, BYTE *pData, DWORD cb);
+	void        ResumeReads();
+	ComPtr<IMFByteStream> CloneByteStream();
 
 	HRESULT     ValidatePresentationDescriptor(IMFPresentationDescriptor *pPD);
 
@@ -309,6 +551,7 @@ private:
 	void        CompleteAsyncOp(SourceOp *pOp);
 	HRESULT     DispatchOperation(SourceOp *pOp);
 	HRESULT     ValidateOperation(SourceOp *pOp);
+	bool        CoalesceOperation(SourceOp *pPending, SourceOp *pOp);
 
 	bool        IsRateSupported(float flRate, float *pflAdjustedRate);
 
@@ -318,11 +561,17 @@ private:
 
 	long                        m_cRef;                     // reference count
 
+	// Lock order: m_attachmentCritSec, m_critSec, then m_demuxCritSec,
+	// then the stream locks.
+	// The demux worker holds only m_demuxCritSec once the source is open.
 	CritSec                     m_critSec;                  // critical section for thread safety
+	CritSec                     m_demuxCritSec;             // Protects the parser, read buffer and byte stream reads.
+	CritSec                     m_attachmentCritSec;        // One ReadAttachment at a time. Taken before the others.
 	SourceState                 m_state;                    // Current state (running, stopped, paused)
 
-	Buffer                      ^m_ReadBuffer;
-	Parser                      ^m_parser;
+	Buffer                      *m_ReadBuffer;
+	Buffer                      *m_PrefetchBuffer;          // Data read ahead of the parser.
+	Parser                      *m_parser;
 
 	ComPtr<IMFMediaEventQueue>  m_spEventQueue;             // Event generator helper
 	ComPtr<IMFPresentationDescriptor> m_spPresentationDescriptor; // Presentation descriptor.
@@ -334,6 +583,7 @@ private:
 	MKVMasterData*				m_masterData;
 
 	StreamList                  m_streams;                  // Array of streams.
+	std::vector<ComPtr<CaptionStream>> m_captionStreams;    // One per subtitle track, after m_streams in the PD.
 
 	DWORD                       m_cPendingEOS;              // Pending EOS notifications.
 	ULONG                       m_cRestartCounter;          // Counter for sample requests.
@@ -341,8 +591,65 @@ private:
 	ComPtr<SourceOp>            m_spCurrentOp;
 	ComPtr<SourceOp>            m_spSampleRequest;
 
-	// Async callback helper.
+	DWORD                       m_dwDemuxQueue;             // Private work queue for reading and parsing.
+	LONG                        m_fDemuxPending;            // Is a demux work item already queued?
+	bool                        m_fDemuxEndOfStream;        // Parser reached the end of the file.
+	bool                        m_fUseSharedScheduler;      // Demux on the shared scheduler?
+	ComPtr<TaskQueue>           m_spTaskQueue;              // Demux task queue, if m_fUseSharedScheduler.
+
+	// Read pipeline. Protected by m_demuxCritSec.
+	QWORD                       m_qwPrefetchPosition;       // File offset of the first prefetched byte.
+	bool                        m_fReadPending;             // Is a read in flight?
+	bool                        m_fParserWaiting;           // Does the parser wait for that read?
+	bool                        m_fEndOfFile;               // Did a read return 0 bytes?
+	ULONG                       m_cReadGeneration;          // Bumped on every seek; older reads are stale.
+	ULONG                       m_cPendingReadGeneration;   // Generation of the read in flight.
+	bool                        m_fAttachmentRead;          // ReadAttachment holds off the read-ahead.
+	concurrency::event          m_readDone;                 // Set when a read completes while m_fAttachmentRead.
+
+	// Attachment reads. Protected by m_attachmentCritSec, and m_critSec
+	// to set up.
+	ComPtr<IMFByteStream>       m_spAttachmentStream;       // Clone of m_spByteStream, with its own position.
+	bool                        m_fAttachmentStreamTried;   // Did we try to clone it?
+
+	// Back-pressure. Protected by m_demuxCritSec.
+	//
+	// Normally frames are delivered in file order (READ_INTERLEAVED). If
+	// a frame belongs to a stream that holds too much while another
+	// stream starves, that track is skipped (READ_SKIP_TRACKS) until the
+	// other streams hold enough. Then the demux seeks back to the cluster
+	// of the first skipped frame and delivers only what it skipped
+	// (READ_REREAD_TRACKS), up to where it stopped skipping.
+	enum ReadMode
+	{
+		READ_INTERLEAVED,
+		READ_SKIP_TRACKS,
+		READ_REREAD_TRACKS
+	};
+
+	struct SkippedTrack
+	{
+		int     track;              // Track number.
+		QWORD   qwFirstFrame;       // File offset of the first skipped frame.
+	};
+
+	ReadMode                    m_readMode;
+	SkippedTrack                m_skipped[MAX_STREAMS];     // Tracks skipped in READ_SKIP_TRACKS.
+	DWORD                       m_cSkipped;
+	QWORD                       m_qwClusterPosition;        // File offset of the current cluster, or 0.
+	QWORD                       m_qwResumePosition;         // Where READ_REREAD_TRACKS starts.
+	QWORD                       m_qwSkipEndPosition;        // Where READ_REREAD_TRACKS ends.
+	PrefetchStats               m_stats;
+
+	SubtitleCueStore            m_subtitles;                // Text subtitle cues seen so far.
+	LONGLONG                    m_hnsSubtitleStart;         // Start position of the last seek (see DeliverParsedSubtitleCues).
+	ChapterIndex                m_chapters;
+	ComPtr<CrcVerifier>         m_spCrcVerifier;
+
+	// Async callback helpers.
 	AsyncCallback<MKVSource>  m_OnByteStreamRead;
+	AsyncCallback<MKVSource>  m_OnDemux;
+	AsyncCallback<MKVSource>  m_OnReadCompleted;
 
 	float                       m_flRate;
 
@@ -19,40 +19,6 @@
 #pragma warning( disable : 4355 )  // 'this' used in base member initializer list
 
 
-/* MKVStream::SourceLock class methods */
-
-//-------------------------------------------------------------------
-// MKVStream::SourceLock constructor - locks the source
-//-------------------------------------------------------------------
-
-_Acquires_lock_(m_pSource)
-MKVStream::SourceLock::SourceLock(MKVSource *pSource)
-: m_pSource(nullptr)
-{
-	if (pSource)
-	{
-		m_pSource = pSource;
-		m_pSource->AddRef();
-		m_pSource->Lock();
-	}
-}
-
-//-------------------------------------------------------------------
-// MKVStream::SourceLock destructor - unlocks the source
-//-------------------------------------------------------------------
-
-_Releases_lock_(m_pSource)
-MKVStream::SourceLock::~SourceLock()
-{
-	if (m_pSource)
-	{
-		m_pSource->Unlock();
-		m_pSource->Release();
-	}
-}
-
-
-
 /* Public class methods */
 
 //-------------------------------------------------------------------
@@ -105,7 +71,7 @@ HRESULT MKVStream::BeginGetEvent(IMFAsyncCallback *pCallback, IUnknown *punkStat
 {
 	HRESULT hr = S_OK;
 
-	SourceLock lock(m_spSource.Get());
+	AutoLock lock(m_critSec);
 
 	hr = CheckShutdown();
 
@@ -121,7 +87,7 @@ HRESULT MKVStream::EndGetEvent(IMFAsyncResult *pResult, IMFMediaEvent **ppEvent)
 {
 	HRESULT hr = S_OK;
 
-	SourceLock lock(m_spSource.Get());
+	AutoLock lock(m_critSec);
 
 	hr = CheckShutdown();
 
@@ -141,7 +107,7 @@ HRESULT MKVStream::GetEvent(DWORD dwFlags, IMFMediaEvent **ppEvent)
 
 	{ // scope for lock
 
-		SourceLock lock(m_spSource.Get());
+		AutoLock lock(m_critSec);
 
 		// Check shutdown
 		hr = CheckShutdown();
@@ -166,7 +132,7 @@ HRESULT MKVStream::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRES
 {
 	HRESULT hr = S_OK;
 
-	SourceLock lock(m_spSource.Get());
+	AutoLock lock(m_critSec);
 
 	hr = CheckShutdown();
 
@@ -190,7 +156,7 @@ HRESULT MKVStream::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRES
 
 HRESULT MKVStream::GetMediaSource(IMFMediaSource **ppMediaSource)
 {
-	SourceLock lock(m_spSource.Get());
+	AutoLock lock(m_critSec);
 
 	if (ppMediaSource == nullptr)
 	{
@@ -223,7 +189,7 @@ HRESULT MKVStream::GetMediaSource(IMFMediaSource **ppMediaSource)
 
 HRESULT MKVStream::GetStreamDescriptor(IMFStreamDescriptor **ppStreamDescriptor)
 {
-	SourceLock lock(m_spSource.Get());
+	AutoLock lock(m_critSec);
 
 	if (ppStreamDescriptor == nullptr)
 	{
@@ -257,10 +223,10 @@ HRESULT MKVStream::GetStreamDescriptor(IMFStreamDescriptor **ppStreamDescriptor)
 HRESULT MKVStream::RequestSample(IUnknown *pToken)
 {
 	HRESULT hr = S_OK;
-	IMFMediaSource *pSource = nullptr;
+	Notify notify = NOTIFY_NONE;
 
-	// Hold the media source object's critical section.
-	SourceLock lock(m_spSource.Get());
+	// Hold the stream's critical section.
+	m_critSec.Lock();
 
 	hr = CheckShutdown();
 	if (FAILED(hr))
@@ -295,15 +261,26 @@ HRESULT MKVStream::RequestSample(IUnknown *pToken)
 		goto done;
 	}
 
+	// Count the request before looking at the sample queue. The demux
+	// thread does the reverse (queue, then count), so one of the two
+	// always sees the other and the request cannot be missed.
+	InterlockedIncrement(&m_cRequests);
+
 	// Dispatch the request.
-	DispatchSamples();
+	hr = DispatchSamples(&notify);
 
 done:
+	m_critSec.Unlock();
+
+	// Tell the source after the stream lock is released, because the
+	// source lock comes first in the lock order. This also sends the
+	// MEError event if the request failed.
+	NotifySource(hr, notify);
+
 	if (FAILED(hr) && (m_state != STATE_SHUTDOWN))
 	{
-		// An error occurred. Send an MEError even from the source,
-		// unless the source is already shut down.
-		hr = m_spSource->QueueEvent(MEError, GUID_NULL, hr, nullptr);
+		// The error was reported through the MEError event.
+		hr = S_OK;
 	}
 	return hr;
 }
@@ -320,6 +297,13 @@ m_cRef(1),
 m_state(STATE_STOPPED),
 m_fActive(false),
 m_fEOS(false),
+m_fSparse(false),
+m_cRequests(0),
+m_hnsQueueStart(0),
+m_hnsQueueEnd(0),
+m_cbQueued(0),
+m_hnsTickTime(0),
+m_fTickSent(false),
 m_flRate(1.0f),
 m_spSource(pSource),
 m_spStreamDescriptor(pSD)
@@ -349,6 +333,15 @@ void MKVStream::Initialize()
 {
 	// Create the media event queue.
 	ThrowIfError(MFCreateEventQueue(&m_spEventQueue));
+
+	// Subtitle streams are sparse.
+	ComPtr<IMFMediaTypeHandler> spHandler;
+	GUID majorType = GUID_NULL;
+
+	ThrowIfError(m_spStreamDescriptor->GetMediaTypeHandler(&spHandler));
+	ThrowIfError(spHandler->GetMajorType(&majorType));
+
+	m_fSparse = (majorType == MKVMediaType_Subtitle);
 }
 
 //-------------------------------------------------------------------
@@ -358,6 +351,8 @@ void MKVStream::Initialize()
 
 void MKVStream::Activate(bool fActive)
 {
+	AutoLock lock(m_critSec);
+
 	if (fActive == m_fActive)
 	{
 		return;
@@ -367,8 +362,9 @@ void MKVStream::Activate(bool fActive)
 
 	if (!fActive)
 	{
-		m_Samples.Clear();
+		ClearSamples();
 		m_Requests.Clear();
+		InterlockedExchange(&m_cRequests, 0);
 	}
 }
 
@@ -382,25 +378,39 @@ void MKVStream::Activate(bool fActive)
 
 void MKVStream::Start(const PROPVARIANT &varStart)
 {
+	HRESULT hr = S_OK;
+	Notify notify = NOTIFY_NONE;
 
-	ThrowIfError(CheckShutdown());
-
-	if (varStart.hVal.QuadPart != 0)
 	{
-		// Queue the seek event
-		ThrowIfError(QueueEvent(MEStreamSeeked, GUID_NULL, S_OK, &varStart));
-	}
-	else
-	{
-		// Queue the stream-started event.
-		ThrowIfError(QueueEvent(MEStreamStarted, GUID_NULL, S_OK, &varStart));
-	}
+		AutoLock lock(m_critSec);
+
+		ThrowIfError(CheckShutdown());
+
+		if (varStart.hVal.QuadPart != 0)
+		{
+			// Queue the seek event
+			ThrowIfError(QueueEvent(MEStreamSeeked, GUID_NULL, S_OK, &varStart));
+		}
+		else
+		{
+			// Queue the stream-started event.
+			ThrowIfError(QueueEvent(MEStreamStarted, GUID_NULL, S_OK, &varStart));
+		}
 
-	m_state = STATE_STARTED;
+		m_state = STATE_STARTED;
 
-	// If we are restarting from paused, there may be
-	// queue sample requests. Dispatch them now.
-	DispatchSamples();
+		// Ticks count from the start position.
+		if (varStart.vt == VT_I8)
+		{
+			InterlockedExchange64(&m_hnsTickTime, varStart.hVal.QuadPart);
+		}
+
+		// If we are restarting from paused, there may be
+		// queue sample requests. Dispatch them now.
+		hr = DispatchSamples(&notify);
+	}
+
+	NotifySource(hr, notify);
 }
 
 
@@ -411,6 +421,8 @@ void MKVStream::Start(const PROPVARIANT &varStart)
 
 void MKVStream::Pause()
 {
+	AutoLock lock(m_critSec);
+
 	ThrowIfError(CheckShutdown());
 
 	m_state = STATE_PAUSED;
@@ -426,10 +438,13 @@ void MKVStream::Pause()
 
 void MKVStream::Stop()
 {
+	AutoLock lock(m_critSec);
+
 	ThrowIfError(CheckShutdown());
 
 	m_Requests.Clear();
-	m_Samples.Clear();
+	InterlockedExchange(&m_cRequests, 0);
+	ClearSamples();
 
 	m_state = STATE_STOPPED;
 
@@ -443,6 +458,8 @@ void MKVStream::Stop()
 
 void MKVStream::SetRate(float flRate)
 {
+	AutoLock lock(m_critSec);
+
 	ThrowIfError(CheckShutdown());
 
 	m_flRate = flRate;
@@ -456,9 +473,18 @@ void MKVStream::SetRate(float flRate)
 
 void MKVStream::EndOfStream()
 {
-	m_fEOS = true;
+	HRESULT hr = S_OK;
+	Notify notify = NOTIFY_NONE;
+
+	{
+		AutoLock lock(m_critSec);
+
+		m_fEOS = true;
 
-	DispatchSamples();
+		hr = DispatchSamples(&notify);
+	}
+
+	NotifySource(hr, notify);
 }
 
 
@@ -469,6 +495,8 @@ void MKVStream::EndOfStream()
 
 void MKVStream::Shutdown()
 {
+	AutoLock lock(m_critSec);
+
 	if (SUCCEEDED(CheckShutdown()))
 	{
 		m_state = STATE_SHUTDOWN;
@@ -480,17 +508,17 @@ void MKVStream::Shutdown()
 		}
 
 		// Release objects.
-		m_Samples.Clear();
+		ClearSamples();
 		m_Requests.Clear();
+		InterlockedExchange(&m_cRequests, 0);
 
 		m_spStreamDescriptor.Reset();
 		m_spEventQueue.Reset();
 
 		// NOTE:
-		// Do NOT release the source pointer here, because the stream uses
-		// it to hold the critical section. In particular, the stream must
-		// hold the critical section when checking the shutdown status,
-		// which obviously can occur after the stream is shut down.
+		// Do NOT release the source pointer here, because a sample request
+		// that is already running can still call into the source (for
+		// example, to queue an MEError event).
 
 		// It is OK to hold a ref count on the source after shutdown,
 		// because the source releases its ref count(s) on the streams,
@@ -504,27 +532,160 @@ void MKVStream::Shutdown()
 // Returns TRUE if the stream needs more data.
 //-------------------------------------------------------------------
 
-bool MKVStream::NeedsData()
+bool MKVStream::NeedsData() const
 {
-	// Note: The stream tries to keep a minimum number of samples
-	// queued ahead.
+	// Note: The stream tries to keep BUFFER_TARGET_DURATION of samples
+	// queued ahead, and at least SAMPLE_QUEUE samples in case the time
+	// stamps do not tell. Called on the demux thread without the lock;
+	// the sample count is exact there, because that thread fills the queue.
+	//
+	// A sparse stream never needs data: the next sample can be minutes
+	// of file away. It gets what the other streams' data brings, and
+	// ticks in between (see SendTick).
+
+	if (!m_fActive || m_fSparse || m_fEOS || m_Samples.IsFull())
+	{
+		return false;
+	}
 
-	return (m_fActive && !m_fEOS && (m_Samples.GetCount() < SAMPLE_QUEUE));
+	return (m_Samples.GetCount() < SAMPLE_QUEUE) || (BufferedDuration() < BUFFER_TARGET_DURATION);
+}
+
+
+//-------------------------------------------------------------------
+// IsStarving
+// Returns true if the pipeline waits for a sample that this stream
+// does not have.
+//-------------------------------------------------------------------
+
+bool MKVStream::IsStarving() const
+{
+	return m_fActive && !m_fSparse && !m_fEOS &&
+		(InterlockedCompareExchange(const_cast<LONG*>(&m_cRequests), 0, 0) > 0) &&
+		m_Samples.IsEmpty();
+}
+
+
+//-------------------------------------------------------------------
+// BufferedDuration
+// Returns the span of presentation time held in the sample queue.
+//
+// This is an estimate: with B-frames the time stamps are not in
+// decode order, and the two ends are updated by different threads.
+//-------------------------------------------------------------------
+
+LONGLONG MKVStream::BufferedDuration() const
+{
+	if (m_Samples.IsEmpty())
+	{
+		return 0;
+	}
+
+	LONGLONG hnsStart = InterlockedCompareExchange64(const_cast<LONGLONG*>(&m_hnsQueueStart), 0, 0);
+	LONGLONG hnsEnd = InterlockedCompareExchange64(const_cast<LONGLONG*>(&m_hnsQueueEnd), 0, 0);
+
+	return (hnsEnd > hnsStart ? hnsEnd - hnsStart : 0);
 }
 
 
 //-------------------------------------------------------------------
 // DeliverPayload
 // Delivers a sample to the stream.
+//
+// Called on the demux thread, which holds the demux lock but not the
+// source lock. The sample queue is lock-free; the stream lock is taken
+// only when a request is waiting for the sample. The demux pass is
+// already running, so a request for more data is dropped, and errors
+// go back to the demux pass.
+//
+// The source checks IsQueueFull() first, so the queue has room.
 //-------------------------------------------------------------------
 
 void MKVStream::DeliverPayload(IMFSample *pSample)
 {
+	LONGLONG hnsTime = 0;
+	LONGLONG hnsDuration = 0;
+	DWORD cbSample = 0;
+
+	(void)pSample->GetSampleTime(&hnsTime);
+	(void)pSample->GetSampleDuration(&hnsDuration);
+	(void)pSample->GetTotalLength(&cbSample);
+
+	// The first sample after a tick starts a new run of data.
+	if (m_fTickSent)
+	{
+		ThrowIfError(pSample->SetUINT32(MFSampleExtension_Discontinuity, TRUE));
+		m_fTickSent = false;
+	}
+
+	if (m_fSparse && (hnsTime + hnsDuration > InterlockedCompareExchange64(&m_hnsTickTime, 0, 0)))
+	{
+		InterlockedExchange64(&m_hnsTickTime, hnsTime + hnsDuration);
+	}
+
+	// If nothing is queued, the queue starts at this sample. (After a
+	// seek the new times can be lower than the old ones.)
+	bool fWasEmpty = m_Samples.IsEmpty();
+	if (fWasEmpty)
+	{
+		InterlockedExchange64(&m_hnsQueueStart, hnsTime);
+	}
+
 	// Queue the sample.
 	ThrowIfError(m_Samples.InsertBack(pSample));
 
+	if (fWasEmpty || (hnsTime + hnsDuration > InterlockedCompareExchange64(&m_hnsQueueEnd, 0, 0)))
+	{
+		InterlockedExchange64(&m_hnsQueueEnd, hnsTime + hnsDuration);
+	}
+	InterlockedExchangeAdd64(&m_cbQueued, cbSample);
+
 	// Deliver the sample if there is an outstanding request.
-	DispatchSamples();
+	if (InterlockedCompareExchange(&m_cRequests, 0, 0) > 0)
+	{
+		AutoLock lock(m_critSec);
+
+		Notify notify = NOTIFY_NONE;
+
+		ThrowIfError(DispatchSamples(&notify));
+	}
+}
+
+
+//-------------------------------------------------------------------
+// SendTick
+// Tells the pipeline that a sparse stream has no data up to hnsTime.
+//
+// Called on the demux thread, with the time of each frame it delivers
+// to the other streams. A tick goes out only if the stream has nothing
+// queued, and at most every SPARSE_TICK_INTERVAL; a time before the
+// last sample or tick (while rereading skipped frames) is ignored.
+//-------------------------------------------------------------------
+
+void MKVStream::SendTick(LONGLONG hnsTime)
+{
+	if (!m_fActive || !m_fSparse || !m_Samples.IsEmpty() ||
+		(hnsTime < InterlockedCompareExchange64(&m_hnsTickTime, 0, 0) + SPARSE_TICK_INTERVAL))
+	{
+		return;
+	}
+
+	AutoLock lock(m_critSec);
+
+	if (m_state != STATE_STARTED || m_fEOS)
+	{
+		return;
+	}
+
+	PROPVARIANT var;
+	PropVariantInit(&var);
+	var.vt = VT_I8;
+	var.hVal.QuadPart = hnsTime;
+
+	ThrowIfError(m_spEventQueue->QueueEventParamVar(MEStreamTick, GUID_NULL, S_OK, &var));
+
+	InterlockedExchange64(&m_hnsTickTime, hnsTime);
+	m_fTickSent = true;
 }
 
 /* Private methods */
@@ -532,15 +693,20 @@ void MKVStream::DeliverPayload(IMFSample *pSample)
 //-------------------------------------------------------------------
 // DispatchSamples
 // Dispatches as many pending sample requests as possible.
+//
+// pNotify: Receives what the caller must ask of the source, once the
+// stream lock is released.
 //-------------------------------------------------------------------
 
-void MKVStream::DispatchSamples() throw()
+HRESULT MKVStream::DispatchSamples(Notify *pNotify) throw()
 {
+	*pNotify = NOTIFY_NONE;
+
 	// An I/O request can complete after the source is paused, stopped, or
 	// shut down. Do not deliver samples unless the source is running.
 	if (m_state != STATE_STARTED)
 	{
-		return;
+		return S_OK;
 	}
 
 	try
@@ -552,10 +718,11 @@ void MKVStream::DispatchSamples() throw()
 			ComPtr<IUnknown> spToken;
 
 			// Pull the next sample from the queue.
-			ThrowIfError(m_Samples.RemoveFront(&spSample));
+			ThrowIfError(RemoveSample(&spSample));
 
 			// Pull the next request token from the queue. Tokens can be nullptr.
 			ThrowIfError(m_Requests.RemoveFront(&spToken));
+			InterlockedDecrement(&m_cRequests);
 
 			if (spToken != nullptr)
 			{
@@ -576,23 +743,97 @@ void MKVStream::DispatchSamples() throw()
 				MEEndOfStream, GUID_NULL, S_OK, nullptr));
 
 			// Notify the source. It will send the end-of-presentation event.
-			ThrowIfError(m_spSource->QueueAsyncOperation(SourceOp::OP_END_OF_STREAM));
+			*pNotify = NOTIFY_END_OF_STREAM;
 		}
 		else if (NeedsData())
 		{
 			// The sample queue is empty; the request queue is not empty; and we
 			// have not reached the end of the stream. Ask for more data.
-			ThrowIfError(m_spSource->QueueAsyncOperation(SourceOp::OP_REQUEST_DATA));
+			*pNotify = NOTIFY_NEED_DATA;
 		}
 	}
 	catch (Exception ^exc)
 	{
-		if (m_state != STATE_SHUTDOWN)
+		return exc->HResult;
+	}
+
+	return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// RemoveSample
+// Removes the next sample from the queue and updates the buffered
+// time and size.
+//-------------------------------------------------------------------
+
+HRESULT MKVStream::RemoveSample(IMFSample **ppSample)
+{
+	IMFSample *pSample = nullptr;
+
+	HRESULT hr = m_Samples.RemoveFront(&pSample);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	LONGLONG hnsTime = 0;
+	DWORD cbSample = 0;
+
+	if (SUCCEEDED(pSample->GetSampleTime(&hnsTime)))
+	{
+		InterlockedExchange64(&m_hnsQueueStart, hnsTime);
+	}
+	(void)pSample->GetTotalLength(&cbSample);
+	InterlockedExchangeAdd64(&m_cbQueued, -static_cast<LONGLONG>(cbSample));
+
+	*ppSample = pSample;    // The queue's reference passes to the caller.
+	return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ClearSamples
+// Releases every queued sample.
+//-------------------------------------------------------------------
+
+void MKVStream::ClearSamples()
+{
+	IMFSample *pSample = nullptr;
+
+	while (SUCCEEDED(RemoveSample(&pSample)))
+	{
+		pSample->Release();
+	}
+}
+
+
+//-------------------------------------------------------------------
+// NotifySource
+// Passes the result of DispatchSamples on to the source.
+//
+// Call without holding the stream lock.
+//-------------------------------------------------------------------
+
+void MKVStream::NotifySource(HRESULT hr, Notify notify) throw()
+{
+	if (SUCCEEDED(hr))
+	{
+		if (notify == NOTIFY_END_OF_STREAM)
 		{
-			// An error occurred. Send an MEError even from the source,
-			// unless the source is already shut down.
-			m_spSource->QueueEvent(MEError, GUID_NULL, exc->HResult, nullptr);
+			hr = m_spSource->QueueAsyncOperation(SourceOp::OP_END_OF_STREAM);
 		}
+		else if (notify == NOTIFY_NEED_DATA)
+		{
+			hr = m_spSource->QueueAsyncOperation(SourceOp::OP_REQUEST_DATA);
+		}
+	}
+
+	if (FAILED(hr) && (m_state != STATE_SHUTDOWN))
+	{
+		// An error occurred. Send an MEError even from the source,
+		// unless the source is already shut down.
+		m_spSource->QueueEvent(MEError, GUID_NULL, hr, nullptr);
 	}
 }
 
@@ -51,41 +51,49 @@ public:
 	void     Shutdown();
 
 	bool      IsActive() const { return m_fActive; }
-	bool      NeedsData();
+	bool      IsSparse() const { return m_fSparse; }
+	bool      NeedsData() const;
+	bool      IsQueueFull() const { return m_Samples.IsFull(); }
+	bool      IsStarving() const;
+	LONGLONG  BufferedDuration() const;
+	LONGLONG  BufferedBytes() const { return InterlockedCompareExchange64(const_cast<LONGLONG*>(&m_cbQueued), 0, 0); }
 
 	void   DeliverPayload(IMFSample *pSample);
+	void   SendTick(LONGLONG hnsTime);
 
 	// Callbacks
 	HRESULT     OnDispatchSamples(IMFAsyncResult *pResult);
 
 private:
 
-	// SourceLock class:
-	// Small helper class to lock and unlock the source.
-	class SourceLock
+	// What DispatchSamples asks of the source. The stream tells the source
+	// only after it releases its own lock (see NotifySource).
+	enum Notify
 	{
-	private:
-		MKVSource *m_pSource;
-	public:
-		_Acquires_lock_(m_pSource)
-			SourceLock(MKVSource *pSource);
-
-		_Releases_lock_(m_pSource)
-			~SourceLock();
+		NOTIFY_NONE,
+		NOTIFY_NEED_DATA,
+		NOTIFY_END_OF_STREAM
 	};
 
-private:
-
 	HRESULT CheckShutdown() const
 	{
 		return (m_state == STATE_SHUTDOWN ? MF_E_SHUTDOWN : S_OK);
 	}
-	void DispatchSamples() throw();
+	HRESULT DispatchSamples(Notify *pNotify) throw();
+	HRESULT RemoveSample(IMFSample **ppSample);
+	void ClearSamples();
+	void NotifySource(HRESULT hr, Notify notify) throw();
 
 
 private:
 	long                m_cRef;                 // reference count
 
+	// The stream has its own lock, so that the demux thread can deliver
+	// samples without holding the source lock. Lock order is source,
+	// then demux, then stream. The demux thread only takes it when a
+	// sample request is waiting.
+	CritSec             m_critSec;
+
 	ComPtr<MKVSource> m_spSource;            // Parent media source
 	ComPtr<IMFStreamDescriptor> m_spStreamDescriptor;
 	ComPtr<IMFMediaEventQueue> m_spEventQueue;  // Event generator helper
@@ -93,9 +101,22 @@ private:
 	SourceState         m_state;                // Current state (running, stopped, paused)
 	bool                m_fActive;              // Is the stream active?
 	bool                m_fEOS;                 // Did the source reach the end of the stream?
+	bool                m_fSparse;              // Subtitle stream: samples are minutes apart, if at all.
 
-	SampleList          m_Samples;              // Samples waiting to be delivered.
+	SampleRing          m_Samples;              // Samples waiting to be delivered.
 	TokenList           m_Requests;             // Sample requests, waiting to be dispatched.
+	volatile LONG       m_cRequests;            // Size of m_Requests, read without the lock.
+
+	// How much is queued, for the source's back-pressure checks. The
+	// demux thread moves the end, the stream moves the start.
+	volatile LONGLONG   m_hnsQueueStart;        // Time stamp of the last sample removed from m_Samples.
+	volatile LONGLONG   m_hnsQueueEnd;          // Latest end time (time + duration) added to m_Samples.
+	volatile LONGLONG   m_cbQueued;             // Bytes in m_Samples.
+
+	// Sparse streams. The demux thread sends an MEStreamTick when it
+	// gets past a gap, and marks the next sample as a discontinuity.
+	volatile LONGLONG   m_hnsTickTime;          // Time of the last sample or tick (or the start position).
+	bool                m_fTickSent;            // Was there a tick since the last sample? (Demux thread only.)
 
 	float               m_flRate;
 };
@@ -19,8 +19,8 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
-#include "MKVSource.h"
-#include "Parse.h"
+#include "Demux.h"
+#include "BitmapSubtitles.h"
 
 
 
@@ -70,7 +70,7 @@ inline void AdvanceBufferPointer(const BYTE* &pData, DWORD &cbBufferSize, DWORD
 	assert(cbBufferSize >= cbAdvance);
 	if (cbBufferSize < cbAdvance)
 	{
-		throw ref new InvalidArgumentException();
+		ThrowException(E_INVALIDARG);
 	}
 	cbBufferSize -= cbAdvance;
 	pData += cbAdvance;
@@ -110,7 +110,6 @@ Buffer::Buffer(DWORD cbSize)
 	, m_allocated(0)
 {
 	SetSize(cbSize);
-	ZeroMemory(Ptr, cbSize);
 }
 
 //-------------------------------------------------------------------
@@ -118,9 +117,9 @@ Buffer::Buffer(DWORD cbSize)
 // Returns a pointer to the start of the buffer.
 //-------------------------------------------------------------------
 
-BYTE *Buffer::DataPtr::get()
+BYTE *Buffer::DataPtr()
 {
-	return Ptr + m_begin;
+	return Ptr() + m_begin;
 }
 
 
@@ -132,7 +131,7 @@ BYTE *Buffer::DataPtr::get()
 // The memory allocated for the buffer can be larger.
 //-------------------------------------------------------------------
 
-DWORD Buffer::DataSize::get() const
+DWORD Buffer::DataSize() const
 {
 	assert(m_end >= m_begin);
 
@@ -142,20 +141,12 @@ DWORD Buffer::DataSize::get() const
 // Reserves memory for the array, but does not increase the count.
 void Buffer::Allocate(DWORD alloc)
 {
-	HRESULT hr = S_OK;
 	if (alloc > m_allocated)
 	{
-		Array<BYTE> ^tmp = ref new Array<BYTE>(alloc);
-		ZeroMemory(tmp->Data, alloc);
-
 		assert(m_count <= m_allocated);
 
-		// Copy the elements to the re-allocated array.
-		for (DWORD i = 0; i < m_count; i++)
-		{
-			tmp[i] = m_array[i];
-		}
-		m_array = tmp;
+		// The new bytes are zeroed and the elements are kept.
+		m_array.resize(alloc);
 		m_allocated = alloc;
 	}
 }
@@ -186,9 +177,9 @@ void Buffer::SetSize(DWORD count)
 
 void Buffer::Reserve(DWORD cb)
 {
-	if (cb > MAXDWORD - DataSize)
+	if (cb > MAXDWORD - DataSize())
 	{
-		throw ref new InvalidArgumentException();
+		ThrowException(E_INVALIDARG);
 	}
 
 	// If this would push the end position past the end of the array,
@@ -200,20 +191,20 @@ void Buffer::Reserve(DWORD cb)
 		// New end position would be past the end of the array.
 		// Check if we need to grow the array.
 
-		if (cb > CurrentFreeSize)
+		if (cb > CurrentFreeSize())
 		{
 			// Array needs to grow
-			SetSize(DataSize + cb);
+			SetSize(DataSize() + cb);
 		}
 
-		MoveMemory(Ptr, DataPtr, DataSize);
+		MoveMemory(Ptr(), DataPtr(), DataSize());
 
 		// Reset begin and end.
-		m_end = DataSize; // Update m_end first before resetting m_begin!
+		m_end = DataSize(); // Update m_end first before resetting m_begin!
 		m_begin = 0;
 	}
 
-	assert(CurrentFreeSize >= cb);
+	assert(CurrentFreeSize() >= cb);
 }
 
 
@@ -227,9 +218,9 @@ void Buffer::Reserve(DWORD cb)
 void Buffer::MoveStart(DWORD cb)
 {
 	// Cannot advance pass the end of the buffer.
-	if (cb > DataSize)
+	if (cb > DataSize())
 	{
-		throw ref new InvalidArgumentException();
+		ThrowException(E_INVALIDARG);
 	}
 
 	m_begin += cb;
@@ -254,10 +245,10 @@ void Buffer::MoveEnd(DWORD cb)
 // Returns the size of the array minus the size of the data.
 //-------------------------------------------------------------------
 
-DWORD Buffer::CurrentFreeSize::get() const
+DWORD Buffer::CurrentFreeSize() const
 {
-	assert(m_count >= DataSize);
-	return m_count - DataSize;
+	assert(m_count >= DataSize());
+	return m_count - DataSize();
 }
 
 
@@ -272,16 +263,36 @@ Parser::Parser()
 	, m_framesReady(false)
 	, m_bEOS(false)
 	, m_isFinishedParsingMaster(false)
+	, m_jumpTo(0)
 	, m_jumpFlag(false)
+	, m_isNewCluster(false)
+	, m_clusterOffset(0)
+	, m_bufferPosition(0)
+	, m_pSubtitles(nullptr)
+	, m_pChapters(nullptr)
+	, m_pCrcVerifier(nullptr)
+	, m_isCurrentKeyFrame(false)
+	, m_currentBlockTimeCode(0)
+	, m_currentTimeStamp(0)
+	, m_currentFrameSize(0)
+	, m_currentStream(0)
 	, m_insertedHeaderYet(false)
+	, m_frameCount(0)
 	, pCircRead(&m_circularBuffer[0])
 	, pCircWrite(&m_circularBuffer[0])
 	, pCircReadPosition(&m_circularBufferPosition[0])
 	, pCircWritePosition(&m_circularBufferPosition[0])
 {
 	ZeroMemory(&m_curPacketHeader, sizeof(m_curPacketHeader));
+	ZeroMemory(m_circularBuffer, sizeof(m_circularBuffer));
+	ZeroMemory(m_circularBufferPosition, sizeof(m_circularBufferPosition));
+	ZeroMemory(&m_startPosition, sizeof(m_startPosition));
 
 	m_masterData = new MKVMasterData();
+
+	m_iTagBps = m_tagReader.Register("BPS");
+	m_iTagFrameCount = m_tagReader.Register("NUMBER_OF_FRAMES");
+	m_iTagDuration = m_tagReader.Register("DURATION");
 }
 
 //-------------------------------------------------------------------
@@ -432,6 +443,7 @@ std::map<DWORD, type_name > element_types_names =
 	std::make_pair(0x66A5, type_name(EET::BINARY, "TrackTranslateTrackID")),
 	std::make_pair(0xE0, type_name(EET::MASTER, "Video")),
 	std::make_pair(0x9A, type_name(EET::_UNSIGNED, "FlagInterlaced")),
+	std::make_pair(0x9D, type_name(EET::_UNSIGNED, "FieldOrder")),
 	std::make_pair(0x53B8, type_name(EET::_UNSIGNED, "StereoMode")),
 	std::make_pair(0x53B9, type_name(EET::_UNSIGNED, "OldStereoMode")),
 	std::make_pair(0xB0, type_name(EET::_UNSIGNED, "PixelWidth")),
@@ -445,6 +457,31 @@ std::map<DWORD, type_name > element_types_names =
 	std::make_pair(0x54B2, type_name(EET::_UNSIGNED, "DisplayUnit")),
 	std::make_pair(0x54B3, type_name(EET::_UNSIGNED, "AspectRatioType")),
 	std::make_pair(0x2EB524, type_name(EET::BINARY, "ColourSpace")),
+	std::make_pair(0x55B0, type_name(EET::MASTER, "Colour")),
+	std::make_pair(0x55B1, type_name(EET::_UNSIGNED, "MatrixCoefficients")),
+	std::make_pair(0x55B2, type_name(EET::_UNSIGNED, "BitsPerChannel")),
+	std::make_pair(0x55B3, type_name(EET::_UNSIGNED, "ChromaSubsamplingHorz")),
+	std::make_pair(0x55B4, type_name(EET::_UNSIGNED, "ChromaSubsamplingVert")),
+	std::make_pair(0x55B5, type_name(EET::_UNSIGNED, "CbSubsamplingHorz")),
+	std::make_pair(0x55B6, type_name(EET::_UNSIGNED, "CbSubsamplingVert")),
+	std::make_pair(0x55B7, type_name(EET::_UNSIGNED, "ChromaSitingHorz")),
+	std::make_pair(0x55B8, type_name(EET::_UNSIGNED, "ChromaSitingVert")),
+	std::make_pair(0x55B9, type_name(EET::_UNSIGNED, "Range")),
+	std::make_pair(0x55BA, type_name(EET::_UNSIGNED, "TransferCharacteristics")),
+	std::make_pair(0x55BB, type_name(EET::_UNSIGNED, "Primaries")),
+	std::make_pair(0x55BC, type_name(EET::_UNSIGNED, "MaxCLL")),
+	std::make_pair(0x55BD, type_name(EET::_UNSIGNED, "MaxFALL")),
+	std::make_pair(0x55D0, type_name(EET::MASTER, "MasteringMetadata")),
+	std::make_pair(0x55D1, type_name(EET::_FLOAT, "PrimaryRChromaticityX")),
+	std::make_pair(0x55D2, type_name(EET::_FLOAT, "PrimaryRChromaticityY")),
+	std::make_pair(0x55D3, type_name(EET::_FLOAT, "PrimaryGChromaticityX")),
+	std::make_pair(0x55D4, type_name(EET::_FLOAT, "PrimaryGChromaticityY")),
+	std::make_pair(0x55D5, type_name(EET::_FLOAT, "PrimaryBChromaticityX")),
+	std::make_pair(0x55D6, type_name(EET::_FLOAT, "PrimaryBChromaticityY")),
+	std::make_pair(0x55D7, type_name(EET::_FLOAT, "WhitePointChromaticityX")),
+	std::make_pair(0x55D8, type_name(EET::_FLOAT, "WhitePointChromaticityY")),
+	std::make_pair(0x55D9, type_name(EET::_FLOAT, "LuminanceMax")),
+	std::make_pair(0x55DA, type_name(EET::_FLOAT, "LuminanceMin")),
 	std::make_pair(0x2FB523, type_name(EET::_FLOAT, "GammaValue")),
 	std::make_pair(0x2383E3, type_name(EET::_FLOAT, "FrameRate")),
 	std::make_pair(0xE1, type_name(EET::MASTER, "Audio")),
@@ -493,8 +530,8 @@ std::map<DWORD, type_name > element_types_names =
 	std::make_pair(0x97, type_name(EET::_UNSIGNED, "CueRefCluster")),
 	std::make_pair(0x535F, type_name(EET::_UNSIGNED, "CueRefNumber")),
 	std::make_pair(0xEB, type_name(EET::_UNSIGNED, "CueRefCodecState")),
-	std::make_pair(0x1941A469, type_name(EET::MASTER, "Attachments")),
-	std::make_pair(0x61A7, type_name(EET::MASTER, "AttachedFile")),
+	std::make_pair(0x1941A469, type_name(EET::JUST_GO_ON, "Attachments")),
+	std::make_pair(0x61A7, type_name(EET::JUST_GO_ON, "AttachedFile")),
 	std::make_pair(0x467E, type_name(EET::TEXTU, "FileDescription")),
 	std::make_pair(0x466E, type_name(EET::TEXTU, "FileName")),
 	std::make_pair(0x4660, type_name(EET::TEXTA, "FileMimeType")),
@@ -606,7 +643,7 @@ matroska_number_result Parser::ReadMatroskaNumber(const BYTE **pData, DWORD *cbL
 {
 	if (unmodified && _signed)
 	{
-		throw ref new Exception(-1, L"Contradictory arguments: ReadMatroskaNumber unmodified and signed");
+		ThrowException(E_INVALIDARG);		// Contradictory arguments: unmodified and signed.
 	}
 	matroska_number_result mresult;
 	DWORD code = **pData;
@@ -642,6 +679,38 @@ matroska_number_result Parser::ReadMatroskaNumber(const BYTE **pData, DWORD *cbL
 	return mresult;
 }
 
+//-------------------------------------------------------------------
+// GetVintLength
+// Returns the length of the EBML number that starts with byte b, or 9
+// if b is 0 (not a valid first byte).
+//-------------------------------------------------------------------
+
+static DWORD GetVintLength(BYTE b)
+{
+	DWORD length = 1;
+	for (BYTE mask = 0x80; mask != 0 && !(b & mask); mask >>= 1)
+	{
+		length++;
+	}
+	return length;
+}
+
+//-------------------------------------------------------------------
+// HasEbmlElementHeader
+// Returns true if the whole element header (ID and size) is in the
+// buffer, so that ReadEbmlElementHeader does not read past the end.
+//-------------------------------------------------------------------
+
+static bool HasEbmlElementHeader(const BYTE *pData, DWORD cbLen)
+{
+	if (cbLen == 0)
+	{
+		return false;
+	}
+	DWORD cbId = GetVintLength(pData[0]);
+	return (cbLen > cbId) && (cbLen >= cbId + GetVintLength(pData[cbId]));
+}
+
 element_header_result Parser::ReadEbmlElementHeader(const BYTE **pData, DWORD *cbLen, DWORD *pAte)
 {
 	matroska_number_result mresult1 = ReadMatroskaNumber(pData, cbLen, pAte, true);
@@ -675,6 +744,16 @@ master_element* Parser::ReadEbmlElementTree2(const BYTE **pData, DWORD *cbLen, D
 			*cbLen -= total_size;
 			*pAte = *pAte + total_size;
 		}
+		if (hresult.id == MKV_ID_CRC32)
+		{
+			// Not data: the parser checks it (see CrcVerifier).
+			*pData += hresult.elemsize;
+			*cbLen -= hresult.elemsize;
+			*pAte = *pAte + hresult.elemsize;
+			total_size -= (hresult.elemsize + hresult.headsize);
+			continue;
+		}
+
 		auto type = EET::BINARY;
 		int len = 9;
 		//		char buffer[8];
@@ -706,8 +785,11 @@ master_element* Parser::ReadEbmlElementTree2(const BYTE **pData, DWORD *cbLen, D
 		{
 			auto simpleElement = ReadSimpleElement2(pData, cbLen, pAte, type, hresult.elemsize);
 			//strcpy_s(simpleElement->name, typeNameResult.name);
-			simpleElement->name = typeNameResult.name;
-			melement->children.push_back(simpleElement); //std::pair<const char*,type_data>(name,type_data(type, d)));
+			if (simpleElement != nullptr)   // (An empty element has no value.)
+			{
+				simpleElement->name = typeNameResult.name;
+				melement->children.push_back(simpleElement); //std::pair<const char*,type_data>(name,type_data(type, d)));
+			}
 		}
 		total_size -= (hresult.elemsize + hresult.headsize);
 		
@@ -1076,24 +1158,38 @@ matroska_number_result Parser::ParseMatroskaNumber(BYTE **pData, bool isSigned =
 
 UINT64 Parser::FindSeekPoint()
 {
-	CuePoint* lastOne;
-	auto scale = m_masterData->SegInfo->TimecodeScale/100 ;
-	auto startTime = m_startPosition.hVal.QuadPart / scale;
-	auto p = std::find_if(m_masterData->Cues.begin(), m_masterData->Cues.end(), [&lastOne, &startTime](CuePoint* item) {
-		if (item->CueTime < startTime)
-		{
-			lastOne = item;
-			return false;
-		}
-		else
-			return true;
+	return FindCuePosition(m_startPosition.hVal.QuadPart);
+}
+
+//-------------------------------------------------------------------
+// FindCuePosition
+// Returns the file offset of the cluster to start reading at for
+// hnsTime: the cluster of the last cue point at or before it. The cue
+// points are in time order, so this is a binary search.
+//
+// Returns 0 if there are no cues.
+//-------------------------------------------------------------------
+
+UINT64 Parser::FindCuePosition(LONGLONG hnsTime)
+{
+	if (m_masterData->Cues.empty() || m_masterData->SegInfo == nullptr)
+	{
+		return 0;
+	}
+
+	auto scale = m_masterData->SegInfo->TimecodeScale / 100;
+	UINT64 time = (UINT64)max(hnsTime, 0) / scale;
+
+	auto p = std::upper_bound(m_masterData->Cues.begin(), m_masterData->Cues.end(), time, [](UINT64 t, const CuePoint* item) {
+		return t < item->CueTime;
 	});
-	
+	if (p != m_masterData->Cues.begin())
+	{
+		--p;
+	}
+
 	//for now, return the first track's position only
-	
-	//clear the seekpoint
-	
-	return lastOne->CueTrackPositions[0]->CueClusterPosition + m_masterData->SegmentPosition;
+	return (*p)->CueTrackPositions[0]->CueClusterPosition + m_masterData->SegmentPosition;
 }
 
 //-------------------------------------------------------------------
@@ -1132,6 +1228,14 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 
 	while (cbLen > 0)
 	{
+		if (!HasEbmlElementHeader(pData, cbLen))
+		{
+			// The read ended inside an element header. Keep it for the next
+			// call, with more data.
+			result = false;
+			break;
+		}
+
 		try
 		{
 			element_header_result elemHeader = ReadEbmlElementHeader(&pData, &cbLen, pAte);
@@ -1152,6 +1256,22 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 					return false;
 				}
 				
+				if (m_pCrcVerifier != nullptr)
+				{
+					m_pCrcVerifier->Verify(elemHeader.id, m_bufferPosition + *pAte - hsize, pData, size);
+				}
+
+				if (name == "Tags")
+				{
+					// Tags are read in place, not as an element tree.
+					ParseTags(pData, size);
+					pData += size;
+					cbLen -= size;
+					*pAte += size;
+					masterElement = nullptr;
+					continue;
+				}
+
 				masterElement = ReadEbmlElementTree2(&pData, &cbLen, pAte, elemHeader.elemsize);
 				//children result = *reinterpret_cast<children*>(ReadEbmlElementTree(&pData, &cbLen, pAte, elemHeader.elemsize));
 				//for (int i = 0; i < result.count; i++)
@@ -1183,7 +1303,48 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 						m_jumpFlag = true;*/
 						
 					}
+
+					// Remember where the cluster starts (relative to pData),
+					// so that the source can come back to it.
+					m_clusterOffset = *pAte - hsize;
+					m_isNewCluster = true;
+
+					// A cluster is checked only if it is all in the buffer.
+					if (m_pCrcVerifier != nullptr && cbLen > 0 && pData[0] == MKV_ID_CRC32)
+					{
+						if ((DWORD)size <= cbLen)
+						{
+							m_pCrcVerifier->Verify(elemHeader.id, m_bufferPosition + *pAte - hsize, pData, size);
+						}
+						else
+						{
+							m_pCrcVerifier->Skip(elemHeader.id);
+						}
+					}
+				}
+			}
+			else if (name == "FileData")
+			{
+				// Only note where the attachment data is (see AttachedFile).
+				// Skip it in the buffer if it is there; otherwise seek past it.
+				if (!m_masterData->Attachments.empty())
+				{
+					AttachedFile *pFile = m_masterData->Attachments.back();
+					pFile->DataPosition = m_bufferPosition + *pAte;
+					pFile->DataSize = size;
+				}
+
+				if ((DWORD)size > cbLen)
+				{
+					m_jumpTo = m_bufferPosition + *pAte + size;
+					m_jumpFlag = true;
+					return false;
 				}
+
+				pData += size;
+				cbLen -= size;
+				*pAte += size;
+				continue;
 			}
 			else
 			{
@@ -1228,7 +1389,8 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 		}
 		else if (name == "Segment")
 		{
-			m_masterData->SegmentPosition = *pAte;
+			// A file offset, so add the offset of the buffer.
+			m_masterData->SegmentPosition = m_bufferPosition + *pAte;
 		}
 		else if (name == "SeekHead")
 		{
@@ -1387,6 +1549,14 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 										video->PixelHeight = sselement->data;
 									else if ((strcmp(sselement->name, "FlagInterlaced") == 0) && (strcmp(selement->name, "Video") == 0))
 										video->FlagInterlaced = sselement->data;
+									else if ((strcmp(sselement->name, "FieldOrder") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->FieldOrder = sselement->data;
+									else if ((strcmp(sselement->name, "DisplayWidth") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->DisplayWidth = sselement->data;
+									else if ((strcmp(sselement->name, "DisplayHeight") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->DisplayHeight = sselement->data;
+									else if ((strcmp(sselement->name, "DisplayUnit") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->DisplayUnit = sselement->data;
 									else if ((strcmp(sselement->name, "Channels") == 0) && (strcmp(selement->name, "Audio") == 0))
 										audio->Channels = sselement->data;
 									else if ((strcmp(sselement->name, "BitDepth") == 0) && (strcmp(selement->name, "Audio") == 0))
@@ -1397,12 +1567,29 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 									auto sselement = dynamic_cast<float_element*>(selement->children[k]);
 									if ((strcmp(sselement->name, "SamplingFrequency") == 0) && (strcmp(selement->name, "Audio") == 0))
 										audio->SamplingFrequency = sselement->data;
+									else if ((strcmp(sselement->name, "FrameRate") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->FrameRate = sselement->data;
 									else if ((strcmp(sselement->name, "OutputSamplingFrequency") == 0) && (strcmp(selement->name, "Audio") == 0))
 										audio->OutputSamplingFrequency = sselement->data;
 								}
+								else if (selement->children[k]->type == EET::MASTER)
+								{
+									auto sselement = dynamic_cast<master_element*>(selement->children[k]);
+									if ((strcmp(sselement->name, "Colour") == 0) && (strcmp(selement->name, "Video") == 0))
+										video->pColour = ParseColour(sselement);
+								}
 							}
-							trackEntry->Video = video;
-							trackEntry->Audio = audio;
+
+							// Other masters (ContentEncodings, TrackOperation...) must
+							// not replace the Video and Audio already read.
+							if (strcmp(selement->name, "Video") == 0)
+								trackEntry->Video = video;
+							else
+								delete video;
+							if (strcmp(selement->name, "Audio") == 0)
+								trackEntry->Audio = audio;
+							else
+								delete audio;
 						}
 
 					}
@@ -1448,6 +1635,49 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 				}
 			}
 		}
+		else if (name == "Chapters")
+		{
+			if (masterElement != nullptr)
+			{
+				ParseChapters(masterElement);
+				delete masterElement;
+				masterElement = nullptr;
+			}
+		}
+		else if (name == "AttachedFile")
+		{
+			// Attachments and AttachedFile are stepped into, like Segment,
+			// so that the file data need not fit in the read buffer.
+			m_masterData->Attachments.push_back(new AttachedFile());
+		}
+		else if ((name == "FileName" || name == "FileMimeType" || name == "FileDescription" || name == "FileUID")
+			&& !m_masterData->Attachments.empty())
+		{
+			AttachedFile *pFile = m_masterData->Attachments.back();
+			auto element = ReadSimpleElement2(&pData, &cbLen, pAte, type, size);
+			if (element == nullptr)
+			{
+				// Empty element.
+			}
+			else if (name == "FileUID")
+			{
+				pFile->FileUID = dynamic_cast<uint_element*>(element)->data;
+				delete element;
+			}
+			else
+			{
+				// The attachment keeps the string; the element goes.
+				auto selement = dynamic_cast<string_element*>(element);
+				if (name == "FileName")
+					pFile->FileName = selement->data;
+				else if (name == "FileMimeType")
+					pFile->FileMimeType = selement->data;
+				else
+					pFile->FileDescription = selement->data;
+				selement->data = nullptr;
+				delete selement;
+			}
+		}
 		else if (name == "Timecode")
 		{
 			//auto timecode = ReadFixedLengthNumber(&pData, &cbLen, pAte, type, size);
@@ -1496,6 +1726,19 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 			//auto blockTimeCode = (m_currentBlockTimeCode + *timeCode)*(m_masterData->SegInfo->TimecodeScale*0.000000001);
 			m_currentTimeStamp = (m_currentBlockTimeCode + timeCode);
 
+			// Subtitles go to the cue store, not to the frame queue.
+			TrackData *pTrack = nullptr;
+			SubtitleFormat subtitleFormat = GetTrackSubtitleFormat(m_currentStream, &pTrack);
+			if (subtitleFormat != SUBTITLE_NONE && laceflags == 0x00)
+			{
+				DWORD cbPayload = size - 4;
+				AddSubtitleCue(subtitleFormat, pTrack, m_currentBlockTimeCode + timeCode, -1, pData, cbPayload);
+				pData += cbPayload;
+				cbLen -= cbPayload;
+				(*pAte) += cbPayload;
+				break;
+			}
+
 			//SKIP HEADER REMOVAL HEADERS FOR TRACKS???
 
 			if (laceflags == 0x00) //no lacing
@@ -1526,7 +1769,7 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 
 				if (laceflags == 0x02)  //Xiph lacing
 				{
-					throw ref new Exception(-4, L"xiph lacing not supported");
+					ThrowException(MF_E_INVALID_FORMAT);		// Xiph lacing is not supported.
 				}
 				else if (laceflags == 0x06) //EBML lacing
 				{
@@ -1567,7 +1810,7 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 							}
 							else
 							{
-								throw ref new Exception(-4, L"laced frame size bigger than 3 bytes");
+								ThrowException(MF_E_INVALID_FORMAT);		// Laced frame size bigger than 3 bytes.
 							}
 						}
 					}
@@ -1634,7 +1877,7 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 								}
 								else
 								{
-									throw ref new Exception(-4, L"laced frame size bigger than 3 bytes");
+									ThrowException(MF_E_INVALID_FORMAT);		// Laced frame size bigger than 3 bytes.
 								}
 							}
 						}
@@ -1672,7 +1915,7 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 				{
 					auto fl = (size - 5) / numframes;
 					if (numframes > m_cirBufferLength)
-						throw ref new Exception(-222, L"circular buffer too small");
+						ThrowException(E_UNEXPECTED);		// The circular buffer is too small.
 					for (int i = 0; i < numframes; ++i)
 					{
 						*pCircWrite = fl;
@@ -1701,7 +1944,12 @@ bool Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 		}
 		else if (name == "BlockGroup")
 		{
-			auto x = 3;
+			if (masterElement != nullptr)
+			{
+				ParseBlockGroup(masterElement);
+				delete masterElement;
+				masterElement = nullptr;
+			}
 		}
 		else
 		{
@@ -2028,6 +2276,413 @@ bool Parser::FindNextStartCode(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 //	return true;
 //}
 
+//-------------------------------------------------------------------
+// GetTrackSubtitleFormat
+// Returns the subtitle format of a track, or SUBTITLE_NONE if it is
+// not a subtitle track this parser handles.
+//-------------------------------------------------------------------
+
+SubtitleFormat Parser::GetTrackSubtitleFormat(int track, TrackData **ppTrack)
+{
+	*ppTrack = nullptr;
+
+	if (m_pSubtitles == nullptr)
+	{
+		return SUBTITLE_NONE;
+	}
+
+	for (int i = 0; i < m_masterData->Tracks.size(); ++i)
+	{
+		TrackData *pTrack = m_masterData->Tracks[i];
+		if (pTrack->TrackNumber == track)
+		{
+			if (pTrack->TrackType != 0x11)
+			{
+				return SUBTITLE_NONE;
+			}
+			*ppTrack = pTrack;
+			return GetSubtitleFormat(pTrack->CodecID);
+		}
+	}
+	return SUBTITLE_NONE;
+}
+
+
+//-------------------------------------------------------------------
+// ParseBlockGroup
+// Handles a BlockGroup element.
+//
+// Muxers put subtitles in block groups, because a BlockGroup has a
+// BlockDuration. Block groups of other tracks are skipped.
+//-------------------------------------------------------------------
+
+void Parser::ParseBlockGroup(master_element *pGroup)
+{
+	binary_element *pBlock = nullptr;
+	INT64 duration = -1;
+
+	for (int i = 0; i < pGroup->children.size(); ++i)
+	{
+		base_element *pChild = pGroup->children[i];
+		if (pChild == nullptr || pChild->name == nullptr)
+		{
+			continue;
+		}
+
+		if (strcmp(pChild->name, "Block") == 0)
+		{
+			pBlock = dynamic_cast<binary_element*>(pChild);
+		}
+		else if (strcmp(pChild->name, "BlockDuration") == 0)
+		{
+			duration = dynamic_cast<uint_element*>(pChild)->data;
+		}
+	}
+
+	// Same layout as a SimpleBlock: track number, 16-bit relative
+	// timecode, flags, then the payload.
+	if (pBlock == nullptr || pBlock->length < 4)
+	{
+		return;
+	}
+
+	int track = pBlock->data[0] - 0x80;
+	INT16 timeCode = (INT16)((pBlock->data[1] << 8) | pBlock->data[2]);
+	BYTE laceflags = pBlock->data[3] & 0x06;
+
+	TrackData *pTrack = nullptr;
+	SubtitleFormat subtitleFormat = GetTrackSubtitleFormat(track, &pTrack);
+	if (subtitleFormat != SUBTITLE_NONE && laceflags == 0x00)
+	{
+		AddSubtitleCue(subtitleFormat, pTrack, m_currentBlockTimeCode + timeCode, duration, pBlock->data + 4, pBlock->length - 4);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// AddSubtitleCue
+// Adds a subtitle block to the cue store.
+//
+// timecode and duration are in TimecodeScale units. If the block has
+// no duration (-1), a VobSub block's own stop time is used, then the
+// track's DefaultDuration; without one, the cue lasts until the next
+// cue of the track. (PGS clears the screen with a display set of no
+// objects, which is the next cue.)
+//-------------------------------------------------------------------
+
+void Parser::AddSubtitleCue(SubtitleFormat format, TrackData *pTrack, INT64 timecode, INT64 duration, const BYTE *pData, DWORD cbData)
+{
+	INT64 timecodeScale = (m_masterData->SegInfo != nullptr) ? m_masterData->SegInfo->TimecodeScale : 1000000;
+
+	LONGLONG hnsStart = timecode * timecodeScale / 100;
+	LONGLONG hnsEnd = SUBTITLE_OPEN_END;
+
+	if (duration >= 0)
+	{
+		hnsEnd = hnsStart + duration * timecodeScale / 100;
+	}
+	else if (format == SUBTITLE_VOBSUB && GetVobSubDisplayDuration(pData, cbData) >= 0)
+	{
+		hnsEnd = hnsStart + GetVobSubDisplayDuration(pData, cbData);
+	}
+	else if (pTrack->DefaultDuration != 0)
+	{
+		hnsEnd = hnsStart + pTrack->DefaultDuration / 100;
+	}
+
+	ParsedSubtitleCue parsed;
+	parsed.dwTrack = pTrack->TrackNumber;
+	parsed.fNew = m_pSubtitles->Add(pTrack->TrackNumber, format, hnsStart, hnsEnd, pData, cbData, &parsed.cue);
+
+	m_parsedCues.push_back(parsed);
+}
+
+
+//-------------------------------------------------------------------
+// ParseTags
+// Reads the statistics tags of the tracks from the body of a Tags
+// element.
+//-------------------------------------------------------------------
+
+void Parser::ParseTags(const BYTE *pData, DWORD cbData)
+{
+	std::vector<TagValue> values;
+
+	m_tagReader.Read(pData, cbData, &values);
+	m_masterData->HasTags = true;
+
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		const TagValue &value = values[i];
+		if (value.trackUID == 0)
+		{
+			continue;
+		}
+
+		TrackStatistics *pStats = nullptr;
+		for (size_t j = 0; j < m_masterData->Statistics.size(); j++)
+		{
+			if (m_masterData->Statistics[j].TrackUID == value.trackUID)
+			{
+				pStats = &m_masterData->Statistics[j];
+				break;
+			}
+		}
+		if (pStats == nullptr)
+		{
+			TrackStatistics stats = { value.trackUID, 0, 0, 0 };
+			m_masterData->Statistics.push_back(stats);
+			pStats = &m_masterData->Statistics.back();
+		}
+
+		if (value.iName == m_iTagBps)
+		{
+			pStats->Bitrate = (UINT32)min(_strtoui64(value.value.c_str(), nullptr, 10), (UINT64)MAXUINT32);
+		}
+		else if (value.iName == m_iTagFrameCount)
+		{
+			pStats->FrameCount = _strtoui64(value.value.c_str(), nullptr, 10);
+		}
+		else if (value.iName == m_iTagDuration)
+		{
+			pStats->Duration = max(ParseTagDuration(value.value.c_str()), 0);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ParseColour
+// Reads the Colour element of a video track.
+//-------------------------------------------------------------------
+
+Colour* Parser::ParseColour(master_element *pColour)
+{
+	auto colour = new Colour();
+
+	// Defaults from the Matroska specification.
+	colour->MatrixCoefficients = 2;
+	colour->TransferCharacteristics = 2;
+	colour->Primaries = 2;
+
+	for (int i = 0; i < pColour->children.size(); ++i)
+	{
+		base_element *pChild = pColour->children[i];
+		if (pChild == nullptr || pChild->name == nullptr)
+		{
+			continue;
+		}
+
+		if (pChild->type == EET::_UNSIGNED)
+		{
+			auto value = (DWORD)dynamic_cast<uint_element*>(pChild)->data;
+			if (strcmp(pChild->name, "MatrixCoefficients") == 0)
+				colour->MatrixCoefficients = value;
+			else if (strcmp(pChild->name, "BitsPerChannel") == 0)
+				colour->BitsPerChannel = value;
+			else if (strcmp(pChild->name, "ChromaSubsamplingHorz") == 0)
+				colour->ChromaSubsamplingHorz = value;
+			else if (strcmp(pChild->name, "ChromaSubsamplingVert") == 0)
+				colour->ChromaSubsamplingVert = value;
+			else if (strcmp(pChild->name, "ChromaSitingHorz") == 0)
+				colour->ChromaSitingHorz = value;
+			else if (strcmp(pChild->name, "ChromaSitingVert") == 0)
+				colour->ChromaSitingVert = value;
+			else if (strcmp(pChild->name, "Range") == 0)
+				colour->Range = value;
+			else if (strcmp(pChild->name, "TransferCharacteristics") == 0)
+				colour->TransferCharacteristics = value;
+			else if (strcmp(pChild->name, "Primaries") == 0)
+				colour->Primaries = value;
+			else if (strcmp(pChild->name, "MaxCLL") == 0)
+				colour->MaxCLL = value;
+			else if (strcmp(pChild->name, "MaxFALL") == 0)
+				colour->MaxFALL = value;
+		}
+		else if (strcmp(pChild->name, "MasteringMetadata") == 0)
+		{
+			auto pMastering = dynamic_cast<master_element*>(pChild);
+			MasteringMetadata &mastering = colour->Mastering;
+			for (int j = 0; j < pMastering->children.size(); ++j)
+			{
+				base_element *pValue = pMastering->children[j];
+				if (pValue == nullptr || pValue->name == nullptr || pValue->type != EET::_FLOAT)
+				{
+					continue;
+				}
+
+				auto value = (float)dynamic_cast<float_element*>(pValue)->data;
+				if (strcmp(pValue->name, "PrimaryRChromaticityX") == 0)
+					mastering.PrimaryRChromaticityX = value;
+				else if (strcmp(pValue->name, "PrimaryRChromaticityY") == 0)
+					mastering.PrimaryRChromaticityY = value;
+				else if (strcmp(pValue->name, "PrimaryGChromaticityX") == 0)
+					mastering.PrimaryGChromaticityX = value;
+				else if (strcmp(pValue->name, "PrimaryGChromaticityY") == 0)
+					mastering.PrimaryGChromaticityY = value;
+				else if (strcmp(pValue->name, "PrimaryBChromaticityX") == 0)
+					mastering.PrimaryBChromaticityX = value;
+				else if (strcmp(pValue->name, "PrimaryBChromaticityY") == 0)
+					mastering.PrimaryBChromaticityY = value;
+				else if (strcmp(pValue->name, "WhitePointChromaticityX") == 0)
+					mastering.WhitePointChromaticityX = value;
+				else if (strcmp(pValue->name, "WhitePointChromaticityY") == 0)
+					mastering.WhitePointChromaticityY = value;
+				else if (strcmp(pValue->name, "LuminanceMax") == 0)
+					mastering.LuminanceMax = value;
+				else if (strcmp(pValue->name, "LuminanceMin") == 0)
+					mastering.LuminanceMin = value;
+			}
+			colour->HasMasteringMetadata = true;
+		}
+	}
+
+	return colour;
+}
+
+
+//-------------------------------------------------------------------
+// ParseChapters
+// Adds the editions of a Chapters element to m_pChapters.
+//-------------------------------------------------------------------
+
+void Parser::ParseChapters(master_element *pChapters)
+{
+	if (m_pChapters == nullptr)
+	{
+		return;
+	}
+
+	for (int i = 0; i < pChapters->children.size(); ++i)
+	{
+		auto pEntry = dynamic_cast<master_element*>(pChapters->children[i]);
+		if (pEntry == nullptr || pEntry->name == nullptr || strcmp(pEntry->name, "EditionEntry") != 0)
+		{
+			continue;
+		}
+
+		ChapterEdition edition;
+		edition.uid = 0;
+		edition.fDefault = false;
+		edition.fOrdered = false;
+		bool fHidden = false;
+
+		for (int j = 0; j < pEntry->children.size(); ++j)
+		{
+			base_element *pChild = pEntry->children[j];
+			if (pChild == nullptr || pChild->name == nullptr)
+			{
+				continue;
+			}
+
+			if (strcmp(pChild->name, "ChapterAtom") == 0)
+			{
+				ParseChapterAtom(dynamic_cast<master_element*>(pChild), 0, &edition);
+			}
+			else if (pChild->type == EET::_UNSIGNED)
+			{
+				auto value = dynamic_cast<uint_element*>(pChild)->data;
+				if (strcmp(pChild->name, "EditionUID") == 0)
+					edition.uid = value;
+				else if (strcmp(pChild->name, "EditionFlagHidden") == 0)
+					fHidden = (value != 0);
+				else if (strcmp(pChild->name, "EditionFlagDefault") == 0)
+					edition.fDefault = (value != 0);
+				else if (strcmp(pChild->name, "EditionFlagOrdered") == 0)
+					edition.fOrdered = (value != 0);
+			}
+		}
+
+		if (!fHidden)
+		{
+			m_pChapters->AddEdition(edition);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ParseChapterAtom
+// Adds a chapter, and the chapters in it, to an edition.
+//
+// Chapter times are in nanoseconds, not in TimecodeScale units.
+//-------------------------------------------------------------------
+
+void Parser::ParseChapterAtom(master_element *pAtom, DWORD depth, ChapterEdition *pEdition)
+{
+	if (pAtom == nullptr)
+	{
+		return;
+	}
+
+	Chapter chapter;
+	chapter.uid = 0;
+	chapter.hnsStart = 0;
+	chapter.hnsEnd = CHAPTER_OPEN_END;
+	chapter.depth = depth;
+	bool fHidden = false;
+	bool fEnabled = true;
+
+	for (int i = 0; i < pAtom->children.size(); ++i)
+	{
+		base_element *pChild = pAtom->children[i];
+		if (pChild == nullptr || pChild->name == nullptr)
+		{
+			continue;
+		}
+
+		if (strcmp(pChild->name, "ChapterAtom") == 0)
+		{
+			// Nested chapters follow their parent in the list.
+			continue;
+		}
+		else if (strcmp(pChild->name, "ChapterDisplay") == 0)
+		{
+			auto pDisplay = dynamic_cast<master_element*>(pChild);
+			for (int j = 0; j < pDisplay->children.size() && chapter.title.empty(); ++j)
+			{
+				base_element *pString = pDisplay->children[j];
+				if (pString != nullptr && pString->name != nullptr && strcmp(pString->name, "ChapString") == 0)
+				{
+					chapter.title = dynamic_cast<string_element*>(pString)->data;
+				}
+			}
+		}
+		else if (pChild->type == EET::_UNSIGNED)
+		{
+			auto value = dynamic_cast<uint_element*>(pChild)->data;
+			if (strcmp(pChild->name, "ChapterUID") == 0)
+				chapter.uid = value;
+			else if (strcmp(pChild->name, "ChapterTimeStart") == 0)
+				chapter.hnsStart = value / 100;
+			else if (strcmp(pChild->name, "ChapterTimeEnd") == 0)
+				chapter.hnsEnd = value / 100;
+			else if (strcmp(pChild->name, "ChapterFlagHidden") == 0)
+				fHidden = (value != 0);
+			else if (strcmp(pChild->name, "ChapterFlagEnabled") == 0)
+				fEnabled = (value != 0);
+		}
+	}
+
+	// A hidden or disabled chapter hides the chapters in it, too.
+	if (fHidden || !fEnabled)
+	{
+		return;
+	}
+
+	pEdition->chapters.push_back(chapter);
+
+	for (int i = 0; i < pAtom->children.size(); ++i)
+	{
+		base_element *pChild = pAtom->children[i];
+		if (pChild != nullptr && pChild->name != nullptr && strcmp(pChild->name, "ChapterAtom") == 0)
+		{
+			ParseChapterAtom(dynamic_cast<master_element*>(pChild), depth + 1, pEdition);
+		}
+	}
+}
+
+
 //-------------------------------------------------------------------
 // OnEndOfStream
 // Called when the parser reaches the MPEG-1 stop code.
@@ -2215,7 +2870,7 @@ DWORD ReadVideoSequenceHeader(
 
 	if (pData == nullptr)
 	{
-		throw ref new InvalidArgumentException();
+		ThrowException(E_INVALIDARG);
 	}
 
 	// Skip to the sequence header code.
@@ -101,9 +101,45 @@ struct MPEG1SystemHeader
 };
 
 
+// SMPTE 2086 mastering display metadata (MasteringMetadata). Chromaticities
+// are CIE 1931 xy; luminances are in cd/m2.
+struct MasteringMetadata
+{
+	float		PrimaryRChromaticityX;
+	float		PrimaryRChromaticityY;
+	float		PrimaryGChromaticityX;
+	float		PrimaryGChromaticityY;
+	float		PrimaryBChromaticityX;
+	float		PrimaryBChromaticityY;
+	float		WhitePointChromaticityX;
+	float		WhitePointChromaticityY;
+	float		LuminanceMax;
+	float		LuminanceMin;
+};
+
+// Colour element. The code points are those of ISO/IEC 23091-4 (as in
+// H.264 Annex E); 2 means unspecified.
+struct Colour
+{
+	DWORD		MatrixCoefficients;
+	DWORD		BitsPerChannel;
+	DWORD		ChromaSubsamplingHorz;
+	DWORD		ChromaSubsamplingVert;
+	DWORD		ChromaSitingHorz;		// 0: unspecified, 1: left collocated, 2: half.
+	DWORD		ChromaSitingVert;		// 0: unspecified, 1: top collocated, 2: half.
+	DWORD		Range;					// 0: unspecified, 1: broadcast, 2: full, 3: defined by the others.
+	DWORD		TransferCharacteristics;
+	DWORD		Primaries;
+	DWORD		MaxCLL;					// cd/m2, 0 if not set.
+	DWORD		MaxFALL;
+	bool		HasMasteringMetadata;
+	MasteringMetadata	Mastering;
+};
+
 struct Video
 {
-	bool		FlagInterlaced;
+	DWORD		FlagInterlaced;		// 0: undetermined, 1: interlaced, 2: progressive.
+	DWORD		FieldOrder;
 	DWORD		StereoMode;
 	DWORD		AlphaMode;
 	DWORD		PixelWidth;
@@ -117,6 +153,8 @@ struct Video
 	DWORD		DisplayUnit;
 	DWORD		AspectRatioType;
 	DWORD		ColourSpace;
+	double		FrameRate;			// Informational only; 0 if not set.
+	Colour*		pColour;			// nullptr if the track has no Colour element.
 };
 
 struct Audio
@@ -161,8 +199,8 @@ struct ContentEncoding
 	DWORD				ContentEncodingOrder;
 	DWORD				ContentEncodingScope;
 	DWORD				ContentEncodingType;
-	ContentCompression	ContentCompression;
-	ContentEncryption	ContentEncryption;
+	::ContentCompression	ContentCompression;
+	::ContentEncryption	ContentEncryption;
 };
 
 struct TrackTranslate
@@ -172,6 +210,8 @@ struct TrackTranslate
 	DWORD		TrackTranslateTrackID;
 };
 
+struct VideoTrackFormat;		// VideoFormat.h
+
 struct TrackData
 {
 	DWORD	TrackNumber;
@@ -197,8 +237,9 @@ struct TrackData
 	DWORD	CodecDelay;
 	DWORD	SeekPreRoll;
 	TrackTranslate	trackTranslate[1];
-	Video*	Video;
-	Audio*	Audio;
+	::Video*	Video;
+	VideoTrackFormat*	VideoFormat;	// Worked out once, by GetVideoTrackFormat.
+	::Audio*	Audio;
 	TrackOperation trackOperation;
 	ContentEncoding ContentEncodings[1];
 };
@@ -237,6 +278,28 @@ struct CuePoint
 	std::vector<CueTrackPosition*>	CueTrackPositions;
 };
 
+// An attachment (a font, cover art, ...). The data is not read with
+// the rest of the master data, because it can be tens of megabytes;
+// DataPosition and DataSize tell where it is in the file.
+struct AttachedFile
+{
+	const char*					FileName;
+	const char*					FileMimeType;
+	const char*					FileDescription;
+	UINT64						FileUID;
+	QWORD						DataPosition;
+	QWORD						DataSize;
+};
+
+// The statistics tags mkvmerge writes for a track. Zero if absent.
+struct TrackStatistics
+{
+	UINT64						TrackUID;
+	UINT32						Bitrate;			// BPS, in bits per second.
+	UINT64						FrameCount;			// NUMBER_OF_FRAMES.
+	LONGLONG					Duration;			// DURATION, in 100-ns units.
+};
+
 struct MKVMasterData
 {
 	LONG64						SegmentPosition;
@@ -245,6 +308,9 @@ struct MKVMasterData
 	std::vector<TrackData*>		Tracks;
 	LONG64						FirstClusterPosition;
 	std::vector<CuePoint*>		Cues;
+	std::vector<AttachedFile*>	Attachments;
+	std::vector<TrackStatistics>	Statistics;
+	bool						HasTags;			// Was the Tags element read?
 };
 
 
@@ -394,7 +460,7 @@ struct master_element : base_element
 
 	~master_element()
 	{
-		for (int i = 0; i < children.size(); ++i)
+		for (size_t i = 0; i < children.size(); ++i)
 		{
 			delete children[i];
 		}
@@ -408,7 +474,7 @@ struct binary_element : base_element
 
 	~binary_element()
 	{
-		delete data;
+		delete[] data;
 	}
 };
 
@@ -418,38 +484,23 @@ struct string_element : base_element
 
 	~string_element()
 	{
-		delete data;
+		delete[] data;
 	}
 };
 
 struct sint_element :base_element
 {
 	INT64		data;
-
-	~sint_element()
-	{
-		delete &data;
-	}
 };
 
 struct uint_element :base_element
 {
 	LONG64		data;
-
-	~uint_element()
-	{
-		delete &data;
-	}
 };
 
 struct float_element :base_element
 {
 	double		data;
-
-	~float_element()
-	{
-		delete &data;
-	}
 };
 
 
@@ -529,52 +580,16 @@ struct element_header_result
 //};
 
 
-// ExpandableStruct class:
-// Class which wraps a structure which can be expanded by additional data.
-template<typename T>
-ref class ExpandableStruct sealed
-{
-internal:
-	ExpandableStruct(unsigned int size)
-		: m_array(ref new Array<BYTE>(size))
-	{
-		ZeroMemory(m_array->Data, m_array->Length);
-	}
-
-	ExpandableStruct(const ExpandableStruct<T> ^src)
-		: m_array(ref new Array<BYTE>(src->Size))
-	{
-		CopyFrom(src);
-	}
-
-	property unsigned int Size {unsigned int get() const { return m_array->Length; }}
-	T *Get() const { return reinterpret_cast<T*>(m_array->Data); }
-	void CopyFrom(const ExpandableStruct<T> ^src)
-	{
-		if (src->Size != Size)
-		{
-			throw ref new InvalidArgumentException();
-		}
-
-		CopyMemory(Get(), src->Get(), Size);
-	}
-
-private:
-	Array<BYTE> ^m_array;
-};
-
-
 // Buffer class:
 // Resizable buffer used to hold the MPEG-1 data.
 
-ref class Buffer sealed
+class Buffer
 {
-internal:
+public:
 	Buffer(DWORD cbSize);
-	HRESULT Initalize(DWORD cbSize);
 
-	property BYTE *DataPtr { BYTE *get(); }
-	property DWORD DataSize { DWORD get() const; }
+	BYTE *DataPtr();
+	DWORD DataSize() const;
 
 	// Reserve: Reserves cb bytes of free data in the buffer.
 	// The reserved bytes start at DataPtr() + DataSize().
@@ -589,16 +604,19 @@ internal:
 	void MoveEnd(DWORD cb);
 
 private:
-	property BYTE *Ptr { BYTE *get() { return m_array->Data; } }
+	Buffer(const Buffer&);
+	Buffer& operator=(const Buffer&);
+
+	BYTE *Ptr() { return m_array.data(); }
 
 	void SetSize(DWORD count);
 	void Allocate(DWORD alloc);
 
-	property DWORD  CurrentFreeSize { DWORD get() const; }
+	DWORD CurrentFreeSize() const;
 
 private:
 
-	Array<BYTE> ^m_array;
+	std::vector<BYTE> m_array;
 	DWORD m_count;        // Nominal count.
 	DWORD m_allocated;    // Actual allocation size.
 
@@ -608,21 +626,50 @@ private:
 
 #include <queue>
 
+// A subtitle cue, as parsed.
+struct ParsedSubtitleCue
+{
+	DWORD		dwTrack;
+	bool		fNew;		// false if the store already had it (the block was read before).
+	SubtitleCue	cue;
+};
+
 // Parser class:
 // Parses an MPEG-1 systems-layer stream.
-ref class Parser sealed
+class Parser
 {
-internal:
+public:
 	Parser();
 
 	bool ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte);
 
-	property bool HasFinishedParsedData{bool get() const { return m_isFinishedParsingMaster; }}
+	bool HasFinishedParsedData() const { return m_isFinishedParsingMaster; }
 	MKVMasterData* GetMasterData();
 
 	//property bool HasBlock {bool get() const {return }}
 	QWORD	m_jumpTo;
 	bool	m_jumpFlag;
+	bool	m_isNewCluster;		// Set when a Cluster header is parsed; the caller clears it.
+	DWORD	m_clusterOffset;	// Offset of that header from the start of the ParseBytes data.
+	QWORD	m_bufferPosition;	// File offset of the ParseBytes data. The caller sets it.
+
+	// Subtitle blocks do not go through the frame queue. The parser
+	// adds them to m_pSubtitles (if set), and lists them in m_parsedCues
+	// for the caller, which clears the list.
+	SubtitleCueStore					*m_pSubtitles;
+	std::vector<ParsedSubtitleCue>		m_parsedCues;
+
+	// Chapters go to m_pChapters, if set.
+	ChapterIndex						*m_pChapters;
+
+	// Masters that start with a CRC-32 go to m_pCrcVerifier, if set.
+	CrcVerifier							*m_pCrcVerifier;
+
+	// Tags are read by m_tagReader, which keeps only the statistics.
+	TagReader							m_tagReader;
+	DWORD								m_iTagBps;
+	DWORD								m_iTagFrameCount;
+	DWORD								m_iTagDuration;
 	bool	m_isFinishedParsingMaster;
 	//property bool HasSystemHeader{bool get() const { return m_header != nullptr; }}
 	//ExpandableStruct<MPEG1SystemHeader> ^GetSystemHeader();
@@ -646,17 +693,26 @@ internal:
 
 	PROPVARIANT			m_startPosition;
 	UINT64				FindSeekPoint();
+	UINT64				FindCuePosition(LONGLONG hnsTime);
+	void				ParseTags(const BYTE *pData, DWORD cbData);
 
-	property std::queue<int> GetFrameSizeQueue {std::queue<int> get() const { return m_frameSizeQueue; }}
+	const std::queue<int>& GetFrameSizeQueue() const { return m_frameSizeQueue; }
 	void	PopFrameSizeQueue() { m_frameSizeQueue.pop(); }
-	property bool HasFrames {bool get() const { return m_framesReady; }}
+	bool HasFrames() const { return m_framesReady; }
 	//property const MPEG1PacketHeader &PacketHeader { const MPEG1PacketHeader &get() { assert(m_bHasPacketHeader); return m_curPacketHeader; } }
 
 	
 	//property DWORD PayloadSize{DWORD get() const { assert(m_bHasPacketHeader); return m_curPacketHeader.cbPayload; }}
 	void ClearFrames() { m_framesReady = false; }
+	void DiscardFrames()
+	{
+		// Drops the frames of the current block, for example before a jump.
+		pCircRead = pCircWrite;
+		m_frameCount = 0;
+		ClearFrames();
+	}
 
-	property bool IsEndOfStream {bool get() const { return m_bEOS; }}
+	bool IsEndOfStream() const { return m_bEOS; }
 
 private:
 	__int64* ParseFixedLengthNumber(byte* data, uint8 pos, uint8 length, bool _signed);
@@ -669,9 +725,15 @@ private:
 	matroska_number_result ParseMatroskaNumber(BYTE **pData, bool isSigned, bool unModified);
 	element_header_result ReadEbmlElementHeader(const BYTE **pData, DWORD *cbLen, DWORD *pAte);
 	//void* ReadEbmlElementTree(const BYTE **pData, DWORD *cbLen, DWORD *pAte, DWORD total_size);
-	master_element* Parser::ReadEbmlElementTree2(const BYTE **pData, DWORD *cbLen, DWORD *pAte, DWORD total_size);
+	master_element* ReadEbmlElementTree2(const BYTE **pData, DWORD *cbLen, DWORD *pAte, DWORD total_size);
 
 	bool FindNextStartCode(const BYTE *pData, DWORD cbLen, DWORD *pAte);
+	SubtitleFormat GetTrackSubtitleFormat(int track, TrackData **ppTrack);
+	void ParseBlockGroup(master_element *pGroup);
+	void AddSubtitleCue(SubtitleFormat format, TrackData *pTrack, INT64 timecode, INT64 duration, const BYTE *pData, DWORD cbData);
+	Colour* ParseColour(master_element *pColour);
+	void ParseChapters(master_element *pChapters);
+	void ParseChapterAtom(master_element *pAtom, DWORD depth, ChapterEdition *pEdition);
 	/*bool ParsePackHeader(const BYTE *pData, DWORD cbLen, DWORD *pAte);
 	bool ParseSystemHeader(const BYTE *pData, DWORD cbLen, DWORD *pAte);
 	bool ParsePacketHeader(const BYTE *pData, DWORD cbLen, DWORD *pAte);*/
@@ -683,13 +745,8 @@ private:
 	
 	LONGLONG m_SCR;
 	DWORD m_muxRate;
-	Array<BYTE> ^m_data;
 
 	MKVMasterData* m_masterData;
-	//ExpandableStruct<MKVMasterData> ^m_masterData;
-
-	ExpandableStruct<MPEG1SystemHeader> ^m_header;
-	// Note: Size of header = sizeof(MPEG1SystemHeader) + (sizeof(MPEG1StreamHeader) * (cStreams - 1))
 
 	bool m_framesReady;
 	MPEG1PacketHeader m_curPacketHeader;  // Most recent packet header.
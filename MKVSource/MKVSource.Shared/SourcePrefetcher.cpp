@@ -0,0 +1,278 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SourcePrefetcher.cpp
+// Opens the next files of a playlist ahead of time.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "MKVSource.h"
+#include "SourcePrefetcher.h"
+
+namespace
+{
+	// The prefetcher for this process. A plain pointer needs no dynamic
+	// initialization, so this is safe to read before any constructor
+	// has run.
+	SourcePrefetcher *s_pShared = nullptr;
+
+	// The CRT destroys static objects when the DLL unloads.
+	struct SharedPrefetcherCleanup
+	{
+		~SharedPrefetcherCleanup()
+		{
+			SourcePrefetcher::ReleaseShared();
+		}
+	} s_sharedPrefetcherCleanup;
+}
+
+
+//-------------------------------------------------------------------
+// GetShared
+// Returns the prefetcher for this process. It is created on first
+// use and lives until ReleaseShared.
+//-------------------------------------------------------------------
+
+HRESULT SourcePrefetcher::GetShared(SourcePrefetcher **ppPrefetcher)
+{
+	if (ppPrefetcher == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	SourcePrefetcher *pPrefetcher = static_cast<SourcePrefetcher*>(
+		InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&s_pShared), nullptr, nullptr));
+
+	if (pPrefetcher == nullptr)
+	{
+		pPrefetcher = new (std::nothrow) SourcePrefetcher();
+		if (pPrefetcher == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		// If another thread got there first, use its prefetcher.
+		SourcePrefetcher *pExisting = static_cast<SourcePrefetcher*>(
+			InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&s_pShared), pPrefetcher, nullptr));
+		if (pExisting != nullptr)
+		{
+			pPrefetcher->Release();
+			pPrefetcher = pExisting;
+		}
+	}
+
+	*ppPrefetcher = pPrefetcher;
+	(*ppPrefetcher)->AddRef();
+	return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// ReleaseShared
+// Shuts down the prefetched sources and releases the reference that
+// s_pShared holds. Called when the DLL unloads.
+//-------------------------------------------------------------------
+
+void SourcePrefetcher::ReleaseShared()
+{
+	SourcePrefetcher *pPrefetcher = static_cast<SourcePrefetcher*>(
+		InterlockedExchangePointer(reinterpret_cast<PVOID*>(&s_pShared), nullptr));
+
+	if (pPrefetcher != nullptr)
+	{
+		pPrefetcher->Retain(std::vector<std::wstring>());
+		pPrefetcher->Release();
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Prefetch
+// Starts opening a source for pwszURL.
+//
+// If MAX_PREFETCHED_SOURCES are already held, the oldest one is shut
+// down to make room.
+//-------------------------------------------------------------------
+
+void SourcePrefetcher::Prefetch(LPCWSTR pwszURL, bool fUseSharedScheduler, CrcVerifyMode crcMode)
+{
+	if (pwszURL == nullptr)
+	{
+		ThrowException(E_POINTER);
+	}
+
+	AutoLock lock(m_critSec);
+
+	for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if (it->url == pwszURL)
+		{
+			return;
+		}
+	}
+
+	if (m_entries.size() >= MAX_PREFETCHED_SOURCES)
+	{
+		ShutdownWhenOpened(m_entries.front());
+		m_entries.erase(m_entries.begin());
+	}
+
+	Entry entry;
+	entry.url = pwszURL;
+	entry.crcMode = crcMode;
+	entry.spSource = MKVSource::CreateInstance();
+	if (fUseSharedScheduler)
+	{
+		entry.spSource->UseSharedScheduler();
+	}
+
+	// The headers are parsed during the open, so their CRC-32 elements
+	// are only checked if the verifier is set up first.
+	entry.spSource->SetCrcVerification(crcMode);
+
+	// Resolving the URL can block, so it runs on a thread pool thread,
+	// like the rest of the open.
+	std::wstring url = entry.url;
+	ComPtr<MKVSource> spSource = entry.spSource;
+
+	entry.opened = concurrency::create_task([url]()
+	{
+		return OpenByteStream(url);
+	}).then([spSource](ComPtr<IMFByteStream> spStream)
+	{
+		return spSource->OpenAsync(spStream.Get());
+	});
+
+	// Nobody might ever take this source. Observe a failed open here, so
+	// that it is not reported as an unhandled task exception.
+	entry.opened.then([](concurrency::task<void> &openTask)
+	{
+		try
+		{
+			openTask.get();
+		}
+		catch (Exception ^)
+		{
+		}
+	});
+
+	m_entries.push_back(entry);
+}
+
+
+//-------------------------------------------------------------------
+// Retain
+// Shuts down the prefetched sources that are not for one of urls,
+// for example because the playlist changed.
+//-------------------------------------------------------------------
+
+void SourcePrefetcher::Retain(const std::vector<std::wstring> &urls)
+{
+	AutoLock lock(m_critSec);
+
+	auto it = m_entries.begin();
+	while (it != m_entries.end())
+	{
+		if (std::find(urls.begin(), urls.end(), it->url) == urls.end())
+		{
+			ShutdownWhenOpened(*it);
+			it = m_entries.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Take
+// Hands over the source prefetched for pwszURL.
+//
+// Returns false if there is none. Otherwise the prefetcher lets go of
+// the source, and the caller owns it. A source prefetched with another
+// CRC-32 mode is shut down instead, because its headers were parsed
+// with the wrong checks.
+//-------------------------------------------------------------------
+
+bool SourcePrefetcher::Take(LPCWSTR pwszURL, CrcVerifyMode crcMode, MKVSource **ppSource, concurrency::task<void> *pOpenTask)
+{
+	AutoLock lock(m_critSec);
+
+	for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if (it->url == pwszURL)
+		{
+			if (it->crcMode != crcMode)
+			{
+				ShutdownWhenOpened(*it);
+				m_entries.erase(it);
+				return false;
+			}
+
+			*ppSource = it->spSource.Detach();
+			*pOpenTask = it->opened;
+			m_entries.erase(it);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+// OpenByteStream
+// Creates a readable byte stream for a URL.
+//-------------------------------------------------------------------
+
+ComPtr<IMFByteStream> SourcePrefetcher::OpenByteStream(const std::wstring &url)
+{
+	ComPtr<IMFSourceResolver> spResolver;
+	ComPtr<IUnknown> spObject;
+	ComPtr<IMFByteStream> spStream;
+	MF_OBJECT_TYPE objectType = MF_OBJECT_INVALID;
+
+	ThrowIfError(MFCreateSourceResolver(&spResolver));
+	ThrowIfError(spResolver->CreateObjectFromURL(
+		url.c_str(),
+		MF_RESOLUTION_BYTESTREAM | MF_RESOLUTION_READ,
+		nullptr,
+		&objectType,
+		&spObject
+		));
+	ThrowIfError(spObject.As(&spStream));
+
+	return spStream;
+}
+
+
+//-------------------------------------------------------------------
+// ShutdownWhenOpened
+// Shuts down a prefetched source that is no longer wanted. A source
+// that is still opening has reads and parsing in flight, so it is shut
+// down once the open completes, whether or not it succeeded.
+//-------------------------------------------------------------------
+
+void SourcePrefetcher::ShutdownWhenOpened(const Entry &entry)
+{
+	ComPtr<MKVSource> spSource = entry.spSource;
+
+	entry.opened.then([spSource](concurrency::task<void> &openTask)
+	{
+		try
+		{
+			openTask.get();
+		}
+		catch (Exception ^)
+		{
+		}
+		(void)spSource->Shutdown();
+	});
+}
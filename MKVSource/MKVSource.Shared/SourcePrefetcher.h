@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SourcePrefetcher.h
+// Opens the next files of a playlist ahead of time.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Opening a file takes several reads before the source can hand out a
+// presentation descriptor: the header, the seek head, the tracks and the
+// cues, and then the first cluster. When a playlist moves to the next
+// file, that shows as a gap.
+//
+// The prefetcher opens the upcoming files while the current one plays.
+// Each prefetched source is opened like any other (see OpenAsync); once
+// open, it reads ahead into the first cluster. When the pipeline then
+// asks the byte stream handler for that URL, the handler takes the
+// prefetched source instead of opening the file again.
+//
+// There is one prefetcher per process (see GetShared). It is freed when
+// the DLL unloads.
+
+const DWORD MAX_PREFETCHED_SOURCES = 4;     // Most sources held open ahead of time.
+
+class SourcePrefetcher sealed
+{
+public:
+
+	// GetShared: Returns the prefetcher for this process, AddRef'd.
+	static HRESULT GetShared(SourcePrefetcher **ppPrefetcher);
+
+	// ReleaseShared: Lets go of the prefetched sources and of the
+	// prefetcher for this process.
+	static void ReleaseShared();
+
+	ULONG AddRef()
+	{
+		return InterlockedIncrement(&m_cRef);
+	}
+
+	ULONG Release()
+	{
+		LONG cRef = InterlockedDecrement(&m_cRef);
+		if (cRef == 0)
+		{
+			delete this;
+		}
+		return cRef;
+	}
+
+	// Starts opening pwszURL, unless a source for it is already open or
+	// opening. Returns immediately. The source checks CRC-32 elements as
+	// crcMode says, from the headers on.
+	void Prefetch(LPCWSTR pwszURL, bool fUseSharedScheduler, CrcVerifyMode crcMode);
+
+	// Shuts down the prefetched sources whose URL is not in urls.
+	void Retain(const std::vector<std::wstring> &urls);
+
+	// Hands over the source prefetched for pwszURL with crcMode, if any.
+	// The source might still be opening: *pOpenTask completes when it is
+	// open, and fails if the open failed.
+	bool Take(LPCWSTR pwszURL, CrcVerifyMode crcMode, MKVSource **ppSource, concurrency::task<void> *pOpenTask);
+
+private:
+
+	struct Entry
+	{
+		std::wstring                url;
+		ComPtr<MKVSource>           spSource;
+		CrcVerifyMode               crcMode;
+		concurrency::task<void>     opened;
+	};
+
+	SourcePrefetcher() : m_cRef(1)
+	{
+	}
+
+	~SourcePrefetcher()
+	{
+	}
+
+	static ComPtr<IMFByteStream> OpenByteStream(const std::wstring &url);
+	static void ShutdownWhenOpened(const Entry &entry);
+
+	long                m_cRef;
+	CritSec             m_critSec;
+	std::vector<Entry>  m_entries;      // Oldest first.
+};
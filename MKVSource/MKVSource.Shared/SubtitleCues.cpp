@@ -0,0 +1,330 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SubtitleCues.cpp
+// Time-indexed store for text subtitle cues.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "Demux.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Orders cues by start time, for std::upper_bound.
+	bool StartsAfter(LONGLONG hnsTime, const SubtitleCue &cue)
+	{
+		return hnsTime < cue.hnsStart;
+	}
+
+	// SSA/ASS blocks hold "ReadOrder, Layer, Style, Name, MarginL, MarginR,
+	// MarginV, Effect, Text". Returns the offset of Text.
+	UINT32 FindSsaText(const BYTE *pData, DWORD cbData)
+	{
+		DWORD cCommas = 0;
+		for (DWORD i = 0; i < cbData; i++)
+		{
+			if (pData[i] == ',' && ++cCommas == 8)
+			{
+				return i + 1;
+			}
+		}
+		return 0;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// GetSubtitleFormat
+// Returns the subtitle format for a CodecID, or SUBTITLE_NONE.
+//-------------------------------------------------------------------
+
+SubtitleFormat GetSubtitleFormat(const char *pszCodecID)
+{
+	if (pszCodecID == nullptr)
+	{
+		return SUBTITLE_NONE;
+	}
+	else if (strcmp(pszCodecID, "S_TEXT/UTF8") == 0)
+	{
+		return SUBTITLE_UTF8;
+	}
+	else if (strcmp(pszCodecID, "S_TEXT/SSA") == 0)
+	{
+		return SUBTITLE_SSA;
+	}
+	else if (strcmp(pszCodecID, "S_TEXT/ASS") == 0)
+	{
+		return SUBTITLE_ASS;
+	}
+	else if (strcmp(pszCodecID, "S_HDMV/PGS") == 0)
+	{
+		return SUBTITLE_PGS;
+	}
+	else if (strcmp(pszCodecID, "S_VOBSUB") == 0)
+	{
+		return SUBTITLE_VOBSUB;
+	}
+	return SUBTITLE_NONE;
+}
+
+
+//-------------------------------------------------------------------
+// SubtitleCueStore class
+//-------------------------------------------------------------------
+
+SubtitleCueStore::SubtitleCueStore()
+	: m_cbArenaUsed(ARENA_BLOCK_SIZE)
+{
+}
+
+SubtitleCueStore::~SubtitleCueStore()
+{
+	Clear();
+}
+
+
+//-------------------------------------------------------------------
+// Add
+// Adds a cue to the index of its track.
+//
+// Cues mostly arrive in order, and are appended. A cue that arrives out
+// of order (after a seek) is inserted, and the copy of a cue that is
+// already there is dropped.
+//
+// A cue without an end time (SUBTITLE_OPEN_END) ends where the next cue
+// of the track starts.
+//-------------------------------------------------------------------
+
+bool SubtitleCueStore::Add(DWORD dwTrack, SubtitleFormat format, LONGLONG hnsStart, LONGLONG hnsEnd, const BYTE *pData, DWORD cbData, SubtitleCue *pCue)
+{
+	assert(format != SUBTITLE_NONE);
+	assert(pCue != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	TrackCues *pTrack = FindTrack(dwTrack);
+	if (pTrack == nullptr)
+	{
+		pTrack = new TrackCues();
+		pTrack->dwTrack = dwTrack;
+		m_tracks.push_back(pTrack);
+	}
+
+	std::vector<SubtitleCue> &cues = pTrack->cues;
+
+	// Find where the cue goes: after every cue that starts at or before it.
+	auto it = std::upper_bound(cues.begin(), cues.end(), hnsStart, StartsAfter);
+
+	// Is it a copy? Copies start at the same time, so they are just before it.
+	for (auto itSame = it; itSame != cues.begin() && (itSame - 1)->hnsStart == hnsStart; --itSame)
+	{
+		const SubtitleCue &same = *(itSame - 1);
+		if (same.cbData == cbData && memcmp(same.pData, pData, cbData) == 0)
+		{
+			*pCue = same;
+			return false;
+		}
+	}
+
+	SubtitleCue cue;
+	cue.hnsStart = hnsStart;
+	cue.hnsEnd = hnsEnd;
+	cue.pData = CopyToArena(pData, cbData);
+	cue.cbData = cbData;
+	cue.cbTextOffset = ((format == SUBTITLE_SSA || format == SUBTITLE_ASS) ? FindSsaText(pData, cbData) : 0);
+
+	size_t iCue = it - cues.begin();
+
+	// Close the open end of the cue before this one, and give this one
+	// the start of the next one if its end is open.
+	if (iCue > 0 && cues[iCue - 1].hnsEnd == SUBTITLE_OPEN_END)
+	{
+		cues[iCue - 1].hnsEnd = hnsStart;
+	}
+	if (cue.hnsEnd == SUBTITLE_OPEN_END && iCue < cues.size())
+	{
+		cue.hnsEnd = cues[iCue].hnsStart;
+	}
+
+	cues.insert(it, cue);
+	pTrack->maxEnd.resize(cues.size());
+
+	UpdateMaxEnd(pTrack, (iCue > 0 ? iCue - 1 : 0));
+
+	*pCue = cue;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// FindActive
+// Returns the cues of a track that show at hnsTime.
+//
+// The cues that start at or before hnsTime come before the upper
+// bound. Walking back from there, maxEnd says when no earlier cue can
+// still be showing.
+//-------------------------------------------------------------------
+
+void SubtitleCueStore::FindActive(DWORD dwTrack, LONGLONG hnsTime, std::vector<SubtitleCue> *pCues)
+{
+	assert(pCues != nullptr);
+
+	pCues->clear();
+
+	AutoLock lock(m_critSec);
+
+	TrackCues *pTrack = FindTrack(dwTrack);
+	if (pTrack == nullptr)
+	{
+		return;
+	}
+
+	const std::vector<SubtitleCue> &cues = pTrack->cues;
+
+	size_t i = std::upper_bound(cues.begin(), cues.end(), hnsTime, StartsAfter) - cues.begin();
+
+	while (i > 0 && pTrack->maxEnd[i - 1] > hnsTime)
+	{
+		--i;
+		if (cues[i].hnsEnd > hnsTime)
+		{
+			pCues->push_back(cues[i]);
+		}
+	}
+
+	std::reverse(pCues->begin(), pCues->end());
+}
+
+
+//-------------------------------------------------------------------
+// FindNext
+// Returns the first cue of a track that starts after hnsTime.
+//-------------------------------------------------------------------
+
+bool SubtitleCueStore::FindNext(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue)
+{
+	assert(pCue != nullptr);
+
+	AutoLock lock(m_critSec);
+
+	TrackCues *pTrack = FindTrack(dwTrack);
+	if (pTrack == nullptr)
+	{
+		return false;
+	}
+
+	auto it = std::upper_bound(pTrack->cues.begin(), pTrack->cues.end(), hnsTime, StartsAfter);
+	if (it == pTrack->cues.end())
+	{
+		return false;
+	}
+
+	*pCue = *it;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// Clear
+// Releases every cue and the arena.
+//-------------------------------------------------------------------
+
+void SubtitleCueStore::Clear()
+{
+	AutoLock lock(m_critSec);
+
+	for (size_t i = 0; i < m_tracks.size(); i++)
+	{
+		delete m_tracks[i];
+	}
+	m_tracks.clear();
+
+	for (size_t i = 0; i < m_arenaBlocks.size(); i++)
+	{
+		delete[] m_arenaBlocks[i];
+	}
+	m_arenaBlocks.clear();
+	m_cbArenaUsed = ARENA_BLOCK_SIZE;
+}
+
+
+//-------------------------------------------------------------------
+// FindTrack
+// Returns the cues of a track, or nullptr. Call with the lock held.
+//-------------------------------------------------------------------
+
+SubtitleCueStore::TrackCues *SubtitleCueStore::FindTrack(DWORD dwTrack)
+{
+	for (size_t i = 0; i < m_tracks.size(); i++)
+	{
+		if (m_tracks[i]->dwTrack == dwTrack)
+		{
+			return m_tracks[i];
+		}
+	}
+	return nullptr;
+}
+
+
+//-------------------------------------------------------------------
+// CopyToArena
+// Copies cue data to the arena, null-terminated.
+//
+// The arena grows by ARENA_BLOCK_SIZE blocks, so that one allocation
+// holds many cues. A cue that does not fit in a block gets a block of
+// its own.
+//-------------------------------------------------------------------
+
+const char *SubtitleCueStore::CopyToArena(const BYTE *pData, DWORD cbData)
+{
+	DWORD cbNeeded = cbData + 1;
+	char *pCopy = nullptr;
+
+	if (cbNeeded > ARENA_BLOCK_SIZE)
+	{
+		pCopy = new char[cbNeeded];
+
+		// Keep the last block last; it still has room.
+		m_arenaBlocks.insert(m_arenaBlocks.empty() ? m_arenaBlocks.end() : m_arenaBlocks.end() - 1, pCopy);
+	}
+	else
+	{
+		if (ARENA_BLOCK_SIZE - m_cbArenaUsed < cbNeeded)
+		{
+			m_arenaBlocks.push_back(new char[ARENA_BLOCK_SIZE]);
+			m_cbArenaUsed = 0;
+		}
+
+		pCopy = m_arenaBlocks.back() + m_cbArenaUsed;
+		m_cbArenaUsed += cbNeeded;
+	}
+
+	CopyMemory(pCopy, pData, cbData);
+	pCopy[cbData] = '\0';
+
+	return pCopy;
+}
+
+
+//-------------------------------------------------------------------
+// UpdateMaxEnd
+// Recomputes maxEnd from index iFirst on.
+//-------------------------------------------------------------------
+
+void SubtitleCueStore::UpdateMaxEnd(TrackCues *pTrack, size_t iFirst)
+{
+	LONGLONG hnsMax = (iFirst > 0 ? pTrack->maxEnd[iFirst - 1] : MINLONGLONG);
+
+	for (size_t i = iFirst; i < pTrack->cues.size(); i++)
+	{
+		hnsMax = max(hnsMax, pTrack->cues[i].hnsEnd);
+		pTrack->maxEnd[i] = hnsMax;
+	}
+}
@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// SubtitleCues.h
+// Time-indexed store for text subtitle cues.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+// Subtitle codecs.
+enum SubtitleFormat
+{
+	SUBTITLE_NONE,
+	SUBTITLE_UTF8,      // S_TEXT/UTF8: plain text.
+	SUBTITLE_SSA,       // S_TEXT/SSA: a Dialogue line without the time fields.
+	SUBTITLE_ASS,       // S_TEXT/ASS: same as SSA.
+	SUBTITLE_PGS,       // S_HDMV/PGS: Blu-ray bitmaps, one display set per block.
+	SUBTITLE_VOBSUB     // S_VOBSUB: DVD bitmaps, one subpicture unit per block.
+};
+
+inline bool IsBitmapSubtitleFormat(SubtitleFormat format)
+{
+	return (format == SUBTITLE_PGS || format == SUBTITLE_VOBSUB);
+}
+
+SubtitleFormat GetSubtitleFormat(const char *pszCodecID);
+
+const LONGLONG SUBTITLE_OPEN_END = MAXLONGLONG;     // End time of a cue whose end is not known yet.
+
+// One subtitle cue. The data lives in the store's arena and stays valid
+// until the store is cleared. For bitmap formats, the data is the block
+// payload, and Text() is not meaningful.
+struct SubtitleCue
+{
+	LONGLONG    hnsStart;       // Presentation time, in 100-ns units.
+	LONGLONG    hnsEnd;         // End time, or SUBTITLE_OPEN_END.
+	const char  *pData;         // The block payload (UTF-8 for text), null-terminated.
+	UINT32      cbData;         // Size of pData, without the terminator.
+	UINT32      cbTextOffset;   // Where the text starts in pData. (SSA/ASS: after the 8 leading fields.)
+
+	const char *Text() const { return pData + cbTextOffset; }
+	UINT32 TextLength() const { return cbData - cbTextOffset; }
+};
+
+// The store keeps the cues of each track sorted by start time, so that
+// finding the cues shown at a given time takes O(log n) plus the cues
+// found. Cues can overlap (SSA/ASS does this a lot).
+//
+// The cues stay in the store after they are delivered. After a seek,
+// the source finds the cues that are already showing at the new
+// position here, without reading the clusters before it again.
+//
+// Blocks are read again after a seek back; the store drops the copies.
+//
+// The store has its own lock: the demux thread adds cues, and the
+// application queries them.
+class SubtitleCueStore
+{
+public:
+	SubtitleCueStore();
+	~SubtitleCueStore();
+
+	// Adds a cue, and returns the stored cue in *pCue. Returns false if
+	// the store already has it; *pCue is then the cue already there.
+	bool Add(DWORD dwTrack, SubtitleFormat format, LONGLONG hnsStart, LONGLONG hnsEnd, const BYTE *pData, DWORD cbData, SubtitleCue *pCue);
+
+	// Returns the cues of a track that show at hnsTime, ordered by start time.
+	void FindActive(DWORD dwTrack, LONGLONG hnsTime, std::vector<SubtitleCue> *pCues);
+
+	// Returns the first cue of a track that starts after hnsTime.
+	bool FindNext(DWORD dwTrack, LONGLONG hnsTime, SubtitleCue *pCue);
+
+	// Releases every cue.
+	void Clear();
+
+private:
+	SubtitleCueStore(const SubtitleCueStore&);
+	SubtitleCueStore& operator=(const SubtitleCueStore&);
+
+	struct TrackCues
+	{
+		DWORD                       dwTrack;
+		std::vector<SubtitleCue>    cues;       // Sorted by hnsStart.
+		std::vector<LONGLONG>       maxEnd;     // maxEnd[i]: latest end time of cues[0..i].
+	};
+
+	TrackCues *FindTrack(DWORD dwTrack);
+	const char *CopyToArena(const BYTE *pData, DWORD cbData);
+	static void UpdateMaxEnd(TrackCues *pTrack, size_t iFirst);
+
+	static const DWORD ARENA_BLOCK_SIZE = 64 * 1024;
+
+	CritSec                     m_critSec;
+	std::vector<TrackCues*>     m_tracks;
+	std::vector<char*>          m_arenaBlocks;  // Text of all the cues. Never moved; freed by Clear.
+	DWORD                       m_cbArenaUsed;  // Bytes used in the last block.
+};
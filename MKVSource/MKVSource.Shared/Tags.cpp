@@ -0,0 +1,329 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Tags.cpp
+// Streaming reader for the Tags element.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "Demux.h"
+
+namespace
+{
+	const DWORD ID_TAGS = 0x1254C367;
+	const DWORD ID_TAG = 0x7373;
+	const DWORD ID_TARGETS = 0x63C0;
+	const DWORD ID_TAG_TRACK_UID = 0x63C5;
+	const DWORD ID_SIMPLE_TAG = 0x67C8;
+	const DWORD ID_TAG_NAME = 0x45A3;
+	const DWORD ID_TAG_STRING = 0x4487;
+
+	// One element header, read from a byte range.
+	struct ElementHeader
+	{
+		DWORD           id;
+		const BYTE      *pData;     // The element's data.
+		DWORD           cbData;
+	};
+
+	// Reads a variable-length integer. For IDs the length marker stays
+	// in the value. Returns 0 if the data is damaged or too short.
+	DWORD ReadVint(const BYTE *pData, DWORD cbData, bool fKeepMarker, UINT64 *pValue)
+	{
+		if (cbData == 0 || pData[0] == 0)
+		{
+			return 0;
+		}
+
+		DWORD cb = 1;
+		while (!(pData[0] & (0x80 >> (cb - 1))))
+		{
+			++cb;
+		}
+		if (cb > cbData)
+		{
+			return 0;
+		}
+
+		UINT64 value = fKeepMarker ? pData[0] : (pData[0] & (0xFF >> cb));
+		for (DWORD i = 1; i < cb; i++)
+		{
+			value = (value << 8) | pData[i];
+		}
+
+		*pValue = value;
+		return cb;
+	}
+
+	// Reads the element header at *ppData, and moves *ppData past the
+	// element. Returns false at the end of the range, or if the element
+	// does not fit in it.
+	bool NextElement(const BYTE **ppData, const BYTE *pEnd, ElementHeader *pHeader)
+	{
+		const BYTE *p = *ppData;
+		UINT64 id = 0;
+		UINT64 size = 0;
+
+		DWORD cbId = ReadVint(p, (DWORD)(pEnd - p), true, &id);
+		if (cbId == 0 || cbId > 4)
+		{
+			return false;
+		}
+		p += cbId;
+
+		DWORD cbSize = ReadVint(p, (DWORD)(pEnd - p), false, &size);
+		if (cbSize == 0)
+		{
+			return false;
+		}
+		p += cbSize;
+
+		if (size > (UINT64)(pEnd - p))
+		{
+			return false;
+		}
+
+		pHeader->id = (DWORD)id;
+		pHeader->pData = p;
+		pHeader->cbData = (DWORD)size;
+
+		*ppData = p + size;
+		return true;
+	}
+
+	UINT64 ReadUnsigned(const BYTE *pData, DWORD cbData)
+	{
+		UINT64 value = 0;
+		for (DWORD i = 0; i < cbData && i < 8; i++)
+		{
+			value = (value << 8) | pData[i];
+		}
+		return value;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// TagReader class
+//-------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+// Register
+// Adds a TagName to the names the reader keeps.
+//-------------------------------------------------------------------
+
+DWORD TagReader::Register(const char *pszName)
+{
+	m_names.push_back(pszName);
+	return (DWORD)(m_names.size() - 1);
+}
+
+
+//-------------------------------------------------------------------
+// Read
+// Reads the Tag elements in a Tags element.
+//-------------------------------------------------------------------
+
+void TagReader::Read(const BYTE *pData, DWORD cbData, std::vector<TagValue> *pValues) const
+{
+	const BYTE *pEnd = pData + cbData;
+	ElementHeader element;
+
+	while (NextElement(&pData, pEnd, &element))
+	{
+		if (element.id == ID_TAG)
+		{
+			ReadTag(element.pData, element.cbData, pValues);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ReadTag
+// Reads one Tag: its target track, then its SimpleTag elements.
+//
+// Targets comes first in a Tag, but the reader does not rely on it.
+//-------------------------------------------------------------------
+
+void TagReader::ReadTag(const BYTE *pData, DWORD cbData, std::vector<TagValue> *pValues) const
+{
+	const BYTE *pEnd = pData + cbData;
+	const BYTE *p = pData;
+	ElementHeader element;
+	UINT64 trackUID = 0;
+
+	while (NextElement(&p, pEnd, &element))
+	{
+		if (element.id != ID_TARGETS)
+		{
+			continue;
+		}
+
+		const BYTE *pTarget = element.pData;
+		const BYTE *pTargetEnd = element.pData + element.cbData;
+		ElementHeader target;
+
+		while (NextElement(&pTarget, pTargetEnd, &target))
+		{
+			if (target.id == ID_TAG_TRACK_UID)
+			{
+				trackUID = ReadUnsigned(target.pData, target.cbData);
+			}
+		}
+	}
+
+	p = pData;
+	while (NextElement(&p, pEnd, &element))
+	{
+		if (element.id == ID_SIMPLE_TAG)
+		{
+			ReadSimpleTag(element.pData, element.cbData, trackUID, pValues);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ReadSimpleTag
+// Keeps a SimpleTag if its name is registered.
+//
+// Nested SimpleTags (sub-tags) are not read.
+//-------------------------------------------------------------------
+
+void TagReader::ReadSimpleTag(const BYTE *pData, DWORD cbData, UINT64 trackUID, std::vector<TagValue> *pValues) const
+{
+	const BYTE *pEnd = pData + cbData;
+	ElementHeader element;
+	int iName = -1;
+	const BYTE *pString = nullptr;
+	DWORD cbString = 0;
+
+	while (NextElement(&pData, pEnd, &element))
+	{
+		if (element.id == ID_TAG_NAME)
+		{
+			iName = FindName(element.pData, element.cbData);
+			if (iName < 0)
+			{
+				return;
+			}
+		}
+		else if (element.id == ID_TAG_STRING)
+		{
+			pString = element.pData;
+			cbString = element.cbData;
+		}
+	}
+
+	if (iName >= 0 && pString != nullptr)
+	{
+		TagValue value;
+		value.trackUID = trackUID;
+		value.iName = (DWORD)iName;
+		value.value.assign(reinterpret_cast<const char*>(pString), cbString);
+
+		// Strings can be padded with zeros.
+		value.value.resize(strnlen(value.value.c_str(), cbString));
+
+		pValues->push_back(value);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// FindName
+// Returns the index of a registered name, or -1.
+//-------------------------------------------------------------------
+
+int TagReader::FindName(const BYTE *pName, DWORD cbName) const
+{
+	// Ignore zero padding.
+	while (cbName > 0 && pName[cbName - 1] == 0)
+	{
+		--cbName;
+	}
+
+	for (size_t i = 0; i < m_names.size(); i++)
+	{
+		if (m_names[i].size() == cbName && memcmp(m_names[i].data(), pName, cbName) == 0)
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+
+//-------------------------------------------------------------------
+// ReadTagsHeader
+// Reads the ID and size of a Tags element.
+//-------------------------------------------------------------------
+
+bool ReadTagsHeader(const BYTE *pData, DWORD cbData, DWORD *pcbHeader, UINT64 *pcbBody)
+{
+	UINT64 id = 0;
+
+	DWORD cbId = ReadVint(pData, cbData, true, &id);
+	if (cbId == 0 || id != ID_TAGS)
+	{
+		return false;
+	}
+
+	DWORD cbSize = ReadVint(pData + cbId, cbData - cbId, false, pcbBody);
+	if (cbSize == 0)
+	{
+		return false;
+	}
+
+	*pcbHeader = cbId + cbSize;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// ParseTagDuration
+// Parses "HH:MM:SS.nnnnnnnnn" into 100-ns units.
+//-------------------------------------------------------------------
+
+LONGLONG ParseTagDuration(const char *psz)
+{
+	LONGLONG fields[3] = { 0, 0, 0 };
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (*psz < '0' || *psz > '9')
+		{
+			return -1;
+		}
+		while (*psz >= '0' && *psz <= '9')
+		{
+			fields[i] = fields[i] * 10 + (*psz++ - '0');
+		}
+		if (*psz != ((i < 2) ? ':' : '.') && !(i == 2 && *psz == '\0'))
+		{
+			return -1;
+		}
+		if (*psz != '\0')
+		{
+			++psz;
+		}
+	}
+
+	LONGLONG hns = ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 10000000;
+
+	// Fraction: up to 7 digits count; the rest are below 100 ns.
+	LONGLONG scale = 1000000;
+	while (*psz >= '0' && *psz <= '9')
+	{
+		hns += (*psz++ - '0') * scale;
+		scale /= 10;
+	}
+
+	return hns;
+}
@@ -0,0 +1,56 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// Tags.h
+// Streaming reader for the Tags element.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A tag value the reader kept.
+struct TagValue
+{
+	UINT64          trackUID;       // TagTrackUID of the tag, or 0 if it is for the whole file.
+	DWORD           iName;          // Index of the name, in the order it was registered.
+	std::string     value;          // TagString (UTF-8).
+};
+
+// Tags can be large: mkvmerge writes statistics for every track, and
+// taggers add anything. The reader walks the bytes of a Tags element
+// without building an element tree. Callers register the names they
+// want; a SimpleTag is compared against those in place, and only a
+// match is copied out. Everything else is skipped by its size.
+class TagReader
+{
+public:
+	// Registers a TagName to keep. Returns its index (see TagValue).
+	DWORD Register(const char *pszName);
+
+	// Reads the body of a Tags element (the data after its header).
+	// Appends the registered tags it finds to *pValues. Damaged data
+	// ends the walk; what was found before it is kept.
+	void Read(const BYTE *pData, DWORD cbData, std::vector<TagValue> *pValues) const;
+
+private:
+	void ReadTag(const BYTE *pData, DWORD cbData, std::vector<TagValue> *pValues) const;
+	void ReadSimpleTag(const BYTE *pData, DWORD cbData, UINT64 trackUID, std::vector<TagValue> *pValues) const;
+	int FindName(const BYTE *pName, DWORD cbName) const;
+
+	std::vector<std::string>    m_names;
+};
+
+// Parses a DURATION statistics tag ("HH:MM:SS.nnnnnnnnn") into 100-ns
+// units. Returns -1 if the string is not in that form.
+LONGLONG ParseTagDuration(const char *psz);
+
+// Reads the header of a Tags element. Returns false if the data does
+// not start with one.
+bool ReadTagsHeader(const BYTE *pData, DWORD cbData, DWORD *pcbHeader, UINT64 *pcbBody);
@@ -0,0 +1,588 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// VideoFormat.cpp
+// Frame rate, aspect ratio and interlacing of a video track.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "MKVSource.h"
+
+#include <math.h>
+
+namespace
+{
+	const UINT64 NS_PER_SECOND = 1000000000;
+
+	// Matroska FieldOrder values.
+	const DWORD FIELD_ORDER_TFF = 1;
+	const DWORD FIELD_ORDER_BFF = 6;
+
+	// Sample aspect ratios for aspect_ratio_idc 1 to 16 (H.264 Table E-1).
+	const MFRatio g_SpsAspectRatios[] =
+	{
+		{ 1, 1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 }, { 24, 11 }, { 20, 11 }, { 32, 11 },
+		{ 80, 33 }, { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, { 4, 3 }, { 3, 2 }, { 2, 1 }
+	};
+	const DWORD SPS_EXTENDED_SAR = 255;
+
+	// The usual frame rates. A frame duration within 0.1% of one of these
+	// is taken to be that rate, since Matroska stores it rounded.
+	const MFRatio g_CommonFrameRates[] =
+	{
+		{ 24000, 1001 }, { 24, 1 }, { 25, 1 }, { 30000, 1001 }, { 30, 1 },
+		{ 48000, 1001 }, { 48, 1 }, { 50, 1 }, { 60000, 1001 }, { 60, 1 },
+		{ 100, 1 }, { 120000, 1001 }, { 120, 1 }, { 15, 1 }, { 12, 1 }
+	};
+
+	// ISO/IEC 23091-4 code points, as used by the Matroska Colour element
+	// and by H.264 VUI.
+	const DWORD COLOUR_UNSPECIFIED = 2;
+
+	MFVideoPrimaries PrimariesFromCode(DWORD code)
+	{
+		switch (code)
+		{
+		case 1:  return MFVideoPrimaries_BT709;
+		case 4:  return MFVideoPrimaries_BT470_2_SysM;
+		case 5:  return MFVideoPrimaries_BT470_2_SysBG;
+		case 6:  return MFVideoPrimaries_SMPTE170M;
+		case 7:  return MFVideoPrimaries_SMPTE240M;
+		case 9:  return MFVideoPrimaries_BT2020;
+		case 10: return MFVideoPrimaries_XYZ;
+		case 11: return MKVVideoPrimaries_DCI_P3;
+		case 22: return MFVideoPrimaries_EBU3213;
+		default: return MFVideoPrimaries_Unknown;
+		}
+	}
+
+	MFVideoTransferFunction TransferFromCode(DWORD code)
+	{
+		switch (code)
+		{
+		case 1:                             // BT.709
+		case 6:                             // SMPTE 170M: same curve
+			return MFVideoTransFunc_709;
+		case 4:  return MFVideoTransFunc_22;
+		case 5:  return MFVideoTransFunc_28;
+		case 7:  return MFVideoTransFunc_240M;
+		case 8:  return MFVideoTransFunc_10;
+		case 9:  return MFVideoTransFunc_Log_100;
+		case 10: return MFVideoTransFunc_Log_316;
+		case 13: return MFVideoTransFunc_sRGB;
+		case 14:                            // BT.2020, 10 and 12 bits
+		case 15:
+			return MFVideoTransFunc_2020;
+		case 16: return MKVVideoTransFunc_2084;
+		case 18: return MKVVideoTransFunc_HLG;
+		default: return MFVideoTransFunc_Unknown;
+		}
+	}
+
+	MFVideoTransferMatrix MatrixFromCode(DWORD code, DWORD bitsPerChannel)
+	{
+		switch (code)
+		{
+		case 1:  return MFVideoTransferMatrix_BT709;
+		case 5:                             // BT.470 BG
+		case 6:                             // SMPTE 170M
+			return MFVideoTransferMatrix_BT601;
+		case 7:  return MFVideoTransferMatrix_SMPTE240M;
+		case 9:  return (bitsPerChannel > 10) ? MFVideoTransferMatrix_BT2020_12 : MFVideoTransferMatrix_BT2020_10;
+		default: return MFVideoTransferMatrix_Unknown;
+		}
+	}
+
+	// Works out the colour attributes from the Colour element, falling
+	// back on the SPS for each one the element leaves unspecified.
+	void SetColour(const Colour *pColour, const H264SpsInfo *pSps, VideoTrackFormat *pFormat)
+	{
+		DWORD primaries = COLOUR_UNSPECIFIED;
+		DWORD transfer = COLOUR_UNSPECIFIED;
+		DWORD matrix = COLOUR_UNSPECIFIED;
+		DWORD bitsPerChannel = 0;
+		pFormat->nominalRange = MFNominalRange_Unknown;
+		pFormat->chromaSiting = MFVideoChromaSubsampling_Unknown;
+
+		if (pColour != nullptr)
+		{
+			primaries = pColour->Primaries;
+			transfer = pColour->TransferCharacteristics;
+			matrix = pColour->MatrixCoefficients;
+			bitsPerChannel = pColour->BitsPerChannel;
+
+			if (pColour->Range == 1)
+			{
+				pFormat->nominalRange = MFNominalRange_16_235;
+			}
+			else if (pColour->Range == 2)
+			{
+				pFormat->nominalRange = MFNominalRange_0_255;
+			}
+
+			if (pColour->ChromaSitingHorz != 0 || pColour->ChromaSitingVert != 0)
+			{
+				UINT32 siting = 0;
+				if (pColour->ChromaSitingHorz == 1)
+				{
+					siting |= MFVideoChromaSubsampling_Horizontally_Cosited;
+				}
+				if (pColour->ChromaSitingVert == 1)
+				{
+					siting |= MFVideoChromaSubsampling_Vertically_Cosited;
+				}
+				else if (pColour->ChromaSitingVert == 2)
+				{
+					siting |= MFVideoChromaSubsampling_Vertically_AlignedChromaPlanes;
+				}
+				pFormat->chromaSiting = siting;
+			}
+
+			pFormat->maxContentLightLevel = pColour->MaxCLL;
+			pFormat->maxFrameAverageLightLevel = pColour->MaxFALL;
+			if (pColour->HasMasteringMetadata)
+			{
+				pFormat->maxMasteringLuminance = (UINT32)(pColour->Mastering.LuminanceMax + 0.5f);
+				pFormat->minMasteringLuminance = (UINT32)(pColour->Mastering.LuminanceMin * 10000 + 0.5f);
+			}
+		}
+
+		if (pSps != nullptr && pSps->fHasColourDescription)
+		{
+			if (primaries == COLOUR_UNSPECIFIED)
+			{
+				primaries = pSps->colourPrimaries;
+			}
+			if (transfer == COLOUR_UNSPECIFIED)
+			{
+				transfer = pSps->transferCharacteristics;
+			}
+			if (matrix == COLOUR_UNSPECIFIED)
+			{
+				matrix = pSps->matrixCoefficients;
+			}
+		}
+		if (pSps != nullptr && pSps->fHasSignalType && pFormat->nominalRange == MFNominalRange_Unknown)
+		{
+			pFormat->nominalRange = pSps->fFullRange ? MFNominalRange_0_255 : MFNominalRange_16_235;
+		}
+
+		pFormat->primaries = PrimariesFromCode(primaries);
+		pFormat->transferFunction = TransferFromCode(transfer);
+		pFormat->transferMatrix = MatrixFromCode(matrix, bitsPerChannel);
+	}
+
+	UINT64 Gcd(UINT64 a, UINT64 b)
+	{
+		while (b != 0)
+		{
+			UINT64 t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	// Reduces a ratio. Returns false if it is empty or does not fit in an MFRatio.
+	bool MakeRatio(UINT64 num, UINT64 den, MFRatio *pRatio)
+	{
+		if (num == 0 || den == 0)
+		{
+			return false;
+		}
+
+		UINT64 gcd = Gcd(num, den);
+		num /= gcd;
+		den /= gcd;
+		if (num > MAXDWORD || den > MAXDWORD)
+		{
+			return false;
+		}
+
+		pRatio->Numerator = (DWORD)num;
+		pRatio->Denominator = (DWORD)den;
+		return true;
+	}
+
+	// Frame rate from the duration of one frame, in nanoseconds.
+	bool FrameRateFromDuration(UINT64 nsFrame, MFRatio *pRate)
+	{
+		if (nsFrame == 0)
+		{
+			return false;
+		}
+
+		// 23.976 and 24 are 0.1% apart, so take the closest match.
+		double bestError = 0.001;
+		const MFRatio *pBest = nullptr;
+		for (DWORD i = 0; i < ARRAYSIZE(g_CommonFrameRates); i++)
+		{
+			double nsExpected = (double)NS_PER_SECOND * g_CommonFrameRates[i].Denominator / g_CommonFrameRates[i].Numerator;
+			double error = fabs(nsFrame - nsExpected) / nsExpected;
+			if (error <= bestError)
+			{
+				bestError = error;
+				pBest = &g_CommonFrameRates[i];
+			}
+		}
+
+		if (pBest != nullptr)
+		{
+			*pRate = *pBest;
+			return true;
+		}
+		return MakeRatio(NS_PER_SECOND, nsFrame, pRate);
+	}
+
+	// Reads the bits of an RBSP (a NAL payload with the emulation
+	// prevention bytes removed). Reading past the end sets an error flag
+	// and returns zeros.
+	class BitReader
+	{
+	public:
+		BitReader(const BYTE *pNal, DWORD cbNal) : m_iBit(0), m_fError(false)
+		{
+			m_rbsp.reserve(cbNal);
+			DWORD zeros = 0;
+			for (DWORD i = 0; i < cbNal; i++)
+			{
+				if (zeros >= 2 && pNal[i] == 0x03)
+				{
+					zeros = 0;
+					continue;
+				}
+				zeros = (pNal[i] == 0) ? zeros + 1 : 0;
+				m_rbsp.push_back(pNal[i]);
+			}
+		}
+
+		bool Failed() const { return m_fError; }
+
+		UINT32 Bits(DWORD count)
+		{
+			UINT32 value = 0;
+			for (DWORD i = 0; i < count; i++)
+			{
+				if (m_iBit >= m_rbsp.size() * 8)
+				{
+					m_fError = true;
+					return 0;
+				}
+				value = (value << 1) | ((m_rbsp[m_iBit / 8] >> (7 - m_iBit % 8)) & 1);
+				++m_iBit;
+			}
+			return value;
+		}
+
+		bool Flag() { return Bits(1) != 0; }
+
+		// ue(v)
+		UINT32 Golomb()
+		{
+			DWORD leadingZeros = 0;
+			while (!Flag())
+			{
+				if (m_fError || ++leadingZeros > 31)
+				{
+					m_fError = true;
+					return 0;
+				}
+			}
+			return (UINT32)((1ULL << leadingZeros) - 1 + Bits(leadingZeros));
+		}
+
+		// se(v)
+		INT32 SignedGolomb()
+		{
+			UINT32 code = Golomb();
+			return (code & 1) ? (INT32)((code + 1) / 2) : -(INT32)(code / 2);
+		}
+
+	private:
+		std::vector<BYTE>   m_rbsp;
+		size_t              m_iBit;
+		bool                m_fError;
+	};
+
+	// Skips a scaling_list() of an SPS.
+	void SkipScalingList(BitReader &bits, DWORD size)
+	{
+		INT32 lastScale = 8;
+		INT32 nextScale = 8;
+		for (DWORD i = 0; i < size && !bits.Failed(); i++)
+		{
+			if (nextScale != 0)
+			{
+				nextScale = (lastScale + bits.SignedGolomb() + 256) % 256;
+			}
+			lastScale = (nextScale == 0) ? lastScale : nextScale;
+		}
+	}
+
+	// The profiles whose SPS carries chroma format and scaling lists.
+	bool IsHighProfile(UINT32 profile)
+	{
+		switch (profile)
+		{
+		case 100: case 110: case 122: case 244: case 44:
+		case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Reads the vui_parameters() fields kept in H264SpsInfo.
+	void ReadVui(BitReader &bits, H264SpsInfo *pInfo)
+	{
+		if (bits.Flag())        // aspect_ratio_info_present_flag
+		{
+			UINT32 idc = bits.Bits(8);
+			if (idc == SPS_EXTENDED_SAR)
+			{
+				UINT32 width = bits.Bits(16);
+				UINT32 height = bits.Bits(16);
+				pInfo->fHasAspectRatio = !bits.Failed() && MakeRatio(width, height, &pInfo->sampleAspectRatio);
+			}
+			else if (idc >= 1 && idc <= ARRAYSIZE(g_SpsAspectRatios))
+			{
+				pInfo->sampleAspectRatio = g_SpsAspectRatios[idc - 1];
+				pInfo->fHasAspectRatio = !bits.Failed();
+			}
+		}
+
+		if (bits.Flag())        // overscan_info_present_flag
+		{
+			bits.Flag();        // overscan_appropriate_flag
+		}
+
+		if (bits.Flag())        // video_signal_type_present_flag
+		{
+			bits.Bits(3);       // video_format
+			pInfo->fFullRange = bits.Flag();
+			pInfo->fHasSignalType = !bits.Failed();
+			if (bits.Flag())    // colour_description_present_flag
+			{
+				pInfo->colourPrimaries = (BYTE)bits.Bits(8);
+				pInfo->transferCharacteristics = (BYTE)bits.Bits(8);
+				pInfo->matrixCoefficients = (BYTE)bits.Bits(8);
+				pInfo->fHasColourDescription = !bits.Failed();
+			}
+		}
+
+		if (bits.Flag())        // chroma_loc_info_present_flag
+		{
+			bits.Golomb();
+			bits.Golomb();
+		}
+
+		if (bits.Flag())        // timing_info_present_flag
+		{
+			pInfo->numUnitsInTick = bits.Bits(32);
+			pInfo->timeScale = bits.Bits(32);
+			pInfo->fHasTiming = !bits.Failed() && pInfo->numUnitsInTick != 0 && pInfo->timeScale != 0;
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// ReadH264Sps
+// Reads the fields of an SPS that describe the picture.
+//-------------------------------------------------------------------
+
+bool ReadH264Sps(const BYTE *pNal, DWORD cbNal, H264SpsInfo *pInfo)
+{
+	ZeroMemory(pInfo, sizeof(*pInfo));
+
+	if (cbNal < 4 || (pNal[0] & 0x1F) != 7)
+	{
+		return false;
+	}
+
+	BitReader bits(pNal + 1, cbNal - 1);
+
+	UINT32 profile = bits.Bits(8);
+	bits.Bits(16);                      // constraint flags, level_idc
+	bits.Golomb();                      // seq_parameter_set_id
+
+	if (IsHighProfile(profile))
+	{
+		UINT32 chromaFormat = bits.Golomb();
+		if (chromaFormat == 3)
+		{
+			bits.Flag();                // separate_colour_plane_flag
+		}
+		bits.Golomb();                  // bit_depth_luma_minus8
+		bits.Golomb();                  // bit_depth_chroma_minus8
+		bits.Flag();                    // qpprime_y_zero_transform_bypass_flag
+		if (bits.Flag())                // seq_scaling_matrix_present_flag
+		{
+			DWORD lists = (chromaFormat == 3) ? 12 : 8;
+			for (DWORD i = 0; i < lists && !bits.Failed(); i++)
+			{
+				if (bits.Flag())
+				{
+					SkipScalingList(bits, (i < 6) ? 16 : 64);
+				}
+			}
+		}
+	}
+
+	bits.Golomb();                      // log2_max_frame_num_minus4
+	UINT32 pocType = bits.Golomb();
+	if (pocType == 0)
+	{
+		bits.Golomb();                  // log2_max_pic_order_cnt_lsb_minus4
+	}
+	else if (pocType == 1)
+	{
+		bits.Flag();                    // delta_pic_order_always_zero_flag
+		bits.SignedGolomb();            // offset_for_non_ref_pic
+		bits.SignedGolomb();            // offset_for_top_to_bottom_field
+		UINT32 cycle = bits.Golomb();
+		for (UINT32 i = 0; i < cycle && !bits.Failed(); i++)
+		{
+			bits.SignedGolomb();
+		}
+	}
+
+	bits.Golomb();                      // max_num_ref_frames
+	bits.Flag();                        // gaps_in_frame_num_value_allowed_flag
+	bits.Golomb();                      // pic_width_in_mbs_minus1
+	bits.Golomb();                      // pic_height_in_map_units_minus1
+
+	pInfo->fFrameMbsOnly = bits.Flag();
+	if (bits.Failed())
+	{
+		return false;
+	}
+	if (!pInfo->fFrameMbsOnly)
+	{
+		bits.Flag();                    // mb_adaptive_frame_field_flag
+	}
+	bits.Flag();                        // direct_8x8_inference_flag
+	if (bits.Flag())                    // frame_cropping_flag
+	{
+		bits.Golomb();
+		bits.Golomb();
+		bits.Golomb();
+		bits.Golomb();
+	}
+
+	if (bits.Flag())                    // vui_parameters_present_flag
+	{
+		ReadVui(bits, pInfo);
+	}
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// FindAvcCSps
+// Finds the first SPS in an AVCDecoderConfigurationRecord.
+//-------------------------------------------------------------------
+
+bool FindAvcCSps(const BYTE *pAvcC, DWORD cbAvcC, const BYTE **ppSps, DWORD *pcbSps)
+{
+	// version, profile, compatibility, level, lengthSizeMinusOne,
+	// numOfSequenceParameterSets, then 16-bit length + NAL unit.
+	if (pAvcC == nullptr || cbAvcC < 8 || pAvcC[0] != 1 || (pAvcC[5] & 0x1F) == 0)
+	{
+		return false;
+	}
+
+	DWORD cbSps = (pAvcC[6] << 8) | pAvcC[7];
+	if (cbSps == 0 || cbSps > cbAvcC - 8)
+	{
+		return false;
+	}
+
+	*ppSps = pAvcC + 8;
+	*pcbSps = cbSps;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// GetVideoTrackFormat
+// Works out the video attributes of a track, once.
+//-------------------------------------------------------------------
+
+const VideoTrackFormat *GetVideoTrackFormat(TrackData *pTrack, const TrackStatistics *pStats)
+{
+	if (pTrack->VideoFormat != nullptr)
+	{
+		return pTrack->VideoFormat;
+	}
+
+	VideoTrackFormat *pFormat = new VideoTrackFormat();
+	const Video *pVideo = pTrack->Video;
+
+	H264SpsInfo sps;
+	const BYTE *pSps = nullptr;
+	DWORD cbSps = 0;
+	bool fHasSps = pTrack->CodecID != nullptr && strcmp(pTrack->CodecID, "V_MPEG4/ISO/AVC") == 0 &&
+		FindAvcCSps(pTrack->CodecPrivate, pTrack->CodecPrivateLength, &pSps, &cbSps) &&
+		ReadH264Sps(pSps, cbSps, &sps);
+
+	// Frame rate: DefaultDuration, then the SPS timing, then the
+	// FrameRate element, then the statistics tags. H.264 ticks once per
+	// field, so a frame lasts 2 * num_units_in_tick.
+	if (!FrameRateFromDuration(pTrack->DefaultDuration, &pFormat->frameRate) &&
+		!(fHasSps && sps.fHasTiming && MakeRatio(sps.timeScale, 2ULL * sps.numUnitsInTick, &pFormat->frameRate)) &&
+		!(pVideo != nullptr && pVideo->FrameRate > 0 && FrameRateFromDuration((UINT64)(NS_PER_SECOND / pVideo->FrameRate + 0.5), &pFormat->frameRate)) &&
+		!(pStats != nullptr && pStats->FrameCount != 0 && pStats->Duration > 0 && FrameRateFromDuration((UINT64)pStats->Duration * 100 / pStats->FrameCount, &pFormat->frameRate)))
+	{
+		pFormat->frameRate.Numerator = 0;
+		pFormat->frameRate.Denominator = 0;
+	}
+
+	// Pixel aspect ratio: the display size (in any unit but "unknown",
+	// its shape is the display aspect ratio), then the SPS, then square.
+	// The display size defaults to the pixel size.
+	const DWORD DISPLAY_UNIT_UNKNOWN = 4;
+	pFormat->pixelAspectRatio.Numerator = 1;
+	pFormat->pixelAspectRatio.Denominator = 1;
+	if (pVideo != nullptr && pVideo->DisplayWidth != 0 && pVideo->DisplayHeight != 0 &&
+		pVideo->DisplayUnit != DISPLAY_UNIT_UNKNOWN &&
+		(pVideo->DisplayWidth != pVideo->PixelWidth || pVideo->DisplayHeight != pVideo->PixelHeight))
+	{
+		MakeRatio((UINT64)pVideo->DisplayWidth * pVideo->PixelHeight,
+			(UINT64)pVideo->DisplayHeight * pVideo->PixelWidth, &pFormat->pixelAspectRatio);
+	}
+	else if (fHasSps && sps.fHasAspectRatio)
+	{
+		pFormat->pixelAspectRatio = sps.sampleAspectRatio;
+	}
+
+	// Interlacing: FlagInterlaced (with FieldOrder), else the SPS. When
+	// nothing says, frames can be either.
+	pFormat->interlaceMode = MFVideoInterlace_MixedInterlaceOrProgressive;
+	DWORD flagInterlaced = (pVideo != nullptr) ? pVideo->FlagInterlaced : 0;
+	if (flagInterlaced == 2 || (flagInterlaced == 0 && fHasSps && sps.fFrameMbsOnly))
+	{
+		pFormat->interlaceMode = MFVideoInterlace_Progressive;
+	}
+	else if (flagInterlaced == 1 && pVideo->FieldOrder == FIELD_ORDER_TFF)
+	{
+		pFormat->interlaceMode = MFVideoInterlace_FieldInterleavedUpperFirst;
+	}
+	else if (flagInterlaced == 1 && pVideo->FieldOrder == FIELD_ORDER_BFF)
+	{
+		pFormat->interlaceMode = MFVideoInterlace_FieldInterleavedLowerFirst;
+	}
+
+	pFormat->avgBitrate = (pStats != nullptr) ? pStats->Bitrate : 0;
+
+	SetColour((pVideo != nullptr) ? pVideo->pColour : nullptr, fHasSps ? &sps : nullptr, pFormat);
+
+	pTrack->VideoFormat = pFormat;
+	return pFormat;
+}
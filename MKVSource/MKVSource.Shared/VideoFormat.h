@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// VideoFormat.h
+// Frame rate, aspect ratio and interlacing of a video track.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// What an H.264 sequence parameter set says about the picture.
+struct H264SpsInfo
+{
+	bool        fFrameMbsOnly;          // No field or MBAFF coding: the stream is progressive.
+	bool        fHasAspectRatio;
+	MFRatio     sampleAspectRatio;      // From aspect_ratio_idc, or sar_width/sar_height.
+	bool        fHasTiming;
+	UINT32      numUnitsInTick;
+	UINT32      timeScale;
+	bool        fHasSignalType;
+	bool        fFullRange;
+	bool        fHasColourDescription;
+	BYTE        colourPrimaries;        // H.264 Table E-3 codes.
+	BYTE        transferCharacteristics;
+	BYTE        matrixCoefficients;
+};
+
+// Reads an SPS NAL unit (starting with the NAL header byte), up to the
+// end of the VUI fields above. Returns false if it is not an SPS or is
+// damaged before frame_mbs_only_flag; fields after the damage are left
+// unset.
+bool ReadH264Sps(const BYTE *pNal, DWORD cbNal, H264SpsInfo *pInfo);
+
+// Finds the first SPS in an AVCDecoderConfigurationRecord (the
+// CodecPrivate data of a V_MPEG4/ISO/AVC track).
+bool FindAvcCSps(const BYTE *pAvcC, DWORD cbAvcC, const BYTE **ppSps, DWORD *pcbSps);
+
+// The video attributes of a track, in Media Foundation terms.
+struct VideoTrackFormat
+{
+	MFRatio                 frameRate;          // {0, 0} if not known.
+	MFRatio                 pixelAspectRatio;
+	MFVideoInterlaceMode    interlaceMode;
+	UINT32                  avgBitrate;         // 0 if not known.
+
+	// Colour description; each is "unknown" if not known.
+	MFVideoPrimaries        primaries;
+	MFVideoTransferFunction transferFunction;
+	MFVideoTransferMatrix   transferMatrix;
+	MFNominalRange          nominalRange;
+	UINT32                  chromaSiting;       // MFVideoChromaSubsampling flags.
+
+	// HDR light levels; 0 if not known.
+	UINT32                  maxContentLightLevel;       // cd/m2
+	UINT32                  maxFrameAverageLightLevel;  // cd/m2
+	UINT32                  maxMasteringLuminance;      // cd/m2
+	UINT32                  minMasteringLuminance;      // 1/10000 cd/m2
+};
+
+// Returns the video attributes of a track. They come from the track
+// header (including its Colour element), the codec data and the
+// statistics tags; each is taken from the first of these that has it.
+// The result is worked out on the first call and kept in the TrackData.
+// pStats can be nullptr.
+const VideoTrackFormat *GetVideoTrackFormat(TrackData *pTrack, const TrackStatistics *pStats);
@@ -38,6 +38,7 @@
 #define LIBEBML_BINARY_H
 
 #include <cstring>
+#include <vector>
 
 #include "EbmlTypes.h"
 #include "EbmlElement.h"
@@ -68,7 +69,11 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
 		filepos_t ReadData(IOCallback & input, ScopeMode ReadFully = SCOPE_ALL_DATA);
 		filepos_t UpdateSize(bool bWithDefault = false, bool bForceRender = false);
 	
+		/*!
+			\note the element takes ownership of Buffer and will free() it
+		*/
 		void SetBuffer(const binary *Buffer, const uint32 BufferSize) {
+			ReleaseBorrowedData();
 			Data = (binary *) Buffer;
 			SetSize_(BufferSize);
 			SetValueIsSet();
@@ -77,8 +82,7 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
 		binary *GetBuffer() const {return Data;}
 		
 		void CopyBuffer(const binary *Buffer, const uint32 BufferSize) {
-			if (Data != NULL)
-				free(Data);
+			FreeData();
 			Data = (binary *)malloc(BufferSize * sizeof(binary));
 			memcpy(Data, Buffer, BufferSize);
 			SetSize_(BufferSize);
@@ -93,12 +97,71 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
 
 		bool operator==(const EbmlBinary & ElementToCompare) const;
 
+		/*!
+			\brief true if the data belongs to a buffer provider, not to the element
+			\note data from an EbmlBufferView is read-only
+		*/
+		bool IsBorrowed() const {return Provider != NULL;}
+
 #if defined(EBML_STRICT_API)
 	private:
 #else
 	protected:
 #endif
 		binary *Data; // the binary data inside the element
+		EbmlBufferProvider *Provider; // where Data came from, NULL if it was allocated
+		uint32 BorrowedSize; // the size Data was acquired with, given back to the Provider
+
+	private:
+		void FreeData();
+		void ReleaseBorrowedData();
+};
+
+/*!
+    \class EbmlBufferPool
+    \brief Lends binary elements reusable buffers, so that reading them does not allocate
+
+	Buffers are kept in power of two size classes; a freed buffer is reused by
+	the next element of its class. Buffers over MaxBufferSize are not pooled.
+	Not thread-safe: use one pool per stream being read.
+*/
+class EBML_DLL_API EbmlBufferPool : public EbmlBufferProvider {
+	public:
+		EbmlBufferPool(uint32 MaxBufferSize = 1 << 24, uint32 MaxFreePerSize = 16);
+		virtual ~EbmlBufferPool();
+
+		binary *Acquire(IOCallback & input, uint32 Size, uint32 & SizeRead);
+		void Release(binary *Buffer, uint32 Size);
+
+	protected:
+		static unsigned int SizeClass(uint32 Size);
+
+		std::vector< std::vector<binary *> > FreeBuffers; // by size class
+		uint32 MaxBufferSize;
+		uint32 MaxFreePerSize;
+};
+
+/*!
+    \class EbmlBufferView
+    \brief Lets binary elements point into memory that holds the stream, without copying
+
+	View holds the bytes at stream positions ViewStart to ViewStart + ViewSize,
+	e.g. a memory mapping of the file or the buffer of a MemIOCallback. Elements
+	outside of it are read as usual. The view must stay valid while elements
+	point into it.
+*/
+class EBML_DLL_API EbmlBufferView : public EbmlBufferProvider {
+	public:
+		EbmlBufferView(const binary *aView, uint64 aViewSize, uint64 aViewStart = 0)
+			:View(aView), ViewSize(aViewSize), ViewStart(aViewStart) {}
+
+		binary *Acquire(IOCallback & input, uint32 Size, uint32 & SizeRead);
+		void Release(binary * /* Buffer */, uint32 /* Size */) {}
+
+	protected:
+		const binary *View;
+		uint64 ViewSize;
+		uint64 ViewStart;
 };
 
 END_LIBEBML_NAMESPACE
@@ -92,6 +92,7 @@ DECLARE_EBML_BINARY(EbmlCrc32)
 #endif
 		void ResetCRC();
 		void UpdateByte(binary b);
+		static uint32 UpdateCrc32(uint32 crc, const binary *input, uint32 length);
 
 		static const uint32 m_tab[256];
 		uint32 m_crc;
@@ -34,6 +34,8 @@
 #ifndef LIBEBML_ELEMENT_H
 #define LIBEBML_ELEMENT_H
 
+#include <vector>
+
 #include "EbmlTypes.h"
 #include "EbmlId.h"
 #include "IOCallback.h"
@@ -379,6 +381,24 @@ class EBML_DLL_API EbmlElement {
 		static EbmlElement * FindNextElement(IOCallback & DataStream, const EbmlSemanticContext & Context, int & UpperLevel, uint64 MaxDataSize, bool AllowDummyElt, unsigned int MaxLowerLevel = 1);
 		static EbmlElement * FindNextID(IOCallback & DataStream, const EbmlCallbacks & ClassInfos, uint64 MaxDataSize);
 
+		/*!
+			\brief skip damaged data up to the next element with one of the given IDs
+			\param Ids the IDs to look for, e.g. the top level and cluster level ones of a file
+			\param MaxScanSize number of bytes to look through, 0 for no limit
+			\param MaxEndPosition a candidate whose data would end past this position is rejected, 0 for no limit
+			\param BoundedIds MaxEndPosition only applies to the first BoundedIds of Ids, the others can end anywhere
+			\return true with DataStream at the start of the element, or false with DataStream where the scan stopped
+			\note the data is read in blocks and searched with SIMD compares; a candidate is only kept if its size is valid
+		*/
+		static bool Resync(IOCallback & DataStream, const std::vector<EbmlId> & Ids, uint64 MaxScanSize = 0, uint64 MaxEndPosition = 0, size_t BoundedIds = size_t(-1));
+
+		/*!
+			\brief add the IDs that FindNextElement() can find in a context: its own, its parents' and the global ones
+			\return the size of Ids once the IDs that can be found inside an element of this context (its own and
+			the global ones) are added; the IDs of upper levels come after them
+		*/
+		static size_t GetContextIds(const EbmlSemanticContext & Context, std::vector<EbmlId> & Ids);
+
 		/*!
 			\brief find the next element with the same ID
 		*/
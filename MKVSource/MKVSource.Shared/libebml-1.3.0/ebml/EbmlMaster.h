@@ -52,6 +52,11 @@ START_LIBEBML_NAMESPACE
 
 const bool bChecksumUsedByDefault = false;
 
+/*!
+	\brief masters read with at least this many children get an ID index, see EbmlMaster::EnableIndex()
+*/
+const size_t IndexedChildrenAfterRead = 64;
+
 /*!
     \class EbmlMaster
     \brief Handle all operations on an EBML element that contains other EBML elements
@@ -157,7 +162,20 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
 		/*!
 			\brief remove all elements, even the mandatory ones
 		*/
-		void RemoveAll() {ElementList.clear();}
+		void RemoveAll() {ElementList.clear(); InvalidateIndex();}
+
+		/*!
+			\brief keep an index of the children by ID, so that the Find functions do not scan the list
+			\note the index is built on the first lookup after the list changed; call InvalidateIndex()
+			after changing the list through GetElementList() or the iterators (children added or
+			removed there are noticed, children replaced are not)
+			\note Read() enables and builds the index of masters with IndexedChildrenAfterRead
+			children or more; lookups on a const master that was changed since build it too, so
+			they must not run concurrently
+		*/
+		void EnableIndex(bool bIsEnabled = true) {bIndexEnabled = bIsEnabled; InvalidateIndex();}
+		bool HasIndex() const {return bIndexEnabled;}
+		void InvalidateIndex() {bIndexValid = false;}
 
 		/*!
 			\brief facility for Master elements to write only the head and force the size later
@@ -196,6 +214,25 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
 			\brief Add all the mandatory elements to the list
 		*/
 		bool ProcessMandatory();
+
+		size_t FindPosition(const EbmlId & Id, size_t From) const;
+		size_t FindPosition(const EbmlElement & Elt) const;
+		void BuildIndex() const;
+
+		struct IdIndexEntry {
+			uint64 Id; // length and value of the ID
+			size_t Position;
+			bool operator<(const IdIndexEntry & Other) const {
+				return Id < Other.Id || (Id == Other.Id && Position < Other.Position);
+			}
+		};
+		typedef std::pair<const EbmlElement *, size_t> EltIndexEntry;
+
+		bool bIndexEnabled;
+		mutable bool bIndexValid;
+		mutable size_t IndexedSize; ///< ListSize() when the index was built
+		mutable std::vector<IdIndexEntry> IdIndex; ///< children sorted by ID, then by position
+		mutable std::vector<EltIndexEntry> EltIndex; ///< children sorted by address
 };
 
 ///< \todo add a restriction to only elements legal in the context
@@ -49,6 +49,7 @@ START_LIBEBML_NAMESPACE
   \class UTFstring
   A class storing strings in a wchar_t (ie, in UCS-2 or UCS-4)
   \note inspired by wstring which is not available everywhere
+  \note with a 16 bits wchar_t, characters over U+FFFF are stored as UTF-16 surrogate pairs
 */
 class EBML_DLL_API UTFstring {
 public:
@@ -50,9 +50,12 @@ enum seek_mode
 	,seek_current=SEEK_CUR
 };
 
+class EbmlBufferProvider;
+
 class EBML_DLL_API IOCallback
 {
 public:
+	IOCallback():BufferProvider(NULL){}
 	virtual ~IOCallback(){}
 
 	// The read callback works like most other read functions. You specify the
@@ -92,6 +95,44 @@ public:
 	void writeFully(const void*Buffer,size_t Size);
 
 	template<class STRUCT> void writeStruct(const STRUCT&Struct){writeFully(&Struct,sizeof(Struct));}
+
+	// Binary elements read from this stream take their data from the provider
+	// instead of allocating it, when one is set. The provider must outlive
+	// every element read with it. NULL (the default) turns this off.
+	void SetBufferProvider(EbmlBufferProvider*Provider){BufferProvider=Provider;}
+	EbmlBufferProvider*GetBufferProvider()const{return BufferProvider;}
+
+protected:
+	EbmlBufferProvider*BufferProvider;
+};
+
+/*!
+	\class EbmlBufferProvider
+	\brief Supplies the data of binary elements as they are read
+
+	A provider either lends a buffer it owns (a pool) or points into memory
+	that already holds the stream (a mapped view of the file). The element
+	keeps the buffer until it is destroyed or reads new data, and then hands
+	it back with Release().
+*/
+class EBML_DLL_API EbmlBufferProvider
+{
+public:
+	virtual ~EbmlBufferProvider(){}
+
+	/*!
+		\brief get Size bytes of input, starting at its current position
+		\param SizeRead set to the number of bytes available in the buffer
+		\return the buffer, with input moved past the data, or NULL to let the
+		element allocate and read it itself (input is then left untouched)
+	*/
+	virtual binary*Acquire(IOCallback&input,uint32 Size,uint32&SizeRead)=0;
+
+	/*!
+		\brief take back a buffer returned by Acquire()
+		\param Size the Size it was acquired with
+	*/
+	virtual void Release(binary*Buffer,uint32 Size)=0;
 };
 
 /* cygwin incompatible
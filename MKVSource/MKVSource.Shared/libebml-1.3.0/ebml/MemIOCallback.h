@@ -49,8 +49,20 @@ class EBML_DLL_API MemIOCallback : public IOCallback
 {
 public:
 	MemIOCallback(uint64 DefaultSize = 128);
+	/*!
+		Writes into a buffer that the caller owns, until the data outgrows it;
+		from then on the data lives in memory of its own. The arena must
+		outlive this object, and GetDataBuffer() can point into it.
+	*/
+	MemIOCallback(binary *Arena, uint64 ArenaSize);
 	~MemIOCallback();
 
+	/*!
+		Makes room for at least Size bytes, so that writes up to that size
+		do not reallocate. Returns false if the memory could not be allocated.
+	*/
+	bool reserve(uint64 Size);
+
 	/*!
 		Use this to copy some data to the Buffer from this classes data
 	*/
@@ -111,6 +123,12 @@ protected:
 		Size of the memory malloc()/realloc()
 	*/
 	uint64 dataBufferMemorySize;
+	/*!
+		Is dataBuffer ours to realloc()/free(), or the caller's arena?
+	*/
+	bool dataBufferOwned;
+
+	bool Grow(uint64 MinSize);
 };
 
 END_LIBEBML_NAMESPACE
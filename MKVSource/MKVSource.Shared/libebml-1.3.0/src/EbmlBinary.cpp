@@ -43,11 +43,11 @@
 START_LIBEBML_NAMESPACE
 
 EbmlBinary::EbmlBinary()
- :EbmlElement(0, false), Data(NULL)
+ :EbmlElement(0, false), Data(NULL), Provider(NULL), BorrowedSize(0)
 {}
 
 EbmlBinary::EbmlBinary(const EbmlBinary & ElementToClone)
- :EbmlElement(ElementToClone)
+ :EbmlElement(ElementToClone), Provider(NULL), BorrowedSize(0)
 {
 	if (ElementToClone.Data == NULL)
 		Data = NULL;
@@ -59,8 +59,26 @@ EbmlBinary::EbmlBinary(const EbmlBinary & ElementToClone)
 }
 
 EbmlBinary::~EbmlBinary(void) {
-	if(Data)
+	FreeData();
+}
+
+void EbmlBinary::FreeData()
+{
+	if (Provider != NULL)
+		ReleaseBorrowedData();
+	else if (Data != NULL)
 		free(Data);
+	Data = NULL;
+}
+
+void EbmlBinary::ReleaseBorrowedData()
+{
+	if (Provider != NULL) {
+		// the size may have changed since (ReadData, SetSize_), the provider wants the acquired one
+		Provider->Release(Data, BorrowedSize);
+		Provider = NULL;
+		Data = NULL;
+	}
 }
 
 EbmlBinary::operator const binary &() const {return *Data;}
@@ -83,15 +101,25 @@ uint64 EbmlBinary::UpdateSize(bool /* bWithDefault */, bool /* bForceRender */)
 
 filepos_t EbmlBinary::ReadData(IOCallback & input, ScopeMode ReadFully)
 {
-	if (Data != NULL)
-		free(Data);
+	FreeData();
 	
     if (ReadFully == SCOPE_NO_DATA || !GetSize())
 	{
-		Data = NULL;
 		return GetSize();
 	}
 
+	EbmlBufferProvider *BufferProvider = input.GetBufferProvider();
+	if (BufferProvider != NULL) {
+		uint32 SizeRead;
+		Data = BufferProvider->Acquire(input, uint32(GetSize()), SizeRead);
+		if (Data != NULL) {
+			Provider = BufferProvider;
+			BorrowedSize = uint32(GetSize());
+			SetValueIsSet();
+			return SizeRead;
+		}
+	}
+
 	Data = (binary *)malloc(GetSize());
     if (Data == NULL)
 		throw CRTError(std::string("Error allocating data"));
@@ -104,4 +132,71 @@ bool EbmlBinary::operator==(const EbmlBinary & ElementToCompare) const
 	return ((GetSize() == ElementToCompare.GetSize()) && !memcmp(Data, ElementToCompare.Data, GetSize()));
 }
 
+EbmlBufferPool::EbmlBufferPool(uint32 aMaxBufferSize, uint32 aMaxFreePerSize)
+ :FreeBuffers(SizeClass(aMaxBufferSize) + 1), MaxBufferSize(aMaxBufferSize), MaxFreePerSize(aMaxFreePerSize)
+{}
+
+EbmlBufferPool::~EbmlBufferPool()
+{
+	for (size_t i=0; i<FreeBuffers.size(); i++) {
+		for (size_t j=0; j<FreeBuffers[i].size(); j++)
+			free(FreeBuffers[i][j]);
+	}
+}
+
+/*!
+	\return the smallest n such that Size <= 2^n, with a minimum of 64 bytes
+*/
+unsigned int EbmlBufferPool::SizeClass(uint32 Size)
+{
+	unsigned int Class = 6;
+	while (Class < 32 && (uint64(1) << Class) < Size)
+		Class++;
+	return Class;
+}
+
+binary *EbmlBufferPool::Acquire(IOCallback & input, uint32 Size, uint32 & SizeRead)
+{
+	binary *Buffer;
+	if (Size > MaxBufferSize) {
+		Buffer = (binary *)malloc(Size);
+	} else {
+		std::vector<binary *> & Free = FreeBuffers[SizeClass(Size)];
+		if (!Free.empty()) {
+			Buffer = Free.back();
+			Free.pop_back();
+		} else {
+			Buffer = (binary *)malloc(size_t(1) << SizeClass(Size));
+		}
+	}
+	if (Buffer == NULL)
+		throw CRTError(std::string("Error allocating data"));
+
+	SizeRead = input.read(Buffer, Size);
+	return Buffer;
+}
+
+void EbmlBufferPool::Release(binary *Buffer, uint32 Size)
+{
+	if (Size <= MaxBufferSize) {
+		std::vector<binary *> & Free = FreeBuffers[SizeClass(Size)];
+		if (Free.size() < MaxFreePerSize) {
+			Free.push_back(Buffer);
+			return;
+		}
+	}
+	free(Buffer);
+}
+
+binary *EbmlBufferView::Acquire(IOCallback & input, uint32 Size, uint32 & SizeRead)
+{
+	uint64 Position = input.getFilePointer();
+	if (Position < ViewStart || Position - ViewStart > ViewSize || Size > ViewSize - (Position - ViewStart))
+		return NULL;
+
+	input.setFilePointer(Size, seek_current);
+	SizeRead = Size;
+	return const_cast<binary *>(View + (Position - ViewStart));
+}
+
 END_LIBEBML_NAMESPACE
@@ -48,6 +48,22 @@
 
 const uint32 CRC32_NEGL = 0xffffffffL;
 
+// The carry-less multiply version is only built for x86 and x64; the
+// CPU is checked at run time before it is used. Define EBML_CRC32_NO_CLMUL
+// to always use the tables.
+#if !defined(WORDS_BIGENDIAN) && !defined(EBML_CRC32_NO_CLMUL) && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+# define EBML_CRC32_CLMUL
+# include <emmintrin.h>
+# include <wmmintrin.h>
+# if defined(_MSC_VER)
+#  include <intrin.h>
+#  define CRC32_CLMUL_TARGET
+# else
+#  include <cpuid.h>
+#  define CRC32_CLMUL_TARGET __attribute__((target("pclmul,sse2")))
+# endif
+#endif
+
 START_LIBEBML_NAMESPACE
 
 DEFINE_EBML_CLASS_GLOBAL(EbmlCrc32, 0xBF, 1, "EBMLCrc32\0ratamadabapa");
@@ -162,6 +178,192 @@ const uint32 EbmlCrc32::m_tab[] = {
 #endif
 };
 
+#ifndef WORDS_BIGENDIAN
+/*!
+	\brief Tables for slicing-by-8: Table[k][b] is the CRC of byte b
+	followed by k zero bytes, so that 8 bytes can be looked up at once.
+*/
+class Crc32SliceTables
+{
+	public:
+		Crc32SliceTables()
+		{
+			for (unsigned int b = 0; b < 256; b++) {
+				uint32 crc = b;
+				for (int bit = 0; bit < 8; bit++)
+					crc = (crc >> 1) ^ (0xedb88320L & (0 - (crc & 1)));
+				Table[0][b] = crc;
+			}
+			for (unsigned int b = 0; b < 256; b++) {
+				for (int k = 1; k < 8; k++)
+					Table[k][b] = (Table[k-1][b] >> 8) ^ Table[0][Table[k-1][b] & 0xff];
+			}
+		}
+
+		uint32 Table[8][256];
+};
+
+static const Crc32SliceTables s_slices;
+
+static uint32 UpdateCrc32Slice8(uint32 crc, const binary *input, uint32 length)
+{
+	const uint32 (*tab)[256] = s_slices.Table;
+
+	for(; !IsAligned<uint32>(input) && length > 0; length--)
+		crc = tab[0][(crc ^ *input++) & 0xff] ^ (crc >> 8);
+
+	while (length >= 8)
+	{
+		uint32 one = *(const uint32 *)input ^ crc;
+		uint32 two = *(const uint32 *)(input + 4);
+		crc = tab[7][one & 0xff] ^ tab[6][(one >> 8) & 0xff] ^ tab[5][(one >> 16) & 0xff] ^ tab[4][one >> 24]
+		    ^ tab[3][two & 0xff] ^ tab[2][(two >> 8) & 0xff] ^ tab[1][(two >> 16) & 0xff] ^ tab[0][two >> 24];
+		length -= 8;
+		input += 8;
+	}
+
+	while (length--)
+		crc = tab[0][(crc ^ *input++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+#endif // WORDS_BIGENDIAN
+
+#ifdef EBML_CRC32_CLMUL
+static bool CpuHasClmul()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) != 0;
+#endif
+}
+
+static const bool s_has_clmul = CpuHasClmul();
+
+/*!
+	\brief Folds a multiple of 16 bytes (at least 64) into the CRC with
+	PCLMULQDQ, as in Intel's "Fast CRC Computation for Generic Polynomials
+	Using PCLMULQDQ Instruction". The constants are for the bit-reflected
+	CRC-32 polynomial.
+*/
+CRC32_CLMUL_TARGET
+static uint32 UpdateCrc32Clmul(uint32 crc, const binary *input, uint32 length)
+{
+	const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+	const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+	const __m128i k5k0 = _mm_set_epi32(0x00000000, 0x00000000, 0x00000001, 0x63cd6124);
+	const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+	const __m128i mask32 = _mm_set_epi32(0, -1, 0, -1);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(input + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(input + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(input + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i *)(input + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	input += 64;
+	length -= 64;
+
+	// Four lanes of 16 bytes each, folded 64 bytes forward at a time
+	while (length >= 64)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(input + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(input + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(input + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(input + 0x30)));
+		input += 64;
+		length -= 64;
+	}
+
+	// Fold the four lanes into one
+	__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Then the remaining blocks of 16 bytes
+	while (length >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)input)), x5);
+		input += 16;
+		length -= 16;
+	}
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif // EBML_CRC32_CLMUL
+
+/*!
+	\brief Adds data to a running (not yet inverted) CRC, with the fastest
+	method the CPU has.
+*/
+uint32 EbmlCrc32::UpdateCrc32(uint32 crc, const binary *input, uint32 length)
+{
+#ifdef EBML_CRC32_CLMUL
+	if (s_has_clmul && length >= 64) {
+		uint32 folded = length & ~15;
+		crc = UpdateCrc32Clmul(crc, input, folded);
+		input += folded;
+		length -= folded;
+	}
+#endif
+#ifdef WORDS_BIGENDIAN
+	for(; !IsAligned<uint32>(input) && length > 0; length--)
+		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+
+	while (length >= 4)
+	{
+		crc ^= *(const uint32 *)input;
+		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+		length -= 4;
+		input += 4;
+	}
+
+	while (length--)
+		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+
+	return crc;
+#else
+	return UpdateCrc32Slice8(crc, input, length);
+#endif
+}
+
 EbmlCrc32::EbmlCrc32()
 {
 	ResetCRC();
@@ -252,24 +454,7 @@ filepos_t EbmlCrc32::ReadData(IOCallback & input, ScopeMode ReadFully)
 
 bool EbmlCrc32::CheckCRC(uint32 inputCRC, const binary *input, uint32 length)
 {
-	uint32 crc = CRC32_NEGL;
-
-	for(; !IsAligned<uint32>(input) && length > 0; length--)
-		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-	while (length >= 4)
-	{
-		crc ^= *(const uint32 *)input;
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		length -= 4;
-		input += 4;
-	}
-
-	while (length--)
-		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+	uint32 crc = UpdateCrc32(CRC32_NEGL, input, length);
 
 	//Now we finalize the CRC32
 	crc ^= CRC32_NEGL;
@@ -316,26 +501,7 @@ void EbmlCrc32::FillCRC32(const binary *s, uint32 n)
 
 void EbmlCrc32::Update(const binary *input, uint32 length)
 {
-	uint32 crc = m_crc;
-
-	for(; !IsAligned<uint32>(input) && length > 0; length--)
-		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-	while (length >= 4)
-	{
-		crc ^= *(const uint32 *)input;
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-		length -= 4;
-		input += 4;
-	}
-
-	while (length--)
-		crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-	m_crc = crc;
+	m_crc = UpdateCrc32(m_crc, input, length);
 }
 
 void EbmlCrc32::Finalize()
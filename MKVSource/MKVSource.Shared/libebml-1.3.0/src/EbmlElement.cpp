@@ -34,6 +34,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <algorithm>
 
 #include "ebml/EbmlElement.h"
 #include "ebml/EbmlMaster.h"
@@ -42,8 +43,21 @@
 #include "ebml/EbmlDummy.h"
 #include "ebml/EbmlContexts.h"
 
+// SSE2 is always there on x64; 32 bits x86 builds use it when the compiler
+// targets it.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+# define EBML_RESYNC_SSE2
+# include <emmintrin.h>
+#endif
+
 START_LIBEBML_NAMESPACE
 
+// Resync() reads this much at first, and doubles it up to RESYNC_MAX_BLOCK
+// while nothing is found, so that a nearby element does not cost a big read.
+static const size_t RESYNC_FIRST_BLOCK = 256;
+static const size_t RESYNC_MAX_BLOCK = 64 * 1024;
+static const size_t RESYNC_MAX_HEAD = 4 + 8; // longest ID and coded size
+
 /*!
 	\todo handle more than CodedSize of 5
 */
@@ -346,6 +360,33 @@ EbmlElement * EbmlElement::FindNextID(IOCallback & DataStream, const EbmlCallbac
 }
 
 
+/*!
+	\brief FindNextElement() is out of sync and only known elements can be found:
+	look for their IDs a block at a time instead of trying each byte in turn
+	\param InnerIds number of KnownIds that are found inside the parent, see GetContextIds()
+	\param Buffered bytes already read after the position where the search starts
+	\param SearchStart position where FindNextElement() started, MaxDataSize is counted from there
+	\param ReadSize bytes read by FindNextElement(), updated to the new position
+	\note a candidate that belongs inside the parent (an ID of Context or a global one) must end
+	within MaxDataSize, like the parent; the IDs of the parent's level and above are not bounded
+*/
+static bool ResyncToContext(IOCallback & DataStream, const EbmlSemanticContext & Context, std::vector<EbmlId> & KnownIds, size_t & InnerIds,
+			int Buffered, uint64 SearchStart, uint64 MaxDataSize, uint32 & ReadSize)
+{
+	if (KnownIds.empty())
+		InnerIds = EbmlElement::GetContextIds(Context, KnownIds);
+
+	uint64 ScanStart = DataStream.getFilePointer() - Buffered;
+	DataStream.setFilePointer(ScanStart);
+	// no bound when the end is past what a position can hold (MaxDataSize set to "anything")
+	uint64 MaxEndPosition = (MaxDataSize <= ~uint64(0) - SearchStart) ? SearchStart + MaxDataSize : 0;
+	if (!EbmlElement::Resync(DataStream, KnownIds, MaxDataSize - (ReadSize - Buffered), MaxEndPosition, InnerIds))
+		return false;
+
+	ReadSize += uint32(DataStream.getFilePointer() - ScanStart) - Buffered;
+	return true;
+}
+
 /*!
 	\todo replace the new RawElement with the appropriate class (when known)
 	\todo skip data for Dummy elements when they are not allowed
@@ -365,6 +406,10 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
 	int SizeIdx;
 	bool bFound;
 	int UpperLevel_original = UpperLevel;
+	std::vector<EbmlId> KnownIds;
+	size_t InnerIds = 0;
+	// MaxDataSize counts from here
+	const uint64 SearchStart = DataStream.getFilePointer();
 
 	do {
 		// read a potential ID
@@ -388,8 +433,15 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
 
 			if (ReadIndex >= 4) {
 				// ID not found
-				// shift left the read octets
-				memmove(&PossibleIdNSize[0],&PossibleIdNSize[1], --ReadIndex);
+				if (!AllowDummyElt && MaxDataSize > ReadSize - (ReadIndex - 1)) {
+					// unlike the byte scan, the resync skips candidates of this level that end past MaxDataSize
+					if (!ResyncToContext(DataStream, Context, KnownIds, InnerIds, ReadIndex - 1, SearchStart, MaxDataSize, ReadSize))
+						return NULL;
+					ReadIndex = 0;
+				} else {
+					// shift left the read octets
+					memmove(&PossibleIdNSize[0],&PossibleIdNSize[1], --ReadIndex);
+				}
 			}
 
 			if (DataStream.read(&PossibleIdNSize[ReadIndex++], 1) == 0) {
@@ -456,11 +508,156 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
 		ReadIndex = SizeIdx - 1;
 		memmove(&PossibleIdNSize[0], &PossibleIdNSize[1], ReadIndex);
 		UpperLevel = UpperLevel_original;
-	} while ( MaxDataSize > DataStream.getFilePointer() - SizeIdx + PossibleID_Length );
+
+		if (!AllowDummyElt && MaxDataSize > ReadSize - ReadIndex && MaxDataSize > DataStream.getFilePointer() - SearchStart - SizeIdx + PossibleID_Length) {
+			// unlike the byte scan, the resync skips candidates of this level that end past MaxDataSize
+			if (!ResyncToContext(DataStream, Context, KnownIds, InnerIds, ReadIndex, SearchStart, MaxDataSize, ReadSize))
+				return NULL;
+			ReadIndex = 0;
+			SizeIdx = 0;
+			PossibleID_Length = 0;
+		}
+	} while ( MaxDataSize > DataStream.getFilePointer() - SearchStart - SizeIdx + PossibleID_Length );
 
 	return NULL;
 }
 
+/*!
+	\return the position of the first byte of Buffer[From, To) that is in FirstBytes, To if there is none
+*/
+static size_t FindFirstByte(const binary * Buffer, size_t From, size_t To, const bool IsFirstByte[256], const binary * FirstBytes, size_t FirstCount)
+{
+#ifdef EBML_RESYNC_SSE2
+	if (FirstCount <= 16) {
+		__m128i Wanted[16];
+		for (size_t i = 0; i < FirstCount; i++)
+			Wanted[i] = _mm_set1_epi8(char(FirstBytes[i]));
+		for (; To - From >= 16; From += 16) {
+			__m128i Block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Buffer + From));
+			__m128i Match = _mm_cmpeq_epi8(Block, Wanted[0]);
+			for (size_t i = 1; i < FirstCount; i++)
+				Match = _mm_or_si128(Match, _mm_cmpeq_epi8(Block, Wanted[i]));
+			unsigned int Mask = _mm_movemask_epi8(Match);
+			if (Mask != 0) {
+				while ((Mask & 1) == 0) {
+					Mask >>= 1;
+					From++;
+				}
+				return From;
+			}
+		}
+	}
+#endif
+	for (; From < To; From++) {
+		if (IsFirstByte[Buffer[From]])
+			return From;
+	}
+	return To;
+}
+
+bool EbmlElement::Resync(IOCallback & DataStream, const std::vector<EbmlId> & Ids, uint64 MaxScanSize, uint64 MaxEndPosition, size_t BoundedIds)
+{
+	if (Ids.empty())
+		return false;
+
+	bool IsFirstByte[256];
+	binary FirstBytes[16];
+	size_t FirstCount = 0;
+	memset(IsFirstByte, 0, sizeof(IsFirstByte));
+	for (size_t i = 0; i < Ids.size(); i++) {
+		binary FirstByte = binary(Ids[i].GetValue() >> (8 * (Ids[i].GetLength() - 1)));
+		if (!IsFirstByte[FirstByte]) {
+			IsFirstByte[FirstByte] = true;
+			if (FirstCount < 16)
+				FirstBytes[FirstCount] = FirstByte;
+			FirstCount++;
+		}
+	}
+
+	std::vector<binary> Buffer(RESYNC_FIRST_BLOCK);
+	uint64 BufferPosition = DataStream.getFilePointer(); // stream position of Buffer[0]
+	// no limit either when the end is past what a position can hold
+	const uint64 ScanEnd = (MaxScanSize != 0 && MaxScanSize <= ~uint64(0) - BufferPosition) ? BufferPosition + MaxScanSize : 0;
+	size_t Filled = 0;
+	bool AtEnd = false;
+
+	for (;;) {
+		size_t Wanted = Buffer.size() - Filled;
+		size_t Got = DataStream.read(&Buffer[Filled], Wanted);
+		AtEnd = (Got < Wanted);
+		Filled += Got;
+
+		// candidates whose head may not be all in the buffer wait for the next block
+		size_t Limit = AtEnd ? Filled : (Filled > RESYNC_MAX_HEAD ? Filled - RESYNC_MAX_HEAD : 0);
+		if (ScanEnd != 0 && BufferPosition + Limit >= ScanEnd) {
+			Limit = size_t(ScanEnd - BufferPosition);
+			AtEnd = true;
+		}
+
+		for (size_t Pos = FindFirstByte(&Buffer[0], 0, Limit, IsFirstByte, FirstBytes, FirstCount); Pos < Limit;
+			Pos = FindFirstByte(&Buffer[0], Pos + 1, Limit, IsFirstByte, FirstBytes, FirstCount)) {
+			for (size_t i = 0; i < Ids.size(); i++) {
+				size_t IdLength = Ids[i].GetLength();
+				if (Pos + IdLength >= Filled || EbmlId(&Buffer[Pos], IdLength) != Ids[i])
+					continue;
+
+				// the size must be coded on 1 to 8 bytes and fit in the limit
+				uint32 SizeLength = uint32(std::min<size_t>(Filled - Pos - IdLength, 8));
+				uint64 SizeUnknown;
+				uint64 SizeFound = ReadCodedSizeValue(&Buffer[Pos + IdLength], SizeLength, SizeUnknown);
+				if (SizeLength == 0)
+					continue;
+				if (MaxEndPosition != 0 && i < BoundedIds && SizeFound != SizeUnknown && BufferPosition + Pos + IdLength + SizeLength + SizeFound > MaxEndPosition)
+					continue;
+
+				DataStream.setFilePointer(BufferPosition + Pos);
+				return true;
+			}
+		}
+
+		if (AtEnd) {
+			DataStream.setFilePointer(BufferPosition + Limit);
+			return false;
+		}
+
+		// keep what was not searched and read a bigger block after it
+		memmove(&Buffer[0], &Buffer[Limit], Filled - Limit);
+		BufferPosition += Limit;
+		Filled -= Limit;
+		if (Buffer.size() < RESYNC_MAX_BLOCK)
+			Buffer.resize(Buffer.size() * 2);
+	}
+}
+
+static void AddContextId(std::vector<EbmlId> & Ids, const EbmlId & Id)
+{
+	if (std::find(Ids.begin(), Ids.end(), Id) == Ids.end())
+		Ids.push_back(Id);
+}
+
+size_t EbmlElement::GetContextIds(const EbmlSemanticContext & Context, std::vector<EbmlId> & Ids)
+{
+	size_t InnerIds = 0;
+	for (const EbmlSemanticContext * Ctx = &Context; Ctx != NULL; Ctx = EBML_CTX_PARENT(*Ctx)) {
+		unsigned int EltIdx;
+		for (EltIdx = 0; EltIdx < EBML_CTX_SIZE(*Ctx); EltIdx++)
+			AddContextId(Ids, EBML_CTX_IDX_ID(*Ctx, EltIdx));
+
+		const EbmlSemanticContext & GlobalContext = Ctx->GetGlobalContext();
+		if (GlobalContext != *Ctx) {
+			for (EltIdx = 0; EltIdx < EBML_CTX_SIZE(GlobalContext); EltIdx++)
+				AddContextId(Ids, EBML_CTX_IDX_ID(GlobalContext, EltIdx));
+		}
+
+		if (Ctx == &Context)
+			InnerIds = Ids.size();
+
+		if (EBML_CTX_MASTER(*Ctx) != NULL)
+			AddContextId(Ids, EBML_INFO_ID(*EBML_CTX_MASTER(*Ctx)));
+	}
+	return InnerIds;
+}
+
 /*!
 	\todo what happens if we are in a upper element with a known size ?
 */
@@ -46,6 +46,7 @@ START_LIBEBML_NAMESPACE
 
 EbmlMaster::EbmlMaster(const EbmlSemanticContext & aContext, bool bSizeIsknown)
  :EbmlElement(0), Context(aContext), bChecksumUsed(bChecksumUsedByDefault)
+ ,bIndexEnabled(false), bIndexValid(false), IndexedSize(0)
 {
 	SetSizeIsFinite(bSizeIsknown);
 	SetValueIsSet();
@@ -58,6 +59,9 @@ EbmlMaster::EbmlMaster(const EbmlMaster & ElementToClone)
  ,Context(ElementToClone.Context)
  ,bChecksumUsed(ElementToClone.bChecksumUsed)
  ,Checksum(ElementToClone.Checksum)
+ ,bIndexEnabled(ElementToClone.bIndexEnabled)
+ ,bIndexValid(false)
+ ,IndexedSize(0)
 {
 	// add a clone of the list
 	std::vector<EbmlElement *>::const_iterator Itr = ElementToClone.ElementList.begin();
@@ -124,6 +128,7 @@ filepos_t EbmlMaster::RenderData(IOCallback & output, bool bForceRender, bool bW
 bool EbmlMaster::PushElement(EbmlElement & element)
 {
 	ElementList.push_back(&element);
+	InvalidateIndex();
 	return true;
 }
 
@@ -260,27 +265,93 @@ std::vector<std::string> EbmlMaster::FindAllMissingElements()
 	return missingElements;
 }
 
-EbmlElement *EbmlMaster::FindElt(const EbmlCallbacks & Callbacks) const
+/*!
+	\return the position of the first child with the ID at or after From, ListSize() if there is none
+*/
+size_t EbmlMaster::FindPosition(const EbmlId & Id, size_t From) const
 {
-	size_t Index;
-	
-	for (Index = 0; Index < ElementList.size(); Index++) {
-		EbmlElement * tmp = ElementList[Index];
-		if (EbmlId(*tmp) == EBML_INFO_ID(Callbacks))
-			return tmp;
+	if (!bIndexEnabled) {
+		for (; From < ElementList.size(); From++) {
+			if (ElementList[From] && EbmlId(*ElementList[From]) == Id)
+				return From;
+		}
+		return ElementList.size();
+	}
+
+	if (!bIndexValid || IndexedSize != ElementList.size())
+		BuildIndex();
+
+	IdIndexEntry Wanted;
+	Wanted.Id = (uint64(Id.GetLength()) << 32) | Id.GetValue();
+	Wanted.Position = From;
+	std::vector<IdIndexEntry>::const_iterator Itr = std::lower_bound(IdIndex.begin(), IdIndex.end(), Wanted);
+	if (Itr != IdIndex.end() && Itr->Id == Wanted.Id)
+		return Itr->Position;
+	return ElementList.size();
+}
+
+/*!
+	\return the position of the child, ListSize() if it is not in the list
+*/
+size_t EbmlMaster::FindPosition(const EbmlElement & Elt) const
+{
+	if (!bIndexEnabled) {
+		size_t Index;
+		for (Index = 0; Index < ElementList.size(); Index++) {
+			if (ElementList[Index] == &Elt)
+				break;
+		}
+		return Index;
 	}
 
+	if (!bIndexValid || IndexedSize != ElementList.size())
+		BuildIndex();
+
+	std::vector<EltIndexEntry>::const_iterator Itr = std::lower_bound(EltIndex.begin(), EltIndex.end(), EltIndexEntry(&Elt, 0));
+	if (Itr != EltIndex.end() && Itr->first == &Elt)
+		return Itr->second;
+	return ElementList.size();
+}
+
+void EbmlMaster::BuildIndex() const
+{
+	IdIndex.clear();
+	EltIndex.clear();
+	IdIndex.reserve(ElementList.size());
+	EltIndex.reserve(ElementList.size());
+
+	for (size_t Index = 0; Index < ElementList.size(); Index++) {
+		const EbmlElement *Elt = ElementList[Index];
+		if (Elt == NULL)
+			continue;
+		const EbmlId Id(*Elt);
+		IdIndexEntry Entry;
+		Entry.Id = (uint64(Id.GetLength()) << 32) | Id.GetValue();
+		Entry.Position = Index;
+		IdIndex.push_back(Entry);
+		EltIndex.push_back(EltIndexEntry(Elt, Index));
+	}
+
+	std::sort(IdIndex.begin(), IdIndex.end());
+	std::sort(EltIndex.begin(), EltIndex.end());
+	IndexedSize = ElementList.size();
+	bIndexValid = true;
+}
+
+EbmlElement *EbmlMaster::FindElt(const EbmlCallbacks & Callbacks) const
+{
+	size_t Index = FindPosition(EBML_INFO_ID(Callbacks), 0);
+	if (Index != ElementList.size())
+		return ElementList[Index];
+
 	return NULL;
 }
 
 EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks, bool bCreateIfNull)
 {
-	size_t Index;
-	
-	for (Index = 0; Index < ElementList.size(); Index++) {
-		if (ElementList[Index] && EbmlId(*(ElementList[Index])) == EBML_INFO_ID(Callbacks))
-			return ElementList[Index];
-	}
+	size_t Index = FindPosition(EBML_INFO_ID(Callbacks), 0);
+	if (Index != ElementList.size())
+		return ElementList[Index];
 	
 	if (bCreateIfNull) {
 		// add the element
@@ -300,12 +371,9 @@ EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks, bool bCre
 
 EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks) const
 {
-	size_t Index;
-	
-	for (Index = 0; Index < ElementList.size(); Index++) {
-		if (EbmlId(*(ElementList[Index])) == EBML_INFO_ID(Callbacks))
-			return ElementList[Index];
-	}
+	size_t Index = FindPosition(EBML_INFO_ID(Callbacks), 0);
+	if (Index != ElementList.size())
+		return ElementList[Index];
 	
 	return NULL;
 }
@@ -316,20 +384,10 @@ EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks) const
 */
 EbmlElement *EbmlMaster::FindNextElt(const EbmlElement & PastElt, bool bCreateIfNull)
 {
-	size_t Index;
-	
-	for (Index = 0; Index < ElementList.size(); Index++) {
-		if ((ElementList[Index]) == &PastElt) {
-			// found past element, new one is :
-			Index++;
-			break;
-		}
-	}
-
-	while (Index < ElementList.size()) {
-		if ((EbmlId)PastElt == (EbmlId)(*ElementList[Index]))
-			break;
-		Index++;
+	size_t Index = FindPosition(PastElt);
+	if (Index != ElementList.size()) {
+		// found past element, new one is :
+		Index = FindPosition(EbmlId(PastElt), Index + 1);
 	}
 
 	if (Index != ElementList.size())
@@ -353,21 +411,14 @@ EbmlElement *EbmlMaster::FindNextElt(const EbmlElement & PastElt, bool bCreateIf
 
 EbmlElement *EbmlMaster::FindNextElt(const EbmlElement & PastElt) const
 {
-	size_t Index;
-	
-	for (Index = 0; Index < ElementList.size(); Index++) {
-		if ((ElementList[Index]) == &PastElt) {
-			// found past element, new one is :
-			Index++;
-			break;
-		}
+	size_t Index = FindPosition(PastElt);
+	if (Index != ElementList.size()) {
+		// found past element, new one is :
+		Index = FindPosition(EbmlId(PastElt), Index + 1);
 	}
 
-	while (Index < ElementList.size()) {
-		if ((EbmlId)PastElt == (EbmlId)(*ElementList[Index]))
-			return ElementList[Index];
-		Index++;
-	}
+	if (Index != ElementList.size())
+		return ElementList[Index];
 
 	return NULL;
 }
@@ -389,6 +440,7 @@ EbmlElement *EbmlMaster::AddNewElt(const EbmlCallbacks & Callbacks)
 void EbmlMaster::Sort()
 {
 	std::sort(ElementList.begin(), ElementList.end(), EbmlElement::CompareElements);
+	InvalidateIndex();
 }
 
 /*!
@@ -409,6 +461,7 @@ void EbmlMaster::Read(EbmlStream & inDataStream, const EbmlSemanticContext & sCo
 			}
 		}
 		ElementList.clear();
+		InvalidateIndex();
 		uint64 MaxSizeToRead;
 
 		if (IsFiniteSize())
@@ -477,6 +530,13 @@ void EbmlMaster::Read(EbmlStream & inDataStream, const EbmlSemanticContext & sCo
 		    delete *CrcItr;
 		    Remove(CrcItr);
         }
+		InvalidateIndex();
+		// large masters (Cues, Tags, clusters) are the ones looked up the
+		// most: index them now, so that const lookups find it built
+		if (ElementList.size() >= IndexedChildrenAfterRead) {
+			bIndexEnabled = true;
+			BuildIndex();
+		}
 		SetValueIsSet();
 	}
 }
@@ -490,17 +550,20 @@ void EbmlMaster::Remove(size_t Index)
 		}
 
 		ElementList.erase(Itr);
+		InvalidateIndex();
 	}
 }
 
 void EbmlMaster::Remove(EBML_MASTER_ITERATOR & Itr)
 {
 	ElementList.erase(Itr);
+	InvalidateIndex();
 }
 
 void EbmlMaster::Remove(EBML_MASTER_RITERATOR & Itr)
 {
 	ElementList.erase(Itr.base());
+	InvalidateIndex();
 }
 
 bool EbmlMaster::VerifyChecksum() const
@@ -530,6 +593,7 @@ bool EbmlMaster::InsertElement(EbmlElement & element, size_t position)
 		return false;
 
 	ElementList.insert(Itr, &element);
+	InvalidateIndex();
 	return true;
 }
 
@@ -544,6 +608,7 @@ bool EbmlMaster::InsertElement(EbmlElement & element, const EbmlElement & before
 		return false;
 
 	ElementList.insert(Itr, &element);
+	InvalidateIndex();
 	return true;
 }
 
@@ -36,6 +36,7 @@
 */
 
 #include <cassert>
+#include <cstring>
 
 #if __GNUC__ == 2 && ! defined ( __OpenBSD__ )
 #include <wchar.h>
@@ -43,8 +44,99 @@
 
 #include "ebml/EbmlUnicodeString.h"
 
+// SSE2 is always there on x64; 32 bits x86 builds use it when the compiler
+// targets it.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+# define EBML_UTF_SSE2
+# include <emmintrin.h>
+#endif
+
 START_LIBEBML_NAMESPACE
 
+/*!
+	\brief copy the ASCII characters at the start of Src to Dst, a block at a time
+	\return the number of characters copied, possibly 0; the rest is left to the caller
+*/
+static size_t WidenASCII(const uint8 *Src, size_t Count, wchar_t *Dst)
+{
+	size_t Done = 0;
+#ifdef EBML_UTF_SSE2
+	const __m128i Zero = _mm_setzero_si128();
+	for (; Count - Done >= 16; Done += 16) {
+		__m128i Bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + Done));
+		if (_mm_movemask_epi8(Bytes) != 0)
+			break;
+		__m128i Lo = _mm_unpacklo_epi8(Bytes, Zero);
+		__m128i Hi = _mm_unpackhi_epi8(Bytes, Zero);
+		__m128i *Out = reinterpret_cast<__m128i *>(Dst + Done);
+		if (sizeof(wchar_t) == 2) {
+			_mm_storeu_si128(Out, Lo);
+			_mm_storeu_si128(Out + 1, Hi);
+		} else {
+			_mm_storeu_si128(Out, _mm_unpacklo_epi16(Lo, Zero));
+			_mm_storeu_si128(Out + 1, _mm_unpackhi_epi16(Lo, Zero));
+			_mm_storeu_si128(Out + 2, _mm_unpacklo_epi16(Hi, Zero));
+			_mm_storeu_si128(Out + 3, _mm_unpackhi_epi16(Hi, Zero));
+		}
+	}
+#else
+	for (; Count - Done >= 8; Done += 8) {
+		uint64 Bytes;
+		memcpy(&Bytes, Src + Done, 8);
+		if ((Bytes & EBML_PRETTYLONGINT(0x8080808080808080)) != 0)
+			break;
+		for (size_t i=0; i<8; i++)
+			Dst[Done + i] = Src[Done + i];
+	}
+#endif
+	return Done;
+}
+
+/*!
+	\brief copy the ASCII characters at the start of Src to Dst as bytes, a block at a time
+	\return the number of characters copied, possibly 0; the rest is left to the caller
+*/
+static size_t NarrowASCII(const wchar_t *Src, size_t Count, uint8 *Dst)
+{
+	size_t Done = 0;
+#ifdef EBML_UTF_SSE2
+	const __m128i Zero = _mm_setzero_si128();
+	for (; Count - Done >= 16; Done += 16) {
+		const __m128i *In = reinterpret_cast<const __m128i *>(Src + Done);
+		__m128i Bytes;
+		if (sizeof(wchar_t) == 2) {
+			__m128i A = _mm_loadu_si128(In);
+			__m128i B = _mm_loadu_si128(In + 1);
+			__m128i High = _mm_and_si128(_mm_or_si128(A, B), _mm_set1_epi16(short(0xFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(High, Zero)) != 0xFFFF)
+				break;
+			Bytes = _mm_packus_epi16(A, B);
+		} else {
+			__m128i A = _mm_loadu_si128(In);
+			__m128i B = _mm_loadu_si128(In + 1);
+			__m128i C = _mm_loadu_si128(In + 2);
+			__m128i D = _mm_loadu_si128(In + 3);
+			__m128i High = _mm_and_si128(_mm_or_si128(_mm_or_si128(A, B), _mm_or_si128(C, D)), _mm_set1_epi32(int(0xFFFFFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(High, Zero)) != 0xFFFF)
+				break;
+			Bytes = _mm_packus_epi16(_mm_packs_epi32(A, B), _mm_packs_epi32(C, D));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + Done), Bytes);
+	}
+#else
+	for (; Count - Done >= 8; Done += 8) {
+		uint32 High = 0;
+		for (size_t i=0; i<8; i++)
+			High |= uint32(Src[Done + i]);
+		if (High >= 0x80)
+			break;
+		for (size_t i=0; i<8; i++)
+			Dst[Done + i] = uint8(Src[Done + i]);
+	}
+#endif
+	return Done;
+}
+
 // ===================== UTFstring class ===================
 
 UTFstring::UTFstring()
@@ -75,12 +167,24 @@ UTFstring::UTFstring(const UTFstring & _aBuf)
 	:_Length(0)
 	,_Data(NULL)
 {
-	*this = _aBuf.c_str();
+	*this = _aBuf;
 }
 
 UTFstring & UTFstring::operator=(const UTFstring & _aBuf)
 {
-	*this = _aBuf.c_str();
+	if (this == &_aBuf)
+		return *this;
+
+	// both forms are already there, no need to convert again
+	delete [] _Data;
+	_Length = _aBuf._Length;
+	if (_aBuf._Data == NULL) {
+		_Data = NULL;
+	} else {
+		_Data = new wchar_t[_Length+1];
+		memcpy(_Data, _aBuf._Data, (_Length+1) * sizeof(wchar_t));
+	}
+	UTF8string = _aBuf.UTF8string;
 	return *this;
 }
 
@@ -93,6 +197,7 @@ UTFstring & UTFstring::operator=(const wchar_t * _aBuf)
 	if (_aBuf == NULL) {
 		_Data = new wchar_t[1];
 		_Data[0] = 0;
+		_Length = 0;
 		UpdateFromUCS2();
 		return *this;
 	}
@@ -101,10 +206,7 @@ UTFstring & UTFstring::operator=(const wchar_t * _aBuf)
 	for (aLen=0; _aBuf[aLen] != 0; aLen++);
 	_Length = aLen;
 	_Data = new wchar_t[_Length+1];
-	for (aLen=0; _aBuf[aLen] != 0; aLen++) {
-		_Data[aLen] = _aBuf[aLen];
-	}
-	_Data[aLen] = 0;
+	memcpy(_Data, _aBuf, (_Length+1) * sizeof(wchar_t));
 	UpdateFromUCS2();
 	return *this;
 }
@@ -136,82 +238,113 @@ void UTFstring::SetUTF8(const std::string & _aStr)
 }
 
 /*!
-	\see RFC 2279
+	\see RFC 3629
+	\note the conversion stops at the first invalid sequence
 */
 void UTFstring::UpdateFromUTF8()
 {
 	delete [] _Data;
-	// find the size of the final UCS-2 string
-	size_t i;
-	for (_Length=0, i=0; i<UTF8string.length(); _Length++) {
-		uint8 lead = static_cast<uint8>(UTF8string[i]);
-		if (lead < 0x80)
-			i++;
-		else if ((lead >> 5) == 0x6)
-			i += 2;
-		else if ((lead >> 4) == 0xe)
-			i += 3;
-		else if ((lead >> 3) == 0x1e)
-			i += 4;
-		else
-			// Invalid size?
-			break;
-	}
-	_Data = new wchar_t[_Length+1];
-	size_t j;
-	for (j=0, i=0; i<UTF8string.length(); j++) {
-		uint8 lead = static_cast<uint8>(UTF8string[i]);
+	const uint8 *Src = reinterpret_cast<const uint8 *>(UTF8string.data());
+	size_t Size = UTF8string.length();
+	// no character takes more wchar_t than UTF-8 bytes, so one pass will do
+	_Data = new wchar_t[Size+1];
+	size_t i = 0, j = 0;
+	while (i < Size) {
+		uint8 lead = Src[i];
 		if (lead < 0x80) {
-			_Data[j] = lead;
-			i++;
-		} else if ((lead >> 5) == 0x6) {
-			_Data[j] = ((lead & 0x1F) << 6) + (UTF8string[i+1] & 0x3F);
-			i += 2;
+			size_t Run = WidenASCII(&Src[i], Size - i, &_Data[j]);
+			if (Run == 0) {
+				_Data[j++] = lead;
+				Run = 1;
+			} else {
+				j += Run;
+			}
+			i += Run;
+			continue;
+		}
+
+		size_t CharSize;
+		uint32 Char;
+		if ((lead >> 5) == 0x6) {
+			CharSize = 2;
+			Char = lead & 0x1F;
 		} else if ((lead >> 4) == 0xe) {
-			_Data[j] = ((lead & 0x0F) << 12) + ((UTF8string[i+1] & 0x3F) << 6) + (UTF8string[i+2] & 0x3F);
-			i += 3;
+			CharSize = 3;
+			Char = lead & 0x0F;
 		} else if ((lead >> 3) == 0x1e) {
-			_Data[j] = ((lead & 0x07) << 18) + ((UTF8string[i+1] & 0x3F) << 12) + ((UTF8string[i+2] & 0x3F) << 6) + (UTF8string[i+3] & 0x3F);
-			i += 4;
+			CharSize = 4;
+			Char = lead & 0x07;
 		} else
+			// Invalid size?
+			break;
+		if (Size - i < CharSize)
+			break;
+		size_t k;
+		for (k=1; k<CharSize && (Src[i+k] & 0xC0) == 0x80; k++)
+			Char = (Char << 6) | (Src[i+k] & 0x3F);
+		if (k != CharSize || Char > 0x10FFFF)
 			// Invalid char?
 			break;
+		i += CharSize;
+
+		if (sizeof(wchar_t) == 2 && Char >= 0x10000) {
+			Char -= 0x10000;
+			_Data[j++] = wchar_t(0xD800 | (Char >> 10));
+			_Data[j++] = wchar_t(0xDC00 | (Char & 0x3FF));
+		} else {
+			_Data[j++] = wchar_t(Char);
+		}
 	}
 	_Data[j] = 0;
+	_Length = j;
 }
 
 void UTFstring::UpdateFromUCS2()
 {
-	// find the size of the final UTF-8 string
-	size_t i,Size=0;
-	for (i=0; i<_Length; i++)
-	{
-		if (_Data[i] < 0x80) {
-			Size++;
-		} else if (_Data[i] < 0x800) {
-			Size += 2;
-		} else {
-			Size += 3;
+	// the UTF-8 string is at most 3 bytes per UTF-16 unit (a surrogate pair
+	// gives 4 bytes) or 4 bytes per UCS-4 character, so one pass will do
+	UTF8string.resize(_Length * (sizeof(wchar_t) == 2 ? 3 : 4));
+	if (_Length == 0)
+		return;
+
+	uint8 *Dst = reinterpret_cast<uint8 *>(&UTF8string[0]);
+	size_t i = 0, Size = 0;
+	while (i < _Length) {
+		uint32 Char = uint32(_Data[i]);
+		if (Char < 0x80) {
+			size_t Run = NarrowASCII(&_Data[i], _Length - i, &Dst[Size]);
+			if (Run == 0) {
+				Dst[Size++] = uint8(Char);
+				Run = 1;
+			} else {
+				Size += Run;
+			}
+			i += Run;
+			continue;
 		}
-	}
-	std::string::value_type *tmpStr = new std::string::value_type[Size+1];
-	for (i=0, Size=0; i<_Length; i++)
-	{
-		if (_Data[i] < 0x80) {
-			tmpStr[Size++] = _Data[i];
-		} else if (_Data[i] < 0x800) {
-			tmpStr[Size++] = 0xC0 | (_Data[i] >> 6);
-			tmpStr[Size++] = 0x80 | (_Data[i] & 0x3F);
+		i++;
+
+		if (Char < 0x800) {
+			Dst[Size++] = uint8(0xC0 | (Char >> 6));
+			Dst[Size++] = uint8(0x80 | (Char & 0x3F));
+		} else if (sizeof(wchar_t) == 2 && (Char & 0xFC00) == 0xD800 && i < _Length && (uint32(_Data[i]) & 0xFC00) == 0xDC00) {
+			Char = 0x10000 + ((Char & 0x3FF) << 10) + (uint32(_Data[i++]) & 0x3FF);
+			Dst[Size++] = uint8(0xF0 | (Char >> 18));
+			Dst[Size++] = uint8(0x80 | ((Char >> 12) & 0x3F));
+			Dst[Size++] = uint8(0x80 | ((Char >> 6) & 0x3F));
+			Dst[Size++] = uint8(0x80 | (Char & 0x3F));
+		} else if (Char < 0x10000) {
+			Dst[Size++] = uint8(0xE0 | (Char >> 12));
+			Dst[Size++] = uint8(0x80 | ((Char >> 6) & 0x3F));
+			Dst[Size++] = uint8(0x80 | (Char & 0x3F));
 		} else {
-			tmpStr[Size++] = 0xE0 | (_Data[i] >> 12);
-			tmpStr[Size++] = 0x80 | ((_Data[i] >> 6) & 0x3F);
-			tmpStr[Size++] = 0x80 | (_Data[i] & 0x3F);
+			Dst[Size++] = uint8(0xF0 | ((Char >> 18) & 0x07));
+			Dst[Size++] = uint8(0x80 | ((Char >> 12) & 0x3F));
+			Dst[Size++] = uint8(0x80 | ((Char >> 6) & 0x3F));
+			Dst[Size++] = uint8(0x80 | (Char & 0x3F));
 		}
 	}
-	tmpStr[Size] = 0;
-	UTF8string = tmpStr; // implicit conversion
-	delete [] tmpStr;
-
+	UTF8string.resize(Size);
 }
 
 bool UTFstring::wcscmp_internal(const wchar_t *str1, const wchar_t *str2)
@@ -40,6 +40,11 @@ START_LIBEBML_NAMESPACE
 
 MemIOCallback::MemIOCallback(uint64 DefaultSize)
 {
+	dataBufferMemorySize = 0;
+	dataBufferPos = 0;
+	dataBufferTotalSize = 0;
+	dataBufferOwned = true;
+
 	//The default size of the buffer is 128 bytes
 	dataBuffer = (binary *)malloc(DefaultSize);
 	if (dataBuffer == NULL) {
@@ -52,17 +57,67 @@ MemIOCallback::MemIOCallback(uint64 DefaultSize)
 	}
 	
 	dataBufferMemorySize = DefaultSize;
+	mOk = true;
+}
+
+MemIOCallback::MemIOCallback(binary *Arena, uint64 ArenaSize)
+{
+	dataBuffer = Arena;
+	dataBufferMemorySize = (Arena != NULL) ? ArenaSize : 0;
 	dataBufferPos = 0;
 	dataBufferTotalSize = 0;
+	dataBufferOwned = (Arena == NULL);
 	mOk = true;
 }
 
 MemIOCallback::~MemIOCallback()
 {
-	if (dataBuffer != NULL)
+	if (dataBuffer != NULL && dataBufferOwned)
 		free(dataBuffer);
 }
 
+bool MemIOCallback::reserve(uint64 Size)
+{
+	if (Size <= dataBufferMemorySize)
+		return true;
+
+	return Grow(Size);
+}
+
+/*!
+	Grows the buffer to at least MinSize bytes. The size at least doubles each
+	time, so that writing N bytes in small pieces copies O(N) bytes in total.
+*/
+bool MemIOCallback::Grow(uint64 MinSize)
+{
+	uint64 NewSize = dataBufferMemorySize * 2;
+	if (NewSize < MinSize)
+		NewSize = MinSize;
+	if (NewSize < 128)
+		NewSize = 128;
+
+	binary *NewBuffer;
+	if (dataBufferOwned) {
+		NewBuffer = (binary *)realloc((void *)dataBuffer, NewSize);
+	} else {
+		// Leave the arena: copy what was written into memory of our own
+		NewBuffer = (binary *)malloc(NewSize);
+		if (NewBuffer != NULL && dataBufferTotalSize != 0)
+			memcpy(NewBuffer, dataBuffer, dataBufferTotalSize);
+	}
+
+	if (NewBuffer == NULL) {
+		mOk = false;
+		mLastErrorStr = "Failed to grow memory block";
+		return false;
+	}
+
+	dataBuffer = NewBuffer;
+	dataBufferMemorySize = NewSize;
+	dataBufferOwned = true;
+	return true;
+}
+
 uint32 MemIOCallback::read(void *Buffer, size_t Size)
 {
 	if (Buffer == NULL || Size < 1)
@@ -99,7 +154,8 @@ size_t MemIOCallback::write(const void *Buffer, size_t Size)
 	if (dataBufferMemorySize < dataBufferPos + Size)
 	{
 		//We need more memory!
-		dataBuffer = (binary *)realloc((void *)dataBuffer, dataBufferPos + Size);		
+		if (!Grow(dataBufferPos + Size))
+			return 0;
 	}
 	memcpy(dataBuffer+dataBufferPos, Buffer, Size);
 	dataBufferPos += Size;
@@ -114,7 +170,8 @@ uint32 MemIOCallback::write(IOCallback & IOToRead, size_t Size)
 	if (dataBufferMemorySize < dataBufferPos + Size)
 	{
 		//We need more memory!
-		dataBuffer = (binary *)realloc((void *)dataBuffer, dataBufferPos + Size);		
+		if (!Grow(dataBufferPos + Size))
+			return 0;
 	}
 	IOToRead.readFully(&dataBuffer[dataBufferPos], Size);
 	dataBufferTotalSize = Size;
@@ -0,0 +1,72 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Helpers shared by the tests and benchmarks in this directory
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#ifndef LIBEBML_TEST_COMMON_H
+#define LIBEBML_TEST_COMMON_H
+
+#include <cstdio>
+#include <sys/time.h>
+
+static inline int & TestFailures()
+{
+	static int Failures = 0;
+	return Failures;
+}
+
+/*!
+	\brief report a failed condition and keep going, so that one run shows all the failures
+*/
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			TestFailures()++; \
+		} \
+	} while (0)
+
+/*!
+	\brief the exit code of a test program
+*/
+static inline int TestResult(const char * Name)
+{
+	if (TestFailures() != 0) {
+		std::fprintf(stderr, "%s: %d check(s) failed\n", Name, TestFailures());
+		return 1;
+	}
+	std::printf("%s: ok\n", Name);
+	return 0;
+}
+
+/*!
+	\brief wall clock time in seconds, for the benchmarks
+*/
+static inline double BenchNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*!
+	\brief keep the compiler from dropping the result of a benchmarked call
+*/
+static inline void BenchKeep(unsigned long Value)
+{
+	static volatile unsigned long Sink;
+	Sink = Sink ^ Value;
+}
+
+#endif // LIBEBML_TEST_COMMON_H
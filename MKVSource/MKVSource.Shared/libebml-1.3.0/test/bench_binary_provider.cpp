@@ -0,0 +1,65 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Read 200,000 binary elements of 100 bytes one after the other, deleting
+** each after use, with and without a buffer provider
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include "ebml/EbmlBinary.h"
+#include "ebml/EbmlVoid.h"
+#include "ebml/MemIOCallback.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+static const uint32 Elements = 200000;
+static const uint32 ElementSize = 100;
+
+static void Bench(const char * Name, MemIOCallback & Stream, EbmlBufferProvider * Provider)
+{
+	Stream.SetBufferProvider(Provider);
+	Stream.setFilePointer(0);
+	unsigned long Sum = 0;
+	double Start = BenchNow();
+	for (uint32 i = 0; i < Elements; i++) {
+		EbmlVoid * Void = new EbmlVoid;
+		Void->SetSize(ElementSize);
+		Void->ReadData(Stream);
+		Sum += Void->GetBuffer()[i % ElementSize];
+		delete Void;
+	}
+	double Elapsed = BenchNow() - Start;
+	BenchKeep(Sum);
+	std::printf("  %-12s %6.1f ms\n", Name, Elapsed * 1000);
+}
+
+int main()
+{
+	MemIOCallback Stream;
+	Stream.reserve(uint64(Elements) * ElementSize);
+	binary Element[ElementSize];
+	for (uint32 i = 0; i < Elements; i++) {
+		for (uint32 j = 0; j < ElementSize; j++)
+			Element[j] = binary(i + j);
+		Stream.write(Element, ElementSize);
+	}
+
+	EbmlBufferPool Pool;
+	EbmlBufferView View(Stream.GetDataBuffer(), Stream.GetDataBufferSize());
+
+	std::printf("bench_binary_provider\n");
+	Bench("no provider", Stream, NULL);
+	Bench("pool", Stream, &Pool);
+	Bench("view", Stream, &View);
+	return 0;
+}
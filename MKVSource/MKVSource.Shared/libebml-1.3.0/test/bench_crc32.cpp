@@ -0,0 +1,110 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Throughput of EbmlCrc32 against the one table loop it replaced, on
+** block sizes from a small element to a whole cluster. Built like
+** test_crc32, once as is and once with EBML_CRC32_NO_CLMUL.
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <vector>
+
+#include "ebml/EbmlCrc32.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+static uint32 OldTable[256];
+
+static void InitOldTable()
+{
+	for (uint32 i = 0; i < 256; i++) {
+		uint32 crc = i;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		OldTable[i] = crc;
+	}
+}
+
+// EbmlCrc32::Update before the slicing and the folding (little endian)
+static uint32 OldCrc32(const binary * input, uint32 length)
+{
+	uint32 crc = 0xffffffff;
+
+	for(; !IsAligned<uint32>(input) && length > 0; length--)
+		crc = OldTable[(crc ^ *input++) & 0xff] ^ (crc >> 8);
+
+	while (length >= 4)
+	{
+		crc ^= *(const uint32 *)input;
+		crc = OldTable[crc & 0xff] ^ (crc >> 8);
+		crc = OldTable[crc & 0xff] ^ (crc >> 8);
+		crc = OldTable[crc & 0xff] ^ (crc >> 8);
+		crc = OldTable[crc & 0xff] ^ (crc >> 8);
+		length -= 4;
+		input += 4;
+	}
+
+	while (length--)
+		crc = OldTable[(crc ^ *input++) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+static uint32 NewCrc32(const binary * input, uint32 length)
+{
+	EbmlCrc32 Crc;
+	Crc.FillCRC32(input, length);
+	return Crc.GetCrc32();
+}
+
+static double MegabytesPerSecond(uint32 (*Crc)(const binary *, uint32), const std::vector<binary> & Buffer, uint32 BlockSize)
+{
+	const uint64 Total = 256 << 20;
+	uint32 Blocks = uint32(Buffer.size() / BlockSize);
+	uint32 Result = 0;
+	double Start = BenchNow();
+	for (uint64 Done = 0; Done < Total; Done += BlockSize)
+		Result ^= Crc(&Buffer[(Done / BlockSize % Blocks) * BlockSize], BlockSize);
+	double Elapsed = BenchNow() - Start;
+	BenchKeep(Result);
+	return Total / 1048576.0 / Elapsed;
+}
+
+int main()
+{
+	InitOldTable();
+
+	std::vector<binary> Buffer(4 << 20);
+	uint32 Seed = 1;
+	for (size_t i = 0; i < Buffer.size(); i++) {
+		Seed = Seed * 1103515245 + 12345;
+		Buffer[i] = binary(Seed >> 16);
+	}
+
+	static const uint32 Sizes[] = {64, 1024, 16384, 1 << 20};
+	std::printf(
+#ifdef EBML_CRC32_NO_CLMUL
+		"bench_crc32 (tables)\n"
+#else
+		"bench_crc32\n"
+#endif
+		);
+	for (size_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+		TEST_CHECK(OldCrc32(&Buffer[0], Sizes[i]) == NewCrc32(&Buffer[0], Sizes[i]));
+		double Old = MegabytesPerSecond(OldCrc32, Buffer, Sizes[i]);
+		double New = MegabytesPerSecond(NewCrc32, Buffer, Sizes[i]);
+		std::printf("  %8u bytes: old %8.0f MB/s, new %8.0f MB/s (x%.1f)\n", Sizes[i], Old, New, New / Old);
+	}
+
+	return TestFailures() != 0;
+}
@@ -0,0 +1,85 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** EbmlMaster lookups on large synthetic masters, with and without the
+** ID index: walking every child of one type with FindNextElt, and the
+** missing elements check
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlSubHead.h"
+#include "ebml/EbmlVoid.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+static void Empty(EbmlMaster & Master)
+{
+	for (size_t i = 0; i < Master.ListSize(); i++)
+		delete Master[i];
+	Master.RemoveAll();
+}
+
+static double WalkVoids(size_t Count, bool bIndexed)
+{
+	// Voids interleaved with half as many DocTypes
+	EbmlHead Head;
+	Empty(Head);
+	for (size_t i = 0; i < Count; i++) {
+		Head.PushElement(*new EbmlVoid);
+		if (i % 2 == 0)
+			Head.PushElement(*new EDocType);
+	}
+	Head.EnableIndex(bIndexed);
+
+	const EbmlHead & Const = Head;
+	double Start = BenchNow();
+	size_t Found = 0;
+	for (EbmlElement * Void = Const.FindFirstElt(EBML_INFO(EbmlVoid)); Void != NULL; Void = Const.FindNextElt(*Void))
+		Found++;
+	double Elapsed = BenchNow() - Start;
+	TEST_CHECK(Found == Count);
+	return Elapsed;
+}
+
+static double MissingElements(size_t Count, bool bIndexed)
+{
+	// the mandatory children are missing or at the end
+	EbmlHead Head;
+	Empty(Head);
+	for (size_t i = 0; i < Count; i++)
+		Head.PushElement(*new EbmlVoid);
+	Head.PushElement(*new EDocType);
+	Head.EnableIndex(bIndexed);
+
+	double Start = BenchNow();
+	size_t Missing = 0;
+	for (int i = 0; i < 100; i++)
+		Missing += Head.FindAllMissingElements().size();
+	double Elapsed = BenchNow() - Start;
+	BenchKeep(Missing);
+	return Elapsed;
+}
+
+int main()
+{
+	static const size_t Counts[] = {10000, 50000};
+	std::printf("bench_master_index\n");
+	for (size_t i = 0; i < sizeof(Counts) / sizeof(Counts[0]); i++) {
+		std::printf("  N = %6lu: walk %8.1f ms -> %6.1f ms, 100 missing checks %7.1f ms -> %6.1f ms\n",
+			(unsigned long)Counts[i],
+			WalkVoids(Counts[i], false) * 1000, WalkVoids(Counts[i], true) * 1000,
+			MissingElements(Counts[i], false) * 1000, MissingElements(Counts[i], true) * 1000);
+	}
+	return TestFailures() != 0;
+}
@@ -0,0 +1,127 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Render a 10 MB master with many small children, the shape of a Cues
+** element, into a MemIOCallback; and into a copy of the old one that
+** resized the buffer to the exact size on every write.
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+
+#include "ebml/MemIOCallback.h"
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlVoid.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+/*!
+	\brief MemIOCallback::write before the geometric growth. With
+	AlwaysMove it does what realloc() does when it cannot grow in place.
+*/
+class OldMemIOCallback : public IOCallback {
+	public:
+		OldMemIOCallback(bool bAlwaysMove)
+			:AlwaysMove(bAlwaysMove), Buffer((binary *)malloc(128)), Pos(0), Size(0), Reallocs(0), Copied(0) {}
+		~OldMemIOCallback() {free(Buffer);}
+
+		uint32 read(void *, size_t) {return 0;}
+		void setFilePointer(int64 Offset, seek_mode Mode = seek_beginning) {
+			if (Mode == seek_beginning)
+				Pos = Offset;
+			else if (Mode == seek_current)
+				Pos += Offset;
+			else
+				Pos = Size + Offset;
+		}
+		size_t write(const void *Data, size_t Length) {
+			if (Size < Pos + Length) {
+				binary *Moved;
+				if (AlwaysMove) {
+					Moved = (binary *)malloc(Pos + Length);
+					memcpy(Moved, Buffer, Size);
+					free(Buffer);
+				} else {
+					Moved = (binary *)realloc(Buffer, Pos + Length);
+				}
+				Reallocs++;
+				if (Moved != Buffer)
+					Copied += Size;
+				Buffer = Moved;
+			}
+			memcpy(Buffer + Pos, Data, Length);
+			Pos += Length;
+			if (Pos > Size)
+				Size = Pos;
+			return Length;
+		}
+		uint64 getFilePointer() {return Pos;}
+		void close() {}
+
+		bool AlwaysMove;
+		binary *Buffer;
+		uint64 Pos;
+		uint64 Size;
+		uint64 Reallocs;
+		uint64 Copied;
+};
+
+static void MakeMaster(EbmlHead & Head, size_t DataSize)
+{
+	// a Void with 18 bytes of data takes 20 bytes, about a CuePoint
+	for (size_t Size = 0; Size < DataSize; Size += 20) {
+		EbmlVoid * Void = new EbmlVoid;
+		Void->SetSize(18);
+		Head.PushElement(*Void);
+	}
+}
+
+static void BenchOld(size_t DataSize, bool AlwaysMove)
+{
+	EbmlHead Head;
+	MakeMaster(Head, DataSize);
+	OldMemIOCallback Old(AlwaysMove);
+	double Start = BenchNow();
+	Head.Render(Old, true, true);
+	double Elapsed = BenchNow() - Start;
+	std::printf("  %5.1f MB, old (%s): %8.1f ms, %7lu reallocs, %9.1f MB moved\n",
+		Old.Size / 1048576.0, AlwaysMove ? "moving realloc" : "libc realloc  ", Elapsed * 1000,
+		(unsigned long)Old.Reallocs, Old.Copied / 1048576.0);
+}
+
+static void BenchNew(size_t DataSize, bool Reserve)
+{
+	EbmlHead Head;
+	MakeMaster(Head, DataSize);
+	MemIOCallback Mem;
+	double Start = BenchNow();
+	if (Reserve)
+		Mem.reserve(Head.UpdateSize(true, true) + 16);
+	Head.Render(Mem, true, true);
+	double Elapsed = BenchNow() - Start;
+	std::printf("  %5.1f MB, new (%s): %8.1f ms\n",
+		Mem.GetDataBufferSize() / 1048576.0, Reserve ? "reserve()     " : "growing       ", Elapsed * 1000);
+	BenchKeep(Mem.GetDataBuffer()[Mem.GetDataBufferSize() - 1]);
+}
+
+int main()
+{
+	std::printf("bench_memio\n");
+	// the always moving copy is quadratic: keep it to a small master
+	BenchOld(1 << 19, true);
+	BenchOld(10 << 20, false);
+	BenchNew(10 << 20, false);
+	BenchNew(10 << 20, true);
+	return 0;
+}
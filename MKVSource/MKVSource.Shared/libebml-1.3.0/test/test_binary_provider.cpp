@@ -0,0 +1,261 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Binary elements borrowing their data from EbmlBufferPool and
+** EbmlBufferView, and giving it back
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ebml/EbmlBinary.h"
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlStream.h"
+#include "ebml/EbmlVoid.h"
+#include "ebml/MemIOCallback.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+/*!
+	\brief a pool that counts what goes through it
+*/
+class CountingPool : public EbmlBufferPool {
+	public:
+		CountingPool(uint32 aMaxBufferSize = 1 << 24, uint32 aMaxFreePerSize = 16)
+			:EbmlBufferPool(aMaxBufferSize, aMaxFreePerSize), Acquired(0), Released(0), LastReleasedSize(0) {}
+
+		binary *Acquire(IOCallback & input, uint32 Size, uint32 & SizeRead) {
+			Acquired++;
+			return EbmlBufferPool::Acquire(input, Size, SizeRead);
+		}
+		void Release(binary *Buffer, uint32 Size) {
+			Released++;
+			LastReleasedSize = Size;
+			EbmlBufferPool::Release(Buffer, Size);
+		}
+		size_t FreeCount(uint32 Size) const {return FreeBuffers[SizeClass(Size)].size();}
+
+		int Acquired;
+		int Released;
+		uint32 LastReleasedSize;
+};
+
+static binary Pattern(size_t Position)
+{
+	return binary(Position * 13 + 5);
+}
+
+static void MakeStream(MemIOCallback & Stream, size_t Size)
+{
+	for (size_t i = 0; i < Size; i++) {
+		binary Byte = Pattern(i);
+		Stream.write(&Byte, 1);
+	}
+	Stream.setFilePointer(0);
+}
+
+static EbmlVoid * ReadVoid(IOCallback & Stream, uint64 Position, uint64 Size)
+{
+	EbmlVoid * Void = new EbmlVoid;
+	Void->SetSize(Size);
+	Stream.setFilePointer(Position);
+	TEST_CHECK(Void->ReadData(Stream) == Size);
+	TEST_CHECK(Stream.getFilePointer() == Position + Size);
+	return Void;
+}
+
+static void TestPool()
+{
+	MemIOCallback Stream;
+	MakeStream(Stream, 4096);
+	CountingPool Pool(1024, 2);
+	Stream.SetBufferProvider(&Pool);
+
+	// the data is read into a pooled buffer
+	EbmlVoid * First = ReadVoid(Stream, 10, 100);
+	TEST_CHECK(First->IsBorrowed());
+	TEST_CHECK(Pool.Acquired == 1);
+	TEST_CHECK(First->GetBuffer()[0] == Pattern(10) && First->GetBuffer()[99] == Pattern(109));
+	binary * FirstBuffer = First->GetBuffer();
+
+	// and goes back to the pool with the element, to be lent again to the
+	// next element of the same size class
+	delete First;
+	TEST_CHECK(Pool.Released == 1 && Pool.LastReleasedSize == 100);
+	TEST_CHECK(Pool.FreeCount(100) == 1);
+	EbmlVoid * Second = ReadVoid(Stream, 200, 120);
+	TEST_CHECK(Second->GetBuffer() == FirstBuffer);
+	TEST_CHECK(Second->GetBuffer()[0] == Pattern(200));
+	TEST_CHECK(Pool.FreeCount(100) == 0);
+
+	// reading again gives back the old buffer first, so it is reused
+	Second->SetSize(70);
+	Stream.setFilePointer(300);
+	Second->ReadData(Stream);
+	TEST_CHECK(Pool.Released == 2 && Pool.LastReleasedSize == 120);
+	TEST_CHECK(Second->IsBorrowed() && Second->GetBuffer() == FirstBuffer);
+	TEST_CHECK(Second->GetBuffer()[0] == Pattern(300));
+
+	// a size changed after the read does not change the class the buffer
+	// goes back to
+	Second->SetSize(1000);
+	delete Second;
+	TEST_CHECK(Pool.Released == 3 && Pool.LastReleasedSize == 70);
+	TEST_CHECK(Pool.FreeCount(70) == 1 && Pool.FreeCount(1000) == 0);
+
+	// only MaxFreePerSize buffers are kept per class
+	std::vector<EbmlVoid *> Many;
+	for (int i = 0; i < 4; i++)
+		Many.push_back(ReadVoid(Stream, i, 64));
+	for (size_t i = 0; i < Many.size(); i++)
+		delete Many[i];
+	TEST_CHECK(Pool.FreeCount(64) == 2);
+
+	// buffers larger than MaxBufferSize are lent but never kept
+	EbmlVoid * Large = ReadVoid(Stream, 0, 2000);
+	TEST_CHECK(Large->IsBorrowed() && Large->GetBuffer()[1999] == Pattern(1999));
+	delete Large;
+	TEST_CHECK(Pool.Acquired == Pool.Released);
+
+	// the stream ends before the element: what is there is read
+	EbmlVoid Short;
+	Short.SetSize(100);
+	Stream.setFilePointer(4096 - 30);
+	TEST_CHECK(Short.ReadData(Stream) == 30);
+	TEST_CHECK(Short.IsBorrowed());
+}
+
+static void TestOwnership()
+{
+	MemIOCallback Stream;
+	MakeStream(Stream, 1024);
+	CountingPool Pool;
+	Stream.SetBufferProvider(&Pool);
+
+	// SetBuffer() gives the borrowed buffer back and owns the new one
+	EbmlVoid * Void = ReadVoid(Stream, 0, 50);
+	binary * Owned = (binary *)malloc(10);
+	memset(Owned, 0x55, 10);
+	Void->SetBuffer(Owned, 10);
+	TEST_CHECK(Pool.Released == 1);
+	TEST_CHECK(!Void->IsBorrowed() && Void->GetBuffer() == Owned);
+	delete Void; // frees Owned
+	TEST_CHECK(Pool.Released == 1);
+
+	// and so does CopyBuffer()
+	Void = ReadVoid(Stream, 0, 50);
+	binary Data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	Void->CopyBuffer(Data, sizeof(Data));
+	TEST_CHECK(Pool.Released == 2);
+	TEST_CHECK(!Void->IsBorrowed() && memcmp(Void->GetBuffer(), Data, sizeof(Data)) == 0);
+	delete Void;
+
+	// a copy of a borrowing element has data of its own
+	Void = ReadVoid(Stream, 100, 50);
+	EbmlVoid * Clone = new EbmlVoid(*Void);
+	TEST_CHECK(!Clone->IsBorrowed());
+	TEST_CHECK(Clone->GetBuffer() != Void->GetBuffer());
+	TEST_CHECK(*Clone == *Void);
+	delete Void;
+	TEST_CHECK(Clone->GetBuffer()[0] == Pattern(100));
+	delete Clone;
+
+	// without a data scope nothing is borrowed
+	EbmlVoid NoData;
+	NoData.SetSize(50);
+	Stream.setFilePointer(0);
+	NoData.ReadData(Stream, SCOPE_NO_DATA);
+	TEST_CHECK(!NoData.IsBorrowed() && NoData.GetBuffer() == NULL);
+
+	TEST_CHECK(Pool.Acquired == Pool.Released);
+}
+
+static void TestView()
+{
+	MemIOCallback Stream;
+	MakeStream(Stream, 1024);
+
+	// the view holds stream positions 256 to 768
+	EbmlBufferView View(Stream.GetDataBuffer() + 256, 512, 256);
+	Stream.SetBufferProvider(&View);
+
+	// inside it, the element points straight into the view
+	EbmlVoid * Inside = ReadVoid(Stream, 300, 100);
+	TEST_CHECK(Inside->IsBorrowed());
+	TEST_CHECK(Inside->GetBuffer() == Stream.GetDataBuffer() + 300);
+	delete Inside;
+
+	// up to its last byte
+	EbmlVoid * End = ReadVoid(Stream, 700, 68);
+	TEST_CHECK(End->IsBorrowed() && End->GetBuffer() == Stream.GetDataBuffer() + 700);
+	delete End;
+
+	// before it, past it or across its ends, the data is read as usual
+	static const uint64 Outside[][2] = {{0, 100}, {200, 100}, {700, 69}, {768, 10}, {900, 100}};
+	for (size_t i = 0; i < sizeof(Outside) / sizeof(Outside[0]); i++) {
+		EbmlVoid * Void = ReadVoid(Stream, Outside[i][0], Outside[i][1]);
+		TEST_CHECK(!Void->IsBorrowed());
+		TEST_CHECK(Void->GetBuffer() != NULL && Void->GetBuffer()[0] == Pattern(size_t(Outside[i][0])));
+		delete Void;
+	}
+}
+
+static void TestStream()
+{
+	// elements found and read through EbmlStream borrow too
+	EbmlHead Head;
+	for (int i = 0; i < 100; i++) {
+		EbmlVoid * Void = new EbmlVoid;
+		Void->SetSize(10 + i);
+		Head.PushElement(*Void);
+	}
+	MemIOCallback Stream;
+	Head.Render(Stream, true, true);
+	Stream.setFilePointer(0);
+
+	CountingPool Pool;
+	Stream.SetBufferProvider(&Pool);
+	EbmlStream Reader(Stream);
+	EbmlElement * Found = Reader.FindNextID(EBML_INFO(EbmlHead), 0xFFFFFFFFL);
+	TEST_CHECK(Found != NULL);
+	if (Found == NULL)
+		return;
+
+	int UpperLevel = 0;
+	EbmlElement * Upper = NULL;
+	static_cast<EbmlMaster *>(Found)->Read(Reader, EBML_CONTEXT(Found), UpperLevel, Upper, true);
+	EbmlMaster & Read = *static_cast<EbmlMaster *>(Found);
+	int Voids = 0;
+	for (size_t i = 0; i < Read.ListSize(); i++) {
+		if (EbmlId(*Read[i]) == EBML_ID(EbmlVoid)) {
+			TEST_CHECK(static_cast<EbmlBinary *>(Read[i])->IsBorrowed());
+			Voids++;
+		}
+	}
+	TEST_CHECK(Voids == 100);
+	TEST_CHECK(Pool.Acquired == 100 && Pool.Released == 0);
+	delete Upper;
+	delete Found;
+	TEST_CHECK(Pool.Released == 100);
+}
+
+int main()
+{
+	TestPool();
+	TestOwnership();
+	TestView();
+	TestStream();
+	return TestResult("test_binary_provider");
+}
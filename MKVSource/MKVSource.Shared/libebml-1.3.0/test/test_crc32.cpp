@@ -0,0 +1,109 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** Check EbmlCrc32 against a bit by bit CRC-32 for all the lengths and
+** alignments the folding and the tables handle differently. The Makefile
+** builds it once as is (carry-less multiply when the CPU has it) and once
+** with EBML_CRC32_NO_CLMUL (tables only).
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <cstring>
+#include <vector>
+
+#include "ebml/EbmlCrc32.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+static uint32 ReferenceCrc32(const binary * Data, size_t Length)
+{
+	uint32 crc = 0xffffffff;
+	for (size_t i = 0; i < Length; i++) {
+		crc ^= Data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return crc ^ 0xffffffff;
+}
+
+static uint32 LibraryCrc32(const binary * Data, uint32 Length)
+{
+	EbmlCrc32 Crc;
+	Crc.FillCRC32(Data, Length);
+	return Crc.GetCrc32();
+}
+
+int main()
+{
+	// the check value of CRC-32/ISO-HDLC
+	const char Check[] = "123456789";
+	TEST_CHECK(LibraryCrc32(reinterpret_cast<const binary *>(Check), 9) == 0xCBF43926);
+	TEST_CHECK(EbmlCrc32::CheckCRC(0xCBF43926, reinterpret_cast<const binary *>(Check), 9));
+	TEST_CHECK(LibraryCrc32(NULL, 0) == 0);
+
+	std::vector<binary> Buffer(4096 + 16);
+	uint32 Seed = 0x12345678;
+	for (size_t i = 0; i < Buffer.size(); i++) {
+		Seed = Seed * 1103515245 + 12345;
+		Buffer[i] = binary(Seed >> 16);
+	}
+
+	// below 64 bytes, around the 16 byte folds and the 64 byte minimum,
+	// then a few large sizes with every tail length
+	std::vector<uint32> Lengths;
+	for (uint32 Length = 0; Length <= 300; Length++)
+		Lengths.push_back(Length);
+	for (uint32 Length = 1000; Length < 1040; Length++)
+		Lengths.push_back(Length);
+	for (uint32 Length = 4096 - 17; Length <= 4096; Length++)
+		Lengths.push_back(Length);
+
+	for (size_t l = 0; l < Lengths.size(); l++) {
+		for (size_t Offset = 0; Offset < 16; Offset++) {
+			const binary * Data = &Buffer[Offset];
+			uint32 Length = Lengths[l];
+			if (Offset + Length > Buffer.size())
+				continue;
+			uint32 Expected = ReferenceCrc32(Data, Length);
+			TEST_CHECK(LibraryCrc32(Data, Length) == Expected);
+			TEST_CHECK(EbmlCrc32::CheckCRC(Expected, Data, Length));
+		}
+	}
+
+	// a running CRC fed in uneven pieces matches the one shot value
+	static const uint32 Pieces[] = {1, 63, 64, 65, 7, 128, 300, 15, 16, 17};
+	EbmlCrc32 Running;
+	size_t Fed = 0;
+	for (size_t i = 0; i < sizeof(Pieces) / sizeof(Pieces[0]); i++) {
+		Running.Update(&Buffer[3 + Fed], Pieces[i]);
+		Fed += Pieces[i];
+	}
+	Running.Finalize();
+	TEST_CHECK(Running.GetCrc32() == ReferenceCrc32(&Buffer[3], Fed));
+
+	// a corrupted byte is caught wherever it is
+	for (size_t i = 0; i < 256; i += 5) {
+		uint32 Good = ReferenceCrc32(&Buffer[0], 256);
+		Buffer[i] ^= 0x20;
+		TEST_CHECK(!EbmlCrc32::CheckCRC(Good, &Buffer[0], 256));
+		Buffer[i] ^= 0x20;
+	}
+
+	return TestResult(
+#ifdef EBML_CRC32_NO_CLMUL
+		"test_crc32 (tables)"
+#else
+		"test_crc32"
+#endif
+		);
+}
@@ -0,0 +1,262 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** EbmlMaster lookups with the ID index agree with a plain scan of the
+** list after every kind of change, and Read() indexes large masters
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <cstdlib>
+#include <vector>
+
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlStream.h"
+#include "ebml/EbmlSubHead.h"
+#include "ebml/EbmlVoid.h"
+#include "ebml/MemIOCallback.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+static const EbmlCallbacks * const Kinds[] = {
+	&EBML_INFO(EbmlVoid), &EBML_INFO(EDocType), &EBML_INFO(EDocTypeVersion), &EBML_INFO(EVersion),
+};
+static const size_t KindCount = sizeof(Kinds) / sizeof(Kinds[0]);
+
+static EbmlElement * NewChild(size_t Kind)
+{
+	return &EBML_INFO_CREATE(*Kinds[Kind % KindCount]);
+}
+
+/*!
+	\brief remove and delete the children, such as the mandatory ones a new master has
+*/
+static void Empty(EbmlMaster & Master)
+{
+	for (size_t i = 0; i < Master.ListSize(); i++)
+		delete Master[i];
+	Master.RemoveAll();
+}
+
+/*!
+	\brief check every lookup of the master against a scan of its list
+*/
+static void CheckLookups(const EbmlMaster & Master, int Line)
+{
+	const std::vector<EbmlElement *> & List = Master.GetElementList();
+	int Failures = TestFailures();
+	for (size_t k = 0; k < KindCount; k++) {
+		const EbmlCallbacks & Kind = *Kinds[k];
+		std::vector<EbmlElement *> Expected;
+		for (size_t i = 0; i < List.size(); i++)
+			if (EbmlId(*List[i]) == EBML_INFO_ID(Kind))
+				Expected.push_back(List[i]);
+
+		EbmlElement * First = Master.FindFirstElt(Kind);
+		TEST_CHECK(Master.FindElt(Kind) == First);
+		TEST_CHECK(First == (Expected.empty() ? NULL : Expected[0]));
+
+		// walk them with FindNextElt
+		for (size_t i = 0; i < Expected.size(); i++)
+			TEST_CHECK(Master.FindNextElt(*Expected[i]) == (i + 1 < Expected.size() ? Expected[i + 1] : NULL));
+	}
+	if (TestFailures() != Failures)
+		std::fprintf(stderr, "  lookups checked at line %d\n", Line);
+}
+#define CHECK_LOOKUPS(master) CheckLookups(master, __LINE__)
+
+static void TestChanges()
+{
+	EbmlHead Indexed;
+	Empty(Indexed);
+	Indexed.EnableIndex();
+	TEST_CHECK(Indexed.HasIndex());
+	CHECK_LOOKUPS(Indexed);
+
+	for (size_t i = 0; i < 40; i++)
+		Indexed.PushElement(*NewChild(i * 7 / 3));
+	CHECK_LOOKUPS(Indexed);
+
+	// each change through EbmlMaster is seen by the next lookup
+	Indexed.InsertElement(*NewChild(1), 0);
+	CHECK_LOOKUPS(Indexed);
+	Indexed.InsertElement(*NewChild(2), 17);
+	CHECK_LOOKUPS(Indexed);
+	Indexed.InsertElement(*NewChild(3), *Indexed[5]);
+	CHECK_LOOKUPS(Indexed);
+	Indexed.AddNewElt(EBML_INFO(EDocType));
+	CHECK_LOOKUPS(Indexed);
+	Indexed.FindFirstElt(EBML_INFO(EMaxIdLength), true);
+	CHECK_LOOKUPS(Indexed);
+
+	delete Indexed[3];
+	Indexed.Remove(3);
+	CHECK_LOOKUPS(Indexed);
+
+	EBML_MASTER_ITERATOR Itr = Indexed.begin() + 10;
+	delete *Itr;
+	Indexed.Remove(Itr);
+	CHECK_LOOKUPS(Indexed);
+
+	EBML_MASTER_RITERATOR RItr = Indexed.rbegin() + 2;
+	delete *RItr.base();
+	Indexed.Remove(RItr);
+	CHECK_LOOKUPS(Indexed);
+
+	Indexed.Sort();
+	CHECK_LOOKUPS(Indexed);
+
+	// children added or removed through the list are noticed...
+	Indexed.GetElementList().push_back(NewChild(1));
+	CHECK_LOOKUPS(Indexed);
+	delete Indexed.GetElementList().front();
+	Indexed.GetElementList().erase(Indexed.begin());
+	CHECK_LOOKUPS(Indexed);
+
+	// ...children replaced need InvalidateIndex()
+	EbmlElement * Replaced = Indexed[0];
+	Indexed.GetElementList()[0] = NewChild(EbmlId(*Replaced) == EBML_ID(EbmlVoid) ? 1 : 0);
+	delete Replaced;
+	Indexed.InvalidateIndex();
+	CHECK_LOOKUPS(Indexed);
+
+	// a child of another master is not found
+	EbmlVoid Stranger;
+	TEST_CHECK(Indexed.FindNextElt(Stranger) == NULL);
+
+	// a copy has an index of its own
+	EbmlHead Copy(Indexed);
+	TEST_CHECK(Copy.HasIndex());
+	CHECK_LOOKUPS(Copy);
+	TEST_CHECK(Copy.FindFirstElt(EBML_INFO(EbmlVoid)) != Indexed.FindFirstElt(EBML_INFO(EbmlVoid)));
+
+	// turned off, lookups scan the list again
+	Indexed.EnableIndex(false);
+	CHECK_LOOKUPS(Indexed);
+	Indexed.PushElement(*NewChild(2));
+	CHECK_LOOKUPS(Indexed);
+	Indexed.EnableIndex();
+	CHECK_LOOKUPS(Indexed);
+
+	std::vector<EbmlElement *> Children(Indexed.begin(), Indexed.end());
+	Indexed.RemoveAll();
+	CHECK_LOOKUPS(Indexed);
+	TEST_CHECK(Indexed.FindFirstElt(EBML_INFO(EbmlVoid)) == NULL);
+	for (size_t i = 0; i < Children.size(); i++)
+		delete Children[i];
+}
+
+static void TestRandomChanges()
+{
+	EbmlHead Indexed;
+	Empty(Indexed);
+	Indexed.EnableIndex();
+	srand(1);
+	for (int Step = 0; Step < 2000; Step++) {
+		size_t Size = Indexed.ListSize();
+		switch (rand() % 5) {
+		case 0:
+		case 1:
+			Indexed.PushElement(*NewChild(rand()));
+			break;
+		case 2:
+			Indexed.InsertElement(*NewChild(rand()), Size ? rand() % Size : 0);
+			break;
+		case 3:
+			if (Size != 0) {
+				size_t Index = rand() % Size;
+				delete Indexed[Index];
+				Indexed.Remove(Index);
+			}
+			break;
+		case 4:
+			if (Size != 0)
+				Indexed.FindNextElt(*Indexed[rand() % Size], true);
+			break;
+		}
+		if (Step % 50 == 0)
+			CHECK_LOOKUPS(Indexed);
+	}
+	CHECK_LOOKUPS(Indexed);
+}
+
+static void TestMandatory()
+{
+	// the semantic checks give the same answers with the index
+	EbmlHead Plain;
+	Empty(Plain);
+	for (size_t i = 0; i < 200; i++)
+		Plain.PushElement(*NewChild(0));
+	EbmlHead Indexed(Plain);
+	Indexed.EnableIndex();
+
+	TEST_CHECK(Plain.CheckMandatory() == Indexed.CheckMandatory());
+	TEST_CHECK(Plain.FindAllMissingElements() == Indexed.FindAllMissingElements());
+	TEST_CHECK(!Indexed.FindAllMissingElements().empty());
+
+	Plain.PushElement(*NewChild(1));
+	Indexed.PushElement(*NewChild(1));
+	TEST_CHECK(Plain.FindAllMissingElements() == Indexed.FindAllMissingElements());
+}
+
+static EbmlMaster * ReadBack(size_t Children)
+{
+	EbmlHead Head; // with its mandatory children, Render() wants them
+	for (size_t i = Head.ListSize(); i < Children; i++)
+		Head.PushElement(*NewChild(i % 2));
+	MemIOCallback Stream;
+	Head.Render(Stream, true, true);
+	Stream.setFilePointer(0);
+
+	EbmlStream Reader(Stream);
+	EbmlElement * Found = Reader.FindNextID(EBML_INFO(EbmlHead), 0xFFFFFFFFL);
+	TEST_CHECK(Found != NULL);
+	if (Found == NULL)
+		return NULL;
+	int UpperLevel = 0;
+	EbmlElement * Upper = NULL;
+	static_cast<EbmlMaster *>(Found)->Read(Reader, EBML_CONTEXT(Found), UpperLevel, Upper, true);
+	delete Upper;
+	return static_cast<EbmlMaster *>(Found);
+}
+
+static void TestRead()
+{
+	// small masters are left as they were
+	EbmlMaster * Small = ReadBack(IndexedChildrenAfterRead - 1);
+	if (Small != NULL) {
+		TEST_CHECK(Small->ListSize() == IndexedChildrenAfterRead - 1);
+		TEST_CHECK(!Small->HasIndex());
+		CHECK_LOOKUPS(*Small);
+		delete Small;
+	}
+
+	// large ones are indexed by Read()
+	EbmlMaster * Large = ReadBack(1000);
+	if (Large != NULL) {
+		TEST_CHECK(Large->ListSize() == 1000);
+		TEST_CHECK(Large->HasIndex());
+		CHECK_LOOKUPS(*Large);
+		Large->PushElement(*NewChild(3));
+		CHECK_LOOKUPS(*Large);
+		delete Large;
+	}
+}
+
+int main()
+{
+	TestChanges();
+	TestRandomChanges();
+	TestMandatory();
+	TestRead();
+	return TestResult("test_master_index");
+}
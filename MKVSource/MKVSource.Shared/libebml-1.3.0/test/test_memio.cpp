@@ -0,0 +1,202 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** MemIOCallback growth, reserve() and the caller's arena
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <cstring>
+#include <vector>
+
+#include "ebml/MemIOCallback.h"
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlVoid.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+class MemIOInspector : public MemIOCallback {
+	public:
+		MemIOInspector(uint64 DefaultSize = 128) :MemIOCallback(DefaultSize) {}
+		MemIOInspector(binary *Arena, uint64 ArenaSize) :MemIOCallback(Arena, ArenaSize) {}
+		uint64 Capacity() const {return dataBufferMemorySize;}
+		bool OwnsBuffer() const {return dataBufferOwned;}
+};
+
+static binary Pattern(size_t Position)
+{
+	return binary(Position * 7 + (Position >> 8));
+}
+
+static bool HasPattern(const binary * Data, size_t Length)
+{
+	for (size_t i = 0; i < Length; i++)
+		if (Data[i] != Pattern(i))
+			return false;
+	return true;
+}
+
+static void TestGrowth()
+{
+	MemIOInspector Mem(16);
+	TEST_CHECK(Mem.IsOk());
+
+	// write 1 MB a few bytes at a time: the capacity must at least double
+	// whenever it changes, so it only changes about log2(1 MB) times
+	std::vector<binary> Source(1 << 20);
+	for (size_t i = 0; i < Source.size(); i++)
+		Source[i] = Pattern(i);
+
+	size_t Changes = 0;
+	uint64 Capacity = Mem.Capacity();
+	for (size_t Done = 0; Done < Source.size(); ) {
+		size_t Piece = 1 + Done % 13;
+		if (Piece > Source.size() - Done)
+			Piece = Source.size() - Done;
+		TEST_CHECK(Mem.write(&Source[Done], Piece) == Piece);
+		Done += Piece;
+		if (Mem.Capacity() != Capacity) {
+			TEST_CHECK(Mem.Capacity() >= 2 * Capacity);
+			Capacity = Mem.Capacity();
+			Changes++;
+		}
+	}
+	TEST_CHECK(Changes <= 20);
+	TEST_CHECK(Mem.GetDataBufferSize() == Source.size());
+	TEST_CHECK(Mem.getFilePointer() == Source.size());
+	TEST_CHECK(HasPattern(Mem.GetDataBuffer(), Source.size()));
+
+	// overwriting inside the data neither grows the buffer nor the size
+	Mem.setFilePointer(100);
+	binary Zeros[50] = {0};
+	TEST_CHECK(Mem.write(Zeros, sizeof(Zeros)) == sizeof(Zeros));
+	TEST_CHECK(Mem.Capacity() == Capacity);
+	TEST_CHECK(Mem.GetDataBufferSize() == Source.size());
+	TEST_CHECK(Mem.GetDataBuffer()[99] == Pattern(99));
+	TEST_CHECK(Mem.GetDataBuffer()[100] == 0 && Mem.GetDataBuffer()[149] == 0);
+	TEST_CHECK(Mem.GetDataBuffer()[150] == Pattern(150));
+
+	// and reading gives back what was written
+	binary Back[64];
+	Mem.setFilePointer(150);
+	TEST_CHECK(Mem.read(Back, sizeof(Back)) == sizeof(Back));
+	TEST_CHECK(std::memcmp(Back, &Source[150], sizeof(Back)) == 0);
+}
+
+static void TestReserve()
+{
+	MemIOInspector Mem;
+	TEST_CHECK(Mem.reserve(100000));
+	TEST_CHECK(Mem.Capacity() >= 100000);
+
+	// nothing moves while the writes fit in the reserved size
+	const binary * Reserved = Mem.GetDataBuffer();
+	binary Piece[100];
+	for (size_t i = 0; i < 1000; i++) {
+		for (size_t j = 0; j < sizeof(Piece); j++)
+			Piece[j] = Pattern(i * sizeof(Piece) + j);
+		TEST_CHECK(Mem.write(Piece, sizeof(Piece)) == sizeof(Piece));
+	}
+	TEST_CHECK(Mem.GetDataBuffer() == Reserved);
+	TEST_CHECK(HasPattern(Mem.GetDataBuffer(), 100000));
+
+	// reserving less than the capacity does nothing
+	uint64 Capacity = Mem.Capacity();
+	TEST_CHECK(Mem.reserve(10));
+	TEST_CHECK(Mem.Capacity() == Capacity && Mem.GetDataBuffer() == Reserved);
+
+	// the next write past it grows and keeps the data
+	TEST_CHECK(Mem.write(Piece, 1) == 1);
+	TEST_CHECK(Mem.Capacity() > Capacity);
+	TEST_CHECK(HasPattern(Mem.GetDataBuffer(), 100000));
+}
+
+static void TestArena()
+{
+	binary Arena[256 + 1];
+	Arena[256] = 0xA5; // guard byte
+
+	MemIOInspector Mem(Arena, 256);
+	TEST_CHECK(Mem.IsOk());
+	TEST_CHECK(!Mem.OwnsBuffer());
+	TEST_CHECK(Mem.Capacity() == 256);
+
+	binary Data[300];
+	for (size_t i = 0; i < sizeof(Data); i++)
+		Data[i] = Pattern(i);
+
+	// everything up to the arena size stays in the arena
+	TEST_CHECK(Mem.write(Data, 200) == 200);
+	TEST_CHECK(Mem.write(Data + 200, 56) == 56);
+	TEST_CHECK(Mem.GetDataBuffer() == Arena);
+	TEST_CHECK(!Mem.OwnsBuffer());
+	TEST_CHECK(HasPattern(Arena, 256));
+
+	// one byte more and the data moves to memory of its own, the arena
+	// is left as it was
+	TEST_CHECK(Mem.write(Data + 256, 44) == 44);
+	TEST_CHECK(Mem.GetDataBuffer() != Arena);
+	TEST_CHECK(Mem.OwnsBuffer());
+	TEST_CHECK(Mem.Capacity() >= 300);
+	TEST_CHECK(Mem.GetDataBufferSize() == 300);
+	TEST_CHECK(HasPattern(Mem.GetDataBuffer(), 300));
+	TEST_CHECK(HasPattern(Arena, 256));
+	TEST_CHECK(Arena[256] == 0xA5);
+
+	// reserve() past the arena spills too
+	binary Small[16];
+	MemIOInspector Reserved(Small, sizeof(Small));
+	TEST_CHECK(Reserved.write(Data, 10) == 10);
+	TEST_CHECK(Reserved.reserve(sizeof(Small)));
+	TEST_CHECK(Reserved.GetDataBuffer() == Small);
+	TEST_CHECK(Reserved.reserve(1000));
+	TEST_CHECK(Reserved.GetDataBuffer() != Small && Reserved.OwnsBuffer());
+	TEST_CHECK(HasPattern(Reserved.GetDataBuffer(), 10));
+
+	// without an arena it behaves like the default constructor
+	MemIOInspector NoArena(NULL, 1000);
+	TEST_CHECK(NoArena.OwnsBuffer() && NoArena.Capacity() == 0);
+	TEST_CHECK(NoArena.write(Data, sizeof(Data)) == sizeof(Data));
+	TEST_CHECK(HasPattern(NoArena.GetDataBuffer(), sizeof(Data)));
+}
+
+static void TestRenderMaster()
+{
+	// a master with many small children renders the same into an arena
+	// that is too small and into a growing buffer
+	EbmlHead Head;
+	for (int i = 0; i < 5000; i++) {
+		EbmlVoid * Void = new EbmlVoid;
+		Void->SetSize(i % 20);
+		Head.PushElement(*Void);
+	}
+
+	MemIOCallback Growing(16);
+	Head.Render(Growing, true, true);
+
+	binary Arena[1024];
+	MemIOCallback Spilled(Arena, sizeof(Arena));
+	Head.Render(Spilled, true, true);
+
+	TEST_CHECK(Growing.GetDataBufferSize() > sizeof(Arena));
+	TEST_CHECK(Growing.GetDataBufferSize() == Spilled.GetDataBufferSize());
+	TEST_CHECK(std::memcmp(Growing.GetDataBuffer(), Spilled.GetDataBuffer(), Growing.GetDataBufferSize()) == 0);
+}
+
+int main()
+{
+	TestGrowth();
+	TestReserve();
+	TestArena();
+	TestRenderMaster();
+	return TestResult("test_memio");
+}
@@ -0,0 +1,189 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** FindNextElement() getting back in sync after garbage: MaxDataSize is
+** counted from where the search starts, elements that belong inside the
+** parent must end within it, upper level elements need not
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <vector>
+
+#include "ebml/EbmlHead.h"
+#include "ebml/EbmlStream.h"
+#include "ebml/EbmlSubHead.h"
+#include "ebml/EbmlVoid.h"
+#include "ebml/MemIOCallback.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+typedef std::vector<binary> Bytes;
+
+static void Append(Bytes & Out, const binary * Data, size_t Size)
+{
+	Out.insert(Out.end(), Data, Data + Size);
+}
+
+static void AppendGarbage(Bytes & Out, size_t Size)
+{
+	// no ID starts with a 0 byte, so the byte scan gives up after 4 and resyncs
+	Out.insert(Out.end(), Size, binary(0));
+}
+
+// a DocType "webm", 7 bytes
+static const binary DocType[] = {0x42, 0x82, 0x84, 'w', 'e', 'b', 'm'};
+
+struct Found {
+	Found() :Id(uint32(0), 0), Position(0), DataPosition(0), UpperLevel(0), bFound(false) {}
+	EbmlId Id;
+	uint64 Position;
+	uint64 DataPosition;
+	int UpperLevel;
+	bool bFound;
+};
+
+/*!
+	\brief look for the next element of an EBML header in Data, from Start
+*/
+static Found FindIn(const Bytes & Data, uint64 Start, uint64 MaxDataSize)
+{
+	MemIOCallback Stream;
+	Stream.write(&Data[0], Data.size());
+	Stream.setFilePointer(Start);
+	EbmlStream Reader(Stream);
+
+	Found Result;
+	EbmlElement * Element = Reader.FindNextElement(EBML_CLASS_CONTEXT(EbmlHead), Result.UpperLevel, MaxDataSize, false);
+	if (Element != NULL) {
+		Result.bFound = true;
+		Result.Id = EbmlId(*Element);
+		Result.Position = Element->GetElementPosition();
+		Result.DataPosition = Stream.getFilePointer();
+		delete Element;
+	}
+	return Result;
+}
+
+static void TestByteScan()
+{
+	// without garbage nothing changed: the element must fit in MaxDataSize
+	Bytes Data;
+	Append(Data, DocType, sizeof(DocType));
+	Found Exact = FindIn(Data, 0, 7);
+	TEST_CHECK(Exact.bFound && Exact.Id == EBML_ID(EDocType) && Exact.Position == 0);
+	TEST_CHECK(!FindIn(Data, 0, 6).bFound);
+}
+
+static void TestRelativeLimit()
+{
+	// the search starts 1000 bytes into the stream: the limit is counted
+	// from there, not from the start of the stream
+	Bytes Data;
+	Data.insert(Data.end(), 1000, binary(0xFF));
+	AppendGarbage(Data, 40);
+	Append(Data, DocType, sizeof(DocType));
+
+	Found Exact = FindIn(Data, 1000, 40 + 7);
+	TEST_CHECK(Exact.bFound);
+	TEST_CHECK(Exact.Id == EBML_ID(EDocType));
+	TEST_CHECK(Exact.Position == 1040);
+	TEST_CHECK(Exact.DataPosition == 1043);
+	TEST_CHECK(Exact.UpperLevel == 0);
+
+	// one byte short and the element is out
+	TEST_CHECK(!FindIn(Data, 1000, 40 + 6).bFound);
+
+	// the same after a candidate was turned down: 0x81 reads as an
+	// unknown element, which is not allowed here
+	Bytes Rejected;
+	Rejected.insert(Rejected.end(), 1000, binary(0xFF));
+	Rejected.insert(Rejected.end(), 40, binary(0x81));
+	Append(Rejected, DocType, sizeof(DocType));
+	Found AfterRejected = FindIn(Rejected, 1000, 40 + 7);
+	TEST_CHECK(AfterRejected.bFound);
+	TEST_CHECK(AfterRejected.Id == EBML_ID(EDocType));
+	TEST_CHECK(AfterRejected.Position == 1040);
+}
+
+static void TestInnerElementsBounded()
+{
+	// a Void that would run past the end of the parent hides the DocType
+	// in its data: it is skipped and the DocType is found
+	Bytes Data;
+	AppendGarbage(Data, 20);
+	static const binary Void[] = {0xEC, 0x8A}; // 10 bytes of data
+	Append(Data, Void, sizeof(Void));
+	Append(Data, DocType, sizeof(DocType));
+	Data.insert(Data.end(), 3, binary(0));
+
+	Found Skipped = FindIn(Data, 0, 29);
+	TEST_CHECK(Skipped.bFound);
+	TEST_CHECK(Skipped.Id == EBML_ID(EDocType));
+	TEST_CHECK(Skipped.Position == 22);
+
+	// when it fits, the Void is the element
+	Found Fits = FindIn(Data, 0, 32);
+	TEST_CHECK(Fits.bFound);
+	TEST_CHECK(Fits.Id == EBML_ID(EbmlVoid));
+	TEST_CHECK(Fits.Position == 20);
+}
+
+static void TestUpperElementsNotBounded()
+{
+	// the next EBML header ends past MaxDataSize: it is not inside this one
+	// and is found anyway
+	Bytes Data;
+	AppendGarbage(Data, 20);
+	static const binary Head[] = {0x1A, 0x45, 0xDF, 0xA3, 0x88};
+	Append(Data, Head, sizeof(Head));
+	Data.insert(Data.end(), 8, binary(0));
+
+	Found Upper = FindIn(Data, 0, 25);
+	TEST_CHECK(Upper.bFound);
+	TEST_CHECK(Upper.Id == EBML_ID(EbmlHead));
+	TEST_CHECK(Upper.Position == 20);
+	TEST_CHECK(Upper.UpperLevel > 0);
+}
+
+static void TestLargeGarbage()
+{
+	// a megabyte of garbage is skipped, with the usual limit or with
+	// "any size", from a position where the end would overflow
+	const size_t GarbageSize = 1 << 20;
+	Bytes Data;
+	Data.insert(Data.end(), 100, binary(0xFF));
+	AppendGarbage(Data, GarbageSize);
+	Append(Data, DocType, sizeof(DocType));
+
+	Found Exact = FindIn(Data, 100, GarbageSize + 7);
+	TEST_CHECK(Exact.bFound && Exact.Id == EBML_ID(EDocType) && Exact.Position == 100 + GarbageSize);
+	TEST_CHECK(!FindIn(Data, 100, GarbageSize + 6).bFound);
+
+	Found Any = FindIn(Data, 100, ~uint64(0));
+	TEST_CHECK(Any.bFound && Any.Id == EBML_ID(EDocType) && Any.Position == 100 + GarbageSize);
+
+	// and nothing is found in garbage alone
+	Bytes Garbage;
+	AppendGarbage(Garbage, GarbageSize);
+	TEST_CHECK(!FindIn(Garbage, 0, ~uint64(0)).bFound);
+}
+
+int main()
+{
+	TestByteScan();
+	TestRelativeLimit();
+	TestInnerElementsBounded();
+	TestUpperElementsNotBounded();
+	TestLargeGarbage();
+	return TestResult("test_resync");
+}
@@ -0,0 +1,239 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** UTFstring conversions between UTF-8 and wchar_t (UTF-16 or UTF-32,
+** depending on the platform), both ways, with ASCII runs of every length
+** around the block size, surrogates and invalid UTF-8. The Makefile also
+** builds it with -fshort-wchar, to check the UTF-16 code on Linux; the
+** wide strings are kept in vectors as the C library functions that
+** std::wstring uses still expect 32 bits characters then.
+**
+** This file is part of libebml.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** See http://www.matroska.org/license/lgpl/ for LGPL licensing information.
+**
+**********************************************************************/
+
+#include <string>
+#include <vector>
+
+#include "ebml/EbmlUnicodeString.h"
+#include "TestCommon.h"
+
+using namespace LIBEBML_NAMESPACE;
+
+typedef std::vector<wchar_t> WideString; // without the terminating 0
+
+static UTFstring MakeUTFstring(WideString Wide)
+{
+	Wide.push_back(0);
+	return UTFstring(&Wide[0]);
+}
+
+static void AppendUTF8(std::string & Out, uint32 Char)
+{
+	if (Char < 0x80) {
+		Out += char(Char);
+	} else if (Char < 0x800) {
+		Out += char(0xC0 | (Char >> 6));
+		Out += char(0x80 | (Char & 0x3F));
+	} else if (Char < 0x10000) {
+		Out += char(0xE0 | (Char >> 12));
+		Out += char(0x80 | ((Char >> 6) & 0x3F));
+		Out += char(0x80 | (Char & 0x3F));
+	} else {
+		Out += char(0xF0 | (Char >> 18));
+		Out += char(0x80 | ((Char >> 12) & 0x3F));
+		Out += char(0x80 | ((Char >> 6) & 0x3F));
+		Out += char(0x80 | (Char & 0x3F));
+	}
+}
+
+static void AppendWide(WideString & Out, uint32 Char)
+{
+	if (sizeof(wchar_t) == 2 && Char >= 0x10000) {
+		Out.push_back(wchar_t(0xD800 | ((Char - 0x10000) >> 10)));
+		Out.push_back(wchar_t(0xDC00 | ((Char - 0x10000) & 0x3FF)));
+	} else {
+		Out.push_back(wchar_t(Char));
+	}
+}
+
+static bool SameWide(const UTFstring & Str, const WideString & Expected)
+{
+	if (Str.length() != Expected.size())
+		return false;
+	for (size_t i = 0; i <= Expected.size(); i++)
+		if (Str.c_str()[i] != (i < Expected.size() ? Expected[i] : 0))
+			return false;
+	return true;
+}
+
+/*!
+	\brief both conversions of the code points in Chars, and back
+*/
+static void CheckRoundTrip(const std::vector<uint32> & Chars)
+{
+	std::string UTF8;
+	WideString Wide;
+	for (size_t i = 0; i < Chars.size(); i++) {
+		AppendUTF8(UTF8, Chars[i]);
+		AppendWide(Wide, Chars[i]);
+	}
+
+	UTFstring FromUTF8;
+	FromUTF8.SetUTF8(UTF8);
+	TEST_CHECK(SameWide(FromUTF8, Wide));
+	TEST_CHECK(FromUTF8.GetUTF8() == UTF8);
+
+	UTFstring FromWide = MakeUTFstring(Wide);
+	TEST_CHECK(FromWide.GetUTF8() == UTF8);
+	TEST_CHECK(SameWide(FromWide, Wide));
+	TEST_CHECK(FromWide == FromUTF8);
+
+	// and through a copy
+	UTFstring Copy(FromWide);
+	TEST_CHECK(Copy.GetUTF8() == UTF8 && SameWide(Copy, Wide));
+}
+
+static void TestASCIIRuns()
+{
+	// every length around the 8 and 16 character blocks, with one
+	// character of each UTF-8 size at every place in the block
+	static const uint32 NonASCII[] = {0xE9, 0x20AC, 0x1F600};
+	for (size_t Length = 0; Length <= 50; Length++) {
+		std::vector<uint32> Chars;
+		for (size_t i = 0; i < Length; i++)
+			Chars.push_back('a' + i % 26);
+		CheckRoundTrip(Chars);
+
+		for (size_t n = 0; n < sizeof(NonASCII) / sizeof(NonASCII[0]); n++) {
+			for (size_t Place = 0; Place < Length; Place++) {
+				std::vector<uint32> Mixed(Chars);
+				Mixed[Place] = NonASCII[n];
+				CheckRoundTrip(Mixed);
+			}
+		}
+	}
+}
+
+static void TestCodePoints()
+{
+	// the limits of each UTF-8 size, and the code points around the
+	// surrogate range
+	static const uint32 Limits[] = {
+		0x01, 0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF,
+		0x10000, 0x10FFFF, 0x1D11E, 0x20000,
+	};
+	std::vector<uint32> All;
+	for (size_t i = 0; i < sizeof(Limits) / sizeof(Limits[0]); i++) {
+		std::vector<uint32> One(1, Limits[i]);
+		CheckRoundTrip(One);
+		All.push_back(Limits[i]);
+		All.push_back('x');
+	}
+	CheckRoundTrip(All);
+
+	// 4 bytes of UTF-8 give a surrogate pair with a 16 bits wchar_t
+	UTFstring Emoji;
+	Emoji.SetUTF8("\xF0\x9F\x98\x80");
+	if (sizeof(wchar_t) == 2) {
+		TEST_CHECK(Emoji.length() == 2);
+		TEST_CHECK(uint32(Emoji.c_str()[0]) == 0xD83D && uint32(Emoji.c_str()[1]) == 0xDE00);
+	} else {
+		TEST_CHECK(Emoji.length() == 1);
+		TEST_CHECK(uint32(Emoji.c_str()[0]) == 0x1F600);
+	}
+}
+
+static void TestLoneSurrogates()
+{
+	// a surrogate that is not part of a pair is written as a 3 byte
+	// sequence of its own, as the conversion always did
+	WideString Wide;
+	Wide.push_back(L'a');
+	Wide.push_back(wchar_t(0xD800));
+	Wide.push_back(L'b');
+	Wide.push_back(wchar_t(0xDC00));
+	UTFstring Str = MakeUTFstring(Wide);
+	TEST_CHECK(Str.GetUTF8() == "a\xED\xA0\x80" "b\xED\xB0\x80");
+
+	if (sizeof(wchar_t) == 2) {
+		// a low surrogate before a high one is not a pair
+		WideString Reversed;
+		Reversed.push_back(wchar_t(0xDC00));
+		Reversed.push_back(wchar_t(0xD800));
+		UTFstring Swapped = MakeUTFstring(Reversed);
+		TEST_CHECK(Swapped.GetUTF8() == "\xED\xB0\x80\xED\xA0\x80");
+
+		// a high surrogate at the end has no pair
+		WideString Last;
+		Last.push_back(L'z');
+		Last.push_back(wchar_t(0xD83D));
+		UTFstring Cut = MakeUTFstring(Last);
+		TEST_CHECK(Cut.GetUTF8() == "z\xED\xA0\xBD");
+	}
+}
+
+static void TestInvalidUTF8()
+{
+	// the wide form stops at the first invalid sequence, the UTF-8 form
+	// is kept as it was given
+	static const struct {
+		const char * UTF8;
+		size_t ValidChars;
+	} Invalid[] = {
+		{"ab\x80" "cd", 2},              // continuation byte without a lead
+		{"abc\xE2\x82", 3},              // sequence cut by the end
+		{"a\xE2\x28\xA1" "b", 1},        // bad continuation byte
+		{"a\xF4\x90\x80\x80" "b", 1},    // over U+10FFFF
+		{"a\xF8\x88\x80\x80\x80" "b", 1},// 5 bytes lead
+		{"\xFF" "abc", 0},
+		{"0123456789abcdef0123\xC3", 20},// after a whole ASCII block
+	};
+	for (size_t i = 0; i < sizeof(Invalid) / sizeof(Invalid[0]); i++) {
+		std::string UTF8(Invalid[i].UTF8);
+		UTFstring Str;
+		Str.SetUTF8(UTF8);
+		TEST_CHECK(Str.GetUTF8() == UTF8);
+		TEST_CHECK(Str.length() == Invalid[i].ValidChars);
+		TEST_CHECK(Str.c_str() != NULL && Str.c_str()[Str.length()] == 0);
+		for (size_t j = 0; j < Str.length(); j++)
+			TEST_CHECK(Str.c_str()[j] == wchar_t(UTF8[j]));
+	}
+
+	// a valid string set afterwards is converted in full
+	UTFstring Str;
+	Str.SetUTF8("\x80");
+	TEST_CHECK(Str.length() == 0);
+	Str.SetUTF8("caf\xC3\xA9");
+	TEST_CHECK(Str.length() == 4 && uint32(Str.c_str()[3]) == 0xE9);
+}
+
+static void TestAssignments()
+{
+	UTFstring Str;
+	Str = wchar_t(0xE9);
+	TEST_CHECK(Str.GetUTF8() == "\xC3\xA9");
+	Str = static_cast<const wchar_t *>(NULL);
+	TEST_CHECK(Str.length() == 0 && Str.GetUTF8().empty());
+	Str = L"";
+	TEST_CHECK(Str.length() == 0 && Str.GetUTF8().empty());
+	Str.SetUTF8("");
+	TEST_CHECK(Str.length() == 0 && Str.c_str() != NULL && Str.c_str()[0] == 0);
+}
+
+int main()
+{
+	TestASCIIRuns();
+	TestCodePoints();
+	TestLoneSurrogates();
+	TestInvalidUTF8();
+	TestAssignments();
+	return TestResult(sizeof(wchar_t) == 2 ? "test_utfstring (UTF-16)" : "test_utfstring");
+}
@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#ifdef _WIN32
+
 #include <windows.h>
 #include <mfapi.h>
 #include <mfidl.h>
@@ -28,3 +30,10 @@
 using namespace Platform;
 using namespace Microsoft::WRL;
 using namespace Microsoft::WRL::Wrappers;
+
+#else
+
+// The platform-neutral code and its tests, built with g++ (make/linux).
+#include <Win32Compat.h>
+
+#endif
@@ -0,0 +1,207 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// TestByteSource.h
+// An AsyncByteSource over a file in memory. The reads wait until the
+// test completes them (CompleteRead), in any order, or until a thread
+// of the source does (StartThread). A cancelled read completes at once
+// with E_ABORT, on the thread that cancels it.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "DemuxPipeline.h"
+#include "TestMkv.h"
+
+class TestByteSource : public AsyncByteSource
+{
+public:
+	TestByteSource(const TestBytes &file)
+		: m_file(file), m_cReads(0), m_cCancelled(0), m_cMaxPending(0), m_qwMaxReadEnd(0),
+		  m_fStop(false), m_random(5489)
+	{
+	}
+
+	~TestByteSource()
+	{
+		StopThread();
+	}
+
+	HRESULT BeginRead(QWORD qwPosition, BYTE *pData, DWORD cb, AsyncReadCallback *pCallback) override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		PendingRead read = { qwPosition, pData, cb, pCallback };
+		m_pending.push_back(read);
+		m_cReads++;
+		m_cMaxPending = max(m_cMaxPending, (DWORD)m_pending.size());
+		m_qwMaxReadEnd = max(m_qwMaxReadEnd, qwPosition + cb);
+		m_readPositions.push_back(qwPosition);
+		m_wake.notify_all();
+		return S_OK;
+	}
+
+	void CancelRead(AsyncReadCallback *pCallback) override
+	{
+		PendingRead read = {};
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			auto p = std::find_if(m_pending.begin(), m_pending.end(),
+				[pCallback](const PendingRead &r) { return r.pCallback == pCallback; });
+			if (p == m_pending.end())
+			{
+				return;
+			}
+			read = *p;
+			m_pending.erase(p);
+			m_cCancelled++;
+		}
+		read.pCallback->OnReadComplete(E_ABORT, 0);
+	}
+
+	// Completes the read at index i of the pending reads (oldest first).
+	// Returns false if there is none.
+	bool CompleteRead(size_t i)
+	{
+		PendingRead read = {};
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (i >= m_pending.size())
+			{
+				return false;
+			}
+			read = m_pending[i];
+			m_pending.erase(m_pending.begin() + i);
+		}
+		Complete(read);
+		return true;
+	}
+
+	// Completes a pending read picked at random.
+	bool CompleteRandomRead()
+	{
+		size_t i = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_pending.empty())
+			{
+				return false;
+			}
+			i = m_random() % m_pending.size();
+		}
+		return CompleteRead(i);
+	}
+
+	// Completes the reads on a thread, in random order, until StopThread.
+	void StartThread()
+	{
+		m_thread = std::thread([this]()
+		{
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [this]() { return m_fStop || !m_pending.empty(); });
+					if (m_fStop)
+					{
+						return;
+					}
+				}
+				(void)CompleteRandomRead();
+			}
+		});
+	}
+
+	void StopThread()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_fStop = true;
+			m_wake.notify_all();
+		}
+		if (m_thread.joinable())
+		{
+			m_thread.join();
+		}
+	}
+
+	size_t Pending()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_pending.size();
+	}
+
+	DWORD Cancelled()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cCancelled;
+	}
+
+	DWORD MaxPending()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cMaxPending;
+	}
+
+	QWORD MaxReadEnd()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_qwMaxReadEnd;
+	}
+
+	// The position of every read, in the order they were issued.
+	std::vector<QWORD> ReadPositions()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_readPositions;
+	}
+
+private:
+	struct PendingRead
+	{
+		QWORD				qwPosition;
+		BYTE				*pData;
+		DWORD				cb;
+		AsyncReadCallback	*pCallback;
+	};
+
+	// Called without the lock: the callback can start the next reads.
+	void Complete(const PendingRead &read)
+	{
+		DWORD cbRead = 0;
+		if (read.qwPosition < m_file.size())
+		{
+			cbRead = (DWORD)min<QWORD>(read.cb, m_file.size() - read.qwPosition);
+			memcpy(read.pData, &m_file[(size_t)read.qwPosition], cbRead);
+		}
+		read.pCallback->OnReadComplete(S_OK, cbRead);
+	}
+
+	const TestBytes				&m_file;
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_wake;
+	std::vector<PendingRead>	m_pending;		// Oldest first.
+	std::vector<QWORD>			m_readPositions;
+	DWORD						m_cReads;
+	DWORD						m_cCancelled;
+	DWORD						m_cMaxPending;
+	QWORD						m_qwMaxReadEnd;
+	bool						m_fStop;
+	std::minstd_rand			m_random;
+	std::thread					m_thread;
+};
@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// TestCommon.h
+// Helpers shared by the tests and benchmarks in this directory. They are
+// built with g++ by make/linux (see Win32Compat.h).
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+inline int& TestFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+// Reports a failed condition and keeps going, so that one run shows all
+// the failures.
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			TestFailures()++; \
+		} \
+	} while (0)
+
+// The exit code of a test program.
+inline int TestResult(const char *name)
+{
+	if (TestFailures() != 0)
+	{
+		std::fprintf(stderr, "%s: %d check(s) failed\n", name, TestFailures());
+		return 1;
+	}
+	std::printf("%s: ok\n", name);
+	return 0;
+}
+
+// Wall clock time in seconds, for the benchmarks.
+inline double BenchNow()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the compiler from dropping the result of a benchmarked call.
+inline void BenchKeep(unsigned long value)
+{
+	static volatile unsigned long sink;
+	sink = sink ^ value;
+}
+
+// A COM object that does nothing but count its references, to stand for a
+// sample or a token.
+class TestUnknown : public IUnknown
+{
+public:
+	TestUnknown() : m_cRef(1) {}
+	virtual ~TestUnknown() {}
+
+	HRESULT QueryInterface(REFIID iid, void **ppv) override
+	{
+		if (ppv == nullptr)
+		{
+			return E_POINTER;
+		}
+		if (iid == IID_IUnknown)
+		{
+			*ppv = static_cast<IUnknown*>(this);
+			AddRef();
+			return S_OK;
+		}
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG AddRef() override { return ++m_cRef; }
+	ULONG Release() override
+	{
+		ULONG cRef = --m_cRef;
+		if (cRef == 0)
+		{
+			delete this;
+		}
+		return cRef;
+	}
+
+	ULONG RefCount() const { return m_cRef; }
+
+private:
+	std::atomic<ULONG> m_cRef;
+};
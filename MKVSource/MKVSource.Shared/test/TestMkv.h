@@ -0,0 +1,420 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// TestMkv.h
+// Synthetic Matroska files for the tests and benchmarks, and a demuxer
+// loop that drives the Parser the way MKVSource::ParseData does.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+
+#include "Demux.h"
+
+typedef std::vector<BYTE> TestBytes;
+
+// Layout of a synthetic file.
+struct TestMkvLayout
+{
+	DWORD	cClusters;
+	DWORD	cFramesPerCluster;	// Per track; the tracks are interleaved.
+	DWORD	cbVideoFrame;
+	DWORD	cbAudioFrame;
+};
+
+// What a demux run saw.
+struct TestMkvFrames
+{
+	DWORD	cFrames[3];			// Indexed by track number (1 video, 2 audio).
+	UINT64	cbPayload;
+	UINT64	checksum;			// Over the payload bytes, in order.
+};
+
+namespace TestMkv
+{
+	const DWORD ID_EBML				= 0x1A45DFA3;
+	const DWORD ID_EBMLVERSION		= 0x4286;
+	const DWORD ID_DOCTYPE			= 0x4282;
+	const DWORD ID_SEGMENT			= 0x18538067;
+	const DWORD ID_SEEKHEAD			= 0x114D9B74;
+	const DWORD ID_SEEK				= 0x4DBB;
+	const DWORD ID_SEEKID			= 0x53AB;
+	const DWORD ID_SEEKPOSITION		= 0x53AC;
+	const DWORD ID_INFO				= 0x1549A966;
+	const DWORD ID_TIMECODESCALE	= 0x2AD7B1;
+	const DWORD ID_TRACKS			= 0x1654AE6B;
+	const DWORD ID_TRACKENTRY		= 0xAE;
+	const DWORD ID_TRACKNUMBER		= 0xD7;
+	const DWORD ID_TRACKUID			= 0x73C5;
+	const DWORD ID_TRACKTYPE		= 0x83;
+	const DWORD ID_CODECID			= 0x86;
+	const DWORD ID_DEFAULTDURATION	= 0x23E383;
+	const DWORD ID_VIDEO			= 0xE0;
+	const DWORD ID_PIXELWIDTH		= 0xB0;
+	const DWORD ID_PIXELHEIGHT		= 0xBA;
+	const DWORD ID_AUDIO			= 0xE1;
+	const DWORD ID_CHANNELS			= 0x9F;
+	const DWORD ID_CUES				= 0x1C53BB6B;
+	const DWORD ID_CUEPOINT			= 0xBB;
+	const DWORD ID_CUETIME			= 0xB3;
+	const DWORD ID_CUETRACKPOSITIONS = 0xB7;
+	const DWORD ID_CUETRACK			= 0xF7;
+	const DWORD ID_CUECLUSTERPOSITION = 0xF1;
+	const DWORD ID_CLUSTER			= 0x1F43B675;
+	const DWORD ID_TIMECODE			= 0xE7;
+	const DWORD ID_SIMPLEBLOCK		= 0xA3;
+
+	const DWORD MS_PER_FRAME		= 40;	// Both tracks. The cluster timecodes are in ms.
+
+	inline void PutId(TestBytes &out, DWORD id)
+	{
+		int shift = (id > 0xFFFFFF) ? 24 : (id > 0xFFFF) ? 16 : (id > 0xFF) ? 8 : 0;
+		for (; shift >= 0; shift -= 8)
+		{
+			out.push_back(BYTE(id >> shift));
+		}
+	}
+
+	// Sizes are one byte when they fit, four otherwise. (The parser reads
+	// sizes into a DWORD, so nothing longer.)
+	inline void PutSize(TestBytes &out, DWORD cb)
+	{
+		if (cb < 0x7F)
+		{
+			out.push_back(BYTE(0x80 | cb));
+		}
+		else
+		{
+			out.push_back(BYTE(0x10 | (cb >> 24)));
+			out.push_back(BYTE(cb >> 16));
+			out.push_back(BYTE(cb >> 8));
+			out.push_back(BYTE(cb));
+		}
+	}
+
+	inline void PutElement(TestBytes &out, DWORD id, const TestBytes &data)
+	{
+		PutId(out, id);
+		PutSize(out, (DWORD)data.size());
+		out.insert(out.end(), data.begin(), data.end());
+	}
+
+	// Unsigned integers are written in four bytes, so that file offsets
+	// can be filled in without changing the layout.
+	inline void PutUInt(TestBytes &out, DWORD id, DWORD value)
+	{
+		PutId(out, id);
+		PutSize(out, 4);
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			out.push_back(BYTE(value >> shift));
+		}
+	}
+
+	inline void PutString(TestBytes &out, DWORD id, const char *psz)
+	{
+		PutId(out, id);
+		PutSize(out, (DWORD)strlen(psz));
+		out.insert(out.end(), psz, psz + strlen(psz));
+	}
+
+	inline BYTE PayloadByte(DWORD iFrame, DWORD i)
+	{
+		return BYTE(iFrame * 7 + i);
+	}
+
+	inline void PutSimpleBlock(TestBytes &out, DWORD track, short timecode, DWORD iFrame, DWORD cbFrame)
+	{
+		PutId(out, ID_SIMPLEBLOCK);
+		PutSize(out, 4 + cbFrame);
+		out.push_back(BYTE(0x80 | track));
+		out.push_back(BYTE(timecode >> 8));
+		out.push_back(BYTE(timecode));
+		out.push_back(0x80);		// Key frame, no lacing.
+		for (DWORD i = 0; i < cbFrame; i++)
+		{
+			out.push_back(PayloadByte(iFrame, i));
+		}
+	}
+
+	inline TestBytes MakeSeekHead(DWORD posInfo, DWORD posTracks, DWORD posCues)
+	{
+		static const DWORD ids[] = { ID_INFO, ID_TRACKS, ID_CUES };
+		const DWORD positions[] = { posInfo, posTracks, posCues };
+
+		TestBytes seeks;
+		for (int i = 0; i < 3; i++)
+		{
+			TestBytes seek, id;
+			PutId(id, ids[i]);
+			PutElement(seek, ID_SEEKID, id);
+			PutUInt(seek, ID_SEEKPOSITION, positions[i]);
+			PutElement(seeks, ID_SEEK, seek);
+		}
+		TestBytes out;
+		PutElement(out, ID_SEEKHEAD, seeks);
+		return out;
+	}
+
+	inline TestBytes MakeCues(const std::vector<DWORD> &clusterPositions, DWORD msPerCluster)
+	{
+		TestBytes points;
+		for (size_t i = 0; i < clusterPositions.size(); i++)
+		{
+			TestBytes point, trackPos;
+			PutUInt(trackPos, ID_CUETRACK, 1);
+			PutUInt(trackPos, ID_CUECLUSTERPOSITION, clusterPositions[i]);
+			PutUInt(point, ID_CUETIME, DWORD(i) * msPerCluster);
+			PutElement(point, ID_CUETRACKPOSITIONS, trackPos);
+			PutElement(points, ID_CUEPOINT, point);
+		}
+		TestBytes out;
+		PutElement(out, ID_CUES, points);
+		return out;
+	}
+}
+
+//-------------------------------------------------------------------
+// MakeTestMkv
+// Builds a file with a video track (1) and an audio track (2): the
+// EBML header, then a Segment with a SeekHead, Info, Tracks, Cues and
+// the clusters. Fills in *pExpected with what a demuxer should see.
+//-------------------------------------------------------------------
+
+inline TestBytes MakeTestMkv(const TestMkvLayout &layout, TestMkvFrames *pExpected)
+{
+	using namespace TestMkv;
+
+	TestMkvFrames expected = {};
+
+	TestBytes header, ebml;
+	PutUInt(ebml, ID_EBMLVERSION, 1);
+	PutString(ebml, ID_DOCTYPE, "matroska");
+	PutElement(header, ID_EBML, ebml);
+
+	TestBytes info, infoData;
+	PutUInt(infoData, ID_TIMECODESCALE, 1000000);
+	PutElement(info, ID_INFO, infoData);
+
+	TestBytes tracks, entries;
+	{
+		TestBytes entry, video;
+		PutUInt(entry, ID_TRACKNUMBER, 1);
+		PutUInt(entry, ID_TRACKUID, 1);
+		PutUInt(entry, ID_TRACKTYPE, 1);
+		PutString(entry, ID_CODECID, "V_MPEG4/ISO/AVC");
+		PutUInt(entry, ID_DEFAULTDURATION, MS_PER_FRAME * 1000000);
+		PutUInt(video, ID_PIXELWIDTH, 320);
+		PutUInt(video, ID_PIXELHEIGHT, 240);
+		PutElement(entry, ID_VIDEO, video);
+		PutElement(entries, ID_TRACKENTRY, entry);
+	}
+	{
+		TestBytes entry, audio;
+		PutUInt(entry, ID_TRACKNUMBER, 2);
+		PutUInt(entry, ID_TRACKUID, 2);
+		PutUInt(entry, ID_TRACKTYPE, 2);
+		PutString(entry, ID_CODECID, "A_AAC");
+		PutUInt(entry, ID_DEFAULTDURATION, MS_PER_FRAME * 1000000);
+		PutUInt(audio, ID_CHANNELS, 2);
+		PutElement(entry, ID_AUDIO, audio);
+		PutElement(entries, ID_TRACKENTRY, entry);
+	}
+	PutElement(tracks, ID_TRACKS, entries);
+
+	TestBytes clusters;
+	std::vector<DWORD> clusterOffsets;
+	DWORD iFrame = 0;
+	for (DWORD c = 0; c < layout.cClusters; c++)
+	{
+		TestBytes cluster;
+		PutUInt(cluster, ID_TIMECODE, c * layout.cFramesPerCluster * MS_PER_FRAME);
+		for (DWORD f = 0; f < layout.cFramesPerCluster; f++)
+		{
+			const short timecode = short(f * MS_PER_FRAME);
+			PutSimpleBlock(cluster, 1, timecode, iFrame, layout.cbVideoFrame);
+			PutSimpleBlock(cluster, 2, timecode, iFrame + 1, layout.cbAudioFrame);
+
+			for (DWORD i = 0; i < layout.cbVideoFrame; i++)
+			{
+				expected.checksum = expected.checksum * 31 + PayloadByte(iFrame, i);
+			}
+			for (DWORD i = 0; i < layout.cbAudioFrame; i++)
+			{
+				expected.checksum = expected.checksum * 31 + PayloadByte(iFrame + 1, i);
+			}
+			expected.cFrames[1]++;
+			expected.cFrames[2]++;
+			expected.cbPayload += layout.cbVideoFrame + layout.cbAudioFrame;
+			iFrame += 2;
+		}
+		clusterOffsets.push_back((DWORD)clusters.size());
+		PutElement(clusters, ID_CLUSTER, cluster);
+	}
+
+	// The SeekHead and the Cues are the same size whatever the offsets
+	// in them, so lay them out with zeros first.
+	const DWORD cbSeekHead = (DWORD)MakeSeekHead(0, 0, 0).size();
+	const DWORD cbCues = (DWORD)MakeCues(clusterOffsets, 0).size();
+
+	const DWORD posInfo = cbSeekHead;
+	const DWORD posTracks = posInfo + (DWORD)info.size();
+	const DWORD posCues = posTracks + (DWORD)tracks.size();
+	const DWORD posClusters = posCues + cbCues;
+
+	for (DWORD &offset : clusterOffsets)
+	{
+		offset += posClusters;
+	}
+
+	TestBytes segment = MakeSeekHead(posInfo, posTracks, posCues);
+	segment.insert(segment.end(), info.begin(), info.end());
+	segment.insert(segment.end(), tracks.begin(), tracks.end());
+	TestBytes cues = MakeCues(clusterOffsets, layout.cFramesPerCluster * MS_PER_FRAME);
+	segment.insert(segment.end(), cues.begin(), cues.end());
+	segment.insert(segment.end(), clusters.begin(), clusters.end());
+
+	TestBytes file = header;
+	PutElement(file, ID_SEGMENT, segment);
+
+	if (pExpected != nullptr)
+	{
+		*pExpected = expected;
+	}
+	return file;
+}
+
+// Counts a frame that a demuxer delivered.
+inline void AddTestMkvFrame(TestMkvFrames *pFrames, int track, const BYTE *pData, DWORD cb)
+{
+	if (track > 0 && track < 3)
+	{
+		pFrames->cFrames[track]++;
+	}
+	pFrames->cbPayload += cb;
+	for (DWORD i = 0; i < cb; i++)
+	{
+		pFrames->checksum = pFrames->checksum * 31 + pData[i];
+	}
+}
+
+//-------------------------------------------------------------------
+// TestDemuxer
+// Demuxes a file in memory with the Parser. Step() follows
+// MKVSource::ParseData: it parses and hands out frames until the
+// parser needs more data, then reads the next chunk into the buffer.
+//-------------------------------------------------------------------
+
+class TestDemuxer
+{
+public:
+	TestDemuxer(const TestBytes &file, DWORD cbRead)
+		: m_file(file), m_cbRead(cbRead), m_position(0), m_buffer(cbRead), m_frames()
+	{
+	}
+
+	// Returns false at the end of the file.
+	bool Step()
+	{
+		for (;;)
+		{
+			DWORD cbAte = 0;
+			bool fNeedMoreData = false;
+
+			if (m_parser.HasFrames())
+			{
+				const DWORD cbFrame = *m_parser.pCircRead;
+				if (cbFrame > m_buffer.DataSize())
+				{
+					fNeedMoreData = true;
+				}
+				else
+				{
+					Deliver(m_buffer.DataPtr(), cbFrame);
+					cbAte = cbFrame;
+
+					m_parser.pCircRead++;
+					if ((m_parser.pCircRead - &m_parser.m_circularBuffer[0]) == m_parser.m_cirBufferLength)
+					{
+						m_parser.pCircRead = &m_parser.m_circularBuffer[0];
+					}
+					m_parser.m_frameCount--;
+					if (m_parser.m_frameCount == 0)
+					{
+						m_parser.ClearFrames();
+					}
+				}
+			}
+			else
+			{
+				m_parser.m_bufferPosition = m_position - m_buffer.DataSize();
+				fNeedMoreData = !m_parser.ParseBytes(m_buffer.DataPtr(), m_buffer.DataSize(), &cbAte);
+			}
+
+			if (m_parser.m_jumpFlag)
+			{
+				m_parser.m_jumpFlag = false;
+				m_position = m_parser.m_jumpTo;
+				m_buffer.MoveStart(m_buffer.DataSize());
+			}
+			else
+			{
+				m_buffer.MoveStart(cbAte);
+			}
+
+			MKVMasterData *pMasterData = m_parser.GetMasterData();
+			if (m_buffer.DataSize() == 0 && !m_parser.HasFinishedParsedData() && !fNeedMoreData
+				&& !pMasterData->Cues.empty())
+			{
+				m_parser.m_isFinishedParsingMaster = true;
+				m_position = pMasterData->Cues[0]->CueTrackPositions[0]->CueClusterPosition + pMasterData->SegmentPosition;
+			}
+
+			if (fNeedMoreData)
+			{
+				return Read();
+			}
+		}
+	}
+
+	const TestMkvFrames& Frames() const { return m_frames; }
+
+private:
+	bool Read()
+	{
+		if (m_position >= m_file.size())
+		{
+			return false;
+		}
+		DWORD cb = (DWORD)min<QWORD>(m_cbRead, m_file.size() - m_position);
+		m_buffer.Reserve(cb);
+		memcpy(m_buffer.DataPtr() + m_buffer.DataSize(), &m_file[(size_t)m_position], cb);
+		m_buffer.MoveEnd(cb);
+		m_position += cb;
+		return true;
+	}
+
+	void Deliver(const BYTE *pData, DWORD cb)
+	{
+		AddTestMkvFrame(&m_frames, m_parser.m_currentStream, pData, cb);
+	}
+
+	const TestBytes	&m_file;
+	DWORD			m_cbRead;
+	QWORD			m_position;		// File offset of the end of m_buffer.
+	Buffer			m_buffer;
+	Parser			m_parser;
+	TestMkvFrames	m_frames;
+};
+
+inline bool operator==(const TestMkvFrames &a, const TestMkvFrames &b)
+{
+	return a.cFrames[1] == b.cFrames[1] && a.cFrames[2] == b.cFrames[2]
+		&& a.cbPayload == b.cbPayload && a.checksum == b.checksum;
+}
@@ -0,0 +1,111 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// bench_ayuv_kernels.cpp
+// The AYUV fill and blend routines at each level the CPU has, over a
+// 1080p caption frame: a clear, a line of text through a coverage mask
+// (mostly empty, as glyph cells are), and a subtitle picture blended
+// over it.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <random>
+#include <vector>
+
+#include "AyuvKernels.h"
+#include "TestCommon.h"
+
+const UINT32 FRAME_WIDTH = 1920;
+const UINT32 FRAME_HEIGHT = 1080;
+const UINT32 TEXT_HEIGHT = 64;          // One line of text, the width of the frame.
+const UINT32 PICTURE_WIDTH = 1280;      // A PGS picture.
+const UINT32 PICTURE_HEIGHT = 200;
+const DWORD TARGET_PIXELS = 400000000;  // Pixels per measurement.
+
+static const char *LevelName(AyuvKernelLevel level)
+{
+	switch (level)
+	{
+	case AYUV_KERNEL_AVX2:
+		return "AVX2";
+	case AYUV_KERNEL_SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+// Runs fn over cPixels pixels per call until TARGET_PIXELS, and returns
+// the nanoseconds per pixel.
+template <class Fn>
+double Measure(UINT32 cPixels, Fn fn)
+{
+	const UINT32 cCalls = TARGET_PIXELS / cPixels;
+
+	double start = BenchNow();
+	for (UINT32 i = 0; i < cCalls; i++)
+	{
+		fn();
+	}
+	double elapsed = BenchNow() - start;
+
+	return elapsed * 1e9 / (double(cCalls) * cPixels);
+}
+
+int main()
+{
+	std::minstd_rand random(3);
+
+	std::vector<DWORD> frame(FRAME_WIDTH * FRAME_HEIGHT);
+
+	// Glyph coverage: most of a text line is background or solid.
+	std::vector<BYTE> coverage(FRAME_WIDTH * TEXT_HEIGHT);
+	for (BYTE &alpha : coverage)
+	{
+		DWORD r = random() % 16;
+		alpha = (r < 10) ? 0 : (r < 14) ? 255 : (BYTE)random();
+	}
+
+	// A picture with a transparent background around opaque strokes.
+	std::vector<DWORD> picture(PICTURE_WIDTH * PICTURE_HEIGHT);
+	for (DWORD &pixel : picture)
+	{
+		DWORD r = random() % 16;
+		DWORD alpha = (r < 8) ? 0 : (r < 14) ? 255 : (random() & 0xff);
+		pixel = (alpha << 24) | (random() & 0x00ffffff);
+	}
+
+	AyuvKernelLevel maxLevel = GetAyuvKernelLevel();
+	std::printf("bench_ayuv_kernels: %ux%u frame, the CPU has %s\n", FRAME_WIDTH, FRAME_HEIGHT, LevelName(maxLevel));
+
+	for (int level = AYUV_KERNEL_SCALAR; level <= maxLevel; level++)
+	{
+		SetAyuvKernelLevel((AyuvKernelLevel)level);
+
+		double fill = Measure(FRAME_WIDTH * FRAME_HEIGHT, [&]()
+		{
+			AyuvFill(frame.data(), FRAME_WIDTH, FRAME_WIDTH, FRAME_HEIGHT, 0x00108080);
+		});
+		double coverageBlend = Measure(FRAME_WIDTH * TEXT_HEIGHT, [&]()
+		{
+			AyuvBlendCoverage(&frame[900 * FRAME_WIDTH], FRAME_WIDTH, coverage.data(), FRAME_WIDTH,
+				FRAME_WIDTH, TEXT_HEIGHT, 0xffeb8080);
+		});
+		double blend = Measure(PICTURE_WIDTH * PICTURE_HEIGHT, [&]()
+		{
+			AyuvBlend(&frame[800 * FRAME_WIDTH + 320], FRAME_WIDTH, picture.data(), PICTURE_WIDTH,
+				PICTURE_WIDTH, PICTURE_HEIGHT);
+		});
+		BenchKeep(frame[900 * FRAME_WIDTH + 1000]);
+
+		std::printf("  %-6s fill %6.3f ns, coverage blend %6.3f ns, AYUV blend %6.3f ns per pixel\n",
+			LevelName((AyuvKernelLevel)level), fill, coverageBlend, blend);
+	}
+	return TestFailures() != 0;
+}
@@ -0,0 +1,197 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// bench_demux_scheduler.cpp
+// 200 sources demuxing at once, as on a transcoding farm. Each source
+// parses one read at a time, and queues the next step when the read is
+// in. The steps go either to the shared WorkScheduler, through a
+// TaskQueue per source, or straight to the platform work queue, as each
+// source does without the scheduler.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "AsyncCB.h"
+#include "WorkScheduler.h"
+#include "TestCommon.h"
+#include "TestMkv.h"
+
+const DWORD SOURCE_COUNT = 200;
+const DWORD DEMUX_READ_SIZE = 64 * 1024;		// As PREFETCH_READ_SIZE.
+
+// Counts the sources that are done, and checks what they saw.
+class Completion
+{
+public:
+	Completion(const TestMkvFrames &expected) : m_expected(expected), m_cDone(0) {}
+
+	void Done(const TestMkvFrames &frames, HRESULT hr)
+	{
+		TEST_CHECK(SUCCEEDED(hr));
+		TEST_CHECK(frames == m_expected);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cDone++;
+		m_done.notify_all();
+	}
+
+	void Wait(DWORD cSources)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this, cSources]() { return m_cDone == cSources; });
+	}
+
+private:
+	TestMkvFrames			m_expected;
+	std::mutex				m_mutex;
+	std::condition_variable	m_done;
+	DWORD					m_cDone;
+};
+
+// One source: a demuxer, and the work item that runs its steps.
+class DemuxJob
+{
+public:
+	DemuxJob(const TestBytes &file, TaskQueue *pQueue, Completion *pCompletion)
+		: m_cRef(1), m_demuxer(file, DEMUX_READ_SIZE), m_pQueue(pQueue), m_pCompletion(pCompletion),
+		  m_OnStep(this, &DemuxJob::OnStep)
+	{
+		if (m_pQueue != nullptr)
+		{
+			m_pQueue->AddRef();
+		}
+	}
+
+	ULONG AddRef() { return InterlockedIncrement(&m_cRef); }
+
+	ULONG Release()
+	{
+		LONG cRef = InterlockedDecrement(&m_cRef);
+		if (cRef == 0)
+		{
+			delete this;
+		}
+		return cRef;
+	}
+
+	HRESULT Start()
+	{
+		return PutStep();
+	}
+
+private:
+	~DemuxJob()
+	{
+		if (m_pQueue != nullptr)
+		{
+			m_pQueue->Release();
+		}
+	}
+
+	HRESULT PutStep()
+	{
+		if (m_pQueue != nullptr)
+		{
+			return m_pQueue->PutWorkItem(&m_OnStep, nullptr);
+		}
+		return MFPutWorkItem2(MFASYNC_CALLBACK_QUEUE_STANDARD, 0, &m_OnStep, nullptr);
+	}
+
+	HRESULT OnStep(IMFAsyncResult *)
+	{
+		HRESULT hr = S_OK;
+		if (m_demuxer.Step())
+		{
+			hr = PutStep();
+			if (SUCCEEDED(hr))
+			{
+				return S_OK;
+			}
+		}
+		m_pCompletion->Done(m_demuxer.Frames(), hr);
+		return S_OK;
+	}
+
+	long					m_cRef;
+	TestDemuxer				m_demuxer;
+	TaskQueue				*m_pQueue;
+	Completion				*m_pCompletion;
+	AsyncCallback<DemuxJob>	m_OnStep;
+};
+
+static double Run(const TestBytes &file, const TestMkvFrames &expected, bool fShared)
+{
+	Completion completion(expected);
+
+	WorkScheduler *pScheduler = nullptr;
+	if (fShared)
+	{
+		TEST_CHECK(SUCCEEDED(WorkScheduler::GetShared(&pScheduler)));
+	}
+
+	std::vector<DemuxJob*> jobs;
+	for (DWORD i = 0; i < SOURCE_COUNT; i++)
+	{
+		TaskQueue *pQueue = nullptr;
+		if (pScheduler != nullptr)
+		{
+			TEST_CHECK(SUCCEEDED(pScheduler->CreateTaskQueue(&pQueue)));
+		}
+		jobs.push_back(new DemuxJob(file, pQueue, &completion));
+		if (pQueue != nullptr)
+		{
+			pQueue->Release();
+		}
+	}
+
+	double start = BenchNow();
+	for (DemuxJob *pJob : jobs)
+	{
+		TEST_CHECK(SUCCEEDED(pJob->Start()));
+	}
+	completion.Wait(SOURCE_COUNT);
+	double elapsed = BenchNow() - start;
+
+	for (DemuxJob *pJob : jobs)
+	{
+		pJob->Release();
+	}
+	if (pScheduler != nullptr)
+	{
+		pScheduler->Release();
+	}
+	return elapsed;
+}
+
+int main()
+{
+	TestMkvLayout layout = { 40, 25, 3000, 300 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	std::printf("bench_demux_scheduler: %u sources, %.1f MB each, %u hardware threads\n",
+		SOURCE_COUNT, file.size() / 1e6, std::thread::hardware_concurrency());
+
+	// Warm up the work queue threads and the scheduler.
+	(void)Run(file, expected, false);
+	(void)Run(file, expected, true);
+
+	const double mb = double(SOURCE_COUNT) * file.size() / 1e6;
+	for (int round = 0; round < 3; round++)
+	{
+		double direct = Run(file, expected, false);
+		double shared = Run(file, expected, true);
+		std::printf("  per-source work items %7.1f MB/s, shared scheduler %7.1f MB/s\n",
+			mb / direct, mb / shared);
+	}
+	return TestFailures() != 0;
+}
@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// bench_list.cpp
+// List<T> with its free list of spare nodes, against List<T, 0>, which
+// allocates a node per insertion as List<T> did before. The queues are
+// used as the source uses them: samples and tokens go in at the back
+// and come out at the front, a few at a time. Each thread has queues of
+// its own, so the allocator is the only thing the threads share.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <thread>
+#include <vector>
+
+#include "LinkList.h"
+#include "TestCommon.h"
+
+const UINT32 OPERATIONS_PER_THREAD = 2000000;	// Insertions, and as many removals.
+const UINT32 QUEUES_PER_THREAD = 4;				// As streams per source.
+
+template <class ListType>
+void Churn(UINT32 cDepth)
+{
+	ListType queues[QUEUES_PER_THREAD];
+	TestUnknown *pSample = new TestUnknown;
+
+	unsigned long sum = 0;
+	for (UINT32 cDone = 0; cDone < OPERATIONS_PER_THREAD; cDone += cDepth * QUEUES_PER_THREAD)
+	{
+		for (ListType &queue : queues)
+		{
+			for (UINT32 i = 0; i < cDepth; i++)
+			{
+				(void)queue.InsertBack(pSample);
+			}
+		}
+		for (ListType &queue : queues)
+		{
+			IUnknown *pItem = nullptr;
+			while (SUCCEEDED(queue.RemoveFront(&pItem)))
+			{
+				sum += (pItem == pSample);
+			}
+		}
+	}
+	BenchKeep(sum);
+
+	TEST_CHECK(pSample->RefCount() == 1);
+	pSample->Release();
+}
+
+template <class ListType>
+double Run(UINT32 cThreads, UINT32 cDepth)
+{
+	double start = BenchNow();
+
+	std::vector<std::thread> threads;
+	for (UINT32 i = 0; i < cThreads; i++)
+	{
+		threads.emplace_back(Churn<ListType>, cDepth);
+	}
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	double elapsed = BenchNow() - start;
+	return elapsed * 1e9 / (double(cThreads) * OPERATIONS_PER_THREAD);
+}
+
+int main()
+{
+	std::printf("bench_list: %u insertions and removals per thread, %u hardware threads\n",
+		OPERATIONS_PER_THREAD, std::thread::hardware_concurrency());
+
+	static const UINT32 depths[] = { 1, 8, 32, 128 };
+	static const UINT32 threadCounts[] = { 1, 4 };
+
+	for (UINT32 cThreads : threadCounts)
+	{
+		for (UINT32 cDepth : depths)
+		{
+			double plain = Run<List<IUnknown*, 0>>(cThreads, cDepth);
+			double pooled = Run<List<IUnknown*>>(cThreads, cDepth);
+			std::printf("  %u thread(s), depth %3u: List<T, 0> %6.1f ns, List<T> %6.1f ns per item\n",
+				cThreads, cDepth, plain, pooled);
+		}
+	}
+	return TestFailures() != 0;
+}
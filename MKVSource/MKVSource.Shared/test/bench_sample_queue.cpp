@@ -0,0 +1,166 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// bench_sample_queue.cpp
+// The per-stream sample queue under contention: one demux thread feeds
+// every stream, and each stream hands its samples out on a thread of its
+// own. ComPtrRing without a lock, against the ComPtrList behind the
+// shared source lock that MKVStream used before.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <thread>
+#include <vector>
+
+#include "CritSec.h"
+#include "LinkList.h"
+#include "RingQueue.h"
+#include "TestCommon.h"
+
+const UINT32 QUEUE_CAPACITY = 128;		// As MKVStream.
+const UINT32 SAMPLES_PER_STREAM = 200000;
+
+// The old way: a list per stream, and one lock for all of them.
+class LockedQueues
+{
+public:
+	LockedQueues(UINT32 cStreams) : m_queues(cStreams) {}
+
+	bool Push(UINT32 iStream, IUnknown *pSample)
+	{
+		AutoLock lock(m_critSec);
+		if (m_queues[iStream].GetCount() >= QUEUE_CAPACITY)
+		{
+			return false;
+		}
+		return SUCCEEDED(m_queues[iStream].InsertBack(pSample));
+	}
+
+	IUnknown* Pop(UINT32 iStream)
+	{
+		AutoLock lock(m_critSec);
+		IUnknown *pSample = nullptr;
+		m_queues[iStream].RemoveFront(&pSample);
+		return pSample;
+	}
+
+private:
+	CritSec m_critSec;
+	std::vector<ComPtrList<IUnknown>> m_queues;
+};
+
+// The new way: a ring per stream, no lock.
+class RingQueues
+{
+public:
+	RingQueues(UINT32 cStreams) : m_queues(new ComPtrRing<IUnknown, QUEUE_CAPACITY>[cStreams]) {}
+	~RingQueues() { delete[] m_queues; }
+
+	bool Push(UINT32 iStream, IUnknown *pSample)
+	{
+		return SUCCEEDED(m_queues[iStream].InsertBack(pSample));
+	}
+
+	IUnknown* Pop(UINT32 iStream)
+	{
+		IUnknown *pSample = nullptr;
+		m_queues[iStream].RemoveFront(&pSample);
+		return pSample;
+	}
+
+private:
+	ComPtrRing<IUnknown, QUEUE_CAPACITY> *m_queues;
+};
+
+template <class Queues>
+double Run(UINT32 cStreams)
+{
+	Queues queues(cStreams);
+	std::vector<TestUnknown*> samples(cStreams);
+	for (UINT32 i = 0; i < cStreams; i++)
+	{
+		samples[i] = new TestUnknown;
+	}
+
+	double start = BenchNow();
+
+	std::vector<std::thread> consumers;
+	for (UINT32 i = 0; i < cStreams; i++)
+	{
+		consumers.emplace_back([&queues, i]()
+		{
+			UINT32 cReceived = 0;
+			while (cReceived < SAMPLES_PER_STREAM)
+			{
+				IUnknown *pSample = queues.Pop(i);
+				if (pSample == nullptr)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				pSample->Release();
+				cReceived++;
+			}
+		});
+	}
+
+	// The demux thread: round-robin over the streams, and on to the next
+	// one when a queue is full.
+	std::vector<UINT32> cSent(cStreams, 0);
+	UINT32 cDone = 0;
+	while (cDone < cStreams)
+	{
+		bool fProgress = false;
+		for (UINT32 i = 0; i < cStreams; i++)
+		{
+			if (cSent[i] < SAMPLES_PER_STREAM && queues.Push(i, samples[i]))
+			{
+				fProgress = true;
+				if (++cSent[i] == SAMPLES_PER_STREAM)
+				{
+					cDone++;
+				}
+			}
+		}
+		if (!fProgress)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	for (std::thread &consumer : consumers)
+	{
+		consumer.join();
+	}
+	double elapsed = BenchNow() - start;
+
+	for (UINT32 i = 0; i < cStreams; i++)
+	{
+		TEST_CHECK(samples[i]->RefCount() == 1);
+		samples[i]->Release();
+	}
+	return elapsed;
+}
+
+int main()
+{
+	std::printf("bench_sample_queue: %u samples per stream, %u hardware threads\n",
+		SAMPLES_PER_STREAM, std::thread::hardware_concurrency());
+
+	static const UINT32 streamCounts[] = { 1, 2, 4, 8 };
+	for (UINT32 cStreams : streamCounts)
+	{
+		double locked = Run<LockedQueues>(cStreams);
+		double ring = Run<RingQueues>(cStreams);
+		double samples = double(cStreams) * SAMPLES_PER_STREAM;
+		std::printf("  %u stream(s): locked list %7.1f ns/sample, ring %7.1f ns/sample\n",
+			cStreams, locked * 1e9 / samples, ring * 1e9 / samples);
+	}
+	return TestFailures() != 0;
+}
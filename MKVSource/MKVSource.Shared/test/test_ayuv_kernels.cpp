@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// test_ayuv_kernels.cpp
+// The AYUV fill and blend routines, at each level the CPU has, against a
+// plain version of the formulas in AyuvKernels.h: every width around the
+// vector sizes, rows with padding, and the pixels around the rectangle
+// left alone. The routines are also picked from several threads at once.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "AyuvKernels.h"
+#include "TestCommon.h"
+
+const DWORD GUARD_PIXEL = 0xdeadbeef;
+const UINT32 PAD = 3;       // Pixels of padding on each side of a row.
+
+static const char *LevelName(AyuvKernelLevel level)
+{
+	switch (level)
+	{
+	case AYUV_KERNEL_AVX2:
+		return "AVX2";
+	case AYUV_KERNEL_SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+// x / 255, rounded half up.
+static DWORD RefDiv255(DWORD x)
+{
+	return (2 * x + 255) / 510;
+}
+
+// One channel of "over": the source at alpha a, over dest.
+static DWORD RefOver(DWORD src, DWORD dest, DWORD a)
+{
+	return RefDiv255(src * a + dest * (255 - a));
+}
+
+static DWORD RefBlendPixel(DWORD dest, DWORD color, DWORD a)
+{
+	if (a == 0)
+	{
+		return dest;
+	}
+	DWORD outA = RefOver(255, dest >> 24, a);
+	DWORD outY = RefOver((color >> 16) & 0xff, (dest >> 16) & 0xff, a);
+	DWORD outU = RefOver((color >> 8) & 0xff, (dest >> 8) & 0xff, a);
+	DWORD outV = RefOver(color & 0xff, dest & 0xff, a);
+	return (outA << 24) | (outY << 16) | (outU << 8) | outV;
+}
+
+// A frame of cy rows of cx pixels, with PAD guard pixels on each side
+// and a guard row above and below.
+struct TestFrame
+{
+	UINT32 cx, cy;
+	LONG pitch;
+	std::vector<DWORD> pixels;
+
+	TestFrame(UINT32 cxFrame, UINT32 cyFrame, std::minstd_rand &random)
+		: cx(cxFrame), cy(cyFrame), pitch((LONG)(cxFrame + 2 * PAD)), pixels((cyFrame + 2) * pitch, GUARD_PIXEL)
+	{
+		for (UINT32 y = 0; y < cy; y++)
+		{
+			for (UINT32 x = 0; x < cx; x++)
+			{
+				At(x, y) = (DWORD)random();
+			}
+		}
+	}
+
+	DWORD &At(UINT32 x, UINT32 y) { return pixels[(y + 1) * pitch + PAD + x]; }
+	DWORD *Origin() { return &At(0, 0); }
+
+	bool GuardsIntact() const
+	{
+		for (size_t i = 0; i < pixels.size(); i++)
+		{
+			LONG x = (LONG)(i % pitch) - (LONG)PAD;
+			LONG y = (LONG)(i / pitch) - 1;
+			bool fInside = (x >= 0 && x < (LONG)cx && y >= 0 && y < (LONG)cy);
+			if (!fInside && pixels[i] != GUARD_PIXEL)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Mostly 0 and 255, as glyph edges and subtitle pictures are, with some
+// values in between.
+static BYTE RandomAlpha(std::minstd_rand &random)
+{
+	DWORD r = random() % 8;
+	return (r < 3) ? 0 : (r < 6) ? 255 : (BYTE)random();
+}
+
+static void TestEveryAlpha()
+{
+	AyuvKernelLevel maxLevel = GetAyuvKernelLevel();
+
+	// Every alpha, over a row of destination values from 0 to 255.
+	for (int level = AYUV_KERNEL_SCALAR; level <= maxLevel; level++)
+	{
+		SetAyuvKernelLevel((AyuvKernelLevel)level);
+
+		int failures = 0;
+		for (DWORD a = 0; a < 256; a++)
+		{
+			DWORD dest[256];
+			DWORD src[256];
+			for (DWORD v = 0; v < 256; v++)
+			{
+				dest[v] = ((255 - v) << 24) | (v << 16) | (v << 8) | v;
+				src[v] = (a << 24) | 0x00ff00ff;
+			}
+
+			AyuvBlend(dest, 256, src, 256, 256, 1);
+
+			for (DWORD v = 0; v < 256; v++)
+			{
+				failures += (dest[v] != RefBlendPixel(((255 - v) << 24) | (v << 16) | (v << 8) | v, src[v], a));
+			}
+		}
+		TEST_CHECK(failures == 0);
+	}
+	SetAyuvKernelLevel(maxLevel);
+}
+
+static void TestLevel(AyuvKernelLevel level)
+{
+	SetAyuvKernelLevel(level);
+	TEST_CHECK(GetAyuvKernelLevel() == level);
+
+	std::minstd_rand random(17);
+
+	for (UINT32 cx = 0; cx <= 40; cx++)
+	{
+		for (UINT32 cy = 1; cy <= 3; cy++)
+		{
+			const DWORD dwColor = (DWORD)random();
+
+			// Fill
+			{
+				TestFrame frame(cx, cy, random);
+				AyuvFill(frame.Origin(), frame.pitch, cx, cy, dwColor);
+
+				bool fOk = frame.GuardsIntact();
+				for (UINT32 y = 0; y < cy; y++)
+				{
+					for (UINT32 x = 0; x < cx; x++)
+					{
+						fOk = fOk && (frame.At(x, y) == dwColor);
+					}
+				}
+				TEST_CHECK(fOk);
+			}
+
+			// Coverage blend, with a mask wider than the rectangle.
+			{
+				TestFrame frame(cx, cy, random);
+				TestFrame expected = frame;
+
+				const LONG alphaPitch = (LONG)cx + 5;
+				std::vector<BYTE> alpha(alphaPitch * cy);
+				for (size_t i = 0; i < alpha.size(); i++)
+				{
+					alpha[i] = RandomAlpha(random);
+				}
+
+				AyuvBlendCoverage(frame.Origin(), frame.pitch, alpha.data(), alphaPitch, cx, cy, dwColor);
+
+				bool fOk = frame.GuardsIntact();
+				for (UINT32 y = 0; y < cy; y++)
+				{
+					for (UINT32 x = 0; x < cx; x++)
+					{
+						fOk = fOk && (frame.At(x, y) == RefBlendPixel(expected.At(x, y), dwColor, alpha[y * alphaPitch + x]));
+					}
+				}
+				TEST_CHECK(fOk);
+				if (!fOk)
+				{
+					std::fprintf(stderr, "  %s coverage blend, %u by %u\n", LevelName(level), cx, cy);
+				}
+			}
+
+			// AYUV over AYUV
+			{
+				TestFrame frame(cx, cy, random);
+				TestFrame expected = frame;
+				TestFrame source(cx, cy, random);
+				for (UINT32 y = 0; y < cy; y++)
+				{
+					for (UINT32 x = 0; x < cx; x++)
+					{
+						source.At(x, y) = (source.At(x, y) & 0x00ffffff) | ((DWORD)RandomAlpha(random) << 24);
+					}
+				}
+
+				AyuvBlend(frame.Origin(), frame.pitch, source.Origin(), source.pitch, cx, cy);
+
+				bool fOk = frame.GuardsIntact();
+				for (UINT32 y = 0; y < cy; y++)
+				{
+					for (UINT32 x = 0; x < cx; x++)
+					{
+						DWORD src = source.At(x, y);
+						fOk = fOk && (frame.At(x, y) == RefBlendPixel(expected.At(x, y), src, src >> 24));
+					}
+				}
+				TEST_CHECK(fOk);
+				if (!fOk)
+				{
+					std::fprintf(stderr, "  %s blend, %u by %u\n", LevelName(level), cx, cy);
+				}
+			}
+		}
+	}
+
+	// Palette expansion (scalar at every level).
+	{
+		TestFrame frame(37, 2, random);
+		DWORD palette[256];
+		for (DWORD &entry : palette)
+		{
+			entry = (DWORD)random();
+		}
+		std::vector<BYTE> indices(40 * 2);
+		for (BYTE &index : indices)
+		{
+			index = (BYTE)random();
+		}
+
+		AyuvExpandPalette(frame.Origin(), frame.pitch, indices.data(), 40, 37, 2, palette);
+
+		bool fOk = frame.GuardsIntact();
+		for (UINT32 y = 0; y < 2; y++)
+		{
+			for (UINT32 x = 0; x < 37; x++)
+			{
+				fOk = fOk && (frame.At(x, y) == palette[indices[y * 40 + x]]);
+			}
+		}
+		TEST_CHECK(fOk);
+	}
+}
+
+// The first calls race to pick the routines. They must all get the same
+// ones, and run them.
+static void TestFirstUse()
+{
+	const int cThreads = 8;
+	std::vector<std::thread> threads;
+	std::vector<int> levels(cThreads, -1);
+	std::vector<DWORD> results(cThreads, 0);
+
+	for (int i = 0; i < cThreads; i++)
+	{
+		threads.emplace_back([i, &levels, &results]()
+		{
+			DWORD pixels[16];
+			AyuvFill(pixels, 16, 16, 1, 0x80108080 + i);
+			levels[i] = GetAyuvKernelLevel();
+			results[i] = pixels[15];
+		});
+	}
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	for (int i = 0; i < cThreads; i++)
+	{
+		TEST_CHECK(levels[i] == levels[0]);
+		TEST_CHECK(results[i] == (DWORD)(0x80108080 + i));
+	}
+}
+
+int main()
+{
+	TestFirstUse();
+
+	AyuvKernelLevel maxLevel = GetAyuvKernelLevel();
+	std::printf("test_ayuv_kernels: the CPU has %s\n", LevelName(maxLevel));
+
+	TestEveryAlpha();
+	for (int level = AYUV_KERNEL_SCALAR; level <= maxLevel; level++)
+	{
+		TestLevel((AyuvKernelLevel)level);
+	}
+
+	// Asking for more than the CPU has gives what it has.
+	SetAyuvKernelLevel(AYUV_KERNEL_AVX2);
+	TEST_CHECK(GetAyuvKernelLevel() == maxLevel);
+
+	return TestResult("test_ayuv_kernels");
+}
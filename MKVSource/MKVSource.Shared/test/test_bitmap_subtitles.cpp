@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// test_bitmap_subtitles.cpp
+// The PGS decoder and the display set cache on hand-made display sets:
+// a set that shows the objects of an earlier one is decoded again after
+// a seek rather than cached, a seek forgets the epoch, and an object
+// larger than the composition is cut to it.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include <string>
+#include <vector>
+
+#include "Demux.h"
+#include "BitmapSubtitles.h"
+#include "TestCommon.h"
+
+const BYTE PGS_EPOCH_START = 0x80;
+const BYTE PGS_NORMAL = 0x00;
+
+// A display set, built a segment at a time.
+class PgsSet
+{
+public:
+	// A composition of the video size, showing one object at (x, y), or
+	// none if objectId is negative.
+	PgsSet &Composition(UINT32 cxVideo, UINT32 cyVideo, BYTE state, int objectId, UINT32 x, UINT32 y)
+	{
+		std::vector<BYTE> data;
+		Put16(&data, cxVideo);
+		Put16(&data, cyVideo);
+		data.push_back(0x10);           // Frame rate.
+		Put16(&data, 0);                // Composition number.
+		data.push_back(state);
+		data.push_back(0);              // Palette update.
+		data.push_back(0);              // Palette ID.
+		data.push_back(objectId >= 0 ? 1 : 0);
+		if (objectId >= 0)
+		{
+			Put16(&data, (UINT32)objectId);
+			data.push_back(0);          // Window ID.
+			data.push_back(0);          // Not cropped.
+			Put16(&data, x);
+			Put16(&data, y);
+		}
+		return Segment(0x16, data);
+	}
+
+	// Palette 0, with one opaque entry.
+	PgsSet &Palette(BYTE index, BYTE y)
+	{
+		std::vector<BYTE> data = { 0, 0, index, y, 128, 128, 255 };
+		return Segment(0x14, data);
+	}
+
+	// An object of cx by cy pixels, each row one run of the index. Only
+	// the first MAX_ROWS rows are coded, and runs are 16383 pixels at
+	// most, which is enough for the decoder to fill the video.
+	PgsSet &Object(UINT32 objectId, UINT32 cx, UINT32 cy, BYTE index)
+	{
+		const UINT32 MAX_ROWS = 1000;
+		const UINT32 run = min(cx, (UINT32)0x3fff);
+
+		std::vector<BYTE> rle;
+		for (UINT32 row = 0; row < min(cy, MAX_ROWS); row++)
+		{
+			const BYTE code[] = { 0, (BYTE)(0xc0 | (run >> 8)), (BYTE)run, index, 0, 0 };
+			rle.insert(rle.end(), code, code + sizeof(code));
+		}
+
+		std::vector<BYTE> data;
+		Put16(&data, objectId);
+		data.push_back(0);              // Version.
+		data.push_back(0xc0);           // First and last fragment.
+		const UINT32 cbData = (UINT32)rle.size() + 4;
+		data.push_back((BYTE)(cbData >> 16));
+		data.push_back((BYTE)(cbData >> 8));
+		data.push_back((BYTE)cbData);
+		Put16(&data, cx);
+		Put16(&data, cy);
+		data.insert(data.end(), rle.begin(), rle.end());
+		return Segment(0x15, data);
+	}
+
+	PgsSet &End()
+	{
+		return Segment(0x80, std::vector<BYTE>());
+	}
+
+	// The set as a cue: the data must outlive the cue.
+	SubtitleCue Cue() const
+	{
+		SubtitleCue cue = {};
+		cue.pData = m_data.data();
+		cue.cbData = (UINT32)m_data.size();
+		return cue;
+	}
+
+	const BYTE *Data() const { return reinterpret_cast<const BYTE*>(m_data.data()); }
+	DWORD Size() const { return (DWORD)m_data.size(); }
+
+private:
+	static void Put16(std::vector<BYTE> *pData, UINT32 value)
+	{
+		pData->push_back((BYTE)(value >> 8));
+		pData->push_back((BYTE)value);
+	}
+
+	PgsSet &Segment(BYTE type, const std::vector<BYTE> &data)
+	{
+		m_data.push_back((char)type);
+		m_data.push_back((char)(data.size() >> 8));
+		m_data.push_back((char)data.size());
+		m_data.append(data.begin(), data.end());
+		return *this;
+	}
+
+	std::string m_data;
+};
+
+// An epoch start that sends object 1, then a set that moves it.
+static void TestCache()
+{
+	PgsSet first;
+	first.Composition(1920, 1080, PGS_EPOCH_START, 1, 100, 900).Palette(1, 235).Object(1, 300, 40, 1).End();
+	PgsSet moved;
+	moved.Composition(1920, 1080, PGS_NORMAL, 1, 200, 950).End();
+
+	BitmapSubtitleCache cache(BitmapSubtitleDecoder::Create(SUBTITLE_PGS, nullptr, 0));
+
+	const std::vector<SubtitleBitmap> &bitmaps = cache.GetBitmaps(first.Cue());
+	TEST_CHECK(bitmaps.size() == 1);
+	TEST_CHECK(bitmaps.size() == 1 && bitmaps[0].cx == 300 && bitmaps[0].cy == 40 && bitmaps[0].x == 100);
+	TEST_CHECK(bitmaps.size() == 1 && bitmaps[0].indices[0] == 1 && (bitmaps[0].palette[1] >> 24) == 255);
+
+	// The second set shows the object of the first.
+	{
+		const std::vector<SubtitleBitmap> &movedBitmaps = cache.GetBitmaps(moved.Cue());
+		TEST_CHECK(movedBitmaps.size() == 1 && movedBitmaps[0].x == 200 && movedBitmaps[0].cx == 300);
+	}
+
+	// After a seek, the decoder has no object: the second set shows
+	// nothing, and was not cached from before.
+	cache.Reset();
+	TEST_CHECK(cache.GetBitmaps(moved.Cue()).empty());
+
+	// The epoch start stays cached, and decodes on its own anyway.
+	{
+		const std::vector<SubtitleBitmap> &again = cache.GetBitmaps(first.Cue());
+		TEST_CHECK(again.size() == 1 && again[0].cx == 300);
+	}
+
+	// Decoding it again brings the epoch back.
+	std::vector<SubtitleBitmap> direct;
+	BitmapSubtitleDecoder *pDecoder = BitmapSubtitleDecoder::Create(SUBTITLE_PGS, nullptr, 0);
+	TEST_CHECK(pDecoder->Decode(first.Data(), first.Size(), &direct));
+	TEST_CHECK(!pDecoder->Decode(moved.Data(), moved.Size(), &direct));
+	TEST_CHECK(direct.size() == 1 && direct[0].x == 200);
+
+	pDecoder->Reset();
+	TEST_CHECK(!pDecoder->Decode(moved.Data(), moved.Size(), &direct));
+	TEST_CHECK(direct.empty());
+	delete pDecoder;
+}
+
+// An epoch start forgets the objects of the epoch before.
+static void TestEpochStart()
+{
+	PgsSet first;
+	first.Composition(1920, 1080, PGS_EPOCH_START, 1, 0, 0).Palette(1, 235).Object(1, 10, 10, 1).End();
+	PgsSet second;
+	second.Composition(1920, 1080, PGS_EPOCH_START, -1, 0, 0).End();
+	PgsSet third;
+	third.Composition(1920, 1080, PGS_NORMAL, 1, 0, 0).End();
+
+	std::vector<SubtitleBitmap> bitmaps;
+	BitmapSubtitleDecoder *pDecoder = BitmapSubtitleDecoder::Create(SUBTITLE_PGS, nullptr, 0);
+	(void)pDecoder->Decode(first.Data(), first.Size(), &bitmaps);
+	TEST_CHECK(bitmaps.size() == 1);
+	TEST_CHECK(pDecoder->Decode(second.Data(), second.Size(), &bitmaps));
+	TEST_CHECK(bitmaps.empty());
+	(void)pDecoder->Decode(third.Data(), third.Size(), &bitmaps);
+	TEST_CHECK(bitmaps.empty());
+	delete pDecoder;
+}
+
+// An object wider and taller than the composition is cut to it, before
+// anything is allocated for it.
+static void TestOversizedObject()
+{
+	PgsSet set;
+	set.Composition(720, 480, PGS_EPOCH_START, 1, 0, 0).Palette(1, 235).Object(1, 0xffff, 0xffff, 1).End();
+
+	std::vector<SubtitleBitmap> bitmaps;
+	BitmapSubtitleDecoder *pDecoder = BitmapSubtitleDecoder::Create(SUBTITLE_PGS, nullptr, 0);
+	(void)pDecoder->Decode(set.Data(), set.Size(), &bitmaps);
+	TEST_CHECK(bitmaps.size() == 1);
+	if (bitmaps.size() == 1)
+	{
+		TEST_CHECK(bitmaps[0].cx == 720 && bitmaps[0].cy == 480);
+		TEST_CHECK(bitmaps[0].indices.size() == 720 * 480);
+		TEST_CHECK(bitmaps[0].indices[719] == 1 && bitmaps[0].indices[720 * 480 - 1] == 1);
+	}
+	delete pDecoder;
+}
+
+int main()
+{
+	TestCache();
+	TestEpochStart();
+	TestOversizedObject();
+	return TestResult("test_bitmap_subtitles");
+}
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// test_demux.cpp
+// The Parser on synthetic files, read in chunks of many sizes: every
+// frame comes out once, whole and in order, wherever the reads end.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include "TestCommon.h"
+#include "TestMkv.h"
+
+static TestMkvFrames Demux(const TestBytes &file, DWORD cbRead)
+{
+	TestDemuxer demuxer(file, cbRead);
+	while (demuxer.Step())
+	{
+	}
+	return demuxer.Frames();
+}
+
+static void TestMasterData()
+{
+	TestMkvLayout layout = { 3, 4, 100, 20 };
+	TestBytes file = MakeTestMkv(layout, nullptr);
+
+	Parser parser;
+	DWORD cbAte = 0;
+	parser.ParseBytes(file.data(), (DWORD)file.size(), &cbAte);
+
+	TEST_CHECK(parser.HasFinishedParsedData());
+	MKVMasterData *pMasterData = parser.GetMasterData();
+	TEST_CHECK(pMasterData->SegInfo != nullptr && pMasterData->SegInfo->TimecodeScale == 1000000);
+	TEST_CHECK(pMasterData->Tracks.size() == 2);
+	TEST_CHECK(pMasterData->Cues.size() == 3);
+	if (pMasterData->Tracks.size() == 2)
+	{
+		TEST_CHECK(pMasterData->Tracks[0]->TrackNumber == 1 && pMasterData->Tracks[0]->Video->PixelWidth == 320);
+		TEST_CHECK(pMasterData->Tracks[1]->TrackNumber == 2 && pMasterData->Tracks[1]->Audio->Channels == 2);
+	}
+
+	// The cues point at the clusters.
+	for (CuePoint *pCue : pMasterData->Cues)
+	{
+		const UINT64 pos = pCue->CueTrackPositions[0]->CueClusterPosition + pMasterData->SegmentPosition;
+		TEST_CHECK(pos + 4 <= file.size());
+		TEST_CHECK(pos + 4 <= file.size() && file[pos] == 0x1F && file[pos + 1] == 0x43 && file[pos + 2] == 0xB6 && file[pos + 3] == 0x75);
+	}
+
+	// The first ParseBytes call stops at the first block.
+	TEST_CHECK(parser.HasFrames());
+	TEST_CHECK(parser.m_currentStream == 1);
+	TEST_CHECK(*parser.pCircRead == 100);
+}
+
+static void TestReadSizes()
+{
+	TestMkvLayout layout = { 5, 10, 700, 90 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	TEST_CHECK(expected.cFrames[1] == 50 && expected.cFrames[2] == 50);
+
+	// Odd sizes end reads inside element headers and block headers.
+	static const DWORD readSizes[] = { 4, 5, 7, 13, 64, 333, 1000, 4096, 64 * 1024 };
+	for (DWORD cbRead : readSizes)
+	{
+		TestMkvFrames frames = Demux(file, cbRead);
+		TEST_CHECK(frames == expected);
+		if (!(frames == expected))
+		{
+			std::fprintf(stderr, "  read size %u: %u video, %u audio frames\n", cbRead, frames.cFrames[1], frames.cFrames[2]);
+		}
+	}
+}
+
+static void TestLargeFrames()
+{
+	// Frames larger than a read: the buffer grows until the block fits.
+	TestMkvLayout layout = { 2, 3, 20000, 3000 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	TEST_CHECK(Demux(file, 4096) == expected);
+}
+
+int main()
+{
+	TestMasterData();
+	TestReadSizes();
+	TestLargeFrames();
+	return TestResult("test_demux");
+}
@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// test_demux_pipeline.cpp
+// The coroutine pipeline over an in-memory source: the frames match the
+// file whatever the order the reads complete in, several clusters are
+// read ahead of the parser, and a seek cancels the reads in flight and
+// resumes at the cluster of the cue point.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+
+#include "TestCommon.h"
+#include "TestByteSource.h"
+
+// Collects the frames. After the seek (if any), it collects them in
+// m_afterSeek, and notes the first one.
+class TestSink : public DemuxSink
+{
+public:
+	TestSink()
+		: m_frames(), m_afterSeek(), m_fSeeked(false), m_firstTrack(0), m_firstTimeStamp(0),
+		  m_qwMaxReadEndAtFirstFrame(0), m_pSource(nullptr), m_fEnded(false), m_hrEnd(S_OK)
+	{
+	}
+
+	void OnFrame(const Parser &parser, const BYTE *pData, DWORD cbData) override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_pSource != nullptr && m_frames.cbPayload == 0)
+		{
+			m_qwMaxReadEndAtFirstFrame = m_pSource->MaxReadEnd();
+		}
+		if (m_fSeeked && m_afterSeek.cbPayload == 0)
+		{
+			m_firstTrack = parser.m_currentStream;
+			m_firstTimeStamp = parser.m_currentTimeStamp;
+		}
+		AddTestMkvFrame(m_fSeeked ? &m_afterSeek : &m_frames, parser.m_currentStream, pData, cbData);
+	}
+
+	void OnEnd(HRESULT hr) override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		TEST_CHECK(!m_fEnded);
+		m_fEnded = true;
+		m_hrEnd = hr;
+		m_ended.notify_all();
+	}
+
+	bool IsEnded()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_fEnded;
+	}
+
+	void WaitForEnd()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_ended.wait(lock, [this]() { return m_fEnded; });
+	}
+
+	std::mutex				m_mutex;
+	std::condition_variable	m_ended;
+	TestMkvFrames			m_frames;
+	TestMkvFrames			m_afterSeek;
+	bool					m_fSeeked;
+	int						m_firstTrack;
+	UINT64					m_firstTimeStamp;
+	QWORD					m_qwMaxReadEndAtFirstFrame;
+	TestByteSource			*m_pSource;
+	bool					m_fEnded;
+	HRESULT					m_hrEnd;
+};
+
+// The file offset of a cluster, from the cues.
+static QWORD ClusterPosition(const TestBytes &file, DWORD iCluster)
+{
+	Parser parser;
+	DWORD cbAte = 0;
+	parser.ParseBytes(file.data(), (DWORD)file.size(), &cbAte);
+
+	MKVMasterData *pMasterData = parser.GetMasterData();
+	return pMasterData->Cues[iCluster]->CueTrackPositions[0]->CueClusterPosition + pMasterData->SegmentPosition;
+}
+
+// Completes reads until the pipeline ends.
+static void Pump(TestByteSource &source, TestSink &sink, bool fRandom)
+{
+	while (!sink.IsEnded())
+	{
+		bool fCompleted = fRandom ? source.CompleteRandomRead() : source.CompleteRead(0);
+		TEST_CHECK(fCompleted);
+		if (!fCompleted)
+		{
+			break;
+		}
+	}
+}
+
+static void TestReadOrders()
+{
+	TestMkvLayout layout = { 5, 10, 700, 90 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	static const DWORD readSizes[] = { 7, 333, 4096, 64 * 1024 };
+	static const DWORD depths[] = { 1, 4 };
+
+	for (DWORD cbRead : readSizes)
+	{
+		for (DWORD cReadsAhead : depths)
+		{
+			for (bool fRandom : { false, true })
+			{
+				TestByteSource source(file);
+				TestSink sink;
+
+				DemuxPipeline *pPipeline = new DemuxPipeline(&source, &sink, cbRead, cReadsAhead);
+				pPipeline->Start();
+				Pump(source, sink, fRandom);
+
+				TEST_CHECK(sink.m_hrEnd == S_OK);
+				TEST_CHECK(sink.m_frames == expected);
+				TEST_CHECK(source.MaxPending() <= cReadsAhead);
+				if (!(sink.m_frames == expected))
+				{
+					std::fprintf(stderr, "  read size %u, %u ahead%s: %u video, %u audio frames\n", cbRead, cReadsAhead,
+						fRandom ? ", random order" : "", sink.m_frames.cFrames[1], sink.m_frames.cFrames[2]);
+				}
+
+				// The reads past the end are still pending.
+				while (source.CompleteRead(0))
+				{
+				}
+				pPipeline->Release();
+			}
+		}
+	}
+}
+
+static void TestReadAhead()
+{
+	TestMkvLayout layout = { 20, 10, 700, 90 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	const DWORD cbRead = 4096;
+	const DWORD cReadsAhead = 8;
+
+	TestByteSource source(file);
+	TestSink sink;
+	sink.m_pSource = &source;
+
+	DemuxPipeline *pPipeline = new DemuxPipeline(&source, &sink, cbRead, cReadsAhead);
+	pPipeline->Start();
+
+	// All the reads are issued before the first completes.
+	TEST_CHECK(source.Pending() == cReadsAhead);
+
+	Pump(source, sink, false);
+	TEST_CHECK(sink.m_frames == expected);
+	TEST_CHECK(pPipeline->GetStats().cMaxReadsInFlight == cReadsAhead);
+
+	// Once the headers are parsed, the reads run ahead from the first
+	// cluster: by its first frame, they reach into the fourth.
+	TEST_CHECK(sink.m_qwMaxReadEndAtFirstFrame > ClusterPosition(file, 3));
+
+	while (source.CompleteRead(0))
+	{
+	}
+	pPipeline->Release();
+}
+
+static void TestSeek()
+{
+	TestMkvLayout layout = { 10, 10, 700, 90 };
+	TestBytes file = MakeTestMkv(layout, nullptr);
+
+	TestByteSource source(file);
+	TestSink sink;
+
+	DemuxPipeline *pPipeline = new DemuxPipeline(&source, &sink, 4096, 4);
+	pPipeline->Start();
+
+	// Demux into the second cluster.
+	while (sink.m_frames.cFrames[1] < 15 && source.CompleteRead(0))
+	{
+	}
+	TEST_CHECK(sink.m_frames.cFrames[1] >= 15);
+	TEST_CHECK(source.Pending() > 0);
+
+	// Seek into the seventh cluster.
+	const DWORD cluster = 6;
+	const UINT64 msCluster = cluster * layout.cFramesPerCluster * TestMkv::MS_PER_FRAME;
+
+	const size_t cReadsBefore = source.ReadPositions().size();
+	const size_t cPendingBefore = source.Pending();
+	sink.m_fSeeked = true;
+	pPipeline->Seek((msCluster + 100) * 10000);
+
+	// The reads in flight are cancelled, and new ones start at the cluster.
+	TEST_CHECK(source.Cancelled() == cPendingBefore);
+	TEST_CHECK(pPipeline->GetStats().cCancelledReads == cPendingBefore);
+	TEST_CHECK(pPipeline->GetStats().cSeeks == 1);
+
+	std::vector<QWORD> positions = source.ReadPositions();
+	TEST_CHECK(positions.size() > cReadsBefore);
+
+	TEST_CHECK(positions.size() > cReadsBefore && positions[cReadsBefore] == ClusterPosition(file, cluster));
+
+	Pump(source, sink, false);
+
+	// Everything from the start of the cluster, and nothing else.
+	const DWORD cFramesAfter = (layout.cClusters - cluster) * layout.cFramesPerCluster;
+	TEST_CHECK(sink.m_hrEnd == S_OK);
+	TEST_CHECK(sink.m_afterSeek.cFrames[1] == cFramesAfter && sink.m_afterSeek.cFrames[2] == cFramesAfter);
+	TEST_CHECK(sink.m_firstTrack == 1);
+	TEST_CHECK(sink.m_firstTimeStamp == msCluster);
+
+	while (source.CompleteRead(0))
+	{
+	}
+	pPipeline->Release();
+}
+
+static void TestShutdown()
+{
+	TestMkvLayout layout = { 5, 10, 700, 90 };
+	TestBytes file = MakeTestMkv(layout, nullptr);
+
+	TestByteSource source(file);
+	TestSink sink;
+
+	DemuxPipeline *pPipeline = new DemuxPipeline(&source, &sink, 1000, 4);
+	pPipeline->Start();
+	for (int i = 0; i < 5; i++)
+	{
+		(void)source.CompleteRead(0);
+	}
+
+	// The cancelled reads end the pipeline at once.
+	pPipeline->Shutdown();
+	TEST_CHECK(sink.IsEnded() && sink.m_hrEnd == MF_E_SHUTDOWN);
+	TEST_CHECK(source.Pending() == 0);
+
+	pPipeline->Release();
+}
+
+static void TestThreaded()
+{
+	TestMkvLayout layout = { 20, 10, 700, 90 };
+	TestMkvFrames expected;
+	TestBytes file = MakeTestMkv(layout, &expected);
+
+	for (int round = 0; round < 20; round++)
+	{
+		TestByteSource source(file);
+		TestSink sink;
+		source.StartThread();
+
+		DemuxPipeline *pPipeline = new DemuxPipeline(&source, &sink, 1500, 6);
+		pPipeline->Start();
+		sink.WaitForEnd();
+		source.StopThread();
+
+		TEST_CHECK(sink.m_hrEnd == S_OK);
+		TEST_CHECK(sink.m_frames == expected);
+
+		while (source.CompleteRead(0))
+		{
+		}
+		pPipeline->Release();
+	}
+}
+
+int main()
+{
+	TestReadOrders();
+	TestReadAhead();
+	TestSeek();
+	TestShutdown();
+	TestThreaded();
+	return TestResult("test_demux_pipeline");
+}